@@ -0,0 +1,776 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-concurrent.h"
+
+ */
+
+#include <sched.h>
+#include <string.h>
+
+#include "avl-tree-concurrent.h"
+
+/* AVL tree with concurrent writers */
+
+#define CONCURRENT_LEFT AVL_TREE_NODE_LEFT
+#define CONCURRENT_RIGHT AVL_TREE_NODE_RIGHT
+
+/* Bits of the version. The rest counts the changes */
+#define CONCURRENT_UNLINKED 1           /* Removed from the tree */
+#define CONCURRENT_SHRINKING 2          /* Keys are leaving the subtree */
+#define CONCURRENT_VERSION_MASK 3
+#define CONCURRENT_VERSION_STEP 4
+
+/* What avl_tree_concurrent_condition() finds, if not a new height */
+#define CONCURRENT_NOTHING_REQUIRED 0
+#define CONCURRENT_REBALANCE_REQUIRED (-1)
+
+/* Spins before giving the CPU to the thread that holds a lock */
+#define CONCURRENT_SPINS 64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONCURRENT_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define CONCURRENT_PAUSE() __asm__ __volatile__ ("yield")
+#else
+#define CONCURRENT_PAUSE() do { } while (0)
+#endif
+
+/* Returned by a descent that must be restarted higher in the tree */
+static AVLTreeConcurrentNode avl_tree_concurrent_retry;
+#define CONCURRENT_RETRY (&avl_tree_concurrent_retry)
+
+/* Returned by the descent of an insert that locked the node to link the
+ * new node to. The levels above check their version before the link */
+static AVLTreeConcurrentNode avl_tree_concurrent_link_marker;
+#define CONCURRENT_LINK (&avl_tree_concurrent_link_marker)
+
+typedef enum {
+  CONCURRENT_LOOKUP,
+  CONCURRENT_INSERT,
+  CONCURRENT_REMOVE
+} AVLTreeConcurrentOperation;
+
+/* An operation, passed down the descent */
+typedef struct _AVLTreeConcurrentSearch {
+  AVLTreeConcurrentOperation operation;
+  AVLTreeKey key;
+  AVLTreeConcurrentNode *leaf;    /* Locked when CONCURRENT_LINK is */
+  int side;                       /* returned. The new node goes there */
+} AVLTreeConcurrentSearch;
+
+/*
+ * Every field that is read without the lock of its node is accessed
+ * atomically. The links are published with release stores and read with
+ * acquire loads, so a search that follows a link also sees the version
+ * that was stored before the link
+ */
+
+static inline AVLTreeConcurrentNode *avl_tree_concurrent_child(
+  AVLTreeConcurrentNode *node, int side)
+{
+  return (__atomic_load_n(&node->children[side], __ATOMIC_ACQUIRE));
+}
+
+static inline void avl_tree_concurrent_set_child(AVLTreeConcurrentNode *node,
+                                                 int side,
+                                                 AVLTreeConcurrentNode *child)
+{
+  __atomic_store_n(&node->children[side], child, __ATOMIC_RELEASE);
+}
+
+static inline AVLTreeConcurrentNode *avl_tree_concurrent_parent(
+  AVLTreeConcurrentNode *node)
+{
+  return (__atomic_load_n(&node->parent, __ATOMIC_RELAXED));
+}
+
+static inline void avl_tree_concurrent_set_parent(
+  AVLTreeConcurrentNode *node, AVLTreeConcurrentNode *parent)
+{
+  if (node != NULL) {
+    __atomic_store_n(&node->parent, parent, __ATOMIC_RELAXED);
+  }
+}
+
+static inline uint64_t avl_tree_concurrent_version(
+  AVLTreeConcurrentNode *node)
+{
+  return (__atomic_load_n(&node->version, __ATOMIC_ACQUIRE));
+}
+
+static inline void avl_tree_concurrent_set_version(
+  AVLTreeConcurrentNode *node, uint64_t version)
+{
+  __atomic_store_n(&node->version, version, __ATOMIC_RELEASE);
+}
+
+static inline int avl_tree_concurrent_height(AVLTreeConcurrentNode *node)
+{
+  return (node == NULL ? 0 : __atomic_load_n(&node->height, __ATOMIC_RELAXED));
+}
+
+static inline void avl_tree_concurrent_set_height(AVLTreeConcurrentNode *node,
+                                                  int height)
+{
+  __atomic_store_n(&node->height, height, __ATOMIC_RELAXED);
+}
+
+static inline int avl_tree_concurrent_max(int a, int b)
+{
+  return (a > b ? a : b);
+}
+
+static inline void avl_tree_concurrent_lock(AVLTreeConcurrentNode *node)
+{
+  int spins = 0;
+
+  while (__atomic_exchange_n(&node->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+    while (__atomic_load_n(&node->lock, __ATOMIC_RELAXED) != 0) {
+      if (++spins < CONCURRENT_SPINS) {
+        CONCURRENT_PAUSE();
+      } else {
+        sched_yield();
+      }
+    }
+  }
+}
+
+static inline void avl_tree_concurrent_unlock(AVLTreeConcurrentNode *node)
+{
+  __atomic_store_n(&node->lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Wait until the keys stop leaving the subtree of "node". They only do
+ * while a writer holds the lock of the node */
+
+static void avl_tree_concurrent_wait(AVLTreeConcurrentNode *node)
+{
+  int spins;
+
+  for (spins = 0; spins < CONCURRENT_SPINS; spins++) {
+    if ((avl_tree_concurrent_version(node) & CONCURRENT_SHRINKING) == 0) {
+      return;
+    }
+    CONCURRENT_PAUSE();
+  }
+  avl_tree_concurrent_lock(node);
+  avl_tree_concurrent_unlock(node);
+}
+
+static inline int avl_tree_concurrent_compare(const AVLTreeConcurrent *tree,
+                                              AVLTreeKey key,
+                                              AVLTreeConcurrentNode *node)
+{
+  AVLTreeValue value = (AVLTreeValue)((uintptr_t)node - tree->node_offset);
+
+  return (tree->compare_func(key, tree->key_func(value, tree->key_context)));
+}
+
+AVLTreeConcurrent *avl_tree_concurrent_new(AVLTreeConcurrent *tree,
+                                           intptr_t node_offset,
+                                           AVLTreeCompareFunc compare_func,
+                                           AVLTreeKeyFunc key_func,
+                                           void *key_context)
+{
+  if (tree == NULL || !compare_func || !key_func) {
+    return (NULL);
+  }
+  memset(&tree->holder, 0, sizeof(tree->holder));
+  tree->node_offset = node_offset;
+  tree->compare_func = compare_func;
+  tree->key_func = key_func;
+  tree->key_context = key_context;
+  tree->num_nodes = 0;
+  return (tree);
+}
+
+/*
+ * Rebalancing. The heights are only changed with the lock of the node
+ * held, but are read without it, so they may be stale. Every update
+ * repairs the nodes that it damaged, from the bottom up, and the tree is
+ * an AVL tree again once all the repairs are done
+ */
+
+/* The new height of "node", or whether it needs a rotation */
+
+static int avl_tree_concurrent_condition(AVLTreeConcurrentNode *node)
+{
+  int left = avl_tree_concurrent_height(
+    avl_tree_concurrent_child(node, CONCURRENT_LEFT));
+  int right = avl_tree_concurrent_height(
+    avl_tree_concurrent_child(node, CONCURRENT_RIGHT));
+  int height = 1 + avl_tree_concurrent_max(left, right);
+
+  if (left - right < -1 || left - right > 1) {
+    return (CONCURRENT_REBALANCE_REQUIRED);
+  }
+  return (height != avl_tree_concurrent_height(node) ?
+          height : CONCURRENT_NOTHING_REQUIRED);
+}
+
+/* Fix the height of the locked "node". Returns the next node to repair,
+ * or NULL */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_fix_height(
+  AVLTreeConcurrentNode *node)
+{
+  int condition = avl_tree_concurrent_condition(node);
+
+  if (condition == CONCURRENT_REBALANCE_REQUIRED) {
+    return (node);
+  }
+  if (condition == CONCURRENT_NOTHING_REQUIRED) {
+    return (NULL);
+  }
+  avl_tree_concurrent_set_height(node, condition);
+  return (avl_tree_concurrent_parent(node));
+}
+
+/* Rotate the locked "node" away from its "tall" side. "parent" and the
+ * child on the tall side are locked. The inner child of that child takes
+ * its place under "node" */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_rotate(
+  AVLTreeConcurrentNode *parent, AVLTreeConcurrentNode *node, int tall,
+  AVLTreeConcurrentNode *child, int short_height, int outer_height,
+  AVLTreeConcurrentNode *inner, int inner_height)
+{
+  int side = (avl_tree_concurrent_child(parent, CONCURRENT_LEFT) == node ?
+              CONCURRENT_LEFT : CONCURRENT_RIGHT);
+  uint64_t version = avl_tree_concurrent_version(node);
+  int node_height, balance;
+
+  avl_tree_concurrent_set_version(node, version | CONCURRENT_SHRINKING);
+  avl_tree_concurrent_set_child(node, tall, inner);
+  avl_tree_concurrent_set_parent(inner, node);
+  avl_tree_concurrent_set_child(child, 1 - tall, node);
+  avl_tree_concurrent_set_parent(node, child);
+  avl_tree_concurrent_set_child(parent, side, child);
+  avl_tree_concurrent_set_parent(child, parent);
+  node_height = 1 + avl_tree_concurrent_max(inner_height, short_height);
+  avl_tree_concurrent_set_height(node, node_height);
+  avl_tree_concurrent_set_height(
+    child, 1 + avl_tree_concurrent_max(outer_height, node_height));
+  avl_tree_concurrent_set_version(node, version + CONCURRENT_VERSION_STEP);
+
+  balance = inner_height - short_height;
+  if (balance < -1 || balance > 1) {
+    return (node);
+  }
+  balance = outer_height - node_height;
+  if (balance < -1 || balance > 1) {
+    return (child);
+  }
+  return (avl_tree_concurrent_fix_height(parent));
+}
+
+/* Same with a double rotation: "inner", also locked, takes the place of
+ * "node" */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_rotate_double(
+  AVLTreeConcurrentNode *parent, AVLTreeConcurrentNode *node, int tall,
+  AVLTreeConcurrentNode *child, int short_height, int outer_height,
+  AVLTreeConcurrentNode *inner, int inner_tall_height)
+{
+  int other = 1 - tall;
+  int side = (avl_tree_concurrent_child(parent, CONCURRENT_LEFT) == node ?
+              CONCURRENT_LEFT : CONCURRENT_RIGHT);
+  uint64_t version = avl_tree_concurrent_version(node);
+  uint64_t child_version = avl_tree_concurrent_version(child);
+  AVLTreeConcurrentNode *inner_tall = avl_tree_concurrent_child(inner, tall);
+  AVLTreeConcurrentNode *inner_other = avl_tree_concurrent_child(inner, other);
+  int inner_other_height = avl_tree_concurrent_height(inner_other);
+  int node_height, child_height, balance;
+
+  avl_tree_concurrent_set_version(node, version | CONCURRENT_SHRINKING);
+  avl_tree_concurrent_set_version(child, child_version | CONCURRENT_SHRINKING);
+  avl_tree_concurrent_set_child(node, tall, inner_other);
+  avl_tree_concurrent_set_parent(inner_other, node);
+  avl_tree_concurrent_set_child(child, other, inner_tall);
+  avl_tree_concurrent_set_parent(inner_tall, child);
+  avl_tree_concurrent_set_child(inner, tall, child);
+  avl_tree_concurrent_set_parent(child, inner);
+  avl_tree_concurrent_set_child(inner, other, node);
+  avl_tree_concurrent_set_parent(node, inner);
+  avl_tree_concurrent_set_child(parent, side, inner);
+  avl_tree_concurrent_set_parent(inner, parent);
+  node_height = 1 + avl_tree_concurrent_max(inner_other_height, short_height);
+  child_height = 1 + avl_tree_concurrent_max(outer_height, inner_tall_height);
+  avl_tree_concurrent_set_height(node, node_height);
+  avl_tree_concurrent_set_height(child, child_height);
+  avl_tree_concurrent_set_height(
+    inner, 1 + avl_tree_concurrent_max(child_height, node_height));
+  avl_tree_concurrent_set_version(node, version + CONCURRENT_VERSION_STEP);
+  avl_tree_concurrent_set_version(child,
+                                  child_version + CONCURRENT_VERSION_STEP);
+
+  balance = inner_other_height - short_height;
+  if (balance < -1 || balance > 1) {
+    return (node);
+  }
+  balance = child_height - node_height;
+  if (balance < -1 || balance > 1) {
+    return (inner);
+  }
+  return (avl_tree_concurrent_fix_height(parent));
+}
+
+/* "node" and "parent" are locked, and the child of "node" on its "tall"
+ * side is taller than the other one by more than 1 */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_rebalance_toward(
+  AVLTreeConcurrentNode *parent, AVLTreeConcurrentNode *node, int tall,
+  int short_height)
+{
+  AVLTreeConcurrentNode *child = avl_tree_concurrent_child(node, tall);
+  AVLTreeConcurrentNode *inner, *result;
+  int outer_height, inner_height, balance;
+
+  avl_tree_concurrent_lock(child);
+  if (avl_tree_concurrent_height(child) - short_height <= 1) {
+    avl_tree_concurrent_unlock(child);
+    return (node);
+  }
+  inner = avl_tree_concurrent_child(child, 1 - tall);
+  outer_height = avl_tree_concurrent_height(
+    avl_tree_concurrent_child(child, tall));
+  inner_height = avl_tree_concurrent_height(inner);
+  if (outer_height >= inner_height) {
+    result = avl_tree_concurrent_rotate(parent, node, tall, child,
+                                        short_height, outer_height,
+                                        inner, inner_height);
+    avl_tree_concurrent_unlock(child);
+    return (result);
+  }
+
+  avl_tree_concurrent_lock(inner);
+  inner_height = avl_tree_concurrent_height(inner);
+  if (outer_height >= inner_height) {
+    result = avl_tree_concurrent_rotate(parent, node, tall, child,
+                                        short_height, outer_height,
+                                        inner, inner_height);
+  } else {
+    inner_height = avl_tree_concurrent_height(
+      avl_tree_concurrent_child(inner, tall));
+    balance = outer_height - inner_height;
+    if (balance < -1 || balance > 1) {
+      /* A double rotation would leave "child" unbalanced. Rotate it
+       * alone first */
+      avl_tree_concurrent_unlock(inner);
+      result = avl_tree_concurrent_rebalance_toward(node, child, 1 - tall,
+                                                    outer_height);
+      avl_tree_concurrent_unlock(child);
+      return (result);
+    }
+    result = avl_tree_concurrent_rotate_double(parent, node, tall, child,
+                                               short_height, outer_height,
+                                               inner, inner_height);
+  }
+  avl_tree_concurrent_unlock(inner);
+  avl_tree_concurrent_unlock(child);
+  return (result);
+}
+
+/* Rebalance or fix the height of the locked "node" under the locked
+ * "parent" */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_rebalance(
+  AVLTreeConcurrentNode *parent, AVLTreeConcurrentNode *node)
+{
+  int left = avl_tree_concurrent_height(
+    avl_tree_concurrent_child(node, CONCURRENT_LEFT));
+  int right = avl_tree_concurrent_height(
+    avl_tree_concurrent_child(node, CONCURRENT_RIGHT));
+  int height = 1 + avl_tree_concurrent_max(left, right);
+
+  if (left - right > 1) {
+    return (avl_tree_concurrent_rebalance_toward(parent, node,
+                                                 CONCURRENT_LEFT, right));
+  }
+  if (right - left > 1) {
+    return (avl_tree_concurrent_rebalance_toward(parent, node,
+                                                 CONCURRENT_RIGHT, left));
+  }
+  if (height != avl_tree_concurrent_height(node)) {
+    avl_tree_concurrent_set_height(node, height);
+    return (avl_tree_concurrent_fix_height(parent));
+  }
+  return (NULL);
+}
+
+/* Repair "node" and its ancestors. Takes no lock on entry */
+
+static void avl_tree_concurrent_repair(AVLTreeConcurrentNode *node)
+{
+  AVLTreeConcurrentNode *parent, *next;
+  bool is_below;
+  int condition;
+
+  /* The holder has no parent and is never repaired */
+  while (node != NULL && avl_tree_concurrent_parent(node) != NULL) {
+    condition = avl_tree_concurrent_condition(node);
+    if (condition == CONCURRENT_NOTHING_REQUIRED ||
+        (avl_tree_concurrent_version(node) & CONCURRENT_UNLINKED) != 0) {
+      return;
+    }
+    if (condition != CONCURRENT_REBALANCE_REQUIRED) {
+      avl_tree_concurrent_lock(node);
+      next = NULL;
+      if ((avl_tree_concurrent_version(node) & CONCURRENT_UNLINKED) == 0) {
+        next = avl_tree_concurrent_fix_height(node);
+      }
+      avl_tree_concurrent_unlock(node);
+    } else {
+      /* A rotation changes the parent. Retry if "node" moved. A removed
+       * node keeps its parent, so check that it is still a child */
+      parent = avl_tree_concurrent_parent(node);
+      next = node;
+      is_below = false;
+      avl_tree_concurrent_lock(parent);
+      if ((avl_tree_concurrent_version(parent) & CONCURRENT_UNLINKED) == 0 &&
+          avl_tree_concurrent_parent(node) == parent &&
+          (avl_tree_concurrent_child(parent, CONCURRENT_LEFT) == node ||
+           avl_tree_concurrent_child(parent, CONCURRENT_RIGHT) == node)) {
+        avl_tree_concurrent_lock(node);
+        next = NULL;
+        if ((avl_tree_concurrent_version(node) & CONCURRENT_UNLINKED) == 0) {
+          next = avl_tree_concurrent_rebalance(parent, node);
+        }
+        avl_tree_concurrent_unlock(node);
+        is_below = (next != NULL && next != parent &&
+                    (next == node ||
+                     avl_tree_concurrent_child(parent, CONCURRENT_LEFT) ==
+                     next ||
+                     avl_tree_concurrent_child(parent, CONCURRENT_RIGHT) ==
+                     next));
+      }
+      avl_tree_concurrent_unlock(parent);
+
+      /* A rotation that left a node below "parent" unbalanced did not fix
+       * the height of "parent". The repair of that node may stop before
+       * it, so come back to it */
+      if (is_below) {
+        avl_tree_concurrent_repair(next);
+        next = parent;
+      }
+    }
+    node = next;
+  }
+}
+
+/*
+ * Updates. A node is removed from the tree when CONCURRENT_UNLINKED is
+ * set in its version, which is done before it is detached, so that a
+ * search that finds the node with the flag clear found it in the tree.
+ *
+ * The version of a node changes whenever the range of keys that its
+ * subtree may hold shrinks. A descent that is on a node whose version
+ * did not change can hence trust that its key is in that range
+ */
+
+/*
+ * Put the successor of the locked "node", that has two children, in its
+ * place under the locked "parent".
+ * Moving the successor up raises the smallest key of the subtree of
+ * every node from the right child of "node" down to the parent of the
+ * successor. All those nodes are locked from the top down, which also
+ * keeps their left links in place, and marked as shrinking during the
+ * move. Returns the successor, and its former parent in
+ * "*successor_parent_out", or NULL if that was "node". Both are repaired
+ * once unlocked, the former parent first
+ */
+static AVLTreeConcurrentNode *avl_tree_concurrent_replace(
+  AVLTreeConcurrentNode *parent, int side, AVLTreeConcurrentNode *node,
+  AVLTreeConcurrentNode **successor_parent_out)
+{
+  AVLTreeConcurrentNode *right = avl_tree_concurrent_child(node,
+                                                           CONCURRENT_RIGHT);
+  AVLTreeConcurrentNode *left = avl_tree_concurrent_child(node,
+                                                          CONCURRENT_LEFT);
+  AVLTreeConcurrentNode *successor, *successor_parent, *path, *next;
+
+  successor_parent = node;
+  successor = right;
+  avl_tree_concurrent_lock(successor);
+  while ((next = avl_tree_concurrent_child(successor,
+                                           CONCURRENT_LEFT)) != NULL) {
+    successor_parent = successor;
+    successor = next;
+    avl_tree_concurrent_lock(successor);
+  }
+
+  for (path = right; path != successor;
+       path = avl_tree_concurrent_child(path, CONCURRENT_LEFT)) {
+    avl_tree_concurrent_set_version(
+      path, avl_tree_concurrent_version(path) | CONCURRENT_SHRINKING);
+  }
+  avl_tree_concurrent_set_version(
+    node, avl_tree_concurrent_version(node) | CONCURRENT_UNLINKED);
+
+  if (successor_parent != node) {
+    next = avl_tree_concurrent_child(successor, CONCURRENT_RIGHT);
+    avl_tree_concurrent_set_child(successor_parent, CONCURRENT_LEFT, next);
+    avl_tree_concurrent_set_parent(next, successor_parent);
+    avl_tree_concurrent_set_child(successor, CONCURRENT_RIGHT, right);
+    avl_tree_concurrent_set_parent(right, successor);
+  }
+  avl_tree_concurrent_set_child(successor, CONCURRENT_LEFT, left);
+  avl_tree_concurrent_set_parent(left, successor);
+  avl_tree_concurrent_set_height(successor, avl_tree_concurrent_height(node));
+  avl_tree_concurrent_set_parent(successor, parent);
+  avl_tree_concurrent_set_child(parent, side, successor);
+
+  /* The path now ends at the parent of the successor */
+  avl_tree_concurrent_unlock(successor);
+  *successor_parent_out = successor_parent;
+  if (successor_parent == node) {
+    *successor_parent_out = NULL;
+    return (successor);
+  }
+  for (path = right; ; path = next) {
+    next = avl_tree_concurrent_child(path, CONCURRENT_LEFT);
+    avl_tree_concurrent_set_version(
+      path, (avl_tree_concurrent_version(path) & ~(uint64_t)
+             CONCURRENT_SHRINKING) + CONCURRENT_VERSION_STEP);
+    avl_tree_concurrent_unlock(path);
+    if (path == successor_parent) {
+      return (successor);
+    }
+  }
+}
+
+/* Remove "node", a child of "parent". Returns "node", or
+ * CONCURRENT_RETRY if it is no longer a child of "parent" */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_remove_node(
+  AVLTreeConcurrent *tree, AVLTreeConcurrentNode *parent,
+  AVLTreeConcurrentNode *node)
+{
+  AVLTreeConcurrentNode *left, *right, *damaged, *moved = NULL;
+  int side;
+
+  avl_tree_concurrent_lock(parent);
+  side = (avl_tree_concurrent_child(parent, CONCURRENT_LEFT) == node ?
+          CONCURRENT_LEFT : CONCURRENT_RIGHT);
+  if ((avl_tree_concurrent_version(parent) & CONCURRENT_UNLINKED) != 0 ||
+      avl_tree_concurrent_child(parent, side) != node) {
+    avl_tree_concurrent_unlock(parent);
+    return (CONCURRENT_RETRY);
+  }
+  avl_tree_concurrent_lock(node);
+  if ((avl_tree_concurrent_version(node) & CONCURRENT_UNLINKED) != 0) {
+    avl_tree_concurrent_unlock(node);
+    avl_tree_concurrent_unlock(parent);
+    return (CONCURRENT_RETRY);
+  }
+
+  left = avl_tree_concurrent_child(node, CONCURRENT_LEFT);
+  right = avl_tree_concurrent_child(node, CONCURRENT_RIGHT);
+  if (left == NULL || right == NULL) {
+    /* Splice the only child, if any, in its place */
+    avl_tree_concurrent_set_version(
+      node, avl_tree_concurrent_version(node) | CONCURRENT_UNLINKED);
+    avl_tree_concurrent_set_child(parent, side, left == NULL ? right : left);
+    avl_tree_concurrent_set_parent(left == NULL ? right : left, parent);
+    damaged = parent;
+  } else {
+    moved = avl_tree_concurrent_replace(parent, side, node, &damaged);
+  }
+  avl_tree_concurrent_unlock(node);
+  avl_tree_concurrent_unlock(parent);
+  __atomic_sub_fetch(&tree->num_nodes, 1, __ATOMIC_RELAXED);
+
+  /* The successor took the height of "node", which a repair that was
+   * on its way up to "node" no longer fixes. Repair it after the nodes
+   * below it */
+  avl_tree_concurrent_repair(damaged);
+  avl_tree_concurrent_repair(moved);
+  return (node);
+}
+
+/* Link "new_node" as the child "side" of the locked "node", which has
+ * none, and unlock it. A removed node keeps counting its changes, so a
+ * search still on it from before sees that it moved */
+
+static void avl_tree_concurrent_link(AVLTreeConcurrent *tree,
+                                     AVLTreeConcurrentNode *node, int side,
+                                     AVLTreeConcurrentNode *new_node)
+{
+  AVLTreeConcurrentNode *damaged;
+  uint64_t version;
+
+  version = avl_tree_concurrent_version(new_node);
+  avl_tree_concurrent_set_version(
+    new_node, (version & ~(uint64_t)CONCURRENT_VERSION_MASK) +
+    CONCURRENT_VERSION_STEP);
+  avl_tree_concurrent_set_child(new_node, CONCURRENT_LEFT, NULL);
+  avl_tree_concurrent_set_child(new_node, CONCURRENT_RIGHT, NULL);
+  avl_tree_concurrent_set_parent(new_node, node);
+  avl_tree_concurrent_set_height(new_node, 1);
+  avl_tree_concurrent_set_child(node, side, new_node);
+  damaged = avl_tree_concurrent_fix_height(node);
+  avl_tree_concurrent_unlock(node);
+  __atomic_add_fetch(&tree->num_nodes, 1, __ATOMIC_RELAXED);
+  avl_tree_concurrent_repair(damaged);
+}
+
+/*
+ * Descend from the link "side" of "node" to the key. A descent holds the
+ * version that "node" had when it was reached, and only trusts a link
+ * of "node" while that version does not change. When it does, the
+ * descent returns CONCURRENT_RETRY to the level above, which reads its
+ * own link again.
+ * A search that ends without the key, and an insert before it links its
+ * node, re-check the version of every node on the way back up, since a
+ * node with the key may have moved up above it in the meantime
+ */
+static AVLTreeConcurrentNode *avl_tree_concurrent_descend(
+  AVLTreeConcurrent *tree, AVLTreeConcurrentSearch *search,
+  AVLTreeConcurrentNode *node, int side, uint64_t version)
+{
+  AVLTreeConcurrentNode *child, *found;
+  uint64_t child_version;
+  int diff;
+
+  for (;;) {
+    child = avl_tree_concurrent_child(node, side);
+    if (child == NULL) {
+      if (search->operation != CONCURRENT_INSERT) {
+        break;
+      }
+      avl_tree_concurrent_lock(node);
+      if (avl_tree_concurrent_version(node) != version) {
+        avl_tree_concurrent_unlock(node);
+        return (CONCURRENT_RETRY);
+      }
+      if (avl_tree_concurrent_child(node, side) == NULL) {
+        search->leaf = node;
+        search->side = side;
+        return (CONCURRENT_LINK);
+      }
+      avl_tree_concurrent_unlock(node);
+      continue;
+    }
+
+    diff = avl_tree_concurrent_compare(tree, search->key, child);
+    child_version = avl_tree_concurrent_version(child);
+    if (diff == 0 && (child_version & CONCURRENT_UNLINKED) == 0) {
+      if (search->operation == CONCURRENT_LOOKUP) {
+        return (child);
+      } else if (search->operation == CONCURRENT_INSERT) {
+        return (NULL);
+      }
+      found = avl_tree_concurrent_remove_node(tree, node, child);
+      if (found != CONCURRENT_RETRY) {
+        return (found);
+      }
+      if (avl_tree_concurrent_version(node) != version) {
+        return (CONCURRENT_RETRY);
+      }
+      continue;
+    }
+
+    if ((child_version & (CONCURRENT_SHRINKING | CONCURRENT_UNLINKED)) != 0 ||
+        child != avl_tree_concurrent_child(node, side)) {
+      if ((child_version & CONCURRENT_SHRINKING) != 0) {
+        avl_tree_concurrent_wait(child);
+      } else if ((child_version & CONCURRENT_UNLINKED) != 0) {
+        /* Its remover holds the lock of "node" and is about to detach
+         * it */
+        sched_yield();
+      }
+      if (avl_tree_concurrent_version(node) != version) {
+        return (CONCURRENT_RETRY);
+      }
+      continue;
+    }
+    if (avl_tree_concurrent_version(node) != version) {
+      return (CONCURRENT_RETRY);
+    }
+    found = avl_tree_concurrent_descend(tree, search, child,
+                                        diff < 0 ? CONCURRENT_LEFT :
+                                        CONCURRENT_RIGHT, child_version);
+    if (found == CONCURRENT_LINK) {
+      if (avl_tree_concurrent_version(node) != version) {
+        avl_tree_concurrent_unlock(search->leaf);
+        return (CONCURRENT_RETRY);
+      }
+      return (found);
+    }
+    if (found == NULL && search->operation != CONCURRENT_INSERT) {
+      break;
+    }
+    if (found != CONCURRENT_RETRY) {
+      return (found);
+    }
+  }
+  return (avl_tree_concurrent_version(node) != version ?
+          CONCURRENT_RETRY : NULL);
+}
+
+/* The version of the holder never changes, so a descent from it never
+ * returns CONCURRENT_RETRY */
+
+static AVLTreeConcurrentNode *avl_tree_concurrent_operation(
+  AVLTreeConcurrent *tree, AVLTreeConcurrentOperation operation,
+  AVLTreeKey key, AVLTreeConcurrentNode *new_node)
+{
+  AVLTreeConcurrentSearch search;
+  AVLTreeConcurrentNode *found;
+
+  search.operation = operation;
+  search.key = key;
+  do {
+    found = avl_tree_concurrent_descend(
+      tree, &search, &tree->holder, CONCURRENT_RIGHT,
+      avl_tree_concurrent_version(&tree->holder));
+  } while (found == CONCURRENT_RETRY);
+  if (found == CONCURRENT_LINK) {
+    avl_tree_concurrent_link(tree, search.leaf, search.side, new_node);
+    found = new_node;
+  }
+  return (found);
+}
+
+AVLTreeConcurrentNode *avl_tree_concurrent_insert(
+  AVLTreeConcurrent *tree, AVLTreeConcurrentNode *new_node)
+{
+  AVLTreeValue value = (AVLTreeValue)((uintptr_t)new_node - tree->node_offset);
+
+  return (avl_tree_concurrent_operation(
+            tree, CONCURRENT_INSERT,
+            tree->key_func(value, tree->key_context), new_node));
+}
+
+AVLTreeConcurrentNode *avl_tree_concurrent_remove(AVLTreeConcurrent *tree,
+                                                  AVLTreeKey key)
+{
+  return (avl_tree_concurrent_operation(tree, CONCURRENT_REMOVE, key, NULL));
+}
+
+AVLTreeConcurrentNode *avl_tree_concurrent_lookup(AVLTreeConcurrent *tree,
+                                                  AVLTreeKey key)
+{
+  return (avl_tree_concurrent_operation(tree, CONCURRENT_LOOKUP, key, NULL));
+}
+
+uint32_t avl_tree_concurrent_num_entries(AVLTreeConcurrent *tree)
+{
+  return (__atomic_load_n(&tree->num_nodes, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,156 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-concurrent.h
+ *
+ * @brief AVL tree with many concurrent writers and lock-free readers
+ *
+ * Each node has its own lock and a version number, as in the tree of
+ * Bronson, Casper, Chafi and Olukotun ("A Practical Concurrent Binary
+ * Search Tree", PPoPP 2010). The version of a node changes when keys
+ * may leave its subtree, i.e. when a rotation moves it down or when it
+ * is removed.
+ *
+ * Searches take no lock. They descend hand over hand: a child is only
+ * followed if the version of its parent did not change, and a search
+ * that did not find its key checks that no version on its path changed
+ * before it says so. Otherwise it retries from the deepest node whose
+ * version did not change.
+ *
+ * Inserts and removes descend in the same way and only lock the few
+ * nodes that they modify. An insert also checks the versions on its way
+ * back up before it links its node. Rebalancing is done after the
+ * change, bottom up, one rotation at a time, and only locks the nodes of
+ * the rotation. The heights may hence be wrong for a moment, but the
+ * tree is an AVL tree again once all the updates have returned.
+ *
+ * Like @ref AVLTreeNode, the node is inside the structure of the user
+ * and nothing is allocated. A removed node with two children is
+ * replaced by its successor, instead of staying in the tree as a
+ * routing node, so that the user gets its structure back at once. That
+ * remove locks every node on the path down to the successor, since the
+ * successor leaves all their subtrees.
+ *
+ * This requires that:
+ *  - A removed structure is not freed or reused while any call on the
+ *    tree that started before the remove returned it may still be
+ *    running, since the call may still be reading it. The caller delays
+ *    the free, e.g. until all its threads passed a quiescent state
+ *  - A node is zeroed before its first insert. The version of a node is
+ *    kept when it is removed and inserted again
+ *  - The key of a structure does not change while it is in the tree
+ */
+
+#ifndef ALGORITHM_AVL_TREE_CONCURRENT_H
+#define ALGORITHM_AVL_TREE_CONCURRENT_H
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A node. Put it in the structure of the user. Do NOT access the
+ * fields directly
+ */
+typedef struct _AVLTreeConcurrentNode {
+  struct _AVLTreeConcurrentNode *children[2];
+  struct _AVLTreeConcurrentNode *parent;
+  uint64_t version;               /* Changes when the subtree shrinks */
+  int height;                     /* May be stale while an update runs */
+  uint32_t lock;
+} AVLTreeConcurrentNode;
+
+/**
+ * An AVL tree with concurrent writers. Do NOT access the fields directly
+ */
+typedef struct _AVLTreeConcurrent {
+  AVLTreeConcurrentNode holder;   /* The root is its right child */
+  intptr_t node_offset;
+  AVLTreeCompareFunc compare_func;
+  AVLTreeKeyFunc key_func;
+  void *key_context;
+  uint32_t num_nodes;
+} AVLTreeConcurrent;
+
+/**
+ * Create an empty tree
+ *
+ * @param tree            Pointer passed to us by the caller to be
+ *                        populated
+ * @param node_offset     See avl_tree_new(). Offset of the
+ *                        @ref AVLTreeConcurrentNode
+ * @param compare_func    See avl_tree_new()
+ * @param key_func        See avl_tree_new()
+ * @param key_context     See avl_tree_new()
+ *
+ * @return                "tree", or NULL on error
+ */
+AVLTreeConcurrent *avl_tree_concurrent_new(AVLTreeConcurrent *tree,
+                                           intptr_t node_offset,
+                                           AVLTreeCompareFunc compare_func,
+                                           AVLTreeKeyFunc key_func,
+                                           void *key_context);
+
+/**
+ * Insert a node. Can run at the same time as any other call on the tree
+ *
+ * @param tree            The tree
+ * @param new_node        The node to insert. Its key MUST be set
+ * @return                "new_node", or NULL if there is already a node
+ *                        with its key
+ */
+AVLTreeConcurrentNode *avl_tree_concurrent_insert(
+  AVLTreeConcurrent *tree, AVLTreeConcurrentNode *new_node);
+
+/**
+ * Remove the node with a key. Can run at the same time as any other
+ * call on the tree
+ *
+ * @param tree            The tree
+ * @param key             The key of the node to remove
+ * @return                The node removed, or NULL if there is no node
+ *                        with the key. See the comments at the top of
+ *                        this file before freeing or reusing it
+ */
+AVLTreeConcurrentNode *avl_tree_concurrent_remove(AVLTreeConcurrent *tree,
+                                                  AVLTreeKey key);
+
+/**
+ * Search the tree. Takes no lock and writes nothing
+ *
+ * @param tree            The tree
+ * @param key             The key to search for
+ * @return                The node with the key, or NULL
+ */
+AVLTreeConcurrentNode *avl_tree_concurrent_lookup(AVLTreeConcurrent *tree,
+                                                  AVLTreeKey key);
+
+/**
+ * Number of nodes in the tree
+ */
+uint32_t avl_tree_concurrent_num_entries(AVLTreeConcurrent *tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_CONCURRENT_H */
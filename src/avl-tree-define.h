@@ -0,0 +1,230 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-define.h
+ *
+ * @brief Type-specialized AVL tree functions generated at compile time
+ *
+ * The functions in "avl-tree.c" reach the key of a node through two
+ * indirect calls at every level of the tree: "key_func" to get the key
+ * out of the user structure then "compare_func" to compare it.
+ *
+ * AVL_TREE_DEFINE() generates "static inline" copies of the
+ * lookup/insert/remove/successor/predeccessor functions for ONE user
+ * structure. The offset of the node and of the key are compile time
+ * constants and the compare function is called directly, so the
+ * compiler can inline both.
+ *
+ * The generated functions operate on the SAME "AVLTree" and
+ * "AVLTreeNode" as the generic ones. So the tree must still be created
+ * with avl_tree_new() and the user is free to mix generic and
+ * specialized calls on the same tree. They follow the multimap mode of
+ * the tree (see avl_tree_set_multimap()). Rebalancing is NOT
+ * duplicated: the specialized insert calls avl_tree_link_node() and the
+ * specialized remove calls avl_tree_remove_node()
+ *
+ * Example
+ *
+ *   struct my_entry {
+ *     uint32_t id;
+ *     AVLTreeNode node;
+ *   };
+ *   static inline int my_cmp(const uint32_t *k1, const uint32_t *k2)
+ *   {
+ *     return ((*k1 > *k2) - (*k1 < *k2));
+ *   }
+ *   AVL_TREE_DEFINE(my_tree, struct my_entry, node, id, my_cmp)
+ *
+ * generates my_tree_lookup(), my_tree_insert(), my_tree_remove(),
+ * my_tree_successor(), my_tree_min_equal_or_greater(),
+ * my_tree_predeccessor(), my_tree_max_equal_or_less() and
+ * my_tree_node_to_value() with the same arguments and return values as
+ * the generic functions with the "avl_tree" prefix.
+ */
+
+#ifndef ALGORITHM_AVLTREE_DEFINE_H
+#define ALGORITHM_AVLTREE_DEFINE_H
+
+#include <stddef.h>
+
+#include "avl-tree.h"
+
+/**
+ * Generate type-specialized AVL tree functions
+ *
+ * @param prefix       Prefix of the generated function names
+ * @param type         Type of the user structure (e.g. "struct my_entry")
+ * @param node_member  Name of the "AVLTreeNode" field in "type". The
+ *                     generated functions do NOT use "node_offset" of the
+ *                     tree. But if generic functions are used on the same
+ *                     tree, the tree MUST be created with
+ *                       offsetof(type, node_member)
+ *                     as "node_offset"
+ * @param key_member   Name of the key field in "type"
+ * @param cmp          Function or macro called as
+ *                       cmp(key1, key2)
+ *                     where both arguments are pointers to the key and
+ *                     returns the same as "AVLTreeCompareFunc". The
+ *                     key passed to the lookup functions is passed as-is
+ *                     as the first argument. It MUST order the keys
+ *                     exactly like the "compare_func" given to
+ *                     avl_tree_new() if generic functions are used on
+ *                     the same tree
+ */
+#define AVL_TREE_DEFINE(prefix, type, node_member, key_member, cmp)     \
+                                                                        \
+static inline type *                                                    \
+prefix##_node_to_value(AVLTreeNode *node)                               \
+{                                                                       \
+  return ((type *)((uintptr_t)node - offsetof(type, node_member)));     \
+}                                                                       \
+                                                                        \
+static inline AVLTreeNode *                                             \
+prefix##_lookup(AVLTree *tree, AVLTreeKey key)                          \
+{                                                                       \
+  AVLTreeNode *node = avl_tree_link_get(&tree->root_node);              \
+  int diff;                                                             \
+                                                                        \
+  while (node != NULL) {                                                \
+    diff = cmp(key, &prefix##_node_to_value(node)->key_member);         \
+    if (diff == 0) {                                                    \
+      return node;                                                      \
+    }                                                                   \
+    node = avl_tree_link_get(&node->children[diff < 0 ?                 \
+                                             AVL_TREE_NODE_LEFT :       \
+                                             AVL_TREE_NODE_RIGHT]);     \
+  }                                                                     \
+  return NULL;                                                          \
+}                                                                       \
+                                                                        \
+static inline AVLTreeNode *                                             \
+prefix##_insert(AVLTree *tree, AVLTreeNode *new_node)                   \
+{                                                                       \
+  AVLTreeNode *node = avl_tree_link_get(&tree->root_node);              \
+  AVLTreeNode *parent = NULL;                                           \
+  AVLTreeNodeSide side = AVL_TREE_NODE_LEFT;                            \
+  int diff;                                                             \
+                                                                        \
+  /* The key of the new node is fetched ONCE, not at every level */     \
+  type *new_value = prefix##_node_to_value(new_node);                   \
+                                                                        \
+  while (node != NULL) {                                                \
+    diff = cmp(&new_value->key_member,                                  \
+               &prefix##_node_to_value(node)->key_member);              \
+    if (diff == 0 && !tree->is_multimap) {                              \
+      return NULL;                                                      \
+    }                                                                   \
+    parent = node;                                                      \
+    side = diff < 0 ? AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT;         \
+    node = avl_tree_link_get(&node->children[side]);                    \
+  }                                                                     \
+  avl_tree_link_node(tree, parent, side, new_node);                     \
+  return new_node;                                                      \
+}                                                                       \
+                                                                        \
+static inline int                                                       \
+prefix##_remove(AVLTree *tree, AVLTreeKey key)                          \
+{                                                                       \
+  AVLTreeNode *node = prefix##_lookup(tree, key);                       \
+                                                                        \
+  if (node == NULL) {                                                   \
+    return 0;                                                           \
+  }                                                                     \
+  avl_tree_remove_node(tree, node);                                     \
+  return 1;                                                             \
+}                                                                       \
+                                                                        \
+static inline AVLTreeNode *                                             \
+prefix##_successor(AVLTree *tree, AVLTreeKey key)                       \
+{                                                                       \
+  AVLTreeNode *node = avl_tree_link_get(&tree->root_node);              \
+  AVLTreeNode *successor = NULL;                                        \
+                                                                        \
+  while (node != NULL) {                                                \
+    if (cmp(key, &prefix##_node_to_value(node)->key_member) < 0) {      \
+      successor = node;                                                 \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_LEFT]);    \
+    } else {                                                            \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_RIGHT]);   \
+    }                                                                   \
+  }                                                                     \
+  return successor;                                                     \
+}                                                                       \
+                                                                        \
+static inline AVLTreeNode *                                             \
+prefix##_min_equal_or_greater(AVLTree *tree, AVLTreeKey key)            \
+{                                                                       \
+  AVLTreeNode *node = avl_tree_link_get(&tree->root_node);              \
+  AVLTreeNode *successor = NULL;                                        \
+  int diff;                                                             \
+                                                                        \
+  while (node != NULL) {                                                \
+    diff = cmp(key, &prefix##_node_to_value(node)->key_member);         \
+    if (diff == 0 && !tree->is_multimap) {                              \
+      return node;                                                      \
+    } else if (diff <= 0) {                                             \
+      successor = node;                                                 \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_LEFT]);    \
+    } else {                                                            \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_RIGHT]);   \
+    }                                                                   \
+  }                                                                     \
+  return successor;                                                     \
+}                                                                       \
+                                                                        \
+static inline AVLTreeNode *                                             \
+prefix##_predeccessor(AVLTree *tree, AVLTreeKey key)                    \
+{                                                                       \
+  AVLTreeNode *node = avl_tree_link_get(&tree->root_node);              \
+  AVLTreeNode *predec = NULL;                                           \
+                                                                        \
+  while (node != NULL) {                                                \
+    if (cmp(key, &prefix##_node_to_value(node)->key_member) > 0) {      \
+      predec = node;                                                    \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_RIGHT]);   \
+    } else {                                                            \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_LEFT]);    \
+    }                                                                   \
+  }                                                                     \
+  return predec;                                                        \
+}                                                                       \
+                                                                        \
+static inline AVLTreeNode *                                             \
+prefix##_max_equal_or_less(AVLTree *tree, AVLTreeKey key)               \
+{                                                                       \
+  AVLTreeNode *node = avl_tree_link_get(&tree->root_node);              \
+  AVLTreeNode *predec = NULL;                                           \
+  int diff;                                                             \
+                                                                        \
+  while (node != NULL) {                                                \
+    diff = cmp(key, &prefix##_node_to_value(node)->key_member);         \
+    if (diff == 0 && !tree->is_multimap) {                              \
+      return node;                                                      \
+    } else if (diff >= 0) {                                             \
+      predec = node;                                                    \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_RIGHT]);   \
+    } else {                                                            \
+      node = avl_tree_link_get(&node->children[AVL_TREE_NODE_LEFT]);    \
+    }                                                                   \
+  }                                                                     \
+  return predec;                                                        \
+}
+
+#endif /* #ifndef ALGORITHM_AVLTREE_DEFINE_H */
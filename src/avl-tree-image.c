@@ -0,0 +1,257 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-image.h"
+
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "avl-tree-image.h"
+
+/* File image of an AVL tree */
+
+#define IMAGE_EMPTY_ROOT UINT64_MAX
+
+/* 64-bit FNV-1a over words instead of bytes, with a fold so that the high
+ * bits of a word reach the low bits of the hash */
+
+#define IMAGE_CHECKSUM_SEED UINT64_C(0xcbf29ce484222325)
+#define IMAGE_CHECKSUM_PRIME UINT64_C(0x100000001b3)
+
+static uint64_t avl_tree_image_checksum(uint64_t hash, const void *data,
+                                        size_t size)
+{
+  const unsigned char *bytes = data;
+  uint64_t word;
+  size_t i;
+
+  for (i = 0; i + sizeof(word) <= size; i += sizeof(word)) {
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * IMAGE_CHECKSUM_PRIME;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ bytes[i]) * IMAGE_CHECKSUM_PRIME;
+  }
+  return (hash);
+}
+
+static uint64_t avl_tree_image_full_checksum(const AVLTreeImageHeader *header,
+                                             const void *arena)
+{
+  AVLTreeImageHeader copy = *header;
+
+  copy.checksum = 0;
+  return (avl_tree_image_checksum(
+            avl_tree_image_checksum(IMAGE_CHECKSUM_SEED, &copy, sizeof(copy)),
+            arena, header->arena_size));
+}
+
+/* The layout of the nodes depends on the compile-time variant */
+
+static uint32_t avl_tree_image_node_format(void)
+{
+  uint32_t format = sizeof(AVLTreeNode);
+
+#ifdef AVL_TREE_COMPACT_NODE
+  format |= (1 << 16);
+#endif
+#ifdef AVL_TREE_ORDER_STATISTIC
+  format |= (1 << 17);
+#endif
+#ifdef AVL_TREE_RELATIVE_NODE
+  format |= (1 << 18);
+#endif
+  return (format);
+}
+
+static bool avl_tree_image_write(int fd, const void *data, size_t size)
+{
+  const char *bytes = data;
+  ssize_t written;
+
+  while (size > 0) {
+    written = write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (false);
+    }
+    bytes += written;
+    size -= written;
+  }
+  return (true);
+}
+
+bool avl_tree_image_save(AVLTree *tree, const void *arena,
+                         size_t arena_size, const char *path)
+{
+  union {
+    AVLTreeImageHeader header;
+    char bytes[AVL_TREE_IMAGE_HEADER_SIZE];
+  } page;
+  AVLTreeNode *root = avl_tree_root_node(tree);
+  uintptr_t root_offset = (uintptr_t)root - (uintptr_t)arena;
+  bool is_written;
+  int saved_errno;
+  int fd;
+
+  if (root != NULL &&
+      ((uintptr_t)root < (uintptr_t)arena ||
+       arena_size < sizeof(*root) ||
+       root_offset > arena_size - sizeof(*root))) {
+    errno = EINVAL;
+    return (false);
+  }
+
+  memset(&page, 0, sizeof(page));
+  page.header.magic = AVL_TREE_IMAGE_MAGIC;
+  page.header.version = AVL_TREE_IMAGE_VERSION;
+  page.header.node_format = avl_tree_image_node_format();
+  page.header.arena_size = arena_size;
+  page.header.arena_address = (uintptr_t)arena;
+  page.header.root_offset = (root == NULL ? IMAGE_EMPTY_ROOT : root_offset);
+  page.header.node_offset = tree->node_offset;
+  page.header.num_nodes = avl_tree_num_entries(tree);
+  page.header.is_multimap = tree->is_multimap;
+  page.header.checksum = avl_tree_image_full_checksum(&page.header, arena);
+
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return (false);
+  }
+  is_written = (avl_tree_image_write(fd, &page, sizeof(page)) &&
+                avl_tree_image_write(fd, arena, arena_size));
+  saved_errno = errno;
+  if (close(fd) != 0 && is_written) {
+    return (false);
+  }
+  errno = saved_errno;
+  return (is_written);
+}
+
+/* Everything that can be checked without reading the arena */
+
+static bool avl_tree_image_check_header(const AVLTreeImageHeader *header,
+                                        const AVLTree *tree,
+                                        off_t file_size)
+{
+  if (header->magic != AVL_TREE_IMAGE_MAGIC ||
+      header->version != AVL_TREE_IMAGE_VERSION ||
+      header->node_format != avl_tree_image_node_format() ||
+      header->node_offset != tree->node_offset ||
+      header->arena_size != (uint64_t)file_size - AVL_TREE_IMAGE_HEADER_SIZE) {
+    return (false);
+  }
+  if (header->root_offset == IMAGE_EMPTY_ROOT) {
+    return (header->num_nodes == 0);
+  }
+  return (header->num_nodes != 0 &&
+          header->arena_size >= sizeof(AVLTreeNode) &&
+          header->root_offset <= header->arena_size - sizeof(AVLTreeNode) &&
+          header->root_offset % __alignof__(AVLTreeNode) == 0);
+}
+
+AVLTree *avl_tree_image_open(AVLTreeImage *image, AVLTree *tree,
+                             const char *path, bool verify_checksum)
+{
+  AVLTreeImageHeader header;
+  struct stat file_stat;
+  void *hint = NULL;
+  void *mapping;
+  char *arena;
+  int saved_errno;
+  int fd;
+
+  if (avl_tree_num_entries(tree) != 0) {
+    errno = EINVAL;
+    return (NULL);
+  }
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return (NULL);
+  }
+  if (fstat(fd, &file_stat) != 0) {
+    goto fail;
+  }
+  if (file_stat.st_size < AVL_TREE_IMAGE_HEADER_SIZE ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      !avl_tree_image_check_header(&header, tree, file_stat.st_size)) {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  /* Ask for the address where the arena was so that the links need no
+   * fix. The mapping is private and writable because the tree can be
+   * modified */
+  if (header.arena_address >= AVL_TREE_IMAGE_HEADER_SIZE) {
+    hint = (void *)(uintptr_t)(header.arena_address -
+                               AVL_TREE_IMAGE_HEADER_SIZE);
+  }
+  mapping = mmap(hint, file_stat.st_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    goto fail;
+  }
+  close(fd);
+  arena = (char *)mapping + AVL_TREE_IMAGE_HEADER_SIZE;
+
+  if (verify_checksum &&
+      avl_tree_image_full_checksum(&header, arena) != header.checksum) {
+    munmap(mapping, file_stat.st_size);
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  image->arena = arena;
+  image->arena_size = header.arena_size;
+  image->mapping = mapping;
+  image->mapping_size = file_stat.st_size;
+
+  /* Attach the root as it was when saved, then move it to the mapping */
+  if (header.root_offset != IMAGE_EMPTY_ROOT) {
+    avl_tree_link_set(&tree->root_node,
+                      (AVLTreeNode *)(uintptr_t)(header.arena_address +
+                                                 header.root_offset));
+    tree->num_nodes = header.num_nodes;
+  }
+  tree->is_multimap = header.is_multimap;
+  avl_tree_relocate(tree, (intptr_t)((uintptr_t)arena -
+                                     (uintptr_t)header.arena_address));
+  return (tree);
+
+fail:
+  saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+  return (NULL);
+}
+
+void avl_tree_image_close(AVLTreeImage *image)
+{
+  munmap(image->mapping, image->mapping_size);
+  image->arena = NULL;
+  image->mapping = NULL;
+}
@@ -0,0 +1,151 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-image.h
+ *
+ * @brief File image of an AVL tree whose nodes live in one arena
+ *
+ * The user structures that hold the nodes of the tree are all inside
+ * one block of memory owned by the caller, the arena.
+ * avl_tree_image_save() writes a header followed by a copy of the arena
+ * to a file. avl_tree_image_open() maps the file with mmap() and
+ * attaches the nodes in the mapping to an empty tree. No node is
+ * inserted and no key is compared.
+ *
+ * With AVL_TREE_RELATIVE_NODE (see AVLTreeLink) the links inside the
+ * arena do not depend on its address and opening is O(1): the pages are
+ * only read when they are used. Otherwise the file is mapped at the
+ * address the arena had when it was saved if that address is free, and
+ * opening is O(1) too. If it is not free, every link is fixed with
+ * avl_tree_relocate(), in O(n) without any comparison.
+ *
+ * The mapping is private: changes made to the tree after opening are
+ * not written back to the file. Save the arena of the mapping to keep
+ * them.
+ *
+ * Like the links of the tree, pointers kept in the user structures
+ * MUST NOT point outside of the arena, and are not fixed when the
+ * arena moves
+ */
+
+#ifndef ALGORITHM_AVL_TREE_IMAGE_H
+#define ALGORITHM_AVL_TREE_IMAGE_H
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * "AVLIMAGE" in the first 8 bytes of the file
+ */
+#define AVL_TREE_IMAGE_MAGIC UINT64_C(0x4547414d494c5641)
+
+/**
+ * Version of the layout of the file
+ */
+#define AVL_TREE_IMAGE_VERSION 1
+
+/**
+ * Size of the header. The arena starts at this offset in the file, so it
+ * is page aligned once mapped
+ */
+#define AVL_TREE_IMAGE_HEADER_SIZE 4096
+
+/**
+ * Header at the start of the file. All the offsets are from the start of
+ * the arena
+ */
+typedef struct _AVLTreeImageHeader {
+  uint64_t magic;                 /* AVL_TREE_IMAGE_MAGIC */
+  uint32_t version;               /* AVL_TREE_IMAGE_VERSION */
+  uint32_t node_format;           /* Size and compile-time variant of
+                                   * AVLTreeNode */
+  uint64_t arena_size;
+  uint64_t arena_address;         /* Address of the arena when saved */
+  uint64_t root_offset;           /* UINT64_MAX if the tree is empty */
+  int64_t node_offset;            /* See avl_tree_new() */
+  uint32_t num_nodes;
+  uint32_t is_multimap;
+  uint64_t checksum;              /* Of the header with this field 0,
+                                   * followed by the arena */
+} AVLTreeImageHeader;
+
+/**
+ * An opened image
+ */
+typedef struct _AVLTreeImage {
+  void *arena;                    /* The arena in the mapping */
+  size_t arena_size;
+  void *mapping;
+  size_t mapping_size;
+} AVLTreeImage;
+
+/**
+ * Write a tree and the arena that holds all its nodes to a file. O(n)
+ *
+ * @param tree            The tree. All its nodes MUST be inside the arena
+ * @param arena           The arena. MUST be aligned to at least the
+ *                        alignment of the structures it holds
+ * @param arena_size      Size of the arena in bytes
+ * @param path            The file. Created or truncated
+ *
+ * @return                True on success. False with errno set otherwise.
+ *                        EINVAL if the root is not in the arena
+ */
+bool avl_tree_image_save(AVLTree *tree, const void *arena,
+                         size_t arena_size, const char *path);
+
+/**
+ * Map an image saved by avl_tree_image_save() and attach its nodes to
+ * "tree". The tree MUST be created with avl_tree_new() with the same
+ * node offset and the same functions as the saved tree, and with the
+ * same augment function if any. It MUST be empty.
+ * Whether the tree is a multimap comes from the image.
+ *
+ * @param image           Pointer passed to us by the caller to be
+ *                        populated. Keep it until avl_tree_image_close()
+ * @param tree            The empty tree
+ * @param path            The file
+ * @param verify_checksum If true, read the whole file to verify its
+ *                        checksum before using it. O(size of the arena)
+ *
+ * @return                "tree", or NULL with errno set if the file cannot
+ *                        be mapped, EINVAL if the tree is not empty or
+ *                        if the image is invalid, was saved with another
+ *                        node offset or another variant of AVLTreeNode,
+ *                        or has a wrong checksum. On error neither
+ *                        "image" nor "tree" is modified
+ */
+AVLTree *avl_tree_image_open(AVLTreeImage *image, AVLTree *tree,
+                             const char *path, bool verify_checksum);
+
+/**
+ * Unmap an image. The tree that it was attached to MUST NOT be used
+ * anymore, except to be created again with avl_tree_new()
+ */
+void avl_tree_image_close(AVLTreeImage *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_IMAGE_H */
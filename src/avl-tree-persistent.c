@@ -0,0 +1,558 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-persistent.h"
+
+ */
+
+#include "avl-tree-persistent.h"
+
+/* Persistent (path-copying) AVL tree */
+
+#define PERSISTENT_LEFT AVL_TREE_NODE_LEFT
+#define PERSISTENT_RIGHT AVL_TREE_NODE_RIGHT
+
+#define PERSISTENT_NO_VERSION UINT64_MAX
+
+/*
+ * State of an insert or a remove while it builds the new version. The
+ * nodes it creates are linked in "created" so that they can be given
+ * back if the pool runs out, and the nodes of the latest version that
+ * it replaces are linked in "replaced" so that they can be retired if it
+ * succeeds. In both cases the nodes are linked with "next", which no
+ * reader looks at
+ */
+typedef struct _AVLTreePersistentUpdate {
+  AVLTreePersistent *tree;
+  uint64_t version;               /* Of the version being built */
+  AVLTreePersistentNode *created;
+  AVLTreePersistentNode *replaced;
+  AVLTreePersistentNode *last_replaced;
+  AVLTreePersistentResult result;
+} AVLTreePersistentUpdate;
+
+AVLTreePersistent *avl_tree_persistent_new(
+  AVLTreePersistent *tree,
+  AVLTreeCompareFunc compare_func,
+  AVLTreeKeyFunc key_func,
+  void *key_context,
+  AVLTreePersistentAllocFunc alloc_func,
+  AVLTreePersistentFreeFunc free_func,
+  void *pool,
+  AVLTreePersistentReader *readers,
+  uint32_t num_readers)
+{
+  uint32_t i;
+
+  if (tree == NULL || !compare_func || !key_func || !alloc_func ||
+      !free_func || pthread_mutex_init(&tree->lock, NULL) != 0) {
+    return (NULL);
+  }
+  tree->root = NULL;
+  tree->version = 0;
+  tree->compare_func = compare_func;
+  tree->key_func = key_func;
+  tree->key_context = key_context;
+  tree->alloc_func = alloc_func;
+  tree->free_func = free_func;
+  tree->pool = pool;
+  tree->readers = readers;
+  tree->num_readers = num_readers;
+  tree->retired = NULL;
+  tree->last_retired = NULL;
+  for (i = 0; i < num_readers; i++) {
+    readers[i].version = PERSISTENT_NO_VERSION;
+  }
+  return (tree);
+}
+
+static void avl_tree_persistent_free_subtree(AVLTreePersistent *tree,
+                                             AVLTreePersistentNode *node)
+{
+  if (node == NULL) {
+    return;
+  }
+  avl_tree_persistent_free_subtree(tree, node->children[PERSISTENT_LEFT]);
+  avl_tree_persistent_free_subtree(tree, node->children[PERSISTENT_RIGHT]);
+  tree->free_func(tree->pool, node);
+}
+
+/* Give back the replaced nodes that no pinned version can reach: the ones
+ * replaced by a version that is not later than the oldest pinned one */
+
+static void avl_tree_persistent_reclaim_locked(AVLTreePersistent *tree)
+{
+  uint64_t oldest = PERSISTENT_NO_VERSION;
+  AVLTreePersistentNode *node;
+  uint64_t version;
+  uint32_t i;
+
+  for (i = 0; i < tree->num_readers; i++) {
+    version = __atomic_load_n(&tree->readers[i].version, __ATOMIC_SEQ_CST);
+    if (version < oldest) {
+      oldest = version;
+    }
+  }
+  while (tree->retired != NULL && tree->retired->stamp <= oldest) {
+    node = tree->retired;
+    tree->retired = node->next;
+    tree->free_func(tree->pool, node);
+  }
+  if (tree->retired == NULL) {
+    tree->last_retired = NULL;
+  }
+}
+
+void avl_tree_persistent_reclaim(AVLTreePersistent *tree)
+{
+  pthread_mutex_lock(&tree->lock);
+  avl_tree_persistent_reclaim_locked(tree);
+  pthread_mutex_unlock(&tree->lock);
+}
+
+void avl_tree_persistent_free(AVLTreePersistent *tree)
+{
+  avl_tree_persistent_free_subtree(tree, tree->root);
+  tree->root = NULL;
+  avl_tree_persistent_reclaim_locked(tree);
+  pthread_mutex_destroy(&tree->lock);
+}
+
+static inline int avl_tree_persistent_compare(const AVLTreePersistent *tree,
+                                              AVLTreeKey key,
+                                              const AVLTreePersistentNode *node)
+{
+  return (tree->compare_func(key, tree->key_func(node->value,
+                                                 tree->key_context)));
+}
+
+static inline int avl_tree_persistent_height(const AVLTreePersistentNode *node)
+{
+  return (node == NULL ? 0 : node->height);
+}
+
+static inline uint32_t avl_tree_persistent_size(
+  const AVLTreePersistentNode *node)
+{
+  return (node == NULL ? 0 : node->size);
+}
+
+static inline void avl_tree_persistent_update_node(AVLTreePersistentNode *node)
+{
+  int left = avl_tree_persistent_height(node->children[PERSISTENT_LEFT]);
+  int right = avl_tree_persistent_height(node->children[PERSISTENT_RIGHT]);
+
+  node->height = (left > right ? left : right) + 1;
+  node->size = (avl_tree_persistent_size(node->children[PERSISTENT_LEFT]) +
+                avl_tree_persistent_size(node->children[PERSISTENT_RIGHT]) +
+                1);
+}
+
+/* A node from the pool, part of the version being built. NULL if the
+ * pool is empty, then the update fails */
+
+static AVLTreePersistentNode *avl_tree_persistent_alloc(
+  AVLTreePersistentUpdate *update)
+{
+  AVLTreePersistentNode *node = update->tree->alloc_func(update->tree->pool);
+
+  if (node == NULL) {
+    update->result = AVL_TREE_PERSISTENT_NO_MEMORY;
+    return (NULL);
+  }
+  node->stamp = update->version;
+  node->next = update->created;
+  update->created = node;
+  return (node);
+}
+
+static void avl_tree_persistent_replace(AVLTreePersistentUpdate *update,
+                                        AVLTreePersistentNode *node)
+{
+  node->next = NULL;
+  if (update->last_replaced == NULL) {
+    update->replaced = node;
+  } else {
+    update->last_replaced->next = node;
+  }
+  update->last_replaced = node;
+}
+
+/* A copy of "node" that can be modified: "node" itself if it was
+ * created by this update */
+
+static AVLTreePersistentNode *avl_tree_persistent_copy(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *node)
+{
+  AVLTreePersistentNode *copy;
+
+  if (node->stamp == update->version) {
+    return (node);
+  }
+  copy = avl_tree_persistent_alloc(update);
+  if (copy == NULL) {
+    return (NULL);
+  }
+  copy->children[PERSISTENT_LEFT] = node->children[PERSISTENT_LEFT];
+  copy->children[PERSISTENT_RIGHT] = node->children[PERSISTENT_RIGHT];
+  copy->value = node->value;
+  copy->size = node->size;
+  copy->height = node->height;
+  avl_tree_persistent_replace(update, node);
+  return (copy);
+}
+
+/* Rotate the modifiable "node" toward "side". Its child on the other
+ * side, that takes its place, is copied */
+
+static AVLTreePersistentNode *avl_tree_persistent_rotate(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *node, int side)
+{
+  AVLTreePersistentNode *pivot;
+
+  pivot = avl_tree_persistent_copy(update, node->children[1 - side]);
+  if (pivot == NULL) {
+    return (node);
+  }
+  node->children[1 - side] = pivot->children[side];
+  pivot->children[side] = node;
+  avl_tree_persistent_update_node(node);
+  avl_tree_persistent_update_node(pivot);
+  return (pivot);
+}
+
+/* Restore the balance of the modifiable "node", whose children differ
+ * in height by at most 2. Returns the root of the subtree */
+
+static AVLTreePersistentNode *avl_tree_persistent_balance(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *node)
+{
+  AVLTreePersistentNode *child;
+  int balance, side;
+
+  avl_tree_persistent_update_node(node);
+  balance = (avl_tree_persistent_height(node->children[PERSISTENT_RIGHT]) -
+             avl_tree_persistent_height(node->children[PERSISTENT_LEFT]));
+  if (balance >= -1 && balance <= 1) {
+    return (node);
+  }
+
+  /* "side" is the taller side. If the child on that side leans the other
+   * way, rotate it first */
+  side = (balance > 0 ? PERSISTENT_RIGHT : PERSISTENT_LEFT);
+  child = node->children[side];
+  if (avl_tree_persistent_height(child->children[1 - side]) >
+      avl_tree_persistent_height(child->children[side])) {
+    child = avl_tree_persistent_copy(update, child);
+    if (child == NULL) {
+      return (node);
+    }
+    node->children[side] = avl_tree_persistent_rotate(update, child, side);
+  }
+  return (avl_tree_persistent_rotate(update, node, 1 - side));
+}
+
+static AVLTreePersistentNode *avl_tree_persistent_insert_subtree(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *node,
+  AVLTreeValue value, AVLTreeKey key)
+{
+  AVLTreePersistentNode *child, *copy;
+  int diff, side;
+
+  if (node == NULL) {
+    node = avl_tree_persistent_alloc(update);
+    if (node != NULL) {
+      node->children[PERSISTENT_LEFT] = NULL;
+      node->children[PERSISTENT_RIGHT] = NULL;
+      node->value = value;
+      avl_tree_persistent_update_node(node);
+    }
+    return (node);
+  }
+  diff = avl_tree_persistent_compare(update->tree, key, node);
+  if (diff == 0) {
+    update->result = AVL_TREE_PERSISTENT_EXISTS;
+    return (node);
+  }
+  side = (diff < 0 ? PERSISTENT_LEFT : PERSISTENT_RIGHT);
+  child = avl_tree_persistent_insert_subtree(update, node->children[side],
+                                             value, key);
+  if (update->result != AVL_TREE_PERSISTENT_OK) {
+    return (node);
+  }
+  copy = avl_tree_persistent_copy(update, node);
+  if (copy == NULL) {
+    return (node);
+  }
+  copy->children[side] = child;
+  return (avl_tree_persistent_balance(update, copy));
+}
+
+/* Take the node with the smallest key out of the subtree of "node" */
+
+static AVLTreePersistentNode *avl_tree_persistent_remove_min(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *node,
+  AVLTreePersistentNode **min)
+{
+  AVLTreePersistentNode *child, *copy;
+
+  if (node->children[PERSISTENT_LEFT] == NULL) {
+    *min = node;
+    return (node->children[PERSISTENT_RIGHT]);
+  }
+  child = avl_tree_persistent_remove_min(update,
+                                         node->children[PERSISTENT_LEFT], min);
+  if (update->result != AVL_TREE_PERSISTENT_OK) {
+    return (node);
+  }
+  copy = avl_tree_persistent_copy(update, node);
+  if (copy == NULL) {
+    return (node);
+  }
+  copy->children[PERSISTENT_LEFT] = child;
+  return (avl_tree_persistent_balance(update, copy));
+}
+
+static AVLTreePersistentNode *avl_tree_persistent_remove_subtree(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *node,
+  AVLTreeKey key, AVLTreeValue *removed)
+{
+  AVLTreePersistentNode *child, *copy, *min;
+  int diff, side;
+
+  if (node == NULL) {
+    update->result = AVL_TREE_PERSISTENT_NOT_FOUND;
+    return (NULL);
+  }
+  diff = avl_tree_persistent_compare(update->tree, key, node);
+  if (diff != 0) {
+    side = (diff < 0 ? PERSISTENT_LEFT : PERSISTENT_RIGHT);
+    child = avl_tree_persistent_remove_subtree(update, node->children[side],
+                                               key, removed);
+    if (update->result != AVL_TREE_PERSISTENT_OK) {
+      return (node);
+    }
+    copy = avl_tree_persistent_copy(update, node);
+    if (copy == NULL) {
+      return (node);
+    }
+    copy->children[side] = child;
+    return (avl_tree_persistent_balance(update, copy));
+  }
+
+  *removed = node->value;
+  if (node->children[PERSISTENT_LEFT] == NULL ||
+      node->children[PERSISTENT_RIGHT] == NULL) {
+    avl_tree_persistent_replace(update, node);
+    return (node->children[node->children[PERSISTENT_LEFT] == NULL ?
+                           PERSISTENT_RIGHT : PERSISTENT_LEFT]);
+  }
+
+  /* Two children: the smallest key of the right subtree takes the place
+   * of the node */
+  child = avl_tree_persistent_remove_min(update,
+                                         node->children[PERSISTENT_RIGHT],
+                                         &min);
+  if (update->result != AVL_TREE_PERSISTENT_OK) {
+    return (node);
+  }
+  copy = avl_tree_persistent_copy(update, min);
+  if (copy == NULL) {
+    return (node);
+  }
+  copy->children[PERSISTENT_LEFT] = node->children[PERSISTENT_LEFT];
+  copy->children[PERSISTENT_RIGHT] = child;
+  avl_tree_persistent_replace(update, node);
+  return (avl_tree_persistent_balance(update, copy));
+}
+
+static void avl_tree_persistent_update_start(AVLTreePersistentUpdate *update,
+                                             AVLTreePersistent *tree)
+{
+  pthread_mutex_lock(&tree->lock);
+  update->tree = tree;
+  update->version = tree->version + 1;
+  update->created = NULL;
+  update->replaced = NULL;
+  update->last_replaced = NULL;
+  update->result = AVL_TREE_PERSISTENT_OK;
+}
+
+/*
+ * Publish the new version if the update succeeded. The root is published
+ * before the version: a reader that sees the new version also sees the
+ * new root (see avl_tree_persistent_pin()). Otherwise give back the
+ * nodes created, the latest version is untouched
+ */
+static AVLTreePersistentResult avl_tree_persistent_update_end(
+  AVLTreePersistentUpdate *update, AVLTreePersistentNode *root)
+{
+  AVLTreePersistent *tree = update->tree;
+  AVLTreePersistentResult result = update->result;
+  AVLTreePersistentNode *node;
+
+  if (result != AVL_TREE_PERSISTENT_OK) {
+    while (update->created != NULL) {
+      node = update->created;
+      update->created = node->next;
+      tree->free_func(tree->pool, node);
+    }
+    pthread_mutex_unlock(&tree->lock);
+    return (result);
+  }
+
+  __atomic_store_n(&tree->root, root, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&tree->version, update->version, __ATOMIC_SEQ_CST);
+
+  for (node = update->replaced; node != NULL; node = node->next) {
+    node->stamp = update->version;
+  }
+  if (update->replaced != NULL) {
+    if (tree->last_retired == NULL) {
+      tree->retired = update->replaced;
+    } else {
+      tree->last_retired->next = update->replaced;
+    }
+    tree->last_retired = update->last_replaced;
+  }
+  avl_tree_persistent_reclaim_locked(tree);
+  pthread_mutex_unlock(&tree->lock);
+  return (result);
+}
+
+AVLTreePersistentResult avl_tree_persistent_insert(AVLTreePersistent *tree,
+                                                   AVLTreeValue value)
+{
+  AVLTreePersistentUpdate update;
+  AVLTreePersistentNode *root;
+
+  avl_tree_persistent_update_start(&update, tree);
+  root = avl_tree_persistent_insert_subtree(
+    &update, tree->root, value, tree->key_func(value, tree->key_context));
+  return (avl_tree_persistent_update_end(&update, root));
+}
+
+AVLTreePersistentResult avl_tree_persistent_remove(AVLTreePersistent *tree,
+                                                   AVLTreeKey key,
+                                                   AVLTreeValue *removed)
+{
+  AVLTreePersistentUpdate update;
+  AVLTreePersistentNode *root;
+  AVLTreeValue value = NULL;
+
+  avl_tree_persistent_update_start(&update, tree);
+  root = avl_tree_persistent_remove_subtree(&update, tree->root, key, &value);
+  if (removed != NULL && update.result == AVL_TREE_PERSISTENT_OK) {
+    *removed = value;
+  }
+  return (avl_tree_persistent_update_end(&update, root));
+}
+
+/*
+ * Announce the version before reading the root. A writer that reclaims
+ * after this reader announced sees the announce. One that reclaims
+ * before published its root before, so the reader reads that root and
+ * then sees that the version changed, and tries again
+ */
+AVLTreePersistentSnapshot *avl_tree_persistent_pin(
+  AVLTreePersistentSnapshot *snapshot, AVLTreePersistent *tree,
+  uint32_t reader)
+{
+  AVLTreePersistentReader *slot = &tree->readers[reader];
+  const AVLTreePersistentNode *root;
+  uint64_t version;
+
+  do {
+    version = __atomic_load_n(&tree->version, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&slot->version, version, __ATOMIC_SEQ_CST);
+    root = __atomic_load_n(&tree->root, __ATOMIC_SEQ_CST);
+  } while (__atomic_load_n(&tree->version, __ATOMIC_SEQ_CST) != version);
+
+  snapshot->tree = tree;
+  snapshot->root = root;
+  snapshot->reader = reader;
+  return (snapshot);
+}
+
+void avl_tree_persistent_unpin(AVLTreePersistentSnapshot *snapshot)
+{
+  __atomic_store_n(&snapshot->tree->readers[snapshot->reader].version,
+                   PERSISTENT_NO_VERSION, __ATOMIC_RELEASE);
+  snapshot->root = NULL;
+}
+
+uint32_t avl_tree_persistent_num_entries(
+  const AVLTreePersistentSnapshot *snapshot)
+{
+  return (avl_tree_persistent_size(snapshot->root));
+}
+
+AVLTreeValue avl_tree_persistent_lookup(
+  const AVLTreePersistentSnapshot *snapshot, AVLTreeKey key)
+{
+  const AVLTreePersistentNode *node = snapshot->root;
+  int diff;
+
+  while (node != NULL) {
+    diff = avl_tree_persistent_compare(snapshot->tree, key, node);
+    if (diff == 0) {
+      return (node->value);
+    }
+    node = node->children[diff < 0 ? PERSISTENT_LEFT : PERSISTENT_RIGHT];
+  }
+  return (NULL);
+}
+
+/* The path holds the nodes still to visit, the current one on top. The
+ * nodes below a node in the path are all after the nodes above it */
+
+AVLTreeValue avl_tree_persistent_cursor_first(
+  AVLTreePersistentCursor *cursor,
+  const AVLTreePersistentSnapshot *snapshot, AVLTreeKey key)
+{
+  const AVLTreePersistentNode *node = snapshot->root;
+
+  cursor->depth = 0;
+  while (node != NULL) {
+    if (key == NULL ||
+        avl_tree_persistent_compare(snapshot->tree, key, node) <= 0) {
+      cursor->path[cursor->depth++] = node;
+      node = node->children[PERSISTENT_LEFT];
+    } else {
+      node = node->children[PERSISTENT_RIGHT];
+    }
+  }
+  return (cursor->depth == 0 ? NULL :
+          cursor->path[cursor->depth - 1]->value);
+}
+
+AVLTreeValue avl_tree_persistent_cursor_next(AVLTreePersistentCursor *cursor)
+{
+  const AVLTreePersistentNode *node;
+
+  if (cursor->depth == 0) {
+    return (NULL);
+  }
+  node = cursor->path[--cursor->depth]->children[PERSISTENT_RIGHT];
+  while (node != NULL) {
+    cursor->path[cursor->depth++] = node;
+    node = node->children[PERSISTENT_LEFT];
+  }
+  return (cursor->depth == 0 ? NULL :
+          cursor->path[cursor->depth - 1]->value);
+}
@@ -0,0 +1,265 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-persistent.h
+ *
+ * @brief Persistent (path-copying) AVL tree for point-in-time readers
+ *
+ * A node of the tree is never modified once it is published. An insert
+ * or a remove copies the O(log n) nodes on the path to the change (and
+ * the few nodes moved by the rotations), then publishes the new root
+ * atomically. Every root is hence an immutable version of the whole
+ * tree that shares all its other nodes with the previous version.
+ *
+ * A reader pins the latest version with avl_tree_persistent_pin() and
+ * can then search it and walk it for as long as it wants, without any
+ * lock and without blocking or being blocked by the writers. The
+ * writers are serialized by a mutex.
+ *
+ * Unlike @ref AVLTreeNode, the nodes are not in the user structures,
+ * since a user structure is in many versions at once. They come from a
+ * pool given by the caller and point to the user structures. A node
+ * replaced by an update is given back to the pool once no pinned
+ * version can reach it: every update records the nodes it replaced
+ * with its version, and the writers free them once all the readers
+ * have pinned a later version or none.
+ *
+ * Each reader has its own slot, given by the caller, so that pinning
+ * writes no cache line shared with other readers. The keys of the user
+ * structures MUST NOT change while they are in any version
+ */
+
+#ifndef ALGORITHM_AVL_TREE_PERSISTENT_H
+#define ALGORITHM_AVL_TREE_PERSISTENT_H
+
+#include <pthread.h>
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum height of a tree. An AVL tree of this height has more than
+ * 2^44 nodes
+ */
+#define AVL_TREE_PERSISTENT_MAX_HEIGHT 64
+
+/**
+ * A node. Allocated from the pool of the caller. Read only
+ */
+typedef struct _AVLTreePersistentNode {
+  struct _AVLTreePersistentNode *children[2];
+  AVLTreeValue value;
+  struct _AVLTreePersistentNode *next;  /* Private to the writers */
+  uint64_t stamp;                 /* Version that created it, then the
+                                   * one that replaced it */
+  uint32_t size;                  /* Number of nodes in the subtree */
+  int height;
+} AVLTreePersistentNode;
+
+/**
+ * Get a node from the pool of the caller
+ *
+ * @return                The node, or NULL if the pool is empty
+ */
+typedef AVLTreePersistentNode *(*AVLTreePersistentAllocFunc)(void *pool);
+
+/**
+ * Give a node back to the pool of the caller
+ */
+typedef void (*AVLTreePersistentFreeFunc)(void *pool,
+                                          AVLTreePersistentNode *node);
+
+/**
+ * The slot of one reader. One per reader thread
+ */
+typedef struct _AVLTreePersistentReader {
+  uint64_t version;               /* Pinned version, UINT64_MAX if none */
+} __attribute__ ((aligned (64))) AVLTreePersistentReader;
+
+/**
+ * A persistent AVL tree. Do NOT access the fields directly
+ */
+typedef struct _AVLTreePersistent {
+  AVLTreePersistentNode *root;    /* Latest version */
+  uint64_t version;
+  AVLTreeCompareFunc compare_func;
+  AVLTreeKeyFunc key_func;
+  void *key_context;
+  AVLTreePersistentAllocFunc alloc_func;
+  AVLTreePersistentFreeFunc free_func;
+  void *pool;
+  AVLTreePersistentReader *readers;
+  uint32_t num_readers;
+  AVLTreePersistentNode *retired; /* Oldest replaced node first */
+  AVLTreePersistentNode *last_retired;
+  pthread_mutex_t lock;           /* Serializes the writers */
+} AVLTreePersistent;
+
+/**
+ * A version pinned by a reader. Read only
+ */
+typedef struct _AVLTreePersistentSnapshot {
+  AVLTreePersistent *tree;
+  const AVLTreePersistentNode *root;
+  uint32_t reader;
+} AVLTreePersistentSnapshot;
+
+/**
+ * Walk of a version in ascending order of keys
+ */
+typedef struct _AVLTreePersistentCursor {
+  const AVLTreePersistentNode *path[AVL_TREE_PERSISTENT_MAX_HEIGHT];
+  int depth;
+} AVLTreePersistentCursor;
+
+/**
+ * Result of an update
+ */
+typedef enum {
+  AVL_TREE_PERSISTENT_OK = 0,
+  AVL_TREE_PERSISTENT_EXISTS,     /* Insert: the key is already there */
+  AVL_TREE_PERSISTENT_NOT_FOUND,  /* Remove: the key is not there */
+  AVL_TREE_PERSISTENT_NO_MEMORY   /* The pool is empty. Nothing changed */
+} AVLTreePersistentResult;
+
+/**
+ * Create an empty tree
+ *
+ * @param tree            Pointer passed to us by the caller to be
+ *                        populated
+ * @param compare_func    See avl_tree_new()
+ * @param key_func        See avl_tree_new(). Gets the user structure
+ * @param key_context     See avl_tree_new()
+ * @param alloc_func      Get a node from "pool"
+ * @param free_func       Give a node back to "pool"
+ * @param pool            Opaque context of "alloc_func" and "free_func".
+ *                        Only used by the writers
+ * @param readers         Array of "num_readers" slots owned by the
+ *                        caller, one for each reader
+ * @param num_readers     Number of slots
+ *
+ * @return                "tree", or NULL on error
+ */
+AVLTreePersistent *avl_tree_persistent_new(
+  AVLTreePersistent *tree,
+  AVLTreeCompareFunc compare_func,
+  AVLTreeKeyFunc key_func,
+  void *key_context,
+  AVLTreePersistentAllocFunc alloc_func,
+  AVLTreePersistentFreeFunc free_func,
+  void *pool,
+  AVLTreePersistentReader *readers,
+  uint32_t num_readers);
+
+/**
+ * Give all the nodes back to the pool. No reader may have a pinned
+ * version. The user structures are not touched
+ */
+void avl_tree_persistent_free(AVLTreePersistent *tree);
+
+/**
+ * Insert a user structure in a new version. O(log n)
+ *
+ * @return                AVL_TREE_PERSISTENT_OK,
+ *                        AVL_TREE_PERSISTENT_EXISTS or
+ *                        AVL_TREE_PERSISTENT_NO_MEMORY
+ */
+AVLTreePersistentResult avl_tree_persistent_insert(AVLTreePersistent *tree,
+                                                   AVLTreeValue value);
+
+/**
+ * Remove a key in a new version. O(log n)
+ *
+ * @param removed         If not NULL, receives the user structure removed
+ *
+ * @return                AVL_TREE_PERSISTENT_OK,
+ *                        AVL_TREE_PERSISTENT_NOT_FOUND or
+ *                        AVL_TREE_PERSISTENT_NO_MEMORY
+ */
+AVLTreePersistentResult avl_tree_persistent_remove(AVLTreePersistent *tree,
+                                                   AVLTreeKey key,
+                                                   AVLTreeValue *removed);
+
+/**
+ * Give back to the pool the nodes that no pinned version can reach.
+ * Done by every insert and remove. Call it after the readers unpin old
+ * versions if there may be no update for a while
+ */
+void avl_tree_persistent_reclaim(AVLTreePersistent *tree);
+
+/**
+ * Pin the latest version for a reader. The nodes of the version are not
+ * freed until avl_tree_persistent_unpin(). Lock-free
+ *
+ * @param snapshot        Pointer passed to us by the caller to be
+ *                        populated
+ * @param tree            The tree
+ * @param reader          Index of the slot of the reader. Only one
+ *                        version can be pinned per slot
+ */
+AVLTreePersistentSnapshot *avl_tree_persistent_pin(
+  AVLTreePersistentSnapshot *snapshot, AVLTreePersistent *tree,
+  uint32_t reader);
+
+/**
+ * Release a pinned version. It MUST NOT be used anymore
+ */
+void avl_tree_persistent_unpin(AVLTreePersistentSnapshot *snapshot);
+
+/**
+ * Number of entries in a version. O(1)
+ */
+uint32_t avl_tree_persistent_num_entries(
+  const AVLTreePersistentSnapshot *snapshot);
+
+/**
+ * Search a version
+ *
+ * @return                The user structure with the key, or NULL
+ */
+AVLTreeValue avl_tree_persistent_lookup(
+  const AVLTreePersistentSnapshot *snapshot, AVLTreeKey key);
+
+/**
+ * Start a walk of a version at the first key that is greater than or
+ * equal to "key", or at the smallest key if "key" is NULL
+ *
+ * @return                The user structure, or NULL if there is none
+ */
+AVLTreeValue avl_tree_persistent_cursor_first(
+  AVLTreePersistentCursor *cursor,
+  const AVLTreePersistentSnapshot *snapshot, AVLTreeKey key);
+
+/**
+ * Continue a walk
+ *
+ * @return                The user structure with the next key, or NULL at
+ *                        the end
+ */
+AVLTreeValue avl_tree_persistent_cursor_next(AVLTreePersistentCursor *cursor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_PERSISTENT_H */
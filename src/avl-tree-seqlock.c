@@ -0,0 +1,258 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-seqlock.h"
+
+ */
+
+#include "avl-tree-seqlock.h"
+
+/* AVL tree with lock-free readers */
+
+/* An AVL tree with 2^32 nodes is less than 1.45 * 32 high. A search that
+ * takes more steps went around a cycle made by a rotation in progress */
+#define SEQLOCK_MAX_STEPS 64
+
+#define SEQLOCK_NODE_TO_VALUE(tree, tree_node)                        \
+  ((AVLTreeValue)((uintptr_t)(tree_node) - (tree)->node_offset))
+
+AVLTreeSeqlock *avl_tree_seqlock_new(AVLTreeSeqlock *seqlock,
+                                     intptr_t node_offset,
+                                     AVLTreeCompareFunc compare_func,
+                                     AVLTreeKeyFunc key_func,
+                                     void *key_context,
+                                     AVLTreeFreeFunc free_func,
+                                     void *free_context)
+{
+  if (seqlock == NULL ||
+      avl_tree_new(&seqlock->tree, node_offset, compare_func, key_func,
+                   key_context, free_func, free_context) == NULL ||
+      pthread_mutex_init(&seqlock->lock, NULL) != 0) {
+    return (NULL);
+  }
+  seqlock->sequence = 0;
+  return (seqlock);
+}
+
+void avl_tree_seqlock_destroy(AVLTreeSeqlock *seqlock)
+{
+  pthread_mutex_destroy(&seqlock->lock);
+}
+
+/*
+ * The odd sequence is visible before any change to the tree, and the
+ * even one after all the changes. See the read section in the header
+ */
+AVLTree *avl_tree_seqlock_write_lock(AVLTreeSeqlock *seqlock)
+{
+  pthread_mutex_lock(&seqlock->lock);
+  __atomic_store_n(&seqlock->sequence, seqlock->sequence + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return (&seqlock->tree);
+}
+
+void avl_tree_seqlock_write_unlock(AVLTreeSeqlock *seqlock)
+{
+  __atomic_store_n(&seqlock->sequence, seqlock->sequence + 1,
+                   __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&seqlock->lock);
+}
+
+/* Read a link that a writer may be modifying. A link is one aligned
+ * word, so the value is one that was written to it, never a mix of two.
+ * Hence it is NULL or the address of a node, possibly no longer the
+ * right one */
+
+static inline AVLTreeNode *avl_tree_seqlock_link(const AVLTreeLink *link)
+{
+  AVLTreeLink value = __atomic_load_n(link, __ATOMIC_RELAXED);
+
+#ifdef AVL_TREE_RELATIVE_NODE
+  return (value == 0 ? NULL : (AVLTreeNode *)((uintptr_t)link + value));
+#else
+  return (value);
+#endif
+}
+
+/* Same for the parent. The compact node keeps the balance factor in the
+ * 2 low bits of the same word (see "avl-tree.c") */
+
+static inline AVLTreeNode *avl_tree_seqlock_parent(const AVLTreeNode *node)
+{
+#ifdef AVL_TREE_COMPACT_NODE
+  uintptr_t value = (__atomic_load_n(&node->parent_balance, __ATOMIC_RELAXED) &
+                     ~(uintptr_t)3);
+
+#ifdef AVL_TREE_RELATIVE_NODE
+  return (value == 0 ? NULL :
+          (AVLTreeNode *)((uintptr_t)&node->parent_balance + value));
+#else
+  return ((AVLTreeNode *)value);
+#endif
+#else
+  return (avl_tree_seqlock_link(&node->parent));
+#endif
+}
+
+static inline int avl_tree_seqlock_compare(const AVLTree *tree,
+                                           AVLTreeKey key,
+                                           AVLTreeNode *node)
+{
+  return (tree->compare_func(key,
+                             tree->key_func(SEQLOCK_NODE_TO_VALUE(tree, node),
+                                            tree->key_context)));
+}
+
+AVLTreeNode *avl_tree_seqlock_lookup(const AVLTreeSeqlock *seqlock,
+                                     AVLTreeKey key)
+{
+  const AVLTree *tree = &seqlock->tree;
+  AVLTreeNode *node = avl_tree_seqlock_link(&tree->root_node);
+  int steps, diff;
+
+  for (steps = 0; node != NULL && steps < SEQLOCK_MAX_STEPS; steps++) {
+    diff = avl_tree_seqlock_compare(tree, key, node);
+    if (diff == 0) {
+      return (node);
+    }
+    node = avl_tree_seqlock_link(&node->children[diff < 0 ?
+                                                 AVL_TREE_NODE_LEFT :
+                                                 AVL_TREE_NODE_RIGHT]);
+  }
+  return (NULL);
+}
+
+AVLTreeNode *avl_tree_seqlock_min_equal_or_greater(
+  const AVLTreeSeqlock *seqlock, AVLTreeKey key)
+{
+  const AVLTree *tree = &seqlock->tree;
+  AVLTreeNode *node = avl_tree_seqlock_link(&tree->root_node);
+  AVLTreeNode *successor = NULL;
+  int steps, diff;
+
+  for (steps = 0; node != NULL && steps < SEQLOCK_MAX_STEPS; steps++) {
+    diff = avl_tree_seqlock_compare(tree, key, node);
+    if (diff == 0 && !tree->is_multimap) {
+      return (node);
+    } else if (diff <= 0) {
+      successor = node;
+      node = avl_tree_seqlock_link(&node->children[AVL_TREE_NODE_LEFT]);
+    } else {
+      node = avl_tree_seqlock_link(&node->children[AVL_TREE_NODE_RIGHT]);
+    }
+  }
+  return (successor);
+}
+
+AVLTreeNode *avl_tree_seqlock_max_equal_or_less(
+  const AVLTreeSeqlock *seqlock, AVLTreeKey key)
+{
+  const AVLTree *tree = &seqlock->tree;
+  AVLTreeNode *node = avl_tree_seqlock_link(&tree->root_node);
+  AVLTreeNode *predecessor = NULL;
+  int steps, diff;
+
+  for (steps = 0; node != NULL && steps < SEQLOCK_MAX_STEPS; steps++) {
+    diff = avl_tree_seqlock_compare(tree, key, node);
+    if (diff == 0 && !tree->is_multimap) {
+      return (node);
+    } else if (diff >= 0) {
+      predecessor = node;
+      node = avl_tree_seqlock_link(&node->children[AVL_TREE_NODE_RIGHT]);
+    } else {
+      node = avl_tree_seqlock_link(&node->children[AVL_TREE_NODE_LEFT]);
+    }
+  }
+  return (predecessor);
+}
+
+/* Last node going down on "side" from "node" */
+static AVLTreeNode *avl_tree_seqlock_extreme(AVLTreeNode *node,
+                                             AVLTreeNodeSide side)
+{
+  AVLTreeNode *child;
+  int steps;
+
+  for (steps = 0; node != NULL && steps < SEQLOCK_MAX_STEPS; steps++) {
+    child = avl_tree_seqlock_link(&node->children[side]);
+    if (child == NULL) {
+      return (node);
+    }
+    node = child;
+  }
+  return (NULL);
+}
+
+AVLTreeNode *avl_tree_seqlock_min(const AVLTreeSeqlock *seqlock)
+{
+  return (avl_tree_seqlock_extreme(
+            avl_tree_seqlock_link(&seqlock->tree.root_node),
+            AVL_TREE_NODE_LEFT));
+}
+
+AVLTreeNode *avl_tree_seqlock_max(const AVLTreeSeqlock *seqlock)
+{
+  return (avl_tree_seqlock_extreme(
+            avl_tree_seqlock_link(&seqlock->tree.root_node),
+            AVL_TREE_NODE_RIGHT));
+}
+
+/*
+ * Same walk as avl_tree_node_step() in "avl-tree.c". The climb is also
+ * bounded: in a tree that no writer modifies it is shorter than the
+ * height, so giving up only happens when the read section is retried
+ */
+static AVLTreeNode *avl_tree_seqlock_step(AVLTreeNode *node,
+                                          AVLTreeNodeSide side)
+{
+  AVLTreeNode *child = avl_tree_seqlock_link(&node->children[side]);
+  AVLTreeNode *parent;
+  int steps;
+
+  if (child != NULL) {
+    return (avl_tree_seqlock_extreme(child, 1 - side));
+  }
+
+  parent = avl_tree_seqlock_parent(node);
+  for (steps = 0; parent != NULL && steps < SEQLOCK_MAX_STEPS; steps++) {
+    if (avl_tree_seqlock_link(&parent->children[side]) != node) {
+      return (parent);
+    }
+    node = parent;
+    parent = avl_tree_seqlock_parent(node);
+  }
+  return (NULL);
+}
+
+AVLTreeNode *avl_tree_seqlock_next(const AVLTreeSeqlock *seqlock,
+                                   AVLTreeNode *node)
+{
+  return (avl_tree_seqlock_step(node, AVL_TREE_NODE_RIGHT));
+}
+
+AVLTreeNode *avl_tree_seqlock_prev(const AVLTreeSeqlock *seqlock,
+                                   AVLTreeNode *node)
+{
+  return (avl_tree_seqlock_step(node, AVL_TREE_NODE_LEFT));
+}
+
+uint32_t avl_tree_seqlock_num_entries(const AVLTreeSeqlock *seqlock)
+{
+  return (__atomic_load_n(&seqlock->tree.num_nodes, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,210 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-seqlock.h
+ *
+ * @brief AVL tree with lock-free readers validated by a sequence counter
+ *
+ * Writers take a mutex with avl_tree_seqlock_write_lock(), which makes
+ * the sequence counter odd, use the returned tree with any function of
+ * "avl-tree.h", and make the counter even again with
+ * avl_tree_seqlock_write_unlock().
+ *
+ * Readers take no lock and write no shared memory, so they do not fight
+ * over a cache line. They run a read section and retry it if a writer
+ * was active during it:
+ *
+ *   do {
+ *     sequence = avl_tree_seqlock_read_begin(tree);
+ *     node = avl_tree_seqlock_lookup(tree, &key);
+ *     if (node != NULL) {
+ *       value = MY_NODE_TO_STRUCT(node)->value;
+ *     }
+ *   } while (avl_tree_seqlock_read_retry(tree, sequence));
+ *
+ * Inside a read section the tree can be modified at any time. The
+ * searches and walks of this file read every link once, atomically, and
+ * give up after more steps than the height of any AVL tree, so a link
+ * that is being rewritten or a cycle seen in the middle of a rotation
+ * never makes them fault or loop. Their result, and anything read from
+ * the node, is only meaningful if avl_tree_seqlock_read_retry() returns
+ * false.
+ *
+ * A scan walks with avl_tree_seqlock_next() from a node found in the
+ * same read section. A long scan can be split over several read
+ * sections: copy the key of the last node seen, and start the next
+ * section with avl_tree_seqlock_min_equal_or_greater() on that key
+ *
+ * This requires that:
+ *  - The memory of a node stays mapped and stays a node (type-stable)
+ *    while any reader may use it, even after it is removed
+ *  - The key function and the compare function do not fault or loop on
+ *    any content that a node ever had, since they can run on a node that
+ *    a writer is modifying
+ * Do NOT call the functions of "avl-tree.h" in a read section
+ */
+
+#ifndef ALGORITHM_AVL_TREE_SEQLOCK_H
+#define ALGORITHM_AVL_TREE_SEQLOCK_H
+
+#include <pthread.h>
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An AVL tree with lock-free readers. Do NOT access the fields directly
+ */
+typedef struct _AVLTreeSeqlock {
+  AVLTree tree;
+  uint32_t sequence;              /* Odd while a writer holds the lock */
+  pthread_mutex_t lock;           /* Serializes the writers */
+} AVLTreeSeqlock;
+
+/**
+ * Create an empty tree. The arguments are those of avl_tree_new()
+ *
+ * @return                "seqlock", or NULL on error
+ */
+AVLTreeSeqlock *avl_tree_seqlock_new(AVLTreeSeqlock *seqlock,
+                                     intptr_t node_offset,
+                                     AVLTreeCompareFunc compare_func,
+                                     AVLTreeKeyFunc key_func,
+                                     void *key_context,
+                                     AVLTreeFreeFunc free_func,
+                                     void *free_context);
+
+/**
+ * Destroy the lock. No reader or writer may be active. The nodes are not
+ * freed: call avl_tree_free() on the tree before if needed
+ */
+void avl_tree_seqlock_destroy(AVLTreeSeqlock *seqlock);
+
+/**
+ * Lock out the other writers and start a modification
+ *
+ * @return                The tree, to be modified with the functions of
+ *                        "avl-tree.h" until avl_tree_seqlock_write_unlock()
+ */
+AVLTree *avl_tree_seqlock_write_lock(AVLTreeSeqlock *seqlock);
+
+/**
+ * End a modification started by avl_tree_seqlock_write_lock()
+ */
+void avl_tree_seqlock_write_unlock(AVLTreeSeqlock *seqlock);
+
+/* Tell the CPU that we are spinning */
+#if defined(__x86_64__) || defined(__i386__)
+#define AVL_TREE_SEQLOCK_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define AVL_TREE_SEQLOCK_PAUSE() __asm__ __volatile__ ("yield")
+#else
+#define AVL_TREE_SEQLOCK_PAUSE() do { } while (0)
+#endif
+
+/**
+ * Start a read section. Waits while a writer is active
+ *
+ * @return                The sequence to pass to
+ *                        avl_tree_seqlock_read_retry()
+ */
+static inline uint32_t avl_tree_seqlock_read_begin(
+  const AVLTreeSeqlock *seqlock)
+{
+  uint32_t sequence;
+
+  while ((sequence = __atomic_load_n(&seqlock->sequence,
+                                     __ATOMIC_ACQUIRE)) & 1) {
+    AVL_TREE_SEQLOCK_PAUSE();
+  }
+  return (sequence);
+}
+
+/**
+ * End a read section
+ *
+ * @return                True if a writer was active during the section.
+ *                        Then what was read MUST be discarded and the
+ *                        section run again
+ */
+static inline bool avl_tree_seqlock_read_retry(const AVLTreeSeqlock *seqlock,
+                                               uint32_t sequence)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (__atomic_load_n(&seqlock->sequence, __ATOMIC_RELAXED) != sequence);
+}
+
+/**
+ * Same as avl_tree_lookup(), in a read section
+ */
+AVLTreeNode *avl_tree_seqlock_lookup(const AVLTreeSeqlock *seqlock,
+                                     AVLTreeKey key);
+
+/**
+ * Same as avl_tree_min_equal_or_greater(), in a read section
+ */
+AVLTreeNode *avl_tree_seqlock_min_equal_or_greater(
+  const AVLTreeSeqlock *seqlock, AVLTreeKey key);
+
+/**
+ * Same as avl_tree_max_equal_or_less(), in a read section
+ */
+AVLTreeNode *avl_tree_seqlock_max_equal_or_less(
+  const AVLTreeSeqlock *seqlock, AVLTreeKey key);
+
+/**
+ * Same as avl_tree_min(), in a read section
+ */
+AVLTreeNode *avl_tree_seqlock_min(const AVLTreeSeqlock *seqlock);
+
+/**
+ * Same as avl_tree_max(), in a read section
+ */
+AVLTreeNode *avl_tree_seqlock_max(const AVLTreeSeqlock *seqlock);
+
+/**
+ * Same as avl_tree_node_next(), in a read section. "node" MUST have been
+ * found in the same read section. A node found in an earlier one may
+ * have been removed since, and its stale links would not make
+ * avl_tree_seqlock_read_retry() fail
+ */
+AVLTreeNode *avl_tree_seqlock_next(const AVLTreeSeqlock *seqlock,
+                                   AVLTreeNode *node);
+
+/**
+ * Same as avl_tree_node_prev(), in a read section. Same restriction as
+ * avl_tree_seqlock_next()
+ */
+AVLTreeNode *avl_tree_seqlock_prev(const AVLTreeSeqlock *seqlock,
+                                   AVLTreeNode *node);
+
+/**
+ * Number of entries in the tree, in a read section
+ */
+uint32_t avl_tree_seqlock_num_entries(const AVLTreeSeqlock *seqlock);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_SEQLOCK_H */
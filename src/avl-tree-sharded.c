@@ -0,0 +1,405 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-sharded.h"
+
+ */
+
+#include <string.h>
+
+#include "avl-tree-sharded.h"
+
+/* Ordered map split by key ranges over several locked AVL trees */
+
+#define SHARDED_NODE_TO_VALUE(tree, tree_node)                        \
+  ((AVLTreeValue)((uintptr_t)(tree_node) - (tree)->node_offset))
+
+#define SHARDED_NODE_KEY(tree, tree_node)                             \
+  ((tree)->key_func(SHARDED_NODE_TO_VALUE(tree, tree_node),           \
+                    (tree)->key_context))
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHARDED_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define SHARDED_PAUSE() __asm__ __volatile__ ("yield")
+#else
+#define SHARDED_PAUSE() do { } while (0)
+#endif
+
+/* Context of avl_tree_sharded_walk_node() */
+typedef struct _AVLTreeShardedWalk {
+  AVLTreeWalkFunc func;
+  void *context;
+  bool is_aborted;
+} AVLTreeShardedWalk;
+
+AVLTreeSharded *avl_tree_sharded_new(AVLTreeSharded *sharded,
+                                     AVLTreeShard *shards,
+                                     uint32_t num_shards,
+                                     AVLTreeKey *boundaries,
+                                     uint32_t key_size,
+                                     intptr_t node_offset,
+                                     AVLTreeCompareFunc compare_func,
+                                     AVLTreeKeyFunc key_func,
+                                     void *key_context)
+{
+  uint32_t i;
+
+  if (sharded == NULL || shards == NULL || num_shards == 0 ||
+      key_size == 0 || key_size > AVL_TREE_SHARDED_MAX_KEY_SIZE ||
+      !compare_func || !key_func) {
+    return (NULL);
+  }
+  for (i = 2; i < num_shards; i++) {
+    if (compare_func(boundaries[i - 2], boundaries[i - 1]) >= 0) {
+      return (NULL);
+    }
+  }
+  if (pthread_mutex_init(&sharded->rebalance_lock, NULL) != 0) {
+    return (NULL);
+  }
+  for (i = 0; i < num_shards; i++) {
+    if (pthread_mutex_init(&shards[i].lock, NULL) != 0) {
+      while (i-- > 0) {
+        pthread_mutex_destroy(&shards[i].lock);
+      }
+      pthread_mutex_destroy(&sharded->rebalance_lock);
+      return (NULL);
+    }
+    avl_tree_new(&shards[i].tree, node_offset, compare_func, key_func,
+                 key_context, NULL, NULL);
+    shards[i].num_operations = 0;
+    memset(shards[i].low, 0, sizeof(shards[i].low));
+    if (i > 0) {
+      memcpy(shards[i].low, boundaries[i - 1], key_size);
+    }
+  }
+  sharded->shards = shards;
+  sharded->num_shards = num_shards;
+  sharded->key_size = key_size;
+  sharded->compare_func = compare_func;
+  sharded->key_func = key_func;
+  sharded->key_context = key_context;
+  sharded->node_offset = node_offset;
+  sharded->sequence = 0;
+  return (sharded);
+}
+
+void avl_tree_sharded_destroy(AVLTreeSharded *sharded)
+{
+  uint32_t i;
+
+  for (i = 0; i < sharded->num_shards; i++) {
+    pthread_mutex_destroy(&sharded->shards[i].lock);
+  }
+  pthread_mutex_destroy(&sharded->rebalance_lock);
+}
+
+/* The last shard whose smallest key is not greater than "key". NULL is
+ * smaller than any key */
+
+static uint32_t avl_tree_sharded_route(AVLTreeSharded *sharded,
+                                       AVLTreeKey key)
+{
+  uint32_t low = 0, high = sharded->num_shards - 1, middle;
+
+  if (key == NULL) {
+    return (0);
+  }
+  while (low < high) {
+    middle = low + (high - low + 1) / 2;
+    if (sharded->compare_func(key, sharded->shards[middle].low) >= 0) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return (low);
+}
+
+/*
+ * Lock the shard of "key". The boundaries only move with the two shards
+ * next to them locked and the sequence odd. So if the sequence did not
+ * change between the routing and the lock, the shard is still the right
+ * one, and stays so while it is locked
+ */
+static AVLTreeShard *avl_tree_sharded_lock(AVLTreeSharded *sharded,
+                                           AVLTreeKey key)
+{
+  AVLTreeShard *shard;
+  uint32_t sequence;
+
+  for (;;) {
+    while ((sequence = __atomic_load_n(&sharded->sequence,
+                                       __ATOMIC_ACQUIRE)) & 1) {
+      SHARDED_PAUSE();
+    }
+    shard = &sharded->shards[avl_tree_sharded_route(sharded, key)];
+    pthread_mutex_lock(&shard->lock);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&sharded->sequence, __ATOMIC_RELAXED) == sequence) {
+      shard->num_operations++;
+      return (shard);
+    }
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+AVLTreeNode *avl_tree_sharded_insert(AVLTreeSharded *sharded,
+                                     AVLTreeNode *new_node)
+{
+  AVLTreeShard *shard;
+  AVLTreeNode *node;
+
+  shard = avl_tree_sharded_lock(sharded,
+                                SHARDED_NODE_KEY(sharded, new_node));
+  node = avl_tree_insert(&shard->tree, new_node);
+  pthread_mutex_unlock(&shard->lock);
+  return (node);
+}
+
+AVLTreeNode *avl_tree_sharded_remove(AVLTreeSharded *sharded,
+                                     AVLTreeKey key)
+{
+  AVLTreeShard *shard = avl_tree_sharded_lock(sharded, key);
+  AVLTreeNode *node = avl_tree_lookup(&shard->tree, key);
+
+  if (node != NULL) {
+    avl_tree_remove_node(&shard->tree, node);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return (node);
+}
+
+AVLTreeNode *avl_tree_sharded_lookup(AVLTreeSharded *sharded,
+                                     AVLTreeKey key)
+{
+  AVLTreeShard *shard = avl_tree_sharded_lock(sharded, key);
+  AVLTreeNode *node = avl_tree_lookup(&shard->tree, key);
+
+  pthread_mutex_unlock(&shard->lock);
+  return (node);
+}
+
+static bool avl_tree_sharded_walk_node(AVLTreeNode *node, void *context)
+{
+  AVLTreeShardedWalk *walk = context;
+
+  walk->is_aborted = walk->func(node, walk->context);
+  return (walk->is_aborted);
+}
+
+/*
+ * The walk of a shard ends below the boundary of the next shard. That
+ * boundary is copied while the shard is locked, and the walk goes on
+ * from it in whichever shard holds it then. If the boundary moved up
+ * meanwhile, that is the same shard again, but the nodes from the copy
+ * on are the ones that came from the next shard
+ */
+void avl_tree_sharded_range_walk(AVLTreeSharded *sharded,
+                                 AVLTreeKey low,
+                                 AVLTreeKey high,
+                                 uint32_t flags,
+                                 AVLTreeWalkFunc func,
+                                 void *context)
+{
+  uint64_t next_low[(AVL_TREE_SHARDED_MAX_KEY_SIZE + 7) / 8];
+  AVLTreeShardedWalk walk = { func, context, false };
+  uint32_t walk_flags = flags;
+  AVLTreeShard *shard;
+  uint32_t index;
+  int diff;
+
+  for (;;) {
+    shard = avl_tree_sharded_lock(sharded, low);
+    avl_tree_range_walk(&shard->tree, low, high, walk_flags, false,
+                        avl_tree_sharded_walk_node, &walk);
+    index = shard - sharded->shards;
+    if (walk.is_aborted || index + 1 == sharded->num_shards) {
+      break;
+    }
+    if (high != NULL) {
+      diff = sharded->compare_func(high, sharded->shards[index + 1].low);
+      if (diff < 0 ||
+          (diff == 0 && !(flags & AVL_TREE_RANGE_INCLUDE_HIGH))) {
+        break;
+      }
+    }
+    memcpy(next_low, sharded->shards[index + 1].low, sharded->key_size);
+    pthread_mutex_unlock(&shard->lock);
+    low = next_low;
+    walk_flags = ((flags & AVL_TREE_RANGE_INCLUDE_HIGH) |
+                  AVL_TREE_RANGE_INCLUDE_LOW);
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+uint32_t avl_tree_sharded_num_entries(AVLTreeSharded *sharded)
+{
+  uint32_t i, num_entries = 0;
+
+  for (i = 0; i < sharded->num_shards; i++) {
+    pthread_mutex_lock(&sharded->shards[i].lock);
+    num_entries += avl_tree_num_entries(&sharded->shards[i].tree);
+    pthread_mutex_unlock(&sharded->shards[i].lock);
+  }
+  return (num_entries);
+}
+
+/* The node at position "index" in ascending order of keys */
+
+static AVLTreeNode *avl_tree_sharded_select(AVLTree *tree, uint32_t index)
+{
+#ifdef AVL_TREE_ORDER_STATISTIC
+  return (avl_tree_select(tree, index));
+#else
+  uint32_t num_nodes = avl_tree_num_entries(tree);
+  AVLTreeNode *node;
+
+  /* Walk from the nearest end */
+  if (index < num_nodes / 2) {
+    for (node = avl_tree_min(tree); index > 0; index--) {
+      node = avl_tree_node_next(node);
+    }
+  } else {
+    for (node = avl_tree_max(tree); index < num_nodes - 1; index++) {
+      node = avl_tree_node_prev(node);
+    }
+  }
+  return (node);
+#endif
+}
+
+/*
+ * Move the boundary above shard "index". Both shards and the rebalance
+ * lock are held. The nodes are cut off with avl_tree_split() and joined
+ * to the other shard with avl_tree_join(). The join leaves the result
+ * in its left tree, so when the nodes move up, one more split with the
+ * same key moves them all to the tree of the upper shard
+ */
+static void avl_tree_sharded_move_locked(AVLTreeSharded *sharded,
+                                         uint32_t index, int32_t num_nodes)
+{
+  AVLTree *lower = &sharded->shards[index].tree;
+  AVLTree *upper = &sharded->shards[index + 1].tree;
+  uint32_t num_lower = avl_tree_num_entries(lower);
+  uint32_t num_upper = avl_tree_num_entries(upper);
+  AVLTreeNode *node;
+  AVLTreeKey key;
+  AVLTree moved;
+
+  /* The shard that gives nodes away keeps at least one */
+  if (num_nodes == 0 || (num_nodes > 0 ? num_lower : num_upper) <= 1) {
+    return;
+  }
+  if (num_nodes > 0 && (uint32_t)num_nodes >= num_lower) {
+    num_nodes = num_lower - 1;
+  } else if (num_nodes < 0 && (uint32_t)-num_nodes >= num_upper) {
+    num_nodes = -(int32_t)(num_upper - 1);
+  }
+
+  __atomic_store_n(&sharded->sequence, sharded->sequence + 1,
+                   __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  if (num_nodes > 0) {
+    /* The first node that moves up is the new boundary */
+    node = avl_tree_sharded_select(lower, num_lower - num_nodes);
+    key = SHARDED_NODE_KEY(lower, node);
+    avl_tree_split(lower, key, lower, &moved);
+    avl_tree_join(&moved, NULL, upper);
+    avl_tree_split(&moved, key, &moved, upper);
+  } else {
+    /* The first node that stays is the new boundary */
+    node = avl_tree_sharded_select(upper, -num_nodes);
+    key = SHARDED_NODE_KEY(upper, node);
+    avl_tree_split(upper, key, &moved, upper);
+    avl_tree_join(lower, NULL, &moved);
+  }
+  memcpy(sharded->shards[index + 1].low, key, sharded->key_size);
+
+  __atomic_store_n(&sharded->sequence, sharded->sequence + 1,
+                   __ATOMIC_RELEASE);
+}
+
+void avl_tree_sharded_move(AVLTreeSharded *sharded, uint32_t index,
+                           int32_t num_nodes)
+{
+  if (index + 1 >= sharded->num_shards) {
+    return;
+  }
+  pthread_mutex_lock(&sharded->rebalance_lock);
+  pthread_mutex_lock(&sharded->shards[index].lock);
+  pthread_mutex_lock(&sharded->shards[index + 1].lock);
+  avl_tree_sharded_move_locked(sharded, index, num_nodes);
+  pthread_mutex_unlock(&sharded->shards[index + 1].lock);
+  pthread_mutex_unlock(&sharded->shards[index].lock);
+  pthread_mutex_unlock(&sharded->rebalance_lock);
+}
+
+/*
+ * The boundaries are moved from the lowest to the highest. The
+ * operations of a shard that were on the nodes moved up are counted in
+ * the next shard when its own upper boundary is moved
+ */
+void avl_tree_sharded_rebalance(AVLTreeSharded *sharded)
+{
+  AVLTreeShard *lower, *upper;
+  uint64_t lower_operations, upper_operations, moved_operations;
+  uint32_t i, num_lower, num_upper, num_moved;
+
+  pthread_mutex_lock(&sharded->rebalance_lock);
+  lower = &sharded->shards[0];
+  pthread_mutex_lock(&lower->lock);
+  lower_operations = lower->num_operations;
+  lower->num_operations = 0;
+  pthread_mutex_unlock(&lower->lock);
+
+  for (i = 0; i + 1 < sharded->num_shards; i++) {
+    lower = &sharded->shards[i];
+    upper = &sharded->shards[i + 1];
+    pthread_mutex_lock(&lower->lock);
+    pthread_mutex_lock(&upper->lock);
+    upper_operations = upper->num_operations;
+    upper->num_operations = 0;
+    num_lower = avl_tree_num_entries(&lower->tree);
+    num_upper = avl_tree_num_entries(&upper->tree);
+
+    if (lower_operations > upper_operations && num_lower > 1) {
+      num_moved = (uint32_t)((double)num_lower *
+                             (lower_operations - upper_operations) /
+                             (2.0 * lower_operations));
+      moved_operations = (uint64_t)((double)lower_operations * num_moved /
+                                    num_lower);
+      avl_tree_sharded_move_locked(sharded, i, (int32_t)num_moved);
+      upper_operations += moved_operations;
+    } else if (upper_operations > lower_operations && num_upper > 1) {
+      num_moved = (uint32_t)((double)num_upper *
+                             (upper_operations - lower_operations) /
+                             (2.0 * upper_operations));
+      moved_operations = (uint64_t)((double)upper_operations * num_moved /
+                                    num_upper);
+      avl_tree_sharded_move_locked(sharded, i, -(int32_t)num_moved);
+      upper_operations -= moved_operations;
+    }
+    pthread_mutex_unlock(&upper->lock);
+    pthread_mutex_unlock(&lower->lock);
+    lower_operations = upper_operations;
+  }
+  pthread_mutex_unlock(&sharded->rebalance_lock);
+}
@@ -0,0 +1,200 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-sharded.h
+ *
+ * @brief Ordered map split by key ranges over several locked AVL trees
+ *
+ * The key space is cut into consecutive ranges, one per shard. Each
+ * shard is an ordinary @ref AVLTree with its own mutex, so updates of
+ * keys in different ranges run in parallel on different cores. A point
+ * operation locks the one shard whose range holds its key. A range walk
+ * locks the shards one after the other, in ascending order of keys.
+ *
+ * The ranges are defined by the smallest key of every shard but the
+ * first one. These boundaries are copied into the shards, so the keys
+ * MUST have a fixed size of at most AVL_TREE_SHARDED_MAX_KEY_SIZE bytes
+ * and the compare function MUST work on a copy of a key.
+ *
+ * A boundary is moved by moving the nodes next to it to the neighbour
+ * shard with avl_tree_split() and avl_tree_join(). With
+ * AVL_TREE_ORDER_STATISTIC, this is O(log n). Without it, finding the new
+ * boundary and counting the nodes walk the nodes that move, so a move is
+ * O(log n + number of nodes moved). avl_tree_sharded_rebalance() moves
+ * the boundaries toward the shards that got fewer operations since the
+ * last call.
+ *
+ * The shard of a key is found without any lock, like a read section of
+ * "avl-tree-seqlock.h", and checked again once the shard is locked. The
+ * compare function can hence be called on a boundary that is being
+ * copied, and MUST NOT fault or loop on any content of a key
+ */
+
+#ifndef ALGORITHM_AVL_TREE_SHARDED_H
+#define ALGORITHM_AVL_TREE_SHARDED_H
+
+#include <pthread.h>
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Maximum size of a key. Can be changed at compile time
+ */
+#ifndef AVL_TREE_SHARDED_MAX_KEY_SIZE
+#define AVL_TREE_SHARDED_MAX_KEY_SIZE 32
+#endif
+
+/**
+ * One shard. The array of shards is given by the caller. Do NOT access
+ * the fields directly
+ */
+typedef struct _AVLTreeShard {
+  pthread_mutex_t lock;
+  AVLTree tree;
+  uint64_t num_operations;        /* Since the last rebalance */
+  uint64_t low[(AVL_TREE_SHARDED_MAX_KEY_SIZE + 7) / 8]; /* Smallest key
+                                   * of the range. Not in shard 0 */
+} __attribute__ ((aligned (64))) AVLTreeShard;
+
+/**
+ * A sharded map. Do NOT access the fields directly
+ */
+typedef struct _AVLTreeSharded {
+  AVLTreeShard *shards;
+  uint32_t num_shards;
+  uint32_t key_size;
+  AVLTreeCompareFunc compare_func;
+  AVLTreeKeyFunc key_func;        /* Copies of those of the trees, which */
+  void *key_context;              /* a split rewrites under the lock */
+  intptr_t node_offset;
+  uint32_t sequence;              /* Odd while a boundary moves */
+  pthread_mutex_t rebalance_lock; /* Serializes the boundary moves */
+} AVLTreeSharded;
+
+/**
+ * Create an empty sharded map
+ *
+ * @param sharded         Pointer passed to us by the caller to be
+ *                        populated
+ * @param shards          Array of "num_shards" shards owned by the caller
+ * @param num_shards      Number of shards. At least 1
+ * @param boundaries      The smallest key of every shard but the first,
+ *                        in ascending order. "num_shards" - 1 keys
+ * @param key_size        Size of a key in bytes
+ * @param node_offset     See avl_tree_new()
+ * @param compare_func    See avl_tree_new()
+ * @param key_func        See avl_tree_new()
+ * @param key_context     See avl_tree_new()
+ *
+ * @return                "sharded", or NULL on error
+ */
+AVLTreeSharded *avl_tree_sharded_new(AVLTreeSharded *sharded,
+                                     AVLTreeShard *shards,
+                                     uint32_t num_shards,
+                                     AVLTreeKey *boundaries,
+                                     uint32_t key_size,
+                                     intptr_t node_offset,
+                                     AVLTreeCompareFunc compare_func,
+                                     AVLTreeKeyFunc key_func,
+                                     void *key_context);
+
+/**
+ * Destroy the locks. The nodes are not touched
+ */
+void avl_tree_sharded_destroy(AVLTreeSharded *sharded);
+
+/**
+ * Insert a node in the shard of its key
+ *
+ * @return                Same as avl_tree_insert()
+ */
+AVLTreeNode *avl_tree_sharded_insert(AVLTreeSharded *sharded,
+                                     AVLTreeNode *new_node);
+
+/**
+ * Remove the node with a key
+ *
+ * @return                The node removed, or NULL if there is none
+ */
+AVLTreeNode *avl_tree_sharded_remove(AVLTreeSharded *sharded,
+                                     AVLTreeKey key);
+
+/**
+ * Search the shard of a key. The node can be removed by another thread
+ * as soon as this returns. The caller keeps it alive if needed
+ *
+ * @return                The node with the key, or NULL
+ */
+AVLTreeNode *avl_tree_sharded_lookup(AVLTreeSharded *sharded,
+                                     AVLTreeKey key);
+
+/**
+ * Walk the nodes whose keys are between "low" and "high" in ascending
+ * order. The arguments are those of avl_tree_range_walk(). "func" is
+ * called with the lock of the shard of the node held, and MUST NOT call
+ * the functions of this file.
+ *
+ * Each shard is walked under its lock, but other shards can change
+ * meanwhile. A node is never passed twice, and the keys are always
+ * ascending, even if a boundary moves during the walk
+ */
+void avl_tree_sharded_range_walk(AVLTreeSharded *sharded,
+                                 AVLTreeKey low,
+                                 AVLTreeKey high,
+                                 uint32_t flags,
+                                 AVLTreeWalkFunc func,
+                                 void *context);
+
+/**
+ * Number of nodes in all the shards. Not an atomic snapshot
+ */
+uint32_t avl_tree_sharded_num_entries(AVLTreeSharded *sharded);
+
+/**
+ * Move the boundary between shard "index" and shard "index" + 1
+ *
+ * @param sharded         The sharded map
+ * @param index           The shard below the boundary
+ * @param num_nodes       If positive, the number of largest nodes of
+ *                        shard "index" to move up. If negative, the
+ *                        number of smallest nodes of shard "index" + 1 to
+ *                        move down. At most all but one of the nodes of
+ *                        the shard are moved
+ */
+void avl_tree_sharded_move(AVLTreeSharded *sharded, uint32_t index,
+                           int32_t num_nodes);
+
+/**
+ * Move every boundary so that the shards next to it would have got about
+ * the same number of operations since the last call, assuming that the
+ * operations are spread evenly over the nodes of a shard. Then start
+ * counting again
+ */
+void avl_tree_sharded_rebalance(AVLTreeSharded *sharded);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_SHARDED_H */
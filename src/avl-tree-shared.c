@@ -0,0 +1,112 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-shared.h"
+
+ */
+
+#include <errno.h>
+
+#include "avl-tree-shared.h"
+
+/* AVL tree shared by several processes */
+
+/* "AVLSHARE" */
+#define SHARED_MAGIC UINT64_C(0x45524148534c5641)
+
+int avl_tree_shared_init(AVLTreeShared *shared, intptr_t node_offset)
+{
+  pthread_mutexattr_t attr;
+  int err;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  err = pthread_mutex_init(&shared->lock, &attr);
+  pthread_mutexattr_destroy(&attr);
+  if (err != 0) {
+    return (err);
+  }
+  avl_tree_link_set(&shared->root_node, NULL);
+  shared->node_offset = node_offset;
+  shared->num_nodes = 0;
+  shared->version = 0;
+  shared->is_multimap = false;
+  shared->magic = SHARED_MAGIC;
+  return (0);
+}
+
+void avl_tree_shared_destroy(AVLTreeShared *shared)
+{
+  shared->magic = 0;
+  pthread_mutex_destroy(&shared->lock);
+}
+
+AVLTreeSharedView *avl_tree_shared_attach(AVLTreeSharedView *view,
+                                          AVLTreeShared *shared,
+                                          AVLTreeCompareFunc compare_func,
+                                          AVLTreeKeyFunc key_func,
+                                          void *key_context)
+{
+  if (shared->magic != SHARED_MAGIC ||
+      avl_tree_new(&view->tree, shared->node_offset, compare_func,
+                   key_func, key_context, NULL, NULL) == NULL) {
+    return (NULL);
+  }
+  view->shared = shared;
+  return (view);
+}
+
+int avl_tree_shared_lock(AVLTreeSharedView *view)
+{
+  AVLTreeShared *shared = view->shared;
+  int err;
+
+  err = pthread_mutex_lock(&shared->lock);
+  if (err == EOWNERDEAD) {
+    /* The mutex can be used again, whatever the state of the tree */
+    pthread_mutex_consistent(&shared->lock);
+  } else if (err != 0) {
+    return (err);
+  }
+  avl_tree_link_set(&view->tree.root_node,
+                    avl_tree_link_get(&shared->root_node));
+  view->tree.num_nodes = shared->num_nodes;
+  view->tree.version = shared->version;
+  view->tree.is_multimap = shared->is_multimap;
+  return (err);
+}
+
+void avl_tree_shared_unlock(AVLTreeSharedView *view)
+{
+  AVLTreeShared *shared = view->shared;
+
+  avl_tree_link_set(&shared->root_node,
+                    avl_tree_link_get(&view->tree.root_node));
+  shared->num_nodes = view->tree.num_nodes;
+  shared->version = view->tree.version;
+  shared->is_multimap = view->tree.is_multimap;
+  pthread_mutex_unlock(&shared->lock);
+}
+
+void avl_tree_shared_reset(AVLTreeSharedView *view)
+{
+  avl_tree_link_set(&view->tree.root_node, NULL);
+  view->tree.num_nodes = 0;
+  ++view->tree.version;
+}
@@ -0,0 +1,151 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-shared.h
+ *
+ * @brief AVL tree shared by several processes
+ *
+ * An @ref AVLTreeShared and the user structures that hold the nodes are
+ * in a shared memory segment (e.g. shm_open() or a file mapped with
+ * MAP_SHARED). The @ref AVLTreeShared only has the state of the tree
+ * that is the same for all the processes: the root, the number of nodes,
+ * the version and a process-shared robust mutex. It has no function
+ * pointer.
+ *
+ * Every process attaches its own @ref AVLTreeSharedView, which has a
+ * private @ref AVLTree with the functions of that process.
+ * avl_tree_shared_lock() takes the mutex and loads the shared state in
+ * the private tree, which can then be used with all the functions of
+ * "avl-tree.h", including the ones that modify it.
+ * avl_tree_shared_unlock() stores the state back and releases the mutex.
+ * The private tree MUST NOT be used when the mutex is not held.
+ *
+ * If a process dies while it holds the mutex, the next
+ * avl_tree_shared_lock() returns EOWNERDEAD instead of blocking forever.
+ * The tree may have been left half modified. avl_tree_shared_reset()
+ * empties it so that it can be rebuilt.
+ *
+ * With AVL_TREE_RELATIVE_NODE (see AVLTreeLink) the segment can be
+ * mapped at a different address in every process. Otherwise it MUST be
+ * mapped at the same address, e.g. by mapping it before fork().
+ * Pointers kept in the user structures have the same constraint
+ */
+
+#ifndef ALGORITHM_AVL_TREE_SHARED_H
+#define ALGORITHM_AVL_TREE_SHARED_H
+
+#include <pthread.h>
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The tree in the shared memory segment. Do NOT access the fields
+ * directly
+ */
+typedef struct _AVLTreeShared {
+  pthread_mutex_t lock;           /* Process-shared and robust */
+  uint64_t magic;                 /* Set when initialized */
+  AVLTreeLink root_node;
+  intptr_t node_offset;           /* See avl_tree_new() */
+  uint32_t num_nodes;
+  uint32_t version;
+  bool is_multimap;
+} AVLTreeShared;
+
+/**
+ * The view of a process on an @ref AVLTreeShared. "tree" is only valid
+ * between avl_tree_shared_lock() and avl_tree_shared_unlock()
+ */
+typedef struct _AVLTreeSharedView {
+  AVLTree tree;
+  AVLTreeShared *shared;
+} AVLTreeSharedView;
+
+/**
+ * Create an empty shared tree. Called once, by one process, before any
+ * other process attaches to it
+ *
+ * @param shared          The tree, in the shared memory segment
+ * @param node_offset     See avl_tree_new()
+ *
+ * @return                0, or the error of pthread_mutex_init()
+ */
+int avl_tree_shared_init(AVLTreeShared *shared, intptr_t node_offset);
+
+/**
+ * Destroy a shared tree once no process uses it. The nodes are not
+ * freed
+ */
+void avl_tree_shared_destroy(AVLTreeShared *shared);
+
+/**
+ * Attach a process to a shared tree. The functions are those of
+ * avl_tree_new() and MUST order the keys in the same way in all the
+ * processes. An augment function can be set on "view->tree" with
+ * avl_tree_set_augment() right after attaching. There is no free
+ * function: a node of a shared tree belongs to no process
+ *
+ * @param view            Pointer passed to us by the caller to be
+ *                        populated. Private to the process
+ * @param shared          The shared tree
+ *
+ * @return                "view", or NULL if "shared" was not initialized
+ *                        with avl_tree_shared_init() or a function is NULL
+ */
+AVLTreeSharedView *avl_tree_shared_attach(AVLTreeSharedView *view,
+                                          AVLTreeShared *shared,
+                                          AVLTreeCompareFunc compare_func,
+                                          AVLTreeKeyFunc key_func,
+                                          void *key_context);
+
+/**
+ * Take the mutex of the shared tree and load its state in "view->tree"
+ *
+ * @return                0 if the mutex is held.
+ *                        EOWNERDEAD if the mutex is held but the
+ *                        previous owner died while holding it. The tree
+ *                        may be inconsistent: call avl_tree_shared_reset()
+ *                        unless the caller knows better.
+ *                        Another error of pthread_mutex_lock() if the
+ *                        mutex is NOT held
+ */
+int avl_tree_shared_lock(AVLTreeSharedView *view);
+
+/**
+ * Store the state of "view->tree" in the shared tree and release the
+ * mutex
+ */
+void avl_tree_shared_unlock(AVLTreeSharedView *view);
+
+/**
+ * Empty the tree without reading any node. The nodes that were in it
+ * can then be inserted again. The mutex MUST be held
+ */
+void avl_tree_shared_reset(AVLTreeSharedView *view);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_SHARED_H */
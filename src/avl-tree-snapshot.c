@@ -0,0 +1,147 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-snapshot.h"
+
+ */
+
+#include "avl-tree-snapshot.h"
+
+/* Read-only snapshot of an AVL tree */
+
+#define SNAPSHOT_NODE_TO_VALUE(tree, tree_node)                       \
+  ((AVLTreeValue)((uintptr_t)(tree_node) - (tree)->node_offset))
+
+/*
+ * Fill the implicit subtree rooted at entry "index" with the nodes of
+ * the AVL tree in ascending order, starting at "node".
+ * Returns the node that follows the last one used
+ */
+static AVLTreeNode *avl_tree_snapshot_fill(AVLTreeSnapshot *snapshot,
+                                           uint64_t index,
+                                           AVLTreeNode *node)
+{
+  AVLTree *tree = snapshot->tree;
+
+  if (index > snapshot->num_entries) {
+    return (node);
+  }
+  node = avl_tree_snapshot_fill(snapshot, 2 * index, node);
+  snapshot->entries[index].key =
+    tree->key_func(SNAPSHOT_NODE_TO_VALUE(tree, node), tree->key_context);
+  snapshot->entries[index].node = node;
+  return (avl_tree_snapshot_fill(snapshot, 2 * index + 1,
+                                 avl_tree_node_next(node)));
+}
+
+AVLTreeSnapshot *avl_tree_freeze(AVLTreeSnapshot *snapshot,
+                                 AVLTree *tree,
+                                 AVLTreeSnapshotEntry *buffer,
+                                 uint32_t capacity)
+{
+  uint32_t num_entries = avl_tree_num_entries(tree);
+
+  if (capacity <= num_entries) {
+    return (NULL);
+  }
+  snapshot->tree = tree;
+  snapshot->compare_func = tree->compare_func;
+  snapshot->entries = buffer;
+  snapshot->capacity = capacity;
+  snapshot->num_entries = num_entries;
+  snapshot->version = tree->version;
+  avl_tree_snapshot_fill(snapshot, 1, avl_tree_min(tree));
+  return (snapshot);
+}
+
+bool avl_tree_snapshot_is_stale(const AVLTreeSnapshot *snapshot)
+{
+  return (snapshot->version != snapshot->tree->version);
+}
+
+AVLTreeSnapshot *avl_tree_snapshot_refresh(AVLTreeSnapshot *snapshot)
+{
+  if (!avl_tree_snapshot_is_stale(snapshot)) {
+    return (snapshot);
+  }
+  return (avl_tree_freeze(snapshot, snapshot->tree, snapshot->entries,
+                          snapshot->capacity));
+}
+
+/*
+ * Go down from the root to past the bottom of the implicit tree. Each
+ * step appends one bit to the index: 1 if the entry is less than "key"
+ * (go right), 0 otherwise (go left). The only branch is the loop exit,
+ * which is the same for all keys.
+ * Entries "4 * index" to "4 * index + 3" are the grandchildren of the
+ * entry, in the same 64-byte cache line when the buffer is aligned
+ */
+static inline uint64_t avl_tree_snapshot_descend(
+  const AVLTreeSnapshot *snapshot, AVLTreeKey key)
+{
+  const AVLTreeSnapshotEntry *entries = snapshot->entries;
+  uint64_t index = 1;
+
+  while (index <= snapshot->num_entries) {
+    __builtin_prefetch(&entries[4 * index]);
+    index = 2 * index + (snapshot->compare_func(entries[index].key, key) < 0);
+  }
+  return (index);
+}
+
+/* The lower bound is the last entry where the descent went left: remove
+ * the trailing 1 bits and the 0 bit before them. 0 if there is none */
+
+static inline uint64_t avl_tree_snapshot_lower_bound(
+  const AVLTreeSnapshot *snapshot, AVLTreeKey key)
+{
+  uint64_t index = avl_tree_snapshot_descend(snapshot, key);
+
+  return (index >> (__builtin_ctzll(~index) + 1));
+}
+
+AVLTreeNode *avl_tree_snapshot_lookup(const AVLTreeSnapshot *snapshot,
+                                      AVLTreeKey key)
+{
+  uint64_t index = avl_tree_snapshot_lower_bound(snapshot, key);
+
+  if (index == 0 ||
+      snapshot->compare_func(snapshot->entries[index].key, key) != 0) {
+    return (NULL);
+  }
+  return (snapshot->entries[index].node);
+}
+
+AVLTreeNode *avl_tree_snapshot_min_equal_or_greater(
+  const AVLTreeSnapshot *snapshot, AVLTreeKey key)
+{
+  uint64_t index = avl_tree_snapshot_lower_bound(snapshot, key);
+
+  return (index == 0 ? NULL : snapshot->entries[index].node);
+}
+
+AVLTreeNode *avl_tree_snapshot_predecessor(const AVLTreeSnapshot *snapshot,
+                                           AVLTreeKey key)
+{
+  uint64_t index = avl_tree_snapshot_descend(snapshot, key);
+
+  /* The last entry where the descent went right: remove the trailing 0
+   * bits and the 1 bit before them */
+  index >>= __builtin_ctzll(index) + 1;
+  return (index == 0 ? NULL : snapshot->entries[index].node);
+}
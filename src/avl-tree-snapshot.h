@@ -0,0 +1,150 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-snapshot.h
+ *
+ * @brief Read-only snapshot of an AVL tree in Eytzinger layout
+ *
+ * avl_tree_freeze() copies the key pointer and the node pointer of every
+ * entry of an AVL tree into an array in memory given by the caller. The
+ * array is in Eytzinger (breadth-first) order: entry "i" is the root of
+ * an implicit complete binary search tree whose children are the entries
+ * "2 * i" and "2 * i + 1". Entry 0 is not used and the root is entry 1.
+ *
+ * A search in the snapshot does not follow any pointer of the tree.
+ * Moving to a child is an index computation with no branch, and the
+ * entries two levels below the current one are in a single cache line
+ * that is prefetched while the current entry is compared. For tables
+ * that are read much more often than they are modified, a lookup in the
+ * snapshot is several times faster than in the tree itself.
+ *
+ * The snapshot points to the keys and nodes of the tree, so it becomes
+ * stale as soon as the tree is modified (see "version" in @ref AVLTree).
+ * The snapshot MUST NOT be searched after a node that it holds is
+ * removed from the tree or freed, and until avl_tree_snapshot_refresh()
+ * is called.
+ *
+ * Refreshing a snapshot that is not stale costs nothing. Refreshing a
+ * stale one rebuilds the whole array in O(n), even if a single node
+ * changed, since an insert or a remove moves the position of most of the
+ * entries. The snapshot is hence meant for trees that are read much more
+ * often than they are modified: the writer refreshes once after each
+ * batch of modifications, not after each one. Do not refresh on a
+ * write-heavy path.
+ *
+ * For the best performance, the buffer should be aligned on 64 bytes
+ */
+
+#ifndef ALGORITHM_AVL_TREE_SNAPSHOT_H
+#define ALGORITHM_AVL_TREE_SNAPSHOT_H
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * An entry of a snapshot. Read only
+ */
+typedef struct _AVLTreeSnapshotEntry {
+  AVLTreeKey key;
+  AVLTreeNode *node;
+} AVLTreeSnapshotEntry;
+
+/**
+ * A snapshot of an AVL tree. Read only.
+ *
+ * The compare function is copied so that searches do not read the tree
+ */
+typedef struct _AVLTreeSnapshot {
+  AVLTree *tree;
+  AVLTreeCompareFunc compare_func;
+  AVLTreeSnapshotEntry *entries;  /* "num_entries + 1" used */
+  uint32_t capacity;              /* Number of entries in the buffer */
+  uint32_t num_entries;
+  uint32_t version;               /* Version of the tree when frozen */
+} AVLTreeSnapshot;
+
+/**
+ * Create a snapshot of a tree. O(n), no comparison.
+ *
+ * @param snapshot        Pointer passed to us by the caller to be
+ *                        populated
+ * @param tree            The tree
+ * @param buffer          Array of entries that receives the snapshot.
+ *                        Owned by the caller
+ * @param capacity        Number of entries in "buffer". MUST be at least
+ *                        avl_tree_num_entries(tree) + 1 because entry 0
+ *                        is not used
+ *
+ * @return                "snapshot", or NULL if "capacity" is too small.
+ *                        On error "snapshot" is not modified
+ */
+AVLTreeSnapshot *avl_tree_freeze(AVLTreeSnapshot *snapshot,
+                                 AVLTree *tree,
+                                 AVLTreeSnapshotEntry *buffer,
+                                 uint32_t capacity);
+
+/**
+ * Whether the tree was modified since the snapshot was taken
+ */
+bool avl_tree_snapshot_is_stale(const AVLTreeSnapshot *snapshot);
+
+/**
+ * Take the snapshot again into the same buffer if the tree was modified.
+ * Returns right away if it was not. O(n) if it was, see above
+ *
+ * @return                "snapshot", or NULL if the tree no longer fits
+ *                        in the buffer. In that case call
+ *                        avl_tree_freeze() with a larger buffer
+ */
+AVLTreeSnapshot *avl_tree_snapshot_refresh(AVLTreeSnapshot *snapshot);
+
+/**
+ * Find the node with a key equal to "key"
+ *
+ * @return                The node, or NULL if there is none
+ */
+AVLTreeNode *avl_tree_snapshot_lookup(const AVLTreeSnapshot *snapshot,
+                                      AVLTreeKey key);
+
+/**
+ * Find the node with the smallest key greater than or equal to "key"
+ * (lower bound). With a multimap, the first of the equal keys
+ *
+ * @return                The node, or NULL if there is none
+ */
+AVLTreeNode *avl_tree_snapshot_min_equal_or_greater(
+  const AVLTreeSnapshot *snapshot, AVLTreeKey key);
+
+/**
+ * Find the node with the largest key strictly less than "key"
+ *
+ * @return                The node, or NULL if there is none
+ */
+AVLTreeNode *avl_tree_snapshot_predecessor(const AVLTreeSnapshot *snapshot,
+                                           AVLTreeKey key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_SNAPSHOT_H */
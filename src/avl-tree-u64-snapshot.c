@@ -0,0 +1,239 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-u64-snapshot.h"
+
+ */
+
+#if defined(__AVX2__) || defined(__SSE4_2__)
+#include <immintrin.h>
+#endif
+
+#include "avl-tree-u64-snapshot.h"
+
+/* K-ary snapshot of an AVL tree with 64-bit keys */
+
+#define SNAPSHOT_KEYS AVL_TREE_U64_SNAPSHOT_KEYS
+
+/* Flip the top bit so that the signed order is the unsigned order */
+
+static inline int64_t avl_tree_u64_snapshot_bias(uint64_t key)
+{
+  return ((int64_t)(key ^ ((uint64_t)1 << 63)));
+}
+
+static inline uint64_t avl_tree_u64_snapshot_child(uint64_t block,
+                                                   unsigned int index)
+{
+  return (block * (SNAPSHOT_KEYS + 1) + index + 1);
+}
+
+/*
+ * Fill the implicit subtree rooted at "block" with the nodes of the AVL
+ * tree in ascending order, starting at "*node", and the unused entries
+ * with the largest key. The order of the entries is: child 0, key 0,
+ * child 1, key 1, ... key 7, child 8
+ */
+static void avl_tree_u64_snapshot_fill(AVLTreeU64Snapshot *snapshot,
+                                       uint64_t block,
+                                       AVLTreeNode **node)
+{
+  AVLTreeU64SnapshotBlock *entry;
+  unsigned int i;
+
+  if (block >= snapshot->num_blocks) {
+    return;
+  }
+  entry = &snapshot->blocks[block];
+  for (i = 0; i < SNAPSHOT_KEYS; i++) {
+    avl_tree_u64_snapshot_fill(snapshot,
+                               avl_tree_u64_snapshot_child(block, i), node);
+    if (*node != NULL) {
+      entry->keys[i] =
+        avl_tree_u64_snapshot_bias(((AVLTreeU64Node *)*node)->key);
+      entry->nodes[i] = (AVLTreeU64Node *)*node;
+      *node = avl_tree_node_next(*node);
+    } else {
+      entry->keys[i] = INT64_MAX;
+      entry->nodes[i] = NULL;
+    }
+  }
+  avl_tree_u64_snapshot_fill(snapshot,
+                             avl_tree_u64_snapshot_child(block, SNAPSHOT_KEYS),
+                             node);
+}
+
+AVLTreeU64Snapshot *avl_tree_u64_freeze(AVLTreeU64Snapshot *snapshot,
+                                        AVLTree *tree,
+                                        AVLTreeU64SnapshotBlock *blocks,
+                                        uint32_t capacity)
+{
+  uint32_t num_blocks;
+  AVLTreeNode *node;
+
+  num_blocks = AVL_TREE_U64_SNAPSHOT_BLOCKS(avl_tree_num_entries(tree));
+  if (capacity < num_blocks) {
+    return (NULL);
+  }
+  snapshot->tree = tree;
+  snapshot->blocks = blocks;
+  snapshot->max_node = (AVLTreeU64Node *)avl_tree_max(tree);
+  snapshot->capacity = capacity;
+  snapshot->num_blocks = num_blocks;
+  snapshot->version = tree->version;
+  node = avl_tree_min(tree);
+  avl_tree_u64_snapshot_fill(snapshot, 0, &node);
+  return (snapshot);
+}
+
+bool avl_tree_u64_snapshot_is_stale(const AVLTreeU64Snapshot *snapshot)
+{
+  return (snapshot->version != snapshot->tree->version);
+}
+
+AVLTreeU64Snapshot *avl_tree_u64_snapshot_refresh(
+  AVLTreeU64Snapshot *snapshot)
+{
+  if (!avl_tree_u64_snapshot_is_stale(snapshot)) {
+    return (snapshot);
+  }
+  return (avl_tree_u64_freeze(snapshot, snapshot->tree, snapshot->blocks,
+                              snapshot->capacity));
+}
+
+/*
+ * Number of keys of the block less than "key". The keys of a block are
+ * sorted, so this is also the index of the first key greater than or
+ * equal to "key"
+ */
+static inline unsigned int avl_tree_u64_snapshot_rank(
+  const AVLTreeU64SnapshotBlock *block, int64_t key)
+{
+#if defined(__AVX2__)
+  __m256i key_vector = _mm256_set1_epi64x(key);
+  __m256i low, high;
+  unsigned int mask;
+
+  low = _mm256_cmpgt_epi64(key_vector,
+                           _mm256_load_si256((const __m256i *)block->keys));
+  high = _mm256_cmpgt_epi64(key_vector,
+                            _mm256_load_si256((const __m256i *)
+                                              &block->keys[4]));
+  mask = (_mm256_movemask_pd(_mm256_castsi256_pd(low)) |
+          (_mm256_movemask_pd(_mm256_castsi256_pd(high)) << 4));
+  return (__builtin_popcount(mask));
+#elif defined(__SSE4_2__)
+  __m128i key_vector = _mm_set1_epi64x(key);
+  unsigned int mask = 0;
+  int i;
+
+  for (i = 0; i < SNAPSHOT_KEYS; i += 2) {
+    mask |= _mm_movemask_pd(_mm_castsi128_pd(
+              _mm_cmpgt_epi64(key_vector,
+                              _mm_load_si128((const __m128i *)
+                                             &block->keys[i])))) << i;
+  }
+  return (__builtin_popcount(mask));
+#else
+  unsigned int count = 0;
+  int i;
+
+  for (i = 0; i < SNAPSHOT_KEYS; i++) {
+    count += (block->keys[i] < key);
+  }
+  return (count);
+#endif
+}
+
+/*
+ * Index (block * SNAPSHOT_KEYS + i) of the first entry, in the order of
+ * the keys, that is greater than or equal to "key", or -1 if there is
+ * none. Each block visited narrows the range, so the last candidate
+ * found is the answer
+ */
+static inline int64_t avl_tree_u64_snapshot_lower_bound(
+  const AVLTreeU64Snapshot *snapshot, int64_t key)
+{
+  uint64_t block = 0;
+  int64_t result = -1;
+  unsigned int i;
+
+  while (block < snapshot->num_blocks) {
+    i = avl_tree_u64_snapshot_rank(&snapshot->blocks[block], key);
+    if (i < SNAPSHOT_KEYS) {
+      result = block * SNAPSHOT_KEYS + i;
+    }
+    block = avl_tree_u64_snapshot_child(block, i);
+  }
+  return (result);
+}
+
+static inline AVLTreeU64Node *avl_tree_u64_snapshot_node(
+  const AVLTreeU64Snapshot *snapshot, int64_t index)
+{
+  if (index < 0) {
+    return (NULL);
+  }
+  return (snapshot->blocks[index / SNAPSHOT_KEYS].nodes[index %
+                                                        SNAPSHOT_KEYS]);
+}
+
+AVLTreeU64Node *avl_tree_u64_snapshot_lookup(
+  const AVLTreeU64Snapshot *snapshot, uint64_t key)
+{
+  AVLTreeU64Node *node = avl_tree_u64_snapshot_min_equal_or_greater(snapshot,
+                                                                    key);
+
+  return (node != NULL && node->key == key ? node : NULL);
+}
+
+AVLTreeU64Node *avl_tree_u64_snapshot_min_equal_or_greater(
+  const AVLTreeU64Snapshot *snapshot, uint64_t key)
+{
+  /* An unused entry is after all the used ones, so it is found only if
+   * no key is large enough. Its node is NULL */
+  return (avl_tree_u64_snapshot_node(
+            snapshot,
+            avl_tree_u64_snapshot_lower_bound(
+              snapshot, avl_tree_u64_snapshot_bias(key))));
+}
+
+AVLTreeU64Node *avl_tree_u64_snapshot_max_equal_or_less(
+  const AVLTreeU64Snapshot *snapshot, uint64_t key)
+{
+  uint64_t block = 0;
+  int64_t result = -1;
+  int64_t biased;
+  unsigned int i;
+
+  /* The unused entries have the largest key */
+  if (key == UINT64_MAX) {
+    return (snapshot->max_node);
+  }
+
+  /* The last entry less than "key + 1" */
+  biased = avl_tree_u64_snapshot_bias(key + 1);
+  while (block < snapshot->num_blocks) {
+    i = avl_tree_u64_snapshot_rank(&snapshot->blocks[block], biased);
+    if (i > 0) {
+      result = block * SNAPSHOT_KEYS + i - 1;
+    }
+    block = avl_tree_u64_snapshot_child(block, i);
+  }
+  return (avl_tree_u64_snapshot_node(snapshot, result));
+}
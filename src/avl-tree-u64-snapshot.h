@@ -0,0 +1,152 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-u64-snapshot.h
+ *
+ * @brief Read-only k-ary snapshot of an AVL tree with 64-bit keys
+ *
+ * avl_tree_u64_freeze() copies the keys of an @ref avl-tree-u64.h tree
+ * into a static search tree (S-tree) given by the caller. Every block of
+ * the S-tree holds AVL_TREE_U64_SNAPSHOT_KEYS keys in one 64-byte cache
+ * line, followed by the pointers to their nodes in a second cache line.
+ * Block "k" has AVL_TREE_U64_SNAPSHOT_KEYS + 1 implicit children, the
+ * blocks "k * (AVL_TREE_U64_SNAPSHOT_KEYS + 1) + i + 1".
+ *
+ * A search reads one key line per level, i.e. log9(n) lines instead of
+ * log2(n) nodes for the AVL tree, and finds its position inside the
+ * block with vector compares and a population count, with no branch:
+ *   - AVX2 (compile with -mavx2): 2 compares of 4 keys
+ *   - SSE4.2 (compile with -msse4.2): 4 compares of 2 keys
+ *   - Otherwise portable C that the compiler may vectorize
+ * The node pointers are only read for the result.
+ *
+ * The rules of the snapshot are the same as those of "avl-tree-snapshot.h":
+ * it becomes stale when the tree is modified, MUST NOT be searched after
+ * a node that it holds is removed, is refreshed for free if the tree was
+ * not modified, and is rebuilt in O(n) if it was
+ */
+
+#ifndef ALGORITHM_AVL_TREE_U64_SNAPSHOT_H
+#define ALGORITHM_AVL_TREE_U64_SNAPSHOT_H
+
+#include "avl-tree-u64.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of keys in a block: one cache line of 64-bit keys
+ */
+#define AVL_TREE_U64_SNAPSHOT_KEYS 8
+
+/**
+ * Number of blocks needed for a tree with "num_entries" entries
+ */
+#define AVL_TREE_U64_SNAPSHOT_BLOCKS(num_entries)                           \
+  (((num_entries) + AVL_TREE_U64_SNAPSHOT_KEYS - 1) /                       \
+   AVL_TREE_U64_SNAPSHOT_KEYS)
+
+/**
+ * A block of the snapshot. Read only.
+ *
+ * The keys have their top bit flipped so that they can be compared as
+ * signed integers. The unused entries of the last blocks have the
+ * largest key and a NULL node
+ */
+typedef struct _AVLTreeU64SnapshotBlock {
+  int64_t keys[AVL_TREE_U64_SNAPSHOT_KEYS];
+  AVLTreeU64Node *nodes[AVL_TREE_U64_SNAPSHOT_KEYS];
+} __attribute__ ((aligned (64))) AVLTreeU64SnapshotBlock;
+
+/**
+ * A k-ary snapshot of an AVL tree with 64-bit keys. Read only
+ */
+typedef struct _AVLTreeU64Snapshot {
+  AVLTree *tree;
+  AVLTreeU64SnapshotBlock *blocks;
+  AVLTreeU64Node *max_node;       /* Node with the largest key */
+  uint32_t capacity;              /* Number of blocks in the buffer */
+  uint32_t num_blocks;
+  uint32_t version;               /* Version of the tree when frozen */
+} AVLTreeU64Snapshot;
+
+/**
+ * Create a k-ary snapshot of a tree created with avl_tree_u64_new().
+ * O(n), no comparison.
+ *
+ * @param snapshot        Pointer passed to us by the caller to be
+ *                        populated
+ * @param tree            The tree
+ * @param blocks          Array of blocks that receives the snapshot.
+ *                        Owned by the caller
+ * @param capacity        Number of blocks in "blocks". MUST be at least
+ *                        AVL_TREE_U64_SNAPSHOT_BLOCKS(
+ *                          avl_tree_num_entries(tree))
+ *
+ * @return                "snapshot", or NULL if "capacity" is too small.
+ *                        On error "snapshot" is not modified
+ */
+AVLTreeU64Snapshot *avl_tree_u64_freeze(AVLTreeU64Snapshot *snapshot,
+                                        AVLTree *tree,
+                                        AVLTreeU64SnapshotBlock *blocks,
+                                        uint32_t capacity);
+
+/**
+ * Whether the tree was modified since the snapshot was taken
+ */
+bool avl_tree_u64_snapshot_is_stale(const AVLTreeU64Snapshot *snapshot);
+
+/**
+ * Take the snapshot again into the same blocks if the tree was modified.
+ * Returns right away if it was not
+ *
+ * @return                "snapshot", or NULL if the tree no longer fits
+ *                        in the blocks. In that case call
+ *                        avl_tree_u64_freeze() with more blocks
+ */
+AVLTreeU64Snapshot *avl_tree_u64_snapshot_refresh(
+  AVLTreeU64Snapshot *snapshot);
+
+/**
+ * Same as avl_tree_u64_lookup() on the tree when it was frozen
+ */
+AVLTreeU64Node *avl_tree_u64_snapshot_lookup(
+  const AVLTreeU64Snapshot *snapshot, uint64_t key);
+
+/**
+ * Same as avl_tree_u64_min_equal_or_greater() on the tree when it was
+ * frozen
+ */
+AVLTreeU64Node *avl_tree_u64_snapshot_min_equal_or_greater(
+  const AVLTreeU64Snapshot *snapshot, uint64_t key);
+
+/**
+ * Same as avl_tree_u64_max_equal_or_less() on the tree when it was
+ * frozen
+ */
+AVLTreeU64Node *avl_tree_u64_snapshot_max_equal_or_less(
+  const AVLTreeU64Snapshot *snapshot, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVL_TREE_U64_SNAPSHOT_H */
@@ -0,0 +1,207 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "avl-tree-u64.h"
+
+ */
+
+#include "avl-tree-u64.h"
+#include "avl-tree-define.h"
+
+/* AVL tree with the key inside the node */
+
+
+static inline int avl_tree_u64_compare(const uint64_t *key1,
+                                       const uint64_t *key2)
+{
+  return ((*key1 > *key2) - (*key1 < *key2));
+}
+
+/*
+ * The "value" of the generated functions is the AVLTreeU64Node itself.
+ * So all descents read the key from the node and never use "key_func"
+ * or "node_offset"
+ */
+AVL_TREE_DEFINE(avl_tree_u64_internal, AVLTreeU64Node, node, key,
+                avl_tree_u64_compare)
+
+/* NULL-safe conversion of the result of the generated functions */
+static inline AVLTreeU64Node *avl_tree_u64_node(AVLTreeNode *node)
+{
+  return (node ? avl_tree_u64_internal_node_to_value(node) : NULL);
+}
+
+
+/*
+ * Compare and key functions given to avl_tree_new() so that the generic
+ * functions keep working on the tree.
+ * The key context is "node_offset" itself, needed to go from the
+ * beginning of the user structure to the node. Not a pointer to the
+ * tree, so that a copy of the tree, e.g. the output of avl_tree_split(),
+ * does not depend on the tree it was copied from
+ */
+static int avl_tree_u64_compare_func(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (avl_tree_u64_compare(key1, key2));
+}
+
+static void *avl_tree_u64_key_func(AVLTreeValue value, void *context)
+{
+  intptr_t node_offset = (intptr_t)context;
+  return (&((AVLTreeU64Node *)((uintptr_t)value + node_offset))->key);
+}
+
+AVLTree *avl_tree_u64_new(AVLTree *new_tree,
+                          intptr_t node_offset,
+                          AVLTreeFreeFunc free_func,
+                          void *free_context)
+{
+  return (avl_tree_new(new_tree,
+                       node_offset,
+                       avl_tree_u64_compare_func,
+                       avl_tree_u64_key_func,
+                       (void *)node_offset,
+                       free_func,
+                       free_context));
+}
+
+AVLTreeU64Node *avl_tree_u64_insert(AVLTree *tree, AVLTreeU64Node *new_node)
+{
+  return (avl_tree_u64_node(avl_tree_u64_internal_insert(tree,
+                                                         &new_node->node)));
+}
+
+void avl_tree_u64_remove_node(AVLTree *tree, AVLTreeU64Node *node)
+{
+  avl_tree_remove_node(tree, &node->node);
+}
+
+int avl_tree_u64_remove(AVLTree *tree, uint64_t key)
+{
+  return (avl_tree_u64_internal_remove(tree, &key));
+}
+
+AVLTreeU64Node *avl_tree_u64_lookup(AVLTree *tree, uint64_t key)
+{
+  return (avl_tree_u64_node(avl_tree_u64_internal_lookup(tree, &key)));
+}
+
+void avl_tree_u64_lookup_batch(AVLTree *tree,
+                               const uint64_t *keys,
+                               uint32_t num_keys,
+                               AVLTreeU64Node **results)
+{
+  struct {
+    AVLTreeU64Node *node;
+    uint32_t index;
+  } slots[AVL_TREE_LOOKUP_BATCH_WIDTH], *slot;
+  AVLTreeU64Node *root = avl_tree_u64_node(avl_tree_root_node(tree));
+  AVLTreeNode *child;
+  uint32_t num_slots, next_index, i;
+  uint64_t key;
+
+  if (root == NULL) {
+    for (i = 0; i < num_keys; i++) {
+      results[i] = NULL;
+    }
+    return;
+  }
+
+  /* Same as avl_tree_lookup_batch() */
+  for (num_slots = 0;
+       num_slots < AVL_TREE_LOOKUP_BATCH_WIDTH && num_slots < num_keys;
+       num_slots++) {
+    slots[num_slots].node = root;
+    slots[num_slots].index = num_slots;
+  }
+  next_index = num_slots;
+
+  while (num_slots > 0) {
+    for (i = 0; i < num_slots; ) {
+      slot = &slots[i];
+      key = keys[slot->index];
+      child = (key == slot->node->key ? NULL :
+               avl_tree_link_get(&slot->node->node.children[
+                                   key < slot->node->key ?
+                                   AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT]));
+      if (child == NULL) {
+        results[slot->index] = (key == slot->node->key ? slot->node : NULL);
+        if (next_index < num_keys) {
+          slot->node = root;
+          slot->index = next_index++;
+          i++;
+        } else {
+          *slot = slots[--num_slots];
+        }
+        continue;
+      }
+
+      __builtin_prefetch(child);
+      slot->node = avl_tree_u64_node(child);
+      i++;
+    }
+  }
+}
+
+AVLTreeU64Node *avl_tree_u64_successor(AVLTree *tree, uint64_t key)
+{
+  return (avl_tree_u64_node(avl_tree_u64_internal_successor(tree, &key)));
+}
+
+AVLTreeU64Node *avl_tree_u64_min_equal_or_greater(AVLTree *tree,
+                                                  uint64_t key)
+{
+  return (avl_tree_u64_node(
+            avl_tree_u64_internal_min_equal_or_greater(tree, &key)));
+}
+
+AVLTreeU64Node *avl_tree_u64_predeccessor(AVLTree *tree, uint64_t key)
+{
+  return (avl_tree_u64_node(avl_tree_u64_internal_predeccessor(tree, &key)));
+}
+
+AVLTreeU64Node *avl_tree_u64_max_equal_or_less(AVLTree *tree, uint64_t key)
+{
+  return (avl_tree_u64_node(
+            avl_tree_u64_internal_max_equal_or_less(tree, &key)));
+}
+
+
+/*
+ * The generic walk passes "AVLTreeNode *". We pass to it this trampoline
+ * to call the user callback with the AVLTreeU64Node
+ */
+struct avl_tree_u64_walk_context {
+  AVLTreeU64WalkFunc func;
+  void *context;
+};
+
+static bool avl_tree_u64_walk_func(AVLTreeNode *node, void *context)
+{
+  struct avl_tree_u64_walk_context *walk_context = context;
+  return (walk_context->func(avl_tree_u64_node(node), walk_context->context));
+}
+
+void avl_tree_u64_walk(AVLTree *tree,
+                       bool is_descending,
+                       AVLTreeU64WalkFunc func,
+                       void *context)
+{
+  struct avl_tree_u64_walk_context walk_context = {func, context};
+  avl_tree_walk(tree, is_descending, avl_tree_u64_walk_func, &walk_context);
+}
@@ -0,0 +1,164 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file avl-tree-u64.h
+ *
+ * @brief AVL tree keyed by a 64-bit integer stored inside the node
+ *
+ * With the generic AVL tree, every level of a descent goes back into
+ * the user structure (through "key_func") to get the key. When the tree
+ * is much larger than the cache and the user structures are scattered
+ * in memory, this costs one extra cache miss per level.
+ *
+ * @ref AVLTreeU64Node keeps a "uint64_t" key right after the children
+ * and parent pointers, so a descent only touches the nodes.
+ *
+ * The embedded "AVLTreeNode" is the first field of @ref AVLTreeU64Node.
+ * So the tree is a regular "AVLTree": it must be created with
+ * @ref avl_tree_u64_new, and after that any function in "avl-tree.h"
+ * that does not need a key (e.g. avl_tree_min(), avl_tree_num_entries())
+ * can be used on it as well. The generic functions that take a key
+ * (e.g. avl_tree_lookup()) also work and expect a "uint64_t *".
+ *
+ * The key of a node MUST be set before the node is inserted and MUST
+ * NOT be modified while the node is in the tree
+ */
+
+#ifndef ALGORITHM_AVLTREE_U64_H
+#define ALGORITHM_AVLTREE_U64_H
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A node of an AVL tree with an inline 64-bit key
+ */
+typedef struct _AVLTreeU64Node {
+  AVLTreeNode node;
+  uint64_t key;
+} AVLTreeU64Node;
+
+/**
+ * Callback function to walk a tree of @ref AVLTreeU64Node
+ *
+ * @return          if the the returned value is "non-false", the walk will
+ *                  be aborted immediately
+ */
+typedef bool (*AVLTreeU64WalkFunc)(AVLTreeU64Node *node, void *context);
+
+/**
+ * Create a new AVL tree keyed by the key in @ref AVLTreeU64Node
+ *
+ * @param new_tree      Pointer passed to us by the caller to be populated
+ * @param node_offset   Offset of the @ref AVLTreeU64Node field from the
+ *                      beginning of the user structure. Same meaning as in
+ *                      avl_tree_new()
+ * @param free_func     Function used to free a node. Optional
+ * @param free_context  Opaque context passed to the free_func
+ *
+ * @return              The argument "new_tree", or NULL on error
+ */
+AVLTree *avl_tree_u64_new(AVLTree *new_tree,
+                          intptr_t node_offset,
+                          AVLTreeFreeFunc free_func,
+                          void *free_context);
+
+/**
+ * Insert a node. The key MUST already be set in "new_node->key"
+ *
+ * @return                "new_node", or NULL if there is already a node
+ *                        with the same key
+ */
+AVLTreeU64Node *avl_tree_u64_insert(AVLTree *tree, AVLTreeU64Node *new_node);
+
+/**
+ * Remove a node from a tree.
+ */
+void avl_tree_u64_remove_node(AVLTree *tree, AVLTreeU64Node *node);
+
+/**
+ * Remove the node with the key "key"
+ *
+ * @return                Zero (false) if no node with the specified key was
+ *                        found in the tree, non-zero (true) if a node with
+ *                        the specified key was removed.
+ */
+int avl_tree_u64_remove(AVLTree *tree, uint64_t key);
+
+/**
+ * Return the node with the key "key" or NULL if not found
+ */
+AVLTreeU64Node *avl_tree_u64_lookup(AVLTree *tree, uint64_t key);
+
+/**
+ * Look up many keys at once. Same as avl_tree_lookup_batch(), but the
+ * key is in the node so only the node is prefetched
+ *
+ * @param results         Array of "num_keys" entries that receives the
+ *                        node with each key or NULL
+ */
+void avl_tree_u64_lookup_batch(AVLTree *tree,
+                               const uint64_t *keys,
+                               uint32_t num_keys,
+                               AVLTreeU64Node **results);
+
+/**
+ * Return the node with the smallest key that is strictly greater than
+ * "key" or NULL if there is none
+ */
+AVLTreeU64Node *avl_tree_u64_successor(AVLTree *tree, uint64_t key);
+
+/**
+ * Return the node with the smallest key that is greater than or equal to
+ * "key" or NULL if there is none
+ */
+AVLTreeU64Node *avl_tree_u64_min_equal_or_greater(AVLTree *tree,
+                                                  uint64_t key);
+
+/**
+ * Return the node with the largest key that is strictly less than "key"
+ * or NULL if there is none
+ */
+AVLTreeU64Node *avl_tree_u64_predeccessor(AVLTree *tree, uint64_t key);
+
+/**
+ * Return the node with the largest key that is less than or equal to
+ * "key" or NULL if there is none
+ */
+AVLTreeU64Node *avl_tree_u64_max_equal_or_less(AVLTree *tree, uint64_t key);
+
+/**
+ * Walk the tree in ascending or descending order of keys.
+ * Same as avl_tree_walk() except that the callback gets the
+ * @ref AVLTreeU64Node
+ */
+void avl_tree_u64_walk(AVLTree *tree,
+                       bool is_descending,
+                       AVLTreeU64WalkFunc func,
+                       void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_AVLTREE_U64_H */
@@ -75,6 +75,30 @@ There are few changes
   ((AVLTreeValue)((uintptr_t)(tree_node) - (tree)->node_offset))
 
 
+/* Access to the children and to the root. See AVLTreeLink */
+
+static inline AVLTreeNode *avl_tree_get_child(AVLTreeNode *node, int side)
+{
+  return (avl_tree_link_get(&node->children[side]));
+}
+
+static inline void avl_tree_set_child(AVLTreeNode *node, int side,
+                                      AVLTreeNode *child)
+{
+  avl_tree_link_set(&node->children[side], child);
+}
+
+static inline AVLTreeNode *avl_tree_get_root(AVLTree *tree)
+{
+  return (avl_tree_link_get(&tree->root_node));
+}
+
+static inline void avl_tree_set_root(AVLTree *tree, AVLTreeNode *node)
+{
+  avl_tree_link_set(&tree->root_node, node);
+}
+
+
 AVLTree *avl_tree_new(AVLTree *new_tree,
                       intptr_t node_offset,
                       AVLTreeCompareFunc compare_func,
@@ -88,66 +112,199 @@ AVLTree *avl_tree_new(AVLTree *new_tree,
     return NULL;
   }
 
-  new_tree->root_node = NULL;
+  avl_tree_set_root(new_tree, NULL);
   new_tree->compare_func = compare_func;
   new_tree->key_func = key_func;
+  new_tree->key_context = key_context;
   new_tree->node_offset = node_offset;
   new_tree->num_nodes = 0;
+  new_tree->version = 0;
   new_tree->free_func = free_func;
   new_tree->free_context = free_context;
+  new_tree->augment_func = NULL;
+  new_tree->augment_context = NULL;
+  new_tree->is_multimap = false;
   
   return new_tree;
 }
 
-static void avl_tree_free_subtree(AVLTree *tree, AVLTreeNode *node)
+/*
+ * Access to the parent pointer and to the balance information of a node.
+ *
+ * With AVL_TREE_COMPACT_NODE, the node has no "height" field. Instead, the
+ * balance factor (height of right subtree - height of left subtree), which
+ * is always -1, 0 or +1, is stored plus one in the 2 low bits of the
+ * parent pointer. These 2 bits are always zero in a pointer to a node
+ * because a node contains pointers and hence is at least 4-byte aligned
+ */
+#ifdef AVL_TREE_COMPACT_NODE
+
+#define AVL_TREE_BALANCE_MASK ((uintptr_t)3)
+
+/* With AVL_TREE_RELATIVE_NODE, the parent is the distance from the field
+ * "parent_balance" to the parent node. The distance between two nodes
+ * is a multiple of their alignment, so the 2 low bits are free as well */
+
+static inline AVLTreeNode *avl_tree_get_parent(AVLTreeNode *node)
 {
-  if (node == NULL) {
-    return;
-  }
-  
-  avl_tree_free_subtree(tree, node->children[AVL_TREE_NODE_LEFT]);
-  avl_tree_free_subtree(tree, node->children[AVL_TREE_NODE_RIGHT]);
-  
-  tree->free_func(node, tree->free_context);
+#ifdef AVL_TREE_RELATIVE_NODE
+  intptr_t offset = (intptr_t)(node->parent_balance & ~AVL_TREE_BALANCE_MASK);
+
+  return (offset == 0 ? NULL :
+          (AVLTreeNode *)((uintptr_t)&node->parent_balance + offset));
+#else
+  return ((AVLTreeNode *)(node->parent_balance & ~AVL_TREE_BALANCE_MASK));
+#endif
 }
 
-void avl_tree_free(AVLTree *tree)
+static inline void avl_tree_set_parent(AVLTreeNode *node, AVLTreeNode *parent)
 {
-  /* User did NOT pass to us a free function
-   * Bail out silently
-   */
-  if (!tree->free_func) {
-    return;
-  }
-  /* Destroy all nodes */
-  
-  avl_tree_free_subtree(tree, tree->root_node);
-  
-  /* REMEMBER that the tree pointer was passed to use by the caller
-   * Hence it is the caller responsibility to take care of it */
+#ifdef AVL_TREE_RELATIVE_NODE
+  uintptr_t offset = (parent == NULL ? 0 :
+                      (uintptr_t)parent - (uintptr_t)&node->parent_balance);
+#else
+  uintptr_t offset = (uintptr_t)parent;
+#endif
+
+  node->parent_balance = (offset |
+                          (node->parent_balance & AVL_TREE_BALANCE_MASK));
+}
+
+static inline int avl_tree_get_balance(AVLTreeNode *node)
+{
+  return ((int)(node->parent_balance & AVL_TREE_BALANCE_MASK) - 1);
+}
+
+static inline void avl_tree_set_balance(AVLTreeNode *node, int balance)
+{
+  node->parent_balance = ((node->parent_balance & ~AVL_TREE_BALANCE_MASK) |
+                          (uintptr_t)(balance + 1));
+}
+
+#else /* AVL_TREE_COMPACT_NODE */
+
+static inline AVLTreeNode *avl_tree_get_parent(AVLTreeNode *node)
+{
+  return (avl_tree_link_get(&node->parent));
+}
+
+static inline void avl_tree_set_parent(AVLTreeNode *node, AVLTreeNode *parent)
+{
+  avl_tree_link_set(&node->parent, parent);
 }
 
+#endif /* AVL_TREE_COMPACT_NODE */
+
 int avl_tree_subtree_height(AVLTreeNode *node)
 {
+#ifdef AVL_TREE_COMPACT_NODE
+  int height = 0;
+
+  /* There is no height field. Walk down the taller side. This is
+   * O(log n) instead of O(1) */
+  while (node != NULL) {
+    height++;
+    node = avl_tree_get_child(node, avl_tree_get_balance(node) < 0 ?
+                              AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT);
+  }
+  return height;
+#else
   if (node == NULL) {
     return 0;
   } else {
     return node->height;
   }
+#endif
+}
+
+#ifdef AVL_TREE_ORDER_STATISTIC
+uint32_t avl_tree_subtree_size(AVLTreeNode *node)
+{
+  return (node == NULL ? 0 : node->size);
+}
+#endif
+
+/* Recompute the size and the augmented value of "node" and of all its
+ * ancestors after a node was linked or unlinked below "node". It is
+ * called BEFORE the retrace so that the rotations always see correct
+ * values in the children of the nodes they move.
+ * Unlike the heights, every value up to the root changes, so this is
+ * always O(log n). Nothing to do without AVL_TREE_ORDER_STATISTIC and
+ * without augment function */
+
+static void avl_tree_update_path(AVLTree *tree, AVLTreeNode *node)
+{
+#ifndef AVL_TREE_ORDER_STATISTIC
+  if (tree->augment_func == NULL) {
+    return;
+  }
+#endif
+  while (node != NULL) {
+#ifdef AVL_TREE_ORDER_STATISTIC
+    node->size =
+      (avl_tree_subtree_size(avl_tree_get_child(node, AVL_TREE_NODE_LEFT)) +
+       avl_tree_subtree_size(avl_tree_get_child(node, AVL_TREE_NODE_RIGHT)) +
+       1);
+#endif
+    if (tree->augment_func != NULL) {
+      tree->augment_func(node, tree->augment_context);
+    }
+    node = avl_tree_get_parent(node);
+  }
+}
+
+void avl_tree_set_augment(AVLTree *tree,
+                          AVLTreeAugmentFunc augment_func,
+                          void *augment_context)
+{
+  tree->augment_func = augment_func;
+  tree->augment_context = augment_context;
+}
+
+void avl_tree_update_augment(AVLTree *tree, AVLTreeNode *node)
+{
+  avl_tree_update_path(tree, node);
+}
+
+/* Height of the right subtree minus height of the left subtree */
+
+static inline int avl_tree_node_balance_factor(AVLTreeNode *node)
+{
+#ifdef AVL_TREE_COMPACT_NODE
+  return (avl_tree_get_balance(node));
+#else
+  return (
+    avl_tree_subtree_height(avl_tree_get_child(node, AVL_TREE_NODE_RIGHT)) -
+    avl_tree_subtree_height(avl_tree_get_child(node, AVL_TREE_NODE_LEFT)));
+#endif
 }
 
 /* Update the "height" variable of a node, from the heights of its
  * children.  This does not update the height variable of any parent
- * nodes. */
-
-static void avl_tree_update_height(AVLTreeNode *node)
+ * nodes.
+ * With AVL_TREE_COMPACT_NODE there is no height. The balance factors are
+ * maintained by the retrace functions instead.
+ * With AVL_TREE_ORDER_STATISTIC the size of the node is updated here
+ * too, and so is the augmented value if the tree has an augment
+ * function. So every rotation keeps them correct. The children MUST
+ * already be up to date */
+
+static void avl_tree_update_height(AVLTree *tree, AVLTreeNode *node)
 {
+#ifdef AVL_TREE_ORDER_STATISTIC
+	node->size =
+	    avl_tree_subtree_size(avl_tree_get_child(node,
+	                                             AVL_TREE_NODE_LEFT)) +
+	    avl_tree_subtree_size(avl_tree_get_child(node,
+	                                             AVL_TREE_NODE_RIGHT)) + 1;
+#endif
+#ifndef AVL_TREE_COMPACT_NODE
 	AVLTreeNode *left_subtree;
 	AVLTreeNode *right_subtree;
 	int left_height, right_height;
 
-	left_subtree = node->children[AVL_TREE_NODE_LEFT];
-	right_subtree = node->children[AVL_TREE_NODE_RIGHT];
+	left_subtree = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+	right_subtree = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
 	left_height = avl_tree_subtree_height(left_subtree);
 	right_height = avl_tree_subtree_height(right_subtree);
 
@@ -156,41 +313,49 @@ static void avl_tree_update_height(AVLTreeNode *node)
 	} else {
 		node->height = right_height + 1;
 	}
+#endif
+
+	if (tree->augment_func != NULL) {
+		tree->augment_func(node, tree->augment_context);
+	}
 }
 
 /* Find what side a node is relative to its parent */
 
 static AVLTreeNodeSide avl_tree_node_parent_side(AVLTreeNode *node)
 {
-	if (node->parent->children[AVL_TREE_NODE_LEFT] == node) {
+	if (avl_tree_get_child(avl_tree_get_parent(node),
+	                       AVL_TREE_NODE_LEFT) == node) {
 		return AVL_TREE_NODE_LEFT;
 	} else {
 		return AVL_TREE_NODE_RIGHT;
 	}
 }
 
-/* Replace node1 with node2 at its parent. */
+/* Replace node1 with node2 at its parent.
+ * The height of the parent is NOT updated here. The retrace that follows
+ * every change compares the stored height against the new one to know
+ * when to stop */
 
 static void avl_tree_node_replace(AVLTree *tree, AVLTreeNode *node1,
                                   AVLTreeNode *node2)
 {
+	AVLTreeNode *parent = avl_tree_get_parent(node1);
 	int side;
 
 	/* Set the node's parent pointer. */
 
 	if (node2 != NULL) {
-		node2->parent = node1->parent;
+		avl_tree_set_parent(node2, parent);
 	}
 
 	/* The root node? */
 
-	if (node1->parent == NULL) {
-		tree->root_node = node2;
+	if (parent == NULL) {
+		avl_tree_set_root(tree, node2);
 	} else {
 		side = avl_tree_node_parent_side(node1);
-		node1->parent->children[side] = node2;
-
-		avl_tree_update_height(node1->parent);
+		avl_tree_set_child(parent, side, node2);
 	}
 }
 
@@ -224,7 +389,7 @@ static AVLTreeNode *avl_tree_rotate(AVLTree *tree, AVLTreeNode *node,
 	/* The child of this node will take its place:
 	   for a left rotation, it is the right child, and vice versa. */
 
-	new_root = node->children[1-direction];
+	new_root = avl_tree_get_child(node, 1-direction);
 
 	/* Make new_root the root, update parent pointers. */
 
@@ -232,25 +397,173 @@ static AVLTreeNode *avl_tree_rotate(AVLTree *tree, AVLTreeNode *node,
 
 	/* Rearrange pointers */
 
-	node->children[1-direction] = new_root->children[direction];
-	new_root->children[direction] = node;
+	avl_tree_set_child(node, 1-direction,
+	                   avl_tree_get_child(new_root, direction));
+	avl_tree_set_child(new_root, direction, node);
 
 	/* Update parent references */
 
-	node->parent = new_root;
+	avl_tree_set_parent(node, new_root);
 
-	if (node->children[1-direction] != NULL) {
-		node->children[1-direction]->parent = node;
+	if (avl_tree_get_child(node, 1-direction) != NULL) {
+		avl_tree_set_parent(avl_tree_get_child(node, 1-direction), node);
 	}
 
-	/* Update heights of the affected nodes */
+	/* Update heights of the affected nodes. "node" is now a child of
+	 * "new_root" so it goes first */
 
-	avl_tree_update_height(new_root);
-	avl_tree_update_height(node);
+	avl_tree_update_height(tree, node);
+	avl_tree_update_height(tree, new_root);
 
 	return new_root;
 }
 
+#ifdef AVL_TREE_COMPACT_NODE
+
+/* Rebalance a node whose balance factor has reached "balance", which is
+ * +2 or -2. "balance" cannot be stored in the node, so it is passed.
+ * Performs a single or a double rotation and sets the balance factors of
+ * the rotated nodes.
+ *
+ * Returns the root node of the new subtree. If the balance factor of the
+ * returned node is zero, the subtree has the same height as before the
+ * node became unbalanced minus one (i.e. the usual case after an insert),
+ * otherwise it has the same height as it would have had with balance
+ * +2/-2 minus one (only possible after a remove). */
+
+static AVLTreeNode *avl_tree_rebalance(AVLTree *tree, AVLTreeNode *node,
+                                       int balance)
+{
+	AVLTreeNodeSide heavy_side;
+	AVLTreeNode *child;
+	AVLTreeNode *grand_child;
+	int sign, child_balance, grand_child_balance;
+
+	heavy_side = balance > 0 ? AVL_TREE_NODE_RIGHT : AVL_TREE_NODE_LEFT;
+	sign = balance > 0 ? 1 : -1;
+	child = avl_tree_get_child(node, heavy_side);
+	child_balance = avl_tree_get_balance(child);
+
+	if (child_balance * sign >= 0) {
+
+		/* Single rotation toward the light side */
+
+		avl_tree_rotate(tree, node, 1 - heavy_side);
+
+		if (child_balance == 0) {
+			avl_tree_set_balance(node, sign);
+			avl_tree_set_balance(child, -sign);
+		} else {
+			avl_tree_set_balance(node, 0);
+			avl_tree_set_balance(child, 0);
+		}
+		return child;
+	}
+
+	/* The child is biased toward the other side: double rotation.
+	 * The grand child ends up on top */
+
+	grand_child = avl_tree_get_child(child, 1 - heavy_side);
+	grand_child_balance = avl_tree_get_balance(grand_child);
+
+	avl_tree_rotate(tree, child, heavy_side);
+	avl_tree_rotate(tree, node, 1 - heavy_side);
+
+	avl_tree_set_balance(node, grand_child_balance == sign ? -sign : 0);
+	avl_tree_set_balance(child, grand_child_balance == -sign ? sign : 0);
+	avl_tree_set_balance(grand_child, 0);
+
+	return grand_child;
+}
+
+/* The subtree rooted at "node" has grown by one. Walk up, updating the
+ * balance factors, until a node absorbs the growth or a rotation
+ * restores the previous height. */
+
+static void avl_tree_retrace_grow(AVLTree *tree, AVLTreeNode *node)
+{
+	AVLTreeNode *parent;
+	int balance;
+
+	parent = avl_tree_get_parent(node);
+
+	while (parent != NULL) {
+
+		balance = avl_tree_get_balance(parent) +
+		    (avl_tree_get_child(parent, AVL_TREE_NODE_RIGHT) == node ?
+		     1 : -1);
+
+		if (balance == 0) {
+
+			/* The short side caught up: height unchanged */
+
+			avl_tree_set_balance(parent, 0);
+			return;
+		}
+
+		if (balance == 1 || balance == -1) {
+
+			/* The parent grew as well */
+
+			avl_tree_set_balance(parent, balance);
+			node = parent;
+
+		} else {
+			node = avl_tree_rebalance(tree, parent, balance);
+
+			if (avl_tree_get_balance(node) == 0) {
+				return;
+			}
+		}
+
+		parent = avl_tree_get_parent(node);
+	}
+}
+
+/* The "side" subtree of "node" has shrunk by one. Walk up, updating the
+ * balance factors, until the height of a subtree stops changing. */
+
+static void avl_tree_retrace_shrink(AVLTree *tree, AVLTreeNode *node,
+                                    AVLTreeNodeSide side)
+{
+	AVLTreeNode *parent;
+	int balance;
+
+	while (node != NULL) {
+
+		balance = avl_tree_get_balance(node) +
+		    (side == AVL_TREE_NODE_RIGHT ? -1 : 1);
+
+		if (balance == 1 || balance == -1) {
+
+			/* Was balanced: the height did not change */
+
+			avl_tree_set_balance(node, balance);
+			return;
+		}
+
+		if (balance == 0) {
+			avl_tree_set_balance(node, 0);
+		} else {
+			node = avl_tree_rebalance(tree, node, balance);
+
+			if (avl_tree_get_balance(node) != 0) {
+				return;
+			}
+		}
+
+		/* This subtree has shrunk as well */
+
+		parent = avl_tree_get_parent(node);
+		if (parent == NULL) {
+			return;
+		}
+		side = avl_tree_node_parent_side(node);
+		node = parent;
+	}
+}
+
+#else /* AVL_TREE_COMPACT_NODE */
 
 /* Balance a particular tree node.
  *
@@ -264,8 +577,8 @@ static AVLTreeNode *avl_tree_node_balance(AVLTree *tree, AVLTreeNode *node)
 	AVLTreeNode *child;
 	int diff;
 
-	left_subtree = node->children[AVL_TREE_NODE_LEFT];
-	right_subtree = node->children[AVL_TREE_NODE_RIGHT];
+	left_subtree = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+	right_subtree = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
 
 	/* Check the heights of the child trees.  If there is an unbalance
 	 * (difference between left and right > 2), then rotate nodes
@@ -280,8 +593,10 @@ static AVLTreeNode *avl_tree_node_balance(AVLTree *tree, AVLTreeNode *node)
 
 		child = right_subtree;
 
-		if (avl_tree_subtree_height(child->children[AVL_TREE_NODE_RIGHT])
-		  < avl_tree_subtree_height(child->children[AVL_TREE_NODE_LEFT])) {
+		if (avl_tree_subtree_height(avl_tree_get_child(child,
+		                                               AVL_TREE_NODE_RIGHT))
+		  < avl_tree_subtree_height(avl_tree_get_child(child,
+		                                               AVL_TREE_NODE_LEFT))) {
 
 			/* If the right child is biased toward the left
 			 * side, it must be rotated right first (double
@@ -300,10 +615,12 @@ static AVLTreeNode *avl_tree_node_balance(AVLTree *tree, AVLTreeNode *node)
 
 		/* Biased toward the left side too much. */
 
-		child = node->children[AVL_TREE_NODE_LEFT];
+		child = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
 
-		if (avl_tree_subtree_height(child->children[AVL_TREE_NODE_LEFT])
-		  < avl_tree_subtree_height(child->children[AVL_TREE_NODE_RIGHT])) {
+		if (avl_tree_subtree_height(avl_tree_get_child(child,
+		                                               AVL_TREE_NODE_LEFT))
+		  < avl_tree_subtree_height(avl_tree_get_child(child,
+		                                               AVL_TREE_NODE_RIGHT))) {
 
 			/* If the left child is biased toward the right
 			 * side, it must be rotated right left (double
@@ -321,94 +638,594 @@ static AVLTreeNode *avl_tree_node_balance(AVLTree *tree, AVLTreeNode *node)
 
 	/* Update the height of this node */
 
-	avl_tree_update_height(node);
+	avl_tree_update_height(tree, node);
 
 	return node;
 }
 
-/* Walk up the tree from the given node, performing any needed rotations */
+/* Walk up the tree from the given node, performing any needed rotations.
+ * The walk stops as soon as the height of a subtree is the same as
+ * before the insert/remove: nothing above it can have changed. Hence an
+ * insert performs at most one (single or double) rotation and does not
+ * write to the ancestors above that point */
 
-static void avl_tree_balance_to_root(AVLTree *tree, AVLTreeNode *node)
+static void avl_tree_retrace(AVLTree *tree, AVLTreeNode *node)
 {
   AVLTreeNode *rover;
+  int old_height;
 
   rover = node;
 
   while (rover != NULL) {
 
+    /* The height stored in this node is the one before the change */
+
+    old_height = rover->height;
+
     /* Balance this node if necessary */
 
     rover = avl_tree_node_balance(tree, rover);
 
+    if (rover->height == old_height) {
+      return;
+    }
+
     /* Go to this node's parent */
 
-    rover = rover->parent;
+    rover = avl_tree_get_parent(rover);
   }
 }
 
-AVLTreeNode *avl_tree_insert(AVLTree *tree, AVLTreeNode *new_node)
+/* The subtree rooted at "node" has grown */
+
+static inline void avl_tree_retrace_grow(AVLTree *tree, AVLTreeNode *node)
 {
-  AVLTreeNode **rover;
-  AVLTreeNode *previous_node;
-  int cmp;
+  avl_tree_retrace(tree, avl_tree_get_parent(node));
+}
+
+/* One of the subtrees of "node" has shrunk */
+
+static inline void avl_tree_retrace_shrink(AVLTree *tree, AVLTreeNode *node,
+                                           AVLTreeNodeSide side)
+{
+  avl_tree_retrace(tree, node);
+}
+
+#endif /* AVL_TREE_COMPACT_NODE */
+
+void avl_tree_link_node(AVLTree *tree,
+                        AVLTreeNode *parent,
+                        AVLTreeNodeSide side,
+                        AVLTreeNode *new_node)
+{
+  avl_tree_set_child(new_node, AVL_TREE_NODE_LEFT, NULL);
+  avl_tree_set_child(new_node, AVL_TREE_NODE_RIGHT, NULL);
+  avl_tree_set_parent(new_node, parent);
+#ifdef AVL_TREE_COMPACT_NODE
+  avl_tree_set_balance(new_node, 0);
+#else
+  new_node->height = 1;
+#endif
 
+  /* Hook the new node at the empty slot found by the caller */
+
+  if (parent == NULL) {
+    avl_tree_set_root(tree, new_node);
+  } else {
+    avl_tree_set_child(parent, side, new_node);
+  }
+  avl_tree_update_path(tree, new_node);
+
+  /* Rebalance the tree, starting from the parent of the new node. */
+
+  avl_tree_retrace_grow(tree, new_node);
+
+  /* Keep track of the number of entries */
+
+  ++tree->num_nodes;
+  ++tree->version;
+}
 
+AVLTreeNode *avl_tree_find_slot(AVLTree *tree, AVLTreeKey key,
+                                AVLTreeSlot *slot)
+{
+  AVLTreeNode *node;
+  int cmp;
 
-  /* Walk down the tree until we reach a NULL pointer */
+  /* Walk down the tree until we reach a NULL pointer, remembering where
+   * it hangs */
 
-  rover = &tree->root_node;
-  previous_node = NULL;
+  node = avl_tree_get_root(tree);
+  slot->parent = NULL;
+  slot->side = AVL_TREE_NODE_LEFT;
 
-  while (*rover != NULL) {
-    previous_node = *rover;
-    cmp = tree->compare_func(tree->key_func(AVL_NODE_TO_VALUE(tree, new_node), tree->key_context),
-                             tree->key_func(AVL_NODE_TO_VALUE(tree, *rover), tree->key_context));
-    if (cmp == 0) {
+  while (node != NULL) {
+    cmp = tree->compare_func(key,
+                             tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                            tree->key_context));
+    if (cmp == 0 && !tree->is_multimap) {
       /* A node already exists with the same key value */
-      return (NULL);
-    } else if (cmp < 0) {
-      rover = &((*rover)->children[AVL_TREE_NODE_LEFT]);
-    } else {
-      rover = &((*rover)->children[AVL_TREE_NODE_RIGHT]);
+      return (node);
     }
+    slot->parent = node;
+    slot->side = cmp < 0 ? AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT;
+    node = avl_tree_get_child(node, slot->side);
   }
 
-  new_node->children[AVL_TREE_NODE_LEFT] = NULL;
-  new_node->children[AVL_TREE_NODE_RIGHT] = NULL;
-  new_node->parent = previous_node;
-  new_node->height = 1;
+  return (NULL);
+}
+
+void avl_tree_insert_at_slot(AVLTree *tree, AVLTreeSlot *slot,
+                             AVLTreeNode *new_node)
+{
+  avl_tree_link_node(tree, slot->parent, slot->side, new_node);
+}
+
+AVLTreeNode *avl_tree_insert_or_get(AVLTree *tree, AVLTreeNode *new_node)
+{
+  AVLTreeSlot slot;
+  AVLTreeNode *node;
+
+  node = avl_tree_find_slot(tree,
+                            tree->key_func(AVL_NODE_TO_VALUE(tree, new_node),
+                                           tree->key_context),
+                            &slot);
+  if (node != NULL) {
+    return (node);
+  }
 
   /* Insert at the NULL pointer that was reached */
 
-  *rover = new_node;
+  avl_tree_link_node(tree, slot.parent, slot.side, new_node);
+  return (new_node);
+}
 
-  /* Rebalance the tree, starting from the previous node. */
+AVLTreeNode *avl_tree_insert(AVLTree *tree, AVLTreeNode *new_node)
+{
+  AVLTreeSlot slot;
 
-  avl_tree_balance_to_root(tree, previous_node);
+  if (avl_tree_find_slot(tree,
+                         tree->key_func(AVL_NODE_TO_VALUE(tree, new_node),
+                                        tree->key_context),
+                         &slot) != NULL) {
+    return (NULL);
+  }
+  avl_tree_link_node(tree, slot.parent, slot.side, new_node);
+  return (new_node);
+}
 
-  /* Keep track of the number of entries */
+/* Compare "key" with the key of "node" */
 
-  ++tree->num_nodes;
+static inline int avl_tree_compare_node(AVLTree *tree, AVLTreeKey key,
+                                        AVLTreeNode *node)
+{
+  return (tree->compare_func(key,
+                             tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                            tree->key_context)));
+}
+
+AVLTreeNode *avl_tree_insert_hint(AVLTree *tree, AVLTreeNode *hint,
+                                  AVLTreeNode *new_node)
+{
+  AVLTreeNode *neighbour;
+  AVLTreeKey key;
+  int cmp;
+
+  key = tree->key_func(AVL_NODE_TO_VALUE(tree, new_node), tree->key_context);
+
+  if (hint == NULL) {
+
+    /* Append: one comparison with the largest node. Walking down the
+     * right spine to it does not compare anything */
+
+    hint = avl_tree_max(tree);
+    if (hint == NULL) {
+      avl_tree_link_node(tree, NULL, AVL_TREE_NODE_LEFT, new_node);
+      return (new_node);
+    }
+    cmp = avl_tree_compare_node(tree, key, hint);
+    if (cmp > 0 || (cmp == 0 && tree->is_multimap)) {
+      avl_tree_link_node(tree, hint, AVL_TREE_NODE_RIGHT, new_node);
+      return (new_node);
+    }
+    return (avl_tree_insert(tree, new_node));
+  }
+
+  /*
+   * The new node goes between "hint" and its next node, or between its
+   * previous node and "hint". Of two nodes next to each other in the
+   * order, one has no child on the side of the other: that is where the
+   * new node is linked. An equal key in a multimap tree must go after
+   * all the nodes with the same key
+   */
+  cmp = avl_tree_compare_node(tree, key, hint);
+  if (cmp > 0 || (cmp == 0 && tree->is_multimap)) {
+    neighbour = avl_tree_node_next(hint);
+    if (neighbour == NULL || avl_tree_compare_node(tree, key, neighbour) < 0) {
+      if (avl_tree_get_child(hint, AVL_TREE_NODE_RIGHT) == NULL) {
+        avl_tree_link_node(tree, hint, AVL_TREE_NODE_RIGHT, new_node);
+      } else {
+        avl_tree_link_node(tree, neighbour, AVL_TREE_NODE_LEFT, new_node);
+      }
+      return (new_node);
+    }
+  } else if (cmp < 0) {
+    neighbour = avl_tree_node_prev(hint);
+    if (neighbour == NULL ||
+        (cmp = avl_tree_compare_node(tree, key, neighbour)) > 0 ||
+        (cmp == 0 && tree->is_multimap)) {
+      if (avl_tree_get_child(hint, AVL_TREE_NODE_LEFT) == NULL) {
+        avl_tree_link_node(tree, hint, AVL_TREE_NODE_LEFT, new_node);
+      } else {
+        avl_tree_link_node(tree, neighbour, AVL_TREE_NODE_RIGHT, new_node);
+      }
+      return (new_node);
+    }
+  } else {
+    /* A node already exists with the same key value */
+    return (NULL);
+  }
+
+  /* Wrong hint */
+
+  return (avl_tree_insert(tree, new_node));
+}
+
+/* Number of bits needed to write "n". This is also the height of a
+ * subtree of "n" nodes built by avl_tree_build_subtree() */
 
-  return new_node;
+static inline int avl_tree_bit_length(uint32_t n)
+{
+  return (n == 0 ? 0 : 32 - __builtin_clz(n));
+}
+
+/* Link the sorted array "nodes" into a perfectly balanced subtree.
+ * The middle node is the root. The left half always has the extra node
+ * if there is one, so the height of the subtree is
+ * avl_tree_bit_length(num_nodes).
+ * Returns the root of the subtree */
+
+static AVLTreeNode *avl_tree_build_subtree(AVLTree *tree,
+                                           AVLTreeNode **nodes,
+                                           uint32_t num_nodes,
+                                           AVLTreeNode *parent)
+{
+  AVLTreeNode *root;
+  uint32_t middle;
+
+  if (num_nodes == 0) {
+    return (NULL);
+  }
+
+  middle = num_nodes / 2;
+  root = nodes[middle];
+  avl_tree_set_parent(root, parent);
+#ifdef AVL_TREE_COMPACT_NODE
+  avl_tree_set_balance(root,
+                       avl_tree_bit_length(num_nodes - middle - 1) -
+                       avl_tree_bit_length(middle));
+#endif
+  avl_tree_set_child(root, AVL_TREE_NODE_LEFT,
+                     avl_tree_build_subtree(tree, nodes, middle, root));
+  avl_tree_set_child(root, AVL_TREE_NODE_RIGHT,
+                     avl_tree_build_subtree(tree, nodes + middle + 1,
+                                            num_nodes - middle - 1, root));
+  avl_tree_update_height(tree, root);
+
+  return (root);
+}
+
+AVLTree *avl_tree_build_from_sorted(AVLTree *tree,
+                                    AVLTreeNode **nodes,
+                                    uint32_t num_nodes,
+                                    bool check_order)
+{
+  uint32_t i;
+  int diff;
+
+  if (avl_tree_get_root(tree) != NULL) {
+    return (NULL);
+  }
+
+  /* Check the order BEFORE touching any node so that the tree and the
+   * nodes are left untouched on failure */
+  if (check_order) {
+    for (i = 1; i < num_nodes; i++) {
+      diff = tree->compare_func(
+        tree->key_func(AVL_NODE_TO_VALUE(tree, nodes[i - 1]),
+                       tree->key_context),
+        tree->key_func(AVL_NODE_TO_VALUE(tree, nodes[i]),
+                       tree->key_context));
+      if (diff > 0 || (diff == 0 && !tree->is_multimap)) {
+        return (NULL);
+      }
+    }
+  }
+
+  avl_tree_set_root(tree,
+                    avl_tree_build_subtree(tree, nodes, num_nodes, NULL));
+  tree->num_nodes = num_nodes;
+  ++tree->version;
+
+  return (tree);
+}
+
+/* Add "delta" to the parent and to the children of "node" and of all the
+ * nodes below it. Each child is fixed before it is visited */
+
+#ifndef AVL_TREE_RELATIVE_NODE
+static void avl_tree_relocate_subtree(AVLTreeNode *node, intptr_t delta)
+{
+  AVLTreeNode *child;
+  int side;
+
+  if (avl_tree_get_parent(node) != NULL) {
+    avl_tree_set_parent(node, (AVLTreeNode *)
+                        ((uintptr_t)avl_tree_get_parent(node) + delta));
+  }
+  for (side = AVL_TREE_NODE_LEFT; side <= AVL_TREE_NODE_RIGHT; side++) {
+    child = avl_tree_get_child(node, side);
+    if (child != NULL) {
+      child = (AVLTreeNode *)((uintptr_t)child + delta);
+      avl_tree_set_child(node, side, child);
+      avl_tree_relocate_subtree(child, delta);
+    }
+  }
+}
+#endif
+
+void avl_tree_relocate(AVLTree *tree, intptr_t delta)
+{
+  AVLTreeNode *root = avl_tree_get_root(tree);
+
+  ++tree->version;
+  if (root == NULL || delta == 0) {
+    return;
+  }
+  root = (AVLTreeNode *)((uintptr_t)root + delta);
+  avl_tree_set_root(tree, root);
+
+  /* Relative links between the nodes did not change */
+#ifndef AVL_TREE_RELATIVE_NODE
+  avl_tree_relocate_subtree(root, delta);
+#endif
+}
+
+/* Height of the "side" child of "node" given the height of "node" */
+
+static inline int avl_tree_child_height(AVLTreeNode *node, int height,
+                                        AVLTreeNodeSide side)
+{
+#ifdef AVL_TREE_COMPACT_NODE
+  int balance = avl_tree_get_balance(node);
+
+  if (side == AVL_TREE_NODE_RIGHT ? balance >= 0 : balance <= 0) {
+    return (height - 1);
+  }
+  return (height - 2);
+#else
+  return (avl_tree_subtree_height(avl_tree_get_child(node, side)));
+#endif
+}
+
+/*
+ * Join the subtrees "left" and "right" (whose root have no parent) with
+ * "pivot" between them. Returns the root of the result.
+ *
+ * Walk down the inner spine of the taller subtree until we find a node
+ * whose height is the height of the shorter subtree or one more. "pivot"
+ * takes the place of that node, with that node on one side and the
+ * shorter subtree on the other side. So "pivot" is balanced, and the
+ * subtree where it was linked has grown by one: the usual retrace after
+ * an insert fixes the ancestors.
+ *
+ * "tree" only supplies the arguments given to avl_tree_new(). Its root
+ * and number of nodes are not touched
+ */
+static AVLTreeNode *avl_tree_join_subtrees(AVLTree *tree,
+                                           AVLTreeNode *left,
+                                           AVLTreeNode *pivot,
+                                           AVLTreeNode *right)
+{
+  AVLTree scratch = *tree;
+  AVLTreeNode *node, *parent, *shorter;
+  AVLTreeNodeSide side;
+  int left_height, right_height, height, shorter_height;
+
+  left_height = avl_tree_subtree_height(left);
+  right_height = avl_tree_subtree_height(right);
+
+  /* Walk down the right spine of "left" if it is the taller, else the
+   * left spine of "right" */
+  if (left_height >= right_height) {
+    side = AVL_TREE_NODE_RIGHT;
+    node = left;
+    height = left_height;
+    shorter = right;
+    shorter_height = right_height;
+  } else {
+    side = AVL_TREE_NODE_LEFT;
+    node = right;
+    height = right_height;
+    shorter = left;
+    shorter_height = left_height;
+  }
+
+  /* The rotations of the retrace update the root of "scratch" */
+  avl_tree_set_root(&scratch, node);
+  parent = NULL;
+  while (height > shorter_height + 1) {
+    parent = node;
+    height = avl_tree_child_height(node, height, side);
+    node = avl_tree_get_child(node, side);
+  }
+
+  avl_tree_set_child(pivot, 1 - side, node);
+  avl_tree_set_child(pivot, side, shorter);
+  avl_tree_set_parent(pivot, parent);
+#ifdef AVL_TREE_COMPACT_NODE
+  avl_tree_set_balance(pivot, side == AVL_TREE_NODE_RIGHT ?
+                       shorter_height - height : height - shorter_height);
+#endif
+  if (node != NULL) {
+    avl_tree_set_parent(node, pivot);
+  }
+  if (shorter != NULL) {
+    avl_tree_set_parent(shorter, pivot);
+  }
+  avl_tree_update_height(tree, pivot);
+
+  if (parent == NULL) {
+    avl_tree_set_root(&scratch, pivot);
+  } else {
+    avl_tree_set_child(parent, side, pivot);
+  }
+  avl_tree_update_path(tree, parent);
+
+  avl_tree_retrace_grow(&scratch, pivot);
+
+  return (avl_tree_get_root(&scratch));
+}
+
+AVLTree *avl_tree_join(AVLTree *left, AVLTreeNode *pivot, AVLTree *right)
+{
+  unsigned int num_nodes;
+
+  if (pivot == NULL) {
+    if (avl_tree_get_root(right) == NULL) {
+      return (left);
+    }
+    pivot = avl_tree_min(right);
+    avl_tree_remove_node(right, pivot);
+  }
+
+  num_nodes = left->num_nodes + right->num_nodes + 1;
+  avl_tree_set_root(left,
+                    avl_tree_join_subtrees(left, avl_tree_get_root(left),
+                                           pivot, avl_tree_get_root(right)));
+  left->num_nodes = num_nodes;
+  ++left->version;
+  avl_tree_set_root(right, NULL);
+  right->num_nodes = 0;
+  ++right->version;
+
+  return (left);
+}
+
+/*
+ * Split the subtree rooted at "node" (that has no parent) into the nodes
+ * less than "key" and the others.
+ * On the way down, every node on the search path is cut from its
+ * children. On the way up, the node is joined back with its child on
+ * the side away from "key" and with the piece coming up from the other
+ * child. The heights of the pieces that are joined grow toward the root,
+ * so the cost of all the joins adds up to O(log n)
+ */
+static void avl_tree_split_subtree(AVLTree *tree,
+                                   AVLTreeNode *node,
+                                   AVLTreeKey key,
+                                   AVLTreeNode **lt_root,
+                                   AVLTreeNode **ge_root)
+{
+  AVLTreeNode *left, *right, *piece;
+
+  if (node == NULL) {
+    *lt_root = NULL;
+    *ge_root = NULL;
+    return;
+  }
+
+  left = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+  right = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
+  if (left != NULL) {
+    avl_tree_set_parent(left, NULL);
+  }
+  if (right != NULL) {
+    avl_tree_set_parent(right, NULL);
+  }
+
+  if (tree->compare_func(key,
+                         tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                        tree->key_context)) <= 0) {
+    avl_tree_split_subtree(tree, left, key, lt_root, &piece);
+    *ge_root = avl_tree_join_subtrees(tree, piece, node, right);
+  } else {
+    avl_tree_split_subtree(tree, right, key, &piece, ge_root);
+    *lt_root = avl_tree_join_subtrees(tree, left, node, piece);
+  }
+}
+
+void avl_tree_split(AVLTree *tree, AVLTreeKey key, AVLTree *lt, AVLTree *ge)
+{
+  AVLTree config = *tree;
+  AVLTreeNode *lt_root, *ge_root;
+  uint32_t version;
+#ifndef AVL_TREE_ORDER_STATISTIC
+  AVLTreeNode *lt_node, *ge_node;
+  unsigned int count;
+#endif
+
+  avl_tree_split_subtree(&config, avl_tree_get_root(tree), key,
+                         &lt_root, &ge_root);
+
+  /* A version that none of the three trees had before */
+  version = tree->version;
+  if ((int32_t)(lt->version - version) > 0) {
+    version = lt->version;
+  }
+  if ((int32_t)(ge->version - version) > 0) {
+    version = ge->version;
+  }
+  version++;
+
+  /* Empty "tree" first because it may be "lt" or "ge" */
+  avl_tree_set_root(tree, NULL);
+  tree->num_nodes = 0;
+  tree->version = version;
+
+  *lt = config;
+  avl_tree_set_root(lt, lt_root);
+  lt->version = version;
+  *ge = config;
+  avl_tree_set_root(ge, ge_root);
+  ge->version = version;
+
+#ifdef AVL_TREE_ORDER_STATISTIC
+  lt->num_nodes = avl_tree_subtree_size(lt_root);
+#else
+  /* Step through both trees in parallel until one of them ends. That
+   * one has "count" nodes and the other one has the rest */
+  lt_node = avl_tree_min(lt);
+  ge_node = avl_tree_min(ge);
+  count = 0;
+  while (lt_node != NULL && ge_node != NULL) {
+    lt_node = avl_tree_node_next(lt_node);
+    ge_node = avl_tree_node_next(ge_node);
+    count++;
+  }
+  lt->num_nodes = (lt_node == NULL ? count : config.num_nodes - count);
+#endif
+  ge->num_nodes = config.num_nodes - lt->num_nodes;
 }
 
 /* Find the nearest node to the given node, to replace it.
  * The node returned is unlinked from the tree.
- * Returns NULL if the node has no children. */
+ * Returns NULL if the node has no children.
+ * "*replacement_side" is set to the subtree of "node" where the
+ * replacement was found */
 
 static AVLTreeNode *avl_tree_node_get_replacement(AVLTree *tree,
-                                                  AVLTreeNode *node)
+                                                  AVLTreeNode *node,
+                                                  AVLTreeNodeSide *replacement_side)
 {
 	AVLTreeNode *left_subtree;
 	AVLTreeNode *right_subtree;
 	AVLTreeNode *result;
 	AVLTreeNode *child;
-	int left_height, right_height;
-	int side;
+	AVLTreeNodeSide side;
 
-	left_subtree = node->children[AVL_TREE_NODE_LEFT];
-	right_subtree = node->children[AVL_TREE_NODE_RIGHT];
+	left_subtree = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+	right_subtree = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
 
 	/* No children? */
 
@@ -419,32 +1236,29 @@ static AVLTreeNode *avl_tree_node_get_replacement(AVLTree *tree,
 	/* Pick a node from whichever subtree is taller.  This helps to
 	 * keep the tree balanced. */
 
-	left_height = avl_tree_subtree_height(left_subtree);
-	right_height = avl_tree_subtree_height(right_subtree);
-
-	if (left_height < right_height) {
+	if (avl_tree_node_balance_factor(node) > 0) {
 		side = AVL_TREE_NODE_RIGHT;
 	} else {
 		side = AVL_TREE_NODE_LEFT;
 	}
+	*replacement_side = side;
 
 	/* Search down the tree, back towards the center. */
 
-	result = node->children[side];
+	result = avl_tree_get_child(node, side);
 
-	while (result->children[1-side] != NULL) {
-		result = result->children[1-side];
+	while (avl_tree_get_child(result, 1-side) != NULL) {
+		result = avl_tree_get_child(result, 1-side);
 	}
 
 	/* Unlink the result node, and hook in its remaining child
 	 * (if it has one) to replace it. */
 
-	child = result->children[side];
+	child = avl_tree_get_child(result, side);
 	avl_tree_node_replace(tree, result, child);
 
-	/* Update the subtree height for the result node's old parent. */
-
-	avl_tree_update_height(result->parent);
+	/* The subtree height for the result node's old parent is updated
+	 * by the retrace in avl_tree_remove_node() */
 
 	return result;
 }
@@ -455,26 +1269,32 @@ void avl_tree_remove_node(AVLTree *tree, AVLTreeNode *node)
 {
 	AVLTreeNode *swap_node;
 	AVLTreeNode *balance_startpoint;
+	AVLTreeNodeSide replacement_side;
+	AVLTreeNodeSide shrunk_side;
+	AVLTreeNode *child;
 	int i;
 
 	/* The node to be removed must be swapped with an "adjacent"
 	 * node, ie. one which has the closest key to this one. Find
 	 * a node to swap with. */
 
-	swap_node = avl_tree_node_get_replacement(tree, node);
+	swap_node = avl_tree_node_get_replacement(tree, node,
+	                                          &replacement_side);
 
 	if (swap_node == NULL) {
 
 		/* This is a leaf node and has no children, therefore
 		 * it can be immediately removed. */
 
-		/* Unlink this node from its parent. */
+		/* Start rebalancing from the parent of the original node */
 
-		avl_tree_node_replace(tree, node, NULL);
+		balance_startpoint = avl_tree_get_parent(node);
+		shrunk_side = balance_startpoint != NULL ?
+		    avl_tree_node_parent_side(node) : AVL_TREE_NODE_LEFT;
 
-		/* Start rebalancing from the parent of the original node */
+		/* Unlink this node from its parent. */
 
-		balance_startpoint = node->parent;
+		avl_tree_node_replace(tree, node, NULL);
 
 	} else {
 		/* We will start rebalancing from the old parent of the
@@ -482,23 +1302,30 @@ void avl_tree_remove_node(AVLTree *tree, AVLTreeNode *node)
 		 * are removing, in which case we must start rebalancing
 		 * from the swap node. */
 
-		if (swap_node->parent == node) {
+		if (avl_tree_get_parent(swap_node) == node) {
 			balance_startpoint = swap_node;
+			shrunk_side = replacement_side;
 		} else {
-			balance_startpoint = swap_node->parent;
+			balance_startpoint = avl_tree_get_parent(swap_node);
+			shrunk_side = 1 - replacement_side;
 		}
 
 		/* Copy references in the node into the swap node */
 
 		for (i=0; i<2; ++i) {
-			swap_node->children[i] = node->children[i];
+			child = avl_tree_get_child(node, i);
+			avl_tree_set_child(swap_node, i, child);
 
-			if (swap_node->children[i] != NULL) {
-				swap_node->children[i]->parent = swap_node;
+			if (child != NULL) {
+				avl_tree_set_parent(child, swap_node);
 			}
 		}
 
+#ifdef AVL_TREE_COMPACT_NODE
+		avl_tree_set_balance(swap_node, avl_tree_get_balance(node));
+#else
 		swap_node->height = node->height;
+#endif
 
 		/* Link the parent's reference to this node */
 
@@ -508,10 +1335,12 @@ void avl_tree_remove_node(AVLTree *tree, AVLTreeNode *node)
 	/* Keep track of the number of nodes */
 
 	--tree->num_nodes;
+	++tree->version;
+	avl_tree_update_path(tree, balance_startpoint);
 
 	/* Rebalance the tree */
 
-	avl_tree_balance_to_root(tree, balance_startpoint);
+	avl_tree_retrace_shrink(tree, balance_startpoint, shrunk_side);
 }
 
 /* Remove a node by key */
@@ -543,7 +1372,7 @@ AVLTreeNode *avl_tree_lookup(AVLTree *tree, AVLTreeKey key)
   /* Search down the tree and attempt to find the node which
    * has the specified key */
 
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
 
   while (node != NULL) {
 
@@ -557,9 +1386,9 @@ AVLTreeNode *avl_tree_lookup(AVLTree *tree, AVLTreeKey key)
       return node;
 
     } else if (diff < 0) {
-      node = node->children[AVL_TREE_NODE_LEFT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
     } else {
-      node = node->children[AVL_TREE_NODE_RIGHT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
     }
   }
 
@@ -568,10 +1397,105 @@ AVLTreeNode *avl_tree_lookup(AVLTree *tree, AVLTreeKey key)
   return NULL;
 }
 
+void avl_tree_lookup_batch(AVLTree *tree, AVLTreeKey *keys, uint32_t num_keys,
+                           AVLTreeNode **results)
+{
+  struct {
+    AVLTreeNode *node;    /* Where the descent is */
+    AVLTreeKey node_key;  /* Key of "node", computed when it was prefetched */
+    uint32_t index;       /* Index of the key being looked up */
+  } slots[AVL_TREE_LOOKUP_BATCH_WIDTH], *slot;
+  AVLTreeNode *root = avl_tree_get_root(tree);
+  AVLTreeNode *child;
+  AVLTreeKey root_key;
+  uint32_t num_slots, next_index, i;
+  int diff;
+
+  if (root == NULL) {
+    for (i = 0; i < num_keys; i++) {
+      results[i] = NULL;
+    }
+    return;
+  }
+  root_key = tree->key_func(AVL_NODE_TO_VALUE(tree, root), tree->key_context);
+
+  /* All the descents start at the root, which stays in the cache */
+  for (num_slots = 0;
+       num_slots < AVL_TREE_LOOKUP_BATCH_WIDTH && num_slots < num_keys;
+       num_slots++) {
+    slots[num_slots].node = root;
+    slots[num_slots].node_key = root_key;
+    slots[num_slots].index = num_slots;
+  }
+  next_index = num_slots;
+
+  while (num_slots > 0) {
+    for (i = 0; i < num_slots; ) {
+      slot = &slots[i];
+
+      /* The node was prefetched when the previous round moved to it */
+      diff = tree->compare_func(keys[slot->index], slot->node_key);
+      child = (diff == 0 ? NULL :
+                avl_tree_get_child(slot->node, diff < 0 ?
+                                  AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT));
+
+      if (child == NULL) {
+
+        /* This descent is over. Start the next key in the same slot or,
+         * if there is none, move the last slot here */
+
+        results[slot->index] = (diff == 0 ? slot->node : NULL);
+        if (next_index < num_keys) {
+          slot->node = root;
+          slot->node_key = root_key;
+          slot->index = next_index++;
+          i++;
+        } else {
+          *slot = slots[--num_slots];
+        }
+        continue;
+      }
+
+      __builtin_prefetch(child);
+      slot->node = child;
+      slot->node_key = tree->key_func(AVL_NODE_TO_VALUE(tree, child),
+                                      tree->key_context);
+      __builtin_prefetch(slot->node_key);
+      i++;
+    }
+  }
+}
+
+void avl_tree_set_multimap(AVLTree *tree, bool is_multimap)
+{
+  tree->is_multimap = is_multimap;
+}
+
+bool avl_tree_equal_range(AVLTree *tree, AVLTreeKey key,
+                          AVLTreeNode **first, AVLTreeNode **last)
+{
+  AVLTreeNode *node;
+
+  /* One descent to the first node with the key or after it, and one to
+   * the last node with the key or before it */
+  node = avl_tree_min_equal_or_greater(tree, key);
+  if (node == NULL ||
+      tree->compare_func(key,
+                         tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                        tree->key_context)) != 0) {
+    *first = NULL;
+    *last = NULL;
+    return (false);
+  }
+  *first = node;
+  *last = avl_tree_max_equal_or_less(tree, key);
+  return (true);
+}
+
 
 AVLTreeNode *avl_tree_root_node(AVLTree *tree)
 {
-	return tree->root_node;
+	return avl_tree_get_root(tree);
 }
 
 AVLTreeKey avl_tree_node_key(AVLTree *tree, AVLTreeNode *node)
@@ -582,7 +1506,7 @@ AVLTreeKey avl_tree_node_key(AVLTree *tree, AVLTreeNode *node)
 AVLTreeNode *avl_tree_node_child(AVLTreeNode *node, AVLTreeNodeSide side)
 {
 	if (side == AVL_TREE_NODE_LEFT || side == AVL_TREE_NODE_RIGHT) {
-		return node->children[side];
+		return avl_tree_get_child(node, side);
 	} else {
 		return NULL;
 	}
@@ -590,7 +1514,7 @@ AVLTreeNode *avl_tree_node_child(AVLTreeNode *node, AVLTreeNodeSide side)
 
 AVLTreeNode *avl_tree_node_parent(AVLTreeNode *node)
 {
-	return node->parent;
+	return avl_tree_get_parent(node);
 }
 
 unsigned int avl_tree_num_entries(AVLTree *tree)
@@ -598,43 +1522,24 @@ unsigned int avl_tree_num_entries(AVLTree *tree)
 	return tree->num_nodes;
 }
 
- static void avl_tree_to_array_add_subtree(AVLTree *tree,
-                                           AVLTreeNode *subtree,
-                                           void **array,
-                                           int *index)
-{
-  if (subtree == NULL) {
-    return;
-  }
-
-  /* Add left subtree first */
-
-  avl_tree_to_array_add_subtree(tree, subtree->children[AVL_TREE_NODE_LEFT],
-	                              array, index);
-
-  /* Add this node */
-
-  array[*index] = tree->key_func(AVL_NODE_TO_VALUE(tree, subtree), tree->key_context);
-  ++*index;
-
-  /* Finally add right subtree */
-
-  avl_tree_to_array_add_subtree(tree, subtree->children[AVL_TREE_NODE_RIGHT],
-                                array, index);
-}
-
-
-
 void **avl_tree_to_array(AVLTree *tree, void **array)
 {
+  AVLTreeNode *node;
   int index = 0;
   
   if (array == NULL) {
     return NULL;
   }
   
-  /* Add all keys */
-  avl_tree_to_array_add_subtree(tree, tree->root_node, array, &index); 
+  /* Add all keys in order. Step through the parent pointers instead of
+   * recursing */
+  for (node = avl_tree_min(tree);
+       node != NULL;
+       node = avl_tree_node_next(node)) {
+    array[index] = tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                  tree->key_context);
+    ++index;
+  }
   return array;
 }
 
@@ -647,10 +1552,10 @@ AVLTreeNode *avl_tree_max(AVLTree *tree)
   /* Search down the tree and attempt to find the node which
    * has the specified key */
   
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
   while (node != NULL) {
     max = node;
-    node = node->children[AVL_TREE_NODE_RIGHT];
+    node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
   }
 
   return (max);
@@ -668,66 +1573,386 @@ AVLTreeNode *avl_tree_min(AVLTree *tree)
   /* Search down the tree and attempt to find the node which
    * has the specified key */
   
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
   while (node != NULL) {
     min = node;
-    node = node->children[AVL_TREE_NODE_LEFT];
+    node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
   }
 
   return (min);
 }
 
 
-static void
-avl_tree_walk_internal(AVLTreeNode *subtree,
-                       bool is_descending,
-                       bool *is_stop,
-                       AVLTreeWalkFunc func,
-                       void *context)
+/*
+ * In-order neighbour of a node using the parent pointers. No key is
+ * compared.
+ * "side" is AVL_TREE_NODE_RIGHT for the next node and AVL_TREE_NODE_LEFT
+ * for the previous one:
+ * - If the node has a child on that side, the neighbour is the extreme
+ *   node of that subtree toward the other side
+ * - Otherwise climb until we come up from the other side
+ */
+static AVLTreeNode *avl_tree_node_step(AVLTreeNode *node,
+                                       AVLTreeNodeSide side)
 {
-  if (subtree == NULL) {
+  AVLTreeNode *parent;
+
+  if (avl_tree_get_child(node, side) != NULL) {
+    node = avl_tree_get_child(node, side);
+    while (avl_tree_get_child(node, 1 - side) != NULL) {
+      node = avl_tree_get_child(node, 1 - side);
+    }
+    return (node);
+  }
+
+  parent = avl_tree_get_parent(node);
+  while (parent != NULL && avl_tree_get_child(parent, side) == node) {
+    node = parent;
+    parent = avl_tree_get_parent(node);
+  }
+  return (parent);
+}
+
+AVLTreeNode *avl_tree_node_next(AVLTreeNode *node)
+{
+  return (avl_tree_node_step(node, AVL_TREE_NODE_RIGHT));
+}
+
+AVLTreeNode *avl_tree_node_prev(AVLTreeNode *node)
+{
+  return (avl_tree_node_step(node, AVL_TREE_NODE_LEFT));
+}
+
+AVLTreeNode *avl_tree_cursor_first(AVLTreeCursor *cursor,
+                                   AVLTree *tree,
+                                   bool is_descending)
+{
+  cursor->tree = tree;
+  cursor->is_descending = is_descending;
+  cursor->node = is_descending ? avl_tree_max(tree) : avl_tree_min(tree);
+  return (cursor->node);
+}
+
+AVLTreeNode *avl_tree_cursor_seek(AVLTreeCursor *cursor,
+                                  AVLTree *tree,
+                                  AVLTreeKey key,
+                                  bool is_descending)
+{
+  cursor->tree = tree;
+  cursor->is_descending = is_descending;
+  cursor->node = (is_descending ?
+                  avl_tree_max_equal_or_less(tree, key) :
+                  avl_tree_min_equal_or_greater(tree, key));
+  return (cursor->node);
+}
+
+AVLTreeNode *avl_tree_cursor_node(AVLTreeCursor *cursor)
+{
+  return (cursor->node);
+}
+
+AVLTreeNode *avl_tree_cursor_next(AVLTreeCursor *cursor)
+{
+  if (cursor->node != NULL) {
+    cursor->node = avl_tree_node_step(cursor->node,
+                                      cursor->is_descending ?
+                                      AVL_TREE_NODE_LEFT :
+                                      AVL_TREE_NODE_RIGHT);
+  }
+  return (cursor->node);
+}
+
+AVLTreeNode *avl_tree_cursor_remove(AVLTreeCursor *cursor)
+{
+  AVLTreeNode *node = cursor->node;
+
+  if (node == NULL) {
+    return (NULL);
+  }
+
+  /* Find the next node BEFORE removing. Removing a node never moves
+   * another node to a different place in the order of the tree, so the
+   * next node stays the next node */
+  avl_tree_cursor_next(cursor);
+  avl_tree_remove_node(cursor->tree, node);
+  return (cursor->node);
+}
+
+
+void avl_tree_range_walk(AVLTree *tree,
+                         AVLTreeKey low,
+                         AVLTreeKey high,
+                         uint32_t flags,
+                         bool is_descending,
+                         AVLTreeWalkFunc func,
+                         void *context)
+{
+  AVLTreeNode *node;
+  AVLTreeKey end;
+  bool is_end_included;
+  int diff;
+
+  /* Descend ONCE to the first node in the range */
+  if (is_descending) {
+    if (high == NULL) {
+      node = avl_tree_max(tree);
+    } else if (flags & AVL_TREE_RANGE_INCLUDE_HIGH) {
+      node = avl_tree_max_equal_or_less(tree, high);
+    } else {
+      node = avl_tree_predeccessor(tree, high);
+    }
+    end = low;
+    is_end_included = ((flags & AVL_TREE_RANGE_INCLUDE_LOW) != 0);
+  } else {
+    if (low == NULL) {
+      node = avl_tree_min(tree);
+    } else if (flags & AVL_TREE_RANGE_INCLUDE_LOW) {
+      node = avl_tree_min_equal_or_greater(tree, low);
+    } else {
+      node = avl_tree_successor(tree, low);
+    }
+    end = high;
+    is_end_included = ((flags & AVL_TREE_RANGE_INCLUDE_HIGH) != 0);
+  }
+
+  /* Then step through the neighbours. Only one key comparison per node
+   * to know if we went past the other end of the range */
+  while (node != NULL) {
+    if (end != NULL) {
+      diff = tree->compare_func(end,
+                                tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                               tree->key_context));
+      if (is_descending) {
+        diff = -diff;
+      }
+      if (diff < 0 || (diff == 0 && !is_end_included)) {
+        return;
+      }
+    }
+    if (func(node, context)) {
+      return;
+    }
+    node = avl_tree_node_step(node, is_descending ?
+                              AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT);
+  }
+}
+
+/* Whether the key of "node" is on the correct side of the range end
+ * "end". "sign" is 1 for the low end and -1 for the high end */
+
+static inline bool avl_tree_range_end_ok(AVLTree *tree, AVLTreeNode *node,
+                                         AVLTreeKey end, int sign,
+                                         bool is_end_included)
+{
+  int diff;
+
+  if (end == NULL) {
+    return (true);
+  }
+  diff = sign * tree->compare_func(
+    tree->key_func(AVL_NODE_TO_VALUE(tree, node), tree->key_context), end);
+  return (diff > 0 || (diff == 0 && is_end_included));
+}
+
+void avl_tree_range_cover(AVLTree *tree,
+                          AVLTreeKey low,
+                          AVLTreeKey high,
+                          uint32_t flags,
+                          AVLTreeCoverFunc func,
+                          void *context)
+{
+  AVLTreeNode *node, *rover;
+  bool is_low_included = ((flags & AVL_TREE_RANGE_INCLUDE_LOW) != 0);
+  bool is_high_included = ((flags & AVL_TREE_RANGE_INCLUDE_HIGH) != 0);
+
+  /* Go down to the first node inside the range. Both ends of the range
+   * are below it, on different sides */
+  node = avl_tree_get_root(tree);
+  while (node != NULL) {
+    if (!avl_tree_range_end_ok(tree, node, low, 1, is_low_included)) {
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
+    } else if (!avl_tree_range_end_ok(tree, node, high, -1,
+                                      is_high_included)) {
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+    } else {
+      break;
+    }
+  }
+  if (node == NULL || func(node, false, context)) {
     return;
   }
 
-  /* If previous call requested stop walking, exit immediately */
-  if (*is_stop) {
+  /* Walk toward "low". Every node at or above "low" is in the range and
+   * so is its whole right subtree */
+  rover = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+  while (rover != NULL) {
+    if (avl_tree_range_end_ok(tree, rover, low, 1, is_low_included)) {
+      if (func(rover, false, context) ||
+          (avl_tree_get_child(rover, AVL_TREE_NODE_RIGHT) != NULL &&
+           func(avl_tree_get_child(rover, AVL_TREE_NODE_RIGHT), true,
+                context))) {
+        return;
+      }
+      rover = avl_tree_get_child(rover, AVL_TREE_NODE_LEFT);
+    } else {
+      rover = avl_tree_get_child(rover, AVL_TREE_NODE_RIGHT);
+    }
+  }
+
+  /* Same toward "high" */
+  rover = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
+  while (rover != NULL) {
+    if (avl_tree_range_end_ok(tree, rover, high, -1, is_high_included)) {
+      if (func(rover, false, context) ||
+          (avl_tree_get_child(rover, AVL_TREE_NODE_LEFT) != NULL &&
+           func(avl_tree_get_child(rover, AVL_TREE_NODE_LEFT), true,
+                context))) {
+        return;
+      }
+      rover = avl_tree_get_child(rover, AVL_TREE_NODE_RIGHT);
+    } else {
+      rover = avl_tree_get_child(rover, AVL_TREE_NODE_LEFT);
+    }
+  }
+}
+
+#ifdef AVL_TREE_ORDER_STATISTIC
+
+/* Number of nodes with a key less than "key", or less than or equal to
+ * "key" if "is_equal_included" is true. Every time the descent goes
+ * right, the node and its left subtree are all smaller */
+
+static uint32_t avl_tree_count_less(AVLTree *tree, AVLTreeKey key,
+                                    bool is_equal_included)
+{
+  AVLTreeNode *node = avl_tree_get_root(tree);
+  uint32_t count = 0;
+  int diff;
+
+  while (node != NULL) {
+    diff = tree->compare_func(key,
+                              tree->key_func(AVL_NODE_TO_VALUE(tree, node),
+                                             tree->key_context));
+    if (diff > 0 || (diff == 0 && is_equal_included)) {
+      count += avl_tree_subtree_size(avl_tree_get_child(node,
+                                                        AVL_TREE_NODE_LEFT)) +
+        1;
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
+    } else {
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+    }
+  }
+  return (count);
+}
+
+uint32_t avl_tree_rank(AVLTree *tree, AVLTreeKey key)
+{
+  return (avl_tree_count_less(tree, key, false));
+}
+
+AVLTreeNode *avl_tree_select(AVLTree *tree, uint32_t index)
+{
+  AVLTreeNode *node = avl_tree_get_root(tree);
+  uint32_t left_size;
+
+  while (node != NULL) {
+    left_size = avl_tree_subtree_size(avl_tree_get_child(node,
+                                                         AVL_TREE_NODE_LEFT));
+    if (index == left_size) {
+      return (node);
+    } else if (index < left_size) {
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+    } else {
+      index -= left_size + 1;
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
+    }
+  }
+  return (NULL);
+}
+
+uint32_t avl_tree_count_range(AVLTree *tree,
+                              AVLTreeKey low,
+                              AVLTreeKey high,
+                              uint32_t flags)
+{
+  uint32_t below_low, up_to_high;
+
+  below_low = (low == NULL ? 0 :
+               avl_tree_count_less(tree, low,
+                                   !(flags & AVL_TREE_RANGE_INCLUDE_LOW)));
+  up_to_high = (high == NULL ?
+                avl_tree_subtree_size(avl_tree_get_root(tree)) :
+                avl_tree_count_less(tree, high,
+                                    (flags & AVL_TREE_RANGE_INCLUDE_HIGH) != 0));
+
+  /* "low" may be above "high" */
+  return (up_to_high > below_low ? up_to_high - below_low : 0);
+}
+
+#endif /* AVL_TREE_ORDER_STATISTIC */
+
+/*
+ * Tear down the whole tree in post-order without recursion and without
+ * extra memory: go down to a leaf, unlink it from its parent, free it
+ * then continue from the parent. The parent pointer is read BEFORE
+ * calling the free function because the node may be reused by then
+ */
+static void avl_tree_free_subtree(AVLTree *tree, AVLTreeNode *node)
+{
+  AVLTreeNode *parent;
+
+  while (node != NULL) {
+    if (avl_tree_get_child(node, AVL_TREE_NODE_LEFT) != NULL) {
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
+    } else if (avl_tree_get_child(node, AVL_TREE_NODE_RIGHT) != NULL) {
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
+    } else {
+      parent = avl_tree_get_parent(node);
+      if (parent != NULL) {
+        avl_tree_set_child(parent, avl_tree_node_parent_side(node), NULL);
+      }
+      tree->free_func(node, tree->free_context);
+      node = parent;
+    }
+  }
+}
+
+void avl_tree_free(AVLTree *tree)
+{
+  /* User did NOT pass to us a free function
+   * Bail out silently
+   */
+  if (!tree->free_func) {
     return;
   }
+  /* Destroy all nodes */
   
-  /* Add left subtree first */
-  avl_tree_walk_internal(subtree->children[is_descending ?
-                                           AVL_TREE_NODE_RIGHT:
-                                           AVL_TREE_NODE_LEFT],
-                         is_descending,
-                         is_stop,
-                         func,
-                         context);
-
-  /* Call the callback function */
-  *is_stop = func(subtree,context);
-
-  /* Finally add right subtree */
-  avl_tree_walk_internal(subtree->children[is_descending ?
-                                           AVL_TREE_NODE_LEFT:
-                                           AVL_TREE_NODE_RIGHT],
-                         is_descending,
-                         is_stop,
-                         func,
-                         context);
-}
+  avl_tree_free_subtree(tree, avl_tree_get_root(tree));
+  avl_tree_set_root(tree, NULL);
+  tree->num_nodes = 0;
+  ++tree->version;
   
+  /* REMEMBER that the tree pointer was passed to use by the caller
+   * Hence it is the caller responsibility to take care of it */
+}
 
 void avl_tree_walk(AVLTree *tree,
                    bool is_descending,
                    AVLTreeWalkFunc func,
                    void *context)
 {
-  bool is_stop = false;
-  avl_tree_walk_internal(tree->root_node,
-                         is_descending,
-                         &is_stop,
-                         func,
-                         context);
+  AVLTreeNode *node;
+
+  /* Step through the parent pointers instead of recursing. O(1) extra
+   * space and we return as soon as the callback asks to stop */
+  node = is_descending ? avl_tree_max(tree) : avl_tree_min(tree);
+  while (node != NULL) {
+    if (func(node, context)) {
+      return;
+    }
+    node = avl_tree_node_step(node, is_descending ?
+                              AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT);
+  }
 }
 
 
@@ -746,7 +1971,7 @@ AVLTreeNode *avl_tree_successor(AVLTree *tree, AVLTreeKey key)
 
   /* Search down the tree and attempt to find the node which
    * has the specified key */
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
   
   while (node != NULL) {
     
@@ -755,9 +1980,9 @@ AVLTreeNode *avl_tree_successor(AVLTree *tree, AVLTreeKey key)
     
     if (diff < 0) {
       successor = node;
-      node = node->children[AVL_TREE_NODE_LEFT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
     } else {
-      node = node->children[AVL_TREE_NODE_RIGHT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
     }
   }
   
@@ -780,24 +2005,25 @@ AVLTreeNode *avl_tree_min_equal_or_greater(AVLTree *tree, AVLTreeKey key)
   /* Search down the tree and attempt to find the node which
    * has the specified key */
   
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
   
   while (node != NULL) {
     
     diff = tree->compare_func(key,
                               tree->key_func(AVL_NODE_TO_VALUE(tree, node), tree->key_context));
     
-    if (diff == 0) {
+    if (diff == 0 && !tree->is_multimap) {
       
       /* found equal to: return it  */
 
       return node;
       
-    } else if (diff < 0) {
+    } else if (diff <= 0) {
+      /* With equal keys, keep going left to the first one */
       successor = node;
-      node = node->children[AVL_TREE_NODE_LEFT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
     } else {
-      node = node->children[AVL_TREE_NODE_RIGHT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
     }
   }
   
@@ -822,7 +2048,7 @@ AVLTreeNode *avl_tree_predeccessor(AVLTree *tree, AVLTreeKey key)
 
   /* Search down the tree and attempt to find the node which
    * has the specified key */
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
   
   while (node != NULL) {
     
@@ -831,9 +2057,9 @@ AVLTreeNode *avl_tree_predeccessor(AVLTree *tree, AVLTreeKey key)
     
     if (diff > 0) {
       predec = node;
-      node = node->children[AVL_TREE_NODE_RIGHT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
     } else {
-      node = node->children[AVL_TREE_NODE_LEFT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
     }
   }
   
@@ -855,24 +2081,25 @@ AVLTreeNode *avl_tree_max_equal_or_less(AVLTree *tree, AVLTreeKey key)
   /* Search down the tree and attempt to find the node which
    * has the specified key */
   
-  node = tree->root_node;
+  node = avl_tree_get_root(tree);
   
   while (node != NULL) {
     
     diff = tree->compare_func(key,
                               tree->key_func(AVL_NODE_TO_VALUE(tree, node), tree->key_context));
     
-    if (diff == 0) {
+    if (diff == 0 && !tree->is_multimap) {
       
       /* found equal to: return it  */
 
       return node;
       
-    } else if (diff > 0) {
+    } else if (diff >= 0) {
+      /* With equal keys, keep going right to the last one */
       predec = node;
-      node = node->children[AVL_TREE_NODE_RIGHT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_RIGHT);
     } else {
-      node = node->children[AVL_TREE_NODE_LEFT];
+      node = avl_tree_get_child(node, AVL_TREE_NODE_LEFT);
     }
   }
 
@@ -94,6 +94,30 @@ typedef enum {
 	AVL_TREE_NODE_RIGHT = 1
 } AVLTreeNodeSide;
 
+/**
+ * A link to a node (child, parent or root).
+ *
+ * By default a link is a pointer. If AVL_TREE_RELATIVE_NODE is defined, a
+ * link is the distance in bytes from the link itself to the node, and 0
+ * for NULL. A tree whose nodes and @ref AVLTree are all inside one block
+ * of memory (e.g. a file or a shared memory segment mapped with mmap())
+ * then stays valid when the block is mapped at another address, with no
+ * fixup. A link is only valid at the address where it was written: an
+ * @ref AVLTree or a node MUST NOT be copied with "=" or memcpy() unless
+ * the whole block is copied.
+ * The function pointers and the contexts in @ref AVLTree, and the
+ * pointers kept in the user structures, are still absolute and MUST be
+ * set again by the process that maps the block.
+ *
+ * Do NOT access a link directly. Use avl_tree_link_get() and
+ * avl_tree_link_set()
+ */
+#ifdef AVL_TREE_RELATIVE_NODE
+typedef intptr_t AVLTreeLink;
+#else
+typedef struct _AVLTreeNode *AVLTreeLink;
+#endif
+
 /**
  * A node in an AVL tree.
  *
@@ -101,12 +125,67 @@ typedef enum {
  * @see avl_tree_node_right_child
  * @see avl_tree_node_parent
  * @see avl_tree_node_key
+ *
+ * If AVL_TREE_COMPACT_NODE is defined, the node does not have a height.
+ * Instead the balance factor of the node is kept in the 2 low bits of
+ * the parent pointer. This makes the node 3 pointers (24 bytes on 64-bit
+ * machines) instead of 32 bytes. The price is that
+ * avl_tree_subtree_height() becomes O(log n) instead of O(1)
+ * The library and all the code that includes this file MUST be compiled
+ * with the same setting of AVL_TREE_COMPACT_NODE (see "AVLCFLAGS" in
+ * the Makefile)
+ *
+ * If AVL_TREE_ORDER_STATISTIC is defined, the node also keeps the number
+ * of nodes in its subtree (see avl_tree_rank(), avl_tree_select() and
+ * avl_tree_count_range()). The size takes the 4 bytes of padding after
+ * "height", so the default node stays 32 bytes on 64-bit machines. The
+ * compact node grows to 32 bytes
+ *
+ * Do NOT access "parent", "parent_balance" or "size" directly. Use
+ * avl_tree_node_parent() and avl_tree_subtree_size()
  */
+#ifdef AVL_TREE_COMPACT_NODE
+typedef struct _AVLTreeNode {
+  AVLTreeLink children[2];
+  uintptr_t parent_balance;
+#ifdef AVL_TREE_ORDER_STATISTIC
+  uint32_t size;
+#endif
+} AVLTreeNode;
+#else
 typedef struct _AVLTreeNode {
-  struct _AVLTreeNode *children[2];
-  struct _AVLTreeNode *parent;
+  AVLTreeLink children[2];
+  AVLTreeLink parent;
   int height;
+#ifdef AVL_TREE_ORDER_STATISTIC
+  uint32_t size;
+#endif
 } AVLTreeNode;
+#endif
+
+/**
+ * Read a link
+ */
+static inline AVLTreeNode *avl_tree_link_get(const AVLTreeLink *link)
+{
+#ifdef AVL_TREE_RELATIVE_NODE
+  return (*link == 0 ? NULL : (AVLTreeNode *)((uintptr_t)link + *link));
+#else
+  return (*link);
+#endif
+}
+
+/**
+ * Write a link
+ */
+static inline void avl_tree_link_set(AVLTreeLink *link, AVLTreeNode *node)
+{
+#ifdef AVL_TREE_RELATIVE_NODE
+  *link = (node == NULL ? 0 : (intptr_t)((uintptr_t)node - (uintptr_t)link));
+#else
+  *link = node;
+#endif
+}
 
 
 /**
@@ -151,6 +230,18 @@ typedef void (*AVLTreeFreeFunc)(AVLTreeNode *node, void *context);
  *                  be aborted immediately
  */
 typedef bool (*AVLTreeWalkFunc)(AVLTreeNode *node, void *context);
+
+/*
+ * Callback function to recompute the user aggregate (sum, max, bitmap,
+ * etc.) stored in the user structure of "node" from the user structure
+ * of "node" and the aggregates of its children (see
+ * avl_tree_node_child()). It MUST NOT modify the tree.
+ * See avl_tree_set_augment()
+ *
+ * @param node      The node to recompute. Its children are up to date
+ * @param context   Opaque context passed to avl_tree_set_augment()
+ */
+typedef void (*AVLTreeAugmentFunc)(AVLTreeNode *node, void *context);
   
 
 /**
@@ -160,14 +251,18 @@ typedef bool (*AVLTreeWalkFunc)(AVLTreeNode *node, void *context);
  * @see avl_tree_new
  */
 typedef struct _AVLTree  {
-  AVLTreeNode *root_node;
+  AVLTreeLink root_node;  /* See avl_tree_root_node() */
   AVLTreeCompareFunc compare_func;
   AVLTreeKeyFunc key_func;
   void *key_context;
   uint32_t num_nodes;
+  uint32_t version;  /* Changes every time the tree is modified */
   AVLTreeFreeFunc free_func;
   intptr_t node_offset;
   void *free_context;
+  AVLTreeAugmentFunc augment_func;
+  void *augment_context;
+  bool is_multimap;
 } AVLTree;
 
 
@@ -243,6 +338,9 @@ AVLTree *avl_tree_new(AVLTree *new_tree,
 
 /**
  * Destroy an AVL tree.
+ * Calls the "free_func" of the tree for every node in post-order (children
+ * before their parent). No recursion and no extra memory are used. The
+ * tree is left empty
  *
  * @param tree            The tree to destroy.
  */
@@ -258,11 +356,261 @@ void avl_tree_free(AVLTree *tree);
  * @return                The newly created tree node containing the
  *                        key and value, or NULL if it was not possible
  *                        to insert the node because there is a already a
- *                        node with the same key
+ *                        node with the same key. A multimap tree (see
+ *                        avl_tree_set_multimap()) never returns NULL
  */
 
 AVLTreeNode *avl_tree_insert(AVLTree *tree, AVLTreeNode *new_node);
 
+/**
+ * Insert a node or return the node that already has its key. Takes a
+ * single descent, unlike avl_tree_insert() followed by
+ * avl_tree_lookup().
+ *
+ * @param tree            The tree.
+ * @param new_node        The node to insert. Its key MUST be set
+ * @return                "new_node" if it was inserted. Otherwise the node
+ *                        already in the tree with the same key and
+ *                        "new_node" is not touched. A multimap tree
+ *                        always inserts
+ */
+
+AVLTreeNode *avl_tree_insert_or_get(AVLTree *tree, AVLTreeNode *new_node);
+
+/**
+ * Insert a node next to a node that is known to be near its place in
+ * the order, e.g. the node inserted just before when the keys arrive
+ * in ascending order.
+ * If the new key belongs between "hint" and the node just before or
+ * just after it, only two keys are compared. Otherwise this falls back
+ * to avl_tree_insert().
+ * With a NULL "hint", the new key is compared with the largest key
+ * only. If it is larger, the node is appended. So keys that arrive in
+ * ascending order are inserted with one comparison each plus the
+ * rebalance.
+ *
+ * @param tree            The tree.
+ * @param hint            A node of the tree, or NULL to append
+ * @param new_node        The node to insert. Its key MUST be set
+ * @return                Same as avl_tree_insert()
+ */
+
+AVLTreeNode *avl_tree_insert_hint(AVLTree *tree, AVLTreeNode *hint,
+                                  AVLTreeNode *new_node);
+
+/**
+ * Where a key would be linked in a tree. Filled by avl_tree_find_slot()
+ * and used by avl_tree_insert_at_slot()
+ */
+typedef struct _AVLTreeSlot {
+  AVLTreeNode *parent;
+  AVLTreeNodeSide side;
+} AVLTreeSlot;
+
+/**
+ * First half of a two-phase insert: look up "key" and, if it is not in
+ * the tree, remember where a node with this key must be linked. The
+ * caller can then build the user structure only on a miss and link it
+ * with avl_tree_insert_at_slot() without descending again.
+ *
+ * @param tree            The tree.
+ * @param key             The key to look up.
+ * @param slot            Filled with the place of the key if it is not
+ *                        found. Valid until the tree is modified
+ * @return                The node with the key, or NULL if there is none.
+ *                        A multimap tree always returns NULL and the
+ *                        slot is after all the nodes with the same key
+ */
+
+AVLTreeNode *avl_tree_find_slot(AVLTree *tree, AVLTreeKey key,
+                                AVLTreeSlot *slot);
+
+/**
+ * Second half of a two-phase insert: link "new_node" at "slot" and
+ * rebalance. No key is compared.
+ *
+ * @param tree            The tree.
+ * @param slot            Filled by avl_tree_find_slot() on this tree. The
+ *                        tree MUST NOT have been modified since then
+ * @param new_node        The node to insert. Its key MUST be the key given
+ *                        to avl_tree_find_slot()
+ */
+
+void avl_tree_insert_at_slot(AVLTree *tree, AVLTreeSlot *slot,
+                             AVLTreeNode *new_node);
+
+/**
+ * Switch a tree to or from multimap mode.
+ *
+ * In multimap mode, avl_tree_insert() accepts a key that is already in
+ * the tree. The new node goes after all the nodes with the same key,
+ * so nodes with equal keys stay in insertion order. Then:
+ * - avl_tree_lookup() and avl_tree_remove() find any one of the nodes
+ *   with the key. Use avl_tree_equal_range() to get all of them
+ * - avl_tree_min_equal_or_greater() returns the first node with the key
+ *   and avl_tree_max_equal_or_less() the last one. So the cursors and
+ *   avl_tree_range_walk() see all the nodes with an end key
+ * - avl_tree_build_from_sorted() accepts consecutive equal keys
+ *
+ * @param tree            The tree
+ * @param is_multimap     True to accept equal keys. Can only be set back
+ *                        to false if the tree has no equal keys
+ */
+
+void avl_tree_set_multimap(AVLTree *tree, bool is_multimap);
+
+/**
+ * Find the first and last nodes with the key "key" in O(log n). With a
+ * multimap tree, all the nodes with the key are from "*first" to "*last"
+ * following avl_tree_node_next()
+ *
+ * @param tree            The tree
+ * @param key             The key to search for
+ * @param first           Receives the first node with the key, or NULL
+ * @param last            Receives the last node with the key, or NULL
+ * @return                True if there is at least one node with the key
+ */
+
+bool avl_tree_equal_range(AVLTree *tree, AVLTreeKey key,
+                          AVLTreeNode **first, AVLTreeNode **last);
+
+/**
+ * Link a new node into an empty slot of the tree and rebalance.
+ * This is the second half of @ref avl_tree_insert. It does NOT
+ * compare any keys. It is meant for code that has already found where
+ * the node belongs by its own descent (e.g. the specialized functions
+ * generated by AVL_TREE_DEFINE() in "avl-tree-define.h")
+ *
+ * @param tree            The tree.
+ * @param parent          The node that will become the parent of the new
+ *                        node, or NULL if the tree is empty
+ * @param side            Which child of "parent" the new node becomes. The
+ *                        child on that side MUST currently be NULL.
+ *                        Ignored if "parent" is NULL
+ * @param new_node        The node to link
+ */
+
+void avl_tree_link_node(AVLTree *tree,
+                        AVLTreeNode *parent,
+                        AVLTreeNodeSide side,
+                        AVLTreeNode *new_node);
+
+/**
+ * Build a tree from an array of nodes that is already sorted in
+ * ascending order of keys. The nodes are linked into a perfectly balanced
+ * tree in O(n) without any rotation and without comparing keys (unless
+ * "check_order" is true)
+ *
+ * @param tree            The tree. MUST be empty
+ * @param nodes           Array of pointers to the nodes to insert in
+ *                        ascending order of keys. The array itself is not
+ *                        kept by the tree
+ * @param num_nodes       Number of entries in "nodes"
+ * @param check_order     If true, compare every pair of consecutive nodes
+ *                        first and fail if they are not strictly
+ *                        ascending
+ * @return                The tree, or NULL if the tree was not empty or
+ *                        "nodes" is not sorted. In that case neither the
+ *                        tree nor the nodes are modified
+ */
+
+AVLTree *avl_tree_build_from_sorted(AVLTree *tree,
+                                    AVLTreeNode **nodes,
+                                    uint32_t num_nodes,
+                                    bool check_order);
+
+/**
+ * Fix a tree after all its nodes were moved "delta" bytes away, e.g.
+ * because the memory that holds them was copied or mapped at another
+ * address, while their links still hold the old addresses. The
+ * @ref AVLTree itself is assumed to be where it was.
+ *
+ * With AVL_TREE_RELATIVE_NODE only the root is fixed, in O(1). Otherwise
+ * all the links are fixed in O(n). No key is compared
+ *
+ * @param tree            The tree
+ * @param delta           New address of the nodes - old address
+ */
+
+void avl_tree_relocate(AVLTree *tree, intptr_t delta);
+
+/**
+ * Attach an augment function to a tree. From then on, the function is
+ * called on every node whose subtree changes: the nodes moved by a
+ * rotation, the node that replaces a removed node and all the
+ * ancestors of a node that is linked or unlinked. Hence the aggregate
+ * kept in every node always covers its whole subtree, and a query over
+ * a range of keys only needs the O(log n) pieces returned by
+ * avl_tree_range_cover().
+ * An insert or a remove calls the function O(log n) times.
+ *
+ * Trees created by avl_tree_split() keep the augment function.
+ *
+ * @param tree            The tree. MUST be empty
+ * @param augment_func    The function. NULL to remove it
+ * @param augment_context Opaque context passed to "augment_func"
+ */
+
+void avl_tree_set_augment(AVLTree *tree,
+                          AVLTreeAugmentFunc augment_func,
+                          void *augment_context);
+
+/**
+ * Recompute the aggregate of "node" and of all its ancestors. Call it
+ * after modifying a field of the user structure of a node that is in the
+ * tree and that is used by the augment function.
+ *
+ * @param tree            The tree
+ * @param node            The node that was modified
+ */
+
+void avl_tree_update_augment(AVLTree *tree, AVLTreeNode *node);
+
+/**
+ * Join two trees and a pivot node into one tree in O(log n) without
+ * comparing any key. Every key in "left" MUST be less than the key of
+ * "pivot" that MUST be less than every key in "right".
+ *
+ * The result is in "left". "right" is left empty. Both trees MUST have
+ * been created with the same arguments to avl_tree_new()
+ *
+ * @param left            Tree with the smaller keys. Receives the result
+ * @param pivot           Node that is not in any tree. If NULL, the
+ *                        smallest node of "right" is removed from it and
+ *                        used as the pivot
+ * @param right           Tree with the larger keys. Empty on return
+ * @return                The argument "left"
+ */
+
+AVLTree *avl_tree_join(AVLTree *left, AVLTreeNode *pivot, AVLTree *right);
+
+/**
+ * Split a tree by key. The nodes with a key less than "key" go to "lt"
+ * and the others go to "ge".
+ *
+ * Cutting the tree takes O(log n) rotations and joins, or
+ * O(log n * log n) with AVL_TREE_COMPACT_NODE, where the height of every
+ * piece has to be walked. The new trees also need their number of nodes:
+ *  - With AVL_TREE_ORDER_STATISTIC, it is read from the subtree sizes
+ *    in O(1)
+ *  - Without it, the nodes of the smaller new tree are counted one by
+ *    one. A split that leaves k nodes on one side is then
+ *    O(log n + min(k, n - k)), i.e. O(n) near the middle of the tree.
+ *    Define AVL_TREE_ORDER_STATISTIC if large trees are split often
+ *
+ * "lt" and "ge" are initialized by this function with the same
+ * arguments to avl_tree_new() as "tree". Either of them can be "tree"
+ * itself. Otherwise "tree" is left empty.
+ *
+ * @param tree            The tree to split
+ * @param key             The key to split at
+ * @param lt              Receives the nodes with a key less than "key"
+ * @param ge              Receives the nodes with a key greater than or
+ *                        equal to "key"
+ */
+
+void avl_tree_split(AVLTree *tree, AVLTreeKey key, AVLTree *lt, AVLTree *ge);
+
 /**
  * Remove a node from a tree.
  *
@@ -292,11 +640,45 @@ int avl_tree_remove(AVLTree *tree, AVLTreeKey key);
  * @param tree            The AVL tree to search.
  * @param key             The key to search for.
  * @return                The tree node containing the given key, or NULL
- *                        if no entry with the given key is found.
+ *                        if no entry with the given key is found. For a
+ *                        multimap tree, any node with the key
  */
 
 AVLTreeNode *avl_tree_lookup(AVLTree *tree, AVLTreeKey key);
 
+/**
+ * Number of descents that avl_tree_lookup_batch() keeps in flight. Can
+ * be changed at compile time. 8 to 16 is enough to cover the latency of
+ * the memory on most machines
+ */
+#ifndef AVL_TREE_LOOKUP_BATCH_WIDTH
+#define AVL_TREE_LOOKUP_BATCH_WIDTH 16
+#endif
+
+/**
+ * Look up many keys at once. Same result as calling avl_tree_lookup()
+ * for each key, but faster on a tree that does not fit in the cache.
+ *
+ * Up to AVL_TREE_LOOKUP_BATCH_WIDTH independent descents advance in
+ * turn, one level at a time. When a descent moves to a child, the child
+ * and its key are prefetched and the other descents are advanced before
+ * that child is read, so the cache misses of all the descents overlap
+ * instead of stalling one after the other. A finished descent is
+ * replaced by the next key right away.
+ *
+ * "key_func" is called on a node right after it is prefetched. So it
+ * should only compute the address of the key and not read the node
+ *
+ * @param tree            The AVL tree to search.
+ * @param keys            Array of "num_keys" keys to search for
+ * @param num_keys        Number of keys
+ * @param results         Array of "num_keys" entries that receives the
+ *                        node with each key or NULL
+ */
+
+void avl_tree_lookup_batch(AVLTree *tree, AVLTreeKey *keys, uint32_t num_keys,
+                           AVLTreeNode **results);
+
 /**
  * Find the root node of a tree.
  *
@@ -347,6 +729,19 @@ AVLTreeNode *avl_tree_node_parent(AVLTreeNode *node);
 
 int avl_tree_subtree_height(AVLTreeNode *node);
 
+#ifdef AVL_TREE_ORDER_STATISTIC
+/**
+ * Find the number of nodes in a subtree. O(1)
+ * Only with AVL_TREE_ORDER_STATISTIC
+ *
+ * @param node            The root node of the subtree.
+ * @return                The number of nodes in the subtree, including
+ *                        "node". Zero if "node" is NULL
+ */
+
+uint32_t avl_tree_subtree_size(AVLTreeNode *node);
+#endif
+
 /**
  * Convert the keys in an AVL tree into a C array.  This allows
  * the tree to be used as an ordered set.
@@ -395,7 +790,7 @@ AVLTreeNode *avl_tree_successor(AVLTree *tree, AVLTreeKey key);
  * Retrieve the value whose key minimum key value that is greater than or 
  * equal to the passed "key" argument
  * Identical to successor except if we find a node that is equal 
- * to "key" we return it
+ * to "key" we return it. For a multimap tree, the first one
  * @param tree            The AVL tree to search.
  * @param key             The key to to find the successor of.
  * @return                The value associated with the successor, or
@@ -426,7 +821,7 @@ AVLTreeNode *avl_tree_predeccessor(AVLTree *tree, AVLTreeKey key);
 
 /**
  * Identical to predeccessor except if we find a node that is equal 
- * to "key" we return it
+ * to "key" we return it. For a multimap tree, the last one
  *
  * @param tree            The AVL tree to search.
  * @param key             The key to to find the successor of.
@@ -481,6 +876,205 @@ void avl_tree_walk(AVLTree *tree ,
                    AVLTreeWalkFunc func,
                    void *context);
 
+/**
+ * Return the node with the next (greater) key using the parent pointers.
+ * No key is compared. Visiting all the nodes of a tree by calling this
+ * function repeatedly starting from avl_tree_min() is O(n) in total
+ *
+ * @param node            A node in a tree
+ * @return                The next node or NULL if "node" is the max
+ */
+AVLTreeNode *avl_tree_node_next(AVLTreeNode *node);
+
+/**
+ * Return the node with the previous (smaller) key using the parent
+ * pointers. No key is compared
+ *
+ * @param node            A node in a tree
+ * @return                The previous node or NULL if "node" is the min
+ */
+AVLTreeNode *avl_tree_node_prev(AVLTreeNode *node);
+
+
+/**
+ * Cursor to iterate a tree in ascending or descending order.
+ * Memory is provided by the caller. The cursor is just a position, so
+ * the tree may be modified while the cursor exists as long as the node
+ * the cursor is at is not removed except through
+ * @ref avl_tree_cursor_remove
+ */
+typedef struct _AVLTreeCursor {
+  AVLTree *tree;
+  AVLTreeNode *node;
+  bool is_descending;
+} AVLTreeCursor;
+
+/**
+ * Position a cursor at the first node of the tree: the min if ascending,
+ * the max if descending
+ *
+ * @param cursor          The cursor to initialize
+ * @param tree            The tree
+ * @param is_descending   If true, the cursor moves toward smaller keys
+ * @return                The node at the cursor or NULL if the tree is
+ *                        empty
+ */
+AVLTreeNode *avl_tree_cursor_first(AVLTreeCursor *cursor,
+                                   AVLTree *tree,
+                                   bool is_descending);
+
+/**
+ * Position a cursor at the first node that is NOT before "key" in the
+ * direction of the cursor, i.e. avl_tree_min_equal_or_greater() if
+ * ascending or avl_tree_max_equal_or_less() if descending
+ *
+ * @return                The node at the cursor or NULL if none
+ */
+AVLTreeNode *avl_tree_cursor_seek(AVLTreeCursor *cursor,
+                                  AVLTree *tree,
+                                  AVLTreeKey key,
+                                  bool is_descending);
+
+/**
+ * Return the node at the cursor or NULL if the cursor went past the end
+ */
+AVLTreeNode *avl_tree_cursor_node(AVLTreeCursor *cursor);
+
+/**
+ * Move the cursor to the next node in its direction
+ *
+ * @return                The new node at the cursor or NULL if the
+ *                        cursor went past the end
+ */
+AVLTreeNode *avl_tree_cursor_next(AVLTreeCursor *cursor);
+
+/**
+ * Remove the node at the cursor from the tree and move the cursor to the
+ * next node in its direction
+ *
+ * @return                The new node at the cursor or NULL if the
+ *                        cursor went past the end
+ */
+AVLTreeNode *avl_tree_cursor_remove(AVLTreeCursor *cursor);
+
+/**
+ * Flags for @ref avl_tree_range_walk
+ */
+#define AVL_TREE_RANGE_INCLUDE_LOW  0x1 /* Range includes key equal to "low" */
+#define AVL_TREE_RANGE_INCLUDE_HIGH 0x2 /* Range includes key equal to "high" */
+
+/**
+ * Walk the nodes whose keys are between "low" and "high" in ascending or
+ * descending order and call "func" for each of them.
+ * The tree is descended once to the first node of the range. After that
+ * the walk moves to the neighbouring node through the parent pointers
+ * and compares one key per node to detect the end of the range. Nodes
+ * outside the range are never passed to "func" and subtrees outside the
+ * range are never entered
+ *
+ * @param tree           The AVL tree to walk
+ * @param low            Lower end of the range. NULL means no lower end
+ * @param high           Upper end of the range. NULL means no upper end
+ * @param flags          Zero or more of AVL_TREE_RANGE_INCLUDE_LOW and
+ *                       AVL_TREE_RANGE_INCLUDE_HIGH
+ * @param is_descending  If true, walk from "high" down to "low"
+ * @param func           the walking callback function
+ *                       If the callback function returns anything
+ *                       other than zero, then the walk is aborted
+ * @param context        Opaque context passed to the callback function
+ */
+void avl_tree_range_walk(AVLTree *tree,
+                         AVLTreeKey low,
+                         AVLTreeKey high,
+                         uint32_t flags,
+                         bool is_descending,
+                         AVLTreeWalkFunc func,
+                         void *context);
+
+/**
+ * Callback function of avl_tree_range_cover()
+ *
+ * @param node          The node
+ * @param is_subtree    If true, the whole subtree rooted at "node" is
+ *                      in the range. Otherwise only "node" itself is in
+ *                      the range and its children must be ignored
+ * @param context       Opaque context passed to avl_tree_range_cover()
+ *
+ * @return              if the the returned value is "non-false", the
+ *                      cover is aborted immediately
+ */
+typedef bool (*AVLTreeCoverFunc)(AVLTreeNode *node, bool is_subtree,
+                                 void *context);
+
+/**
+ * Call "func" on O(log n) disjoint pieces, single nodes and whole
+ * subtrees, that together hold exactly the nodes whose keys are between
+ * "low" and "high". The pieces are not passed in order of keys.
+ * With an augment function (see avl_tree_set_augment()), this gives the
+ * aggregate of a range in O(log n): the aggregate of a whole subtree is
+ * the one in its root and a single node only counts for itself.
+ *
+ * @param tree           The tree
+ * @param low            Lower end of the range. NULL means no lower end
+ * @param high           Upper end of the range. NULL means no upper end
+ * @param flags          Zero or more of AVL_TREE_RANGE_INCLUDE_LOW and
+ *                       AVL_TREE_RANGE_INCLUDE_HIGH. Same meaning as in
+ *                       avl_tree_range_walk()
+ * @param func           Called for every piece
+ * @param context        Opaque context passed to "func"
+ */
+void avl_tree_range_cover(AVLTree *tree,
+                          AVLTreeKey low,
+                          AVLTreeKey high,
+                          uint32_t flags,
+                          AVLTreeCoverFunc func,
+                          void *context);
+
+#ifdef AVL_TREE_ORDER_STATISTIC
+/**
+ * Find the number of nodes whose key is less than "key". If there is a
+ * node with the key "key", this is its index in ascending order
+ * starting from zero. O(log n)
+ * Only with AVL_TREE_ORDER_STATISTIC
+ *
+ * @param tree            The tree
+ * @param key             The key. Does not have to be in the tree
+ * @return                The number of nodes with a smaller key
+ */
+uint32_t avl_tree_rank(AVLTree *tree, AVLTreeKey key);
+
+/**
+ * Find the node at position "index" in ascending order of keys, starting
+ * from zero. O(log n)
+ * Only with AVL_TREE_ORDER_STATISTIC
+ *
+ * @param tree            The tree
+ * @param index           Position of the node
+ * @return                The node, or NULL if "index" is not less than
+ *                        the number of nodes in the tree
+ */
+AVLTreeNode *avl_tree_select(AVLTree *tree, uint32_t index);
+
+/**
+ * Count the nodes whose keys are between "low" and "high" without
+ * visiting them. O(log n)
+ * Only with AVL_TREE_ORDER_STATISTIC
+ *
+ * @param tree           The tree
+ * @param low            Lower end of the range. NULL means no lower end
+ * @param high           Upper end of the range. NULL means no upper end
+ * @param flags          Zero or more of AVL_TREE_RANGE_INCLUDE_LOW and
+ *                       AVL_TREE_RANGE_INCLUDE_HIGH. Same meaning as in
+ *                       avl_tree_range_walk()
+ * @return               The number of nodes that avl_tree_range_walk()
+ *                       would visit with the same arguments
+ */
+uint32_t avl_tree_count_range(AVLTree *tree,
+                              AVLTreeKey low,
+                              AVLTreeKey high,
+                              uint32_t flags);
+#endif /* AVL_TREE_ORDER_STATISTIC */
+
 #ifdef __cplusplus
 }
 #endif
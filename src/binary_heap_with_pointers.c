@@ -76,51 +76,71 @@ binary_heap_init(binary_heap_t *heap,
   return (BINARY_HEAP_ERR_OK);
 }
 
+/*
+ * Short names for the links. See "binary_heap_link_t"
+ */
+#define HEAP_LEFT(node)   binary_heap_link_get(&(node)->left)
+#define HEAP_RIGHT(node)  binary_heap_link_get(&(node)->right)
+#define HEAP_PARENT(node) binary_heap_link_get(&(node)->parent)
+#define HEAP_SET_LEFT(node, value)                    \
+  binary_heap_link_set(&(node)->left, (value))
+#define HEAP_SET_RIGHT(node, value)                   \
+  binary_heap_link_set(&(node)->right, (value))
+#define HEAP_SET_PARENT(node, value)                  \
+  binary_heap_link_set(&(node)->parent, (value))
+
 binary_heap_node_t* binary_heap_top(binary_heap_t *heap) {
-  return (heap ? heap->min : NULL);
+  return (heap ? binary_heap_link_get(&heap->min) : NULL);
 }
 
-/* Swap parent with child. Child moves closer to the root, parent moves away. */
+/* Swap parent with child. Child moves closer to the root, parent moves away.
+ * The links are read before any is written because they cannot be copied
+ * with the node when they are relative */
 static inline void
 binary_heap_node_swap(binary_heap_t * heap,
                       binary_heap_node_t * parent,
                       binary_heap_node_t * child) {
+  binary_heap_node_t* grand_parent = HEAP_PARENT(parent);
+  binary_heap_node_t* parent_left = HEAP_LEFT(parent);
+  binary_heap_node_t* parent_right = HEAP_RIGHT(parent);
+  binary_heap_node_t* child_left = HEAP_LEFT(child);
+  binary_heap_node_t* child_right = HEAP_RIGHT(child);
   binary_heap_node_t* sibling;
-  binary_heap_node_t t;
 
-  t = *parent;
-  *parent = *child;
-  *child = t;
-
-  parent->parent = child;
-  if (child->left == child) {
-    child->left = parent;
-    sibling = child->right;
+  HEAP_SET_PARENT(child, grand_parent);
+  if (parent_left == child) {
+    HEAP_SET_LEFT(child, parent);
+    HEAP_SET_RIGHT(child, parent_right);
+    sibling = parent_right;
   } else {
-    child->right = parent;
-    sibling = child->left;
+    HEAP_SET_LEFT(child, parent_left);
+    HEAP_SET_RIGHT(child, parent);
+    sibling = parent_left;
   }
   if (sibling != NULL)
-    sibling->parent = child;
-
-  if (parent->left != NULL)
-    parent->left->parent = parent;
-  if (parent->right != NULL)
-    parent->right->parent = parent;
-
-  if (child->parent == NULL)
-    heap->min = child;
-  else if (child->parent->left == parent)
-    child->parent->left = child;
+    HEAP_SET_PARENT(sibling, child);
+
+  HEAP_SET_PARENT(parent, child);
+  HEAP_SET_LEFT(parent, child_left);
+  HEAP_SET_RIGHT(parent, child_right);
+  if (child_left != NULL)
+    HEAP_SET_PARENT(child_left, parent);
+  if (child_right != NULL)
+    HEAP_SET_PARENT(child_right, parent);
+
+  if (grand_parent == NULL)
+    binary_heap_link_set(&heap->min, child);
+  else if (HEAP_LEFT(grand_parent) == parent)
+    HEAP_SET_LEFT(grand_parent, child);
   else
-    child->parent->right = child;
+    HEAP_SET_RIGHT(grand_parent, child);
 }
 
 binary_heap_err_t
 binary_heap_insert(binary_heap_t *heap,
                    binary_heap_node_t* newnode) {
-  binary_heap_node_t** parent;
-  binary_heap_node_t** child;
+  binary_heap_link_t* parent;
+  binary_heap_link_t* child;
   unsigned int path;
   unsigned int n;
   unsigned int k;
@@ -136,9 +156,9 @@ binary_heap_insert(binary_heap_t *heap,
    */
   if (!heap ||
       !newnode ||
-      newnode->left != NULL ||
-      newnode->right != NULL ||
-      newnode->parent != NULL) {
+      HEAP_LEFT(newnode) != NULL ||
+      HEAP_RIGHT(newnode) != NULL ||
+      HEAP_PARENT(newnode) != NULL) {
     return (BINARY_HEAP_ERR_INVAL);
   }
 
@@ -156,16 +176,16 @@ binary_heap_insert(binary_heap_t *heap,
   while (k > 0) {
     parent = child;
     if (path & 1)
-      child = &(*child)->right;
+      child = &binary_heap_link_get(child)->right;
     else
-      child = &(*child)->left;
+      child = &binary_heap_link_get(child)->left;
     path >>= 1;
     k -= 1;
   }
 
   /* Insert the new node. */
-  newnode->parent = *parent;
-  *child = newnode;
+  HEAP_SET_PARENT(newnode, binary_heap_link_get(parent));
+  binary_heap_link_set(child, newnode);
   heap->num_entries += 1;
 
   /* Walk up the tree and check at each node if the heap property holds.
@@ -175,9 +195,9 @@ binary_heap_insert(binary_heap_t *heap,
    * min and max heaps look the same by swaping the subtraction if the this is 
    * a max heap
    */
-  while (newnode->parent != NULL &&
-         binary_heap_compare(heap, newnode, newnode->parent) < 0) {
-    binary_heap_node_swap(heap, newnode->parent, newnode);
+  while (HEAP_PARENT(newnode) != NULL &&
+         binary_heap_compare(heap, newnode, HEAP_PARENT(newnode)) < 0) {
+    binary_heap_node_swap(heap, HEAP_PARENT(newnode), newnode);
   }
 
   return (BINARY_HEAP_ERR_OK);
@@ -187,7 +207,7 @@ binary_heap_err_t
 binary_heap_delete(binary_heap_t  *heap,
                    binary_heap_node_t* node) {
   binary_heap_node_t* smallest;
-  binary_heap_node_t** max;
+  binary_heap_link_t* max;
   binary_heap_node_t* child;
   unsigned int path;
   unsigned int k;
@@ -203,9 +223,9 @@ binary_heap_delete(binary_heap_t  *heap,
    */
   if (heap->num_entries == 0 ||
       (heap->num_entries > 1 &&
-       node->left == NULL &&
-       node->right == NULL &&
-       node->parent == NULL)) {
+       HEAP_LEFT(node) == NULL &&
+       HEAP_RIGHT(node) == NULL &&
+       HEAP_PARENT(node) == NULL)) {
       return (BINARY_HEAP_ERR_NOENT);
   }
 
@@ -221,9 +241,9 @@ binary_heap_delete(binary_heap_t  *heap,
   max = &heap->min;
   while (k > 0) {
     if (path & 1)
-      max = &(*max)->right;
+      max = &binary_heap_link_get(max)->right;
     else
-      max = &(*max)->left;
+      max = &binary_heap_link_get(max)->left;
     path >>= 1;
     k -= 1;
   }
@@ -231,37 +251,37 @@ binary_heap_delete(binary_heap_t  *heap,
   heap->num_entries -= 1;
 
   /* Unlink the max node. */
-  child = *max;
-  *max = NULL;
+  child = binary_heap_link_get(max);
+  binary_heap_link_set(max, NULL);
 
   if (child == node) {
     /* We're removing either the max or the last node in the tree. */
-    if (child == heap->min) {
-      heap->min = NULL;
+    if (child == binary_heap_link_get(&heap->min)) {
+      binary_heap_link_set(&heap->min, NULL);
     }
     /* Exit after zeroing the pointers of the node to be deleted from the heap*/
     goto out;
   }
 
   /* Replace the node to be deleted node with the max node. */
-  child->left = node->left;
-  child->right = node->right;
-  child->parent = node->parent;
+  HEAP_SET_LEFT(child, HEAP_LEFT(node));
+  HEAP_SET_RIGHT(child, HEAP_RIGHT(node));
+  HEAP_SET_PARENT(child, HEAP_PARENT(node));
 
-  if (child->left != NULL) {
-    child->left->parent = child;
+  if (HEAP_LEFT(child) != NULL) {
+    HEAP_SET_PARENT(HEAP_LEFT(child), child);
   }
 
-  if (child->right != NULL) {
-    child->right->parent = child;
+  if (HEAP_RIGHT(child) != NULL) {
+    HEAP_SET_PARENT(HEAP_RIGHT(child), child);
   }
 
-  if (node->parent == NULL) {
-    heap->min = child;
-  } else if (node->parent->left == node) {
-    node->parent->left = child;
+  if (HEAP_PARENT(node) == NULL) {
+    binary_heap_link_set(&heap->min, child);
+  } else if (HEAP_LEFT(HEAP_PARENT(node)) == node) {
+    HEAP_SET_LEFT(HEAP_PARENT(node), child);
   } else {
-    node->parent->right = child;
+    HEAP_SET_RIGHT(HEAP_PARENT(node), child);
   }
 
   /* Walk down the subtree and check at each node if the heap property holds.
@@ -273,11 +293,11 @@ binary_heap_delete(binary_heap_t  *heap,
    */
   for (;;) {
     smallest = child;
-    if (child->left != NULL && binary_heap_compare(heap, child->left, smallest) < 0) {
-      smallest = child->left;
+    if (HEAP_LEFT(child) != NULL && binary_heap_compare(heap, HEAP_LEFT(child), smallest) < 0) {
+      smallest = HEAP_LEFT(child);
     }
-    if (child->right != NULL && binary_heap_compare(heap, child->right, smallest) < 0) {
-      smallest = child->right;
+    if (HEAP_RIGHT(child) != NULL && binary_heap_compare(heap, HEAP_RIGHT(child), smallest) < 0) {
+      smallest = HEAP_RIGHT(child);
     }
     if (smallest == child) {
       break;
@@ -292,8 +312,8 @@ binary_heap_delete(binary_heap_t  *heap,
    * min and max heaps look the same by swaping the subtraction if the this is 
    * a max heap
    */
-  while (child->parent != NULL && binary_heap_compare(heap, child, child->parent) < 0) {
-    binary_heap_node_swap(heap, child->parent, child);
+  while (HEAP_PARENT(child) != NULL && binary_heap_compare(heap, child, HEAP_PARENT(child)) < 0) {
+    binary_heap_node_swap(heap, HEAP_PARENT(child), child);
   }
 
   /*
@@ -304,9 +324,9 @@ binary_heap_delete(binary_heap_t  *heap,
    * already inserted
    */
  out:
-  node->left = NULL;
-  node->right = NULL;
-  node->parent = NULL;
+  HEAP_SET_LEFT(node, NULL);
+  HEAP_SET_RIGHT(node, NULL);
+  HEAP_SET_PARENT(node, NULL);
 
   return (BINARY_HEAP_ERR_OK);
 }
@@ -327,9 +347,9 @@ binary_heap_modify(binary_heap_t *heap,
    */
   if (heap->num_entries == 0 ||
       (heap->num_entries > 1 &&
-       node->left == NULL &&
-       node->right == NULL &&
-       node->parent == NULL)) {
+       HEAP_LEFT(node) == NULL &&
+       HEAP_RIGHT(node) == NULL &&
+       HEAP_PARENT(node) == NULL)) {
       return (BINARY_HEAP_ERR_NOENT);
   }
 
@@ -345,11 +365,11 @@ binary_heap_modify(binary_heap_t *heap,
    */
   for (;;) {
     smallest = node;
-    if (node->left != NULL && binary_heap_compare(heap, node->left, smallest) < 0) {
-      smallest = node->left;
+    if (HEAP_LEFT(node) != NULL && binary_heap_compare(heap, HEAP_LEFT(node), smallest) < 0) {
+      smallest = HEAP_LEFT(node);
     }
-    if (node->right != NULL && binary_heap_compare(heap, node->right, smallest) < 0) {
-      smallest = node->right;
+    if (HEAP_RIGHT(node) != NULL && binary_heap_compare(heap, HEAP_RIGHT(node), smallest) < 0) {
+      smallest = HEAP_RIGHT(node);
     }
     if (smallest == node) {
       break;
@@ -363,8 +383,8 @@ binary_heap_modify(binary_heap_t *heap,
    * Note that if the modified node value was increased, then the
    * check of the while loop will fail and hence we will not enter the loop
    */
-  while (node->parent != NULL && binary_heap_compare(heap, node, node->parent) < 0) {
-    binary_heap_node_swap(heap, node->parent, node);
+  while (HEAP_PARENT(node) != NULL && binary_heap_compare(heap, node, HEAP_PARENT(node)) < 0) {
+    binary_heap_node_swap(heap, HEAP_PARENT(node), node);
   }
 
   return (BINARY_HEAP_ERR_OK);
@@ -379,8 +399,8 @@ binary_heap_pop(binary_heap_t *heap)
   if (!heap || !heap->num_entries) {
     return (NULL);
   }
-  min = heap->min;
-  err = binary_heap_delete(heap, heap->min); 
+  min = binary_heap_link_get(&heap->min);
+  err = binary_heap_delete(heap, min); 
   if (err != BINARY_HEAP_ERR_OK) {
     return (NULL);
   }
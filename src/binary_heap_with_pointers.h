@@ -66,14 +66,63 @@ typedef enum binary_heap_err_t_ {
 
 
 /*
- * A single node
+ * A link to a node (left, right, parent or min).
+ *
+ * By default a link is a pointer. If BINARY_HEAP_RELATIVE_NODE is
+ * defined, a link is the distance in bytes from the link itself to the
+ * node, and 0 for NULL. A heap whose nodes and "binary_heap_t" are all
+ * inside one block of memory (e.g. a file or a shared memory segment
+ * mapped with mmap()) then stays valid when the block is mapped at
+ * another address, with no fixup. A link is only valid at the address
+ * where it was written: a node or a heap MUST NOT be copied unless the
+ * whole block is copied. "compare_func" is still an absolute pointer
+ * and MUST be set again by the process that maps the block.
+ * The library and all the code that includes this file MUST be compiled
+ * with the same setting of BINARY_HEAP_RELATIVE_NODE
+ */
+#ifdef BINARY_HEAP_RELATIVE_NODE
+typedef intptr_t binary_heap_link_t;
+#else
+typedef struct binary_heap_node_t_ *binary_heap_link_t;
+#endif
+
+/*
+ * A single node. Do NOT access the links directly, use
+ * binary_heap_link_get()
  */
 typedef struct binary_heap_node_t_ {
-  struct binary_heap_node_t_* left;
-  struct binary_heap_node_t_* right;
-  struct binary_heap_node_t_* parent;
+  binary_heap_link_t left;
+  binary_heap_link_t right;
+  binary_heap_link_t parent;
 } binary_heap_node_t;
 
+/*
+ * Read a link
+ */
+static inline binary_heap_node_t *
+binary_heap_link_get(const binary_heap_link_t *link)
+{
+#ifdef BINARY_HEAP_RELATIVE_NODE
+  return (*link == 0 ? NULL : (binary_heap_node_t *)((uintptr_t)link + *link));
+#else
+  return (*link);
+#endif
+}
+
+/*
+ * Write a link
+ */
+static inline void
+binary_heap_link_set(binary_heap_link_t *link, binary_heap_node_t *node)
+{
+#ifdef BINARY_HEAP_RELATIVE_NODE
+  *link = (node == NULL ? 0 :
+           (intptr_t)((uintptr_t)node - (uintptr_t)link));
+#else
+  *link = node;
+#endif
+}
+
 
 /**
  * Heap type.  
@@ -122,7 +171,7 @@ typedef struct _binary_heap_t_ {
   binary_heap_type_t heap_type;
   uint32_t num_entries;
   binary_heap_compare_func compare_func;
-  binary_heap_node_t *min;
+  binary_heap_link_t min;
 } binary_heap_t;
 
 /**
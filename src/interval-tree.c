@@ -0,0 +1,221 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ See comments in "interval-tree.h"
+
+ */
+
+#include "interval-tree.h"
+
+/* Interval tree */
+
+#define INTERVAL_NODE_TO_VALUE(tree, tree_node)                       \
+  ((AVLTreeValue)((uintptr_t)(tree_node) - (tree)->tree.node_offset))
+
+static inline IntervalTreeNode *interval_tree_node(AVLTreeNode *node)
+{
+  return ((IntervalTreeNode *)node);
+}
+
+static inline AVLTreeNode *interval_tree_child(AVLTreeNode *node, int side)
+{
+  return (avl_tree_link_get(&node->children[side]));
+}
+
+static inline AVLTreeKey interval_tree_low(IntervalTree *tree,
+                                           AVLTreeNode *node)
+{
+  return (tree->tree.key_func(INTERVAL_NODE_TO_VALUE(tree, node),
+                              tree->tree.key_context));
+}
+
+static inline AVLTreeKey interval_tree_high(IntervalTree *tree,
+                                            AVLTreeNode *node)
+{
+  return (tree->high_key_func(INTERVAL_NODE_TO_VALUE(tree, node),
+                              tree->tree.key_context));
+}
+
+/* Augment function: the largest "high" of the node and its children */
+
+static void interval_tree_augment(AVLTreeNode *node, void *context)
+{
+  IntervalTree *tree = context;
+  AVLTreeNode *child;
+  AVLTreeKey max_high;
+  int side;
+
+  max_high = interval_tree_high(tree, node);
+  for (side = 0; side < 2; side++) {
+    child = interval_tree_child(node, side);
+    if (child != NULL &&
+        tree->tree.compare_func(interval_tree_node(child)->max_high,
+                                max_high) > 0) {
+      max_high = interval_tree_node(child)->max_high;
+    }
+  }
+  interval_tree_node(node)->max_high = max_high;
+}
+
+IntervalTree *interval_tree_new(IntervalTree *new_tree,
+                                intptr_t node_offset,
+                                AVLTreeCompareFunc compare_func,
+                                AVLTreeKeyFunc low_key_func,
+                                AVLTreeKeyFunc high_key_func,
+                                void *key_context,
+                                AVLTreeFreeFunc free_func,
+                                void *free_context)
+{
+  if (new_tree == NULL || high_key_func == NULL ||
+      avl_tree_new(&new_tree->tree, node_offset, compare_func, low_key_func,
+                   key_context, free_func, free_context) == NULL) {
+    return (NULL);
+  }
+  new_tree->high_key_func = high_key_func;
+  avl_tree_set_augment(&new_tree->tree, interval_tree_augment, new_tree);
+  return (new_tree);
+}
+
+void interval_tree_insert(IntervalTree *tree, IntervalTreeNode *new_node)
+{
+  AVLTreeNode *node = avl_tree_root_node(&tree->tree);
+  AVLTreeNode *parent = NULL;
+  AVLTreeNodeSide side = AVL_TREE_NODE_LEFT;
+  AVLTreeKey low;
+  int diff;
+
+  /* Order by "low" then by address, so that there is never a tie */
+  low = interval_tree_low(tree, &new_node->node);
+  while (node != NULL) {
+    diff = tree->tree.compare_func(low, interval_tree_low(tree, node));
+    if (diff == 0) {
+      diff = (((uintptr_t)&new_node->node > (uintptr_t)node) -
+              ((uintptr_t)&new_node->node < (uintptr_t)node));
+    }
+    parent = node;
+    side = diff < 0 ? AVL_TREE_NODE_LEFT : AVL_TREE_NODE_RIGHT;
+    node = interval_tree_child(node, side);
+  }
+  avl_tree_link_node(&tree->tree, parent, side, &new_node->node);
+}
+
+void interval_tree_remove(IntervalTree *tree, IntervalTreeNode *node)
+{
+  avl_tree_remove_node(&tree->tree, &node->node);
+}
+
+/* Whether the subtree of "node" may hold an interval that ends at or
+ * after "low" */
+
+static inline bool interval_tree_may_reach(IntervalTree *tree,
+                                           AVLTreeNode *node,
+                                           AVLTreeKey low)
+{
+  return (node != NULL &&
+          tree->tree.compare_func(interval_tree_node(node)->max_high,
+                                  low) >= 0);
+}
+
+/* Go down to the first node of the subtree of "node" in ascending order
+ * of "low" whose left subtree has nothing that reaches "low" */
+
+static AVLTreeNode *interval_tree_descend(IntervalTree *tree,
+                                          AVLTreeNode *node,
+                                          AVLTreeKey low)
+{
+  while (interval_tree_may_reach(
+           tree, interval_tree_child(node, AVL_TREE_NODE_LEFT), low)) {
+    node = interval_tree_child(node, AVL_TREE_NODE_LEFT);
+  }
+  return (node);
+}
+
+/* Next node after "node" in ascending order of "low", skipping the
+ * subtrees that do not reach "low" */
+
+static AVLTreeNode *interval_tree_step(IntervalTree *tree,
+                                       AVLTreeNode *node,
+                                       AVLTreeKey low)
+{
+  AVLTreeNode *right = interval_tree_child(node, AVL_TREE_NODE_RIGHT);
+  AVLTreeNode *parent;
+
+  if (interval_tree_may_reach(tree, right, low)) {
+    return (interval_tree_descend(tree, right, low));
+  }
+  parent = avl_tree_node_parent(node);
+  while (parent != NULL &&
+         interval_tree_child(parent, AVL_TREE_NODE_RIGHT) == node) {
+    node = parent;
+    parent = avl_tree_node_parent(node);
+  }
+  return (parent);
+}
+
+/*
+ * Walk from "node" with interval_tree_step() and return the first node
+ * that overlaps [low, high].
+ * Stops at the first node that starts after "high": every node after it
+ * in the order starts after "high" as well
+ */
+static AVLTreeNode *interval_tree_scan(IntervalTree *tree,
+                                       AVLTreeNode *node,
+                                       AVLTreeKey low,
+                                       AVLTreeKey high)
+{
+  while (node != NULL) {
+    if (tree->tree.compare_func(interval_tree_low(tree, node), high) > 0) {
+      return (NULL);
+    }
+    if (tree->tree.compare_func(interval_tree_high(tree, node), low) >= 0) {
+      return (node);
+    }
+    node = interval_tree_step(tree, node, low);
+  }
+  return (NULL);
+}
+
+IntervalTreeNode *interval_tree_overlap_first(IntervalTree *tree,
+                                              AVLTreeKey low,
+                                              AVLTreeKey high)
+{
+  AVLTreeNode *root = avl_tree_root_node(&tree->tree);
+
+  if (!interval_tree_may_reach(tree, root, low)) {
+    return (NULL);
+  }
+  return (interval_tree_node(
+            interval_tree_scan(tree, interval_tree_descend(tree, root, low),
+                               low, high)));
+}
+
+IntervalTreeNode *interval_tree_overlap_next(IntervalTree *tree,
+                                             IntervalTreeNode *node,
+                                             AVLTreeKey low,
+                                             AVLTreeKey high)
+{
+  return (interval_tree_node(
+            interval_tree_scan(tree,
+                               interval_tree_step(tree, &node->node, low),
+                               low, high)));
+}
+
+IntervalTreeNode *interval_tree_stab(IntervalTree *tree, AVLTreeKey point)
+{
+  return (interval_tree_overlap_first(tree, point, point));
+}
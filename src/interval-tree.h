@@ -0,0 +1,156 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+ */
+
+/** @file interval-tree.h
+ *
+ * @brief Intrusive interval tree on top of the AVL tree
+ *
+ * Every entry is a closed interval [low, high] with low <= high. Both
+ * ends are keys inside the user structure, returned by two key functions
+ * and ordered by one compare function, exactly like the key of an
+ * "AVLTree".
+ *
+ * The entries are kept in an AVL tree ordered by "low". Entries with the
+ * same "low" are allowed and are ordered by the address of their node.
+ * Every node also keeps a pointer to the largest "high" in its subtree
+ * (an augment function, see avl_tree_set_augment()), so a search skips
+ * every subtree whose intervals all end before the query starts.
+ *
+ * The intervals that overlap [low, high] are enumerated in ascending
+ * order of "low" with interval_tree_overlap_first() and
+ * interval_tree_overlap_next(). Each step climbs or descends through the
+ * parent pointers only into subtrees that may hold an overlap, and the
+ * enumeration stops at the first node starting after "high". Finding the
+ * first overlap is O(log n). Enumerating "k" overlaps visits the union
+ * of their paths from the root, which is O(log n + k * log(n / k)) and
+ * O(log n + k) when the overlaps are next to each other in the tree.
+ *
+ * The "AVLTree" inside @ref IntervalTree is a regular tree: any function
+ * of "avl-tree.h" that does not insert (e.g. avl_tree_num_entries(),
+ * avl_tree_walk(), avl_tree_remove_node()) can be used on "&tree->tree".
+ * The "AVLTreeNode" is the first field of @ref IntervalTreeNode.
+ *
+ * The ends of an interval MUST NOT be modified while it is in the tree.
+ * The @ref IntervalTree MUST NOT be moved or copied after
+ * interval_tree_new() because the tree keeps a pointer to it
+ */
+
+#ifndef ALGORITHM_INTERVAL_TREE_H
+#define ALGORITHM_INTERVAL_TREE_H
+
+#include "avl-tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A node of an interval tree
+ */
+typedef struct _IntervalTreeNode {
+  AVLTreeNode node;
+  AVLTreeKey max_high; /* Largest "high" in the subtree. Read only */
+} IntervalTreeNode;
+
+/**
+ * An interval tree
+ */
+typedef struct _IntervalTree {
+  AVLTree tree;
+  AVLTreeKeyFunc high_key_func;
+} IntervalTree;
+
+/**
+ * Create a new interval tree
+ *
+ * @param new_tree      Pointer passed to us by the caller to be populated
+ * @param node_offset   Offset of the @ref IntervalTreeNode field from the
+ *                      beginning of the user structure. Same meaning as
+ *                      in avl_tree_new()
+ * @param compare_func  Function to compare two ends of intervals
+ * @param low_key_func  Function to get the pointer to the low end given
+ *                      the beginning of the user structure
+ * @param high_key_func Function to get the pointer to the high end given
+ *                      the beginning of the user structure
+ * @param key_context   Opaque context passed to both key functions
+ * @param free_func     Function used to free a node. Optional
+ * @param free_context  Opaque context passed to the free_func
+ *
+ * @return              The argument "new_tree", or NULL on error
+ */
+IntervalTree *interval_tree_new(IntervalTree *new_tree,
+                                intptr_t node_offset,
+                                AVLTreeCompareFunc compare_func,
+                                AVLTreeKeyFunc low_key_func,
+                                AVLTreeKeyFunc high_key_func,
+                                void *key_context,
+                                AVLTreeFreeFunc free_func,
+                                void *free_context);
+
+/**
+ * Insert an interval. Both ends MUST already be set in the user
+ * structure. Never fails, even if an identical interval is in the tree
+ */
+void interval_tree_insert(IntervalTree *tree, IntervalTreeNode *new_node);
+
+/**
+ * Remove an interval from the tree
+ */
+void interval_tree_remove(IntervalTree *tree, IntervalTreeNode *node);
+
+/**
+ * Find the interval with the smallest "low" that overlaps [low, high],
+ * i.e. whose "low" is less than or equal to "high" and whose "high" is
+ * greater than or equal to "low". O(log n)
+ *
+ * @return              The node, or NULL if no interval overlaps
+ */
+IntervalTreeNode *interval_tree_overlap_first(IntervalTree *tree,
+                                              AVLTreeKey low,
+                                              AVLTreeKey high);
+
+/**
+ * Find the next interval that overlaps [low, high] after "node" in
+ * ascending order of "low". "low" and "high" MUST be the ones passed to
+ * interval_tree_overlap_first(). The tree MUST NOT be modified between
+ * the calls, except by removing the last node returned AFTER calling this
+ * function.
+ *
+ * @return              The node, or NULL if there is no more overlap
+ */
+IntervalTreeNode *interval_tree_overlap_next(IntervalTree *tree,
+                                             IntervalTreeNode *node,
+                                             AVLTreeKey low,
+                                             AVLTreeKey high);
+
+/**
+ * Find the interval with the smallest "low" that contains "point". The
+ * next ones are found with
+ *   interval_tree_overlap_next(tree, node, point, point)
+ *
+ * @return              The node, or NULL if no interval contains "point"
+ */
+IntervalTreeNode *interval_tree_stab(IntervalTree *tree, AVLTreeKey point);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* #ifndef ALGORITHM_INTERVAL_TREE_H */
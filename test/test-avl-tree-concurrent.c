@@ -0,0 +1,354 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the AVL tree with concurrent writers
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "avl-tree-concurrent.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 1000
+#define NUM_WRITERS 3
+#define NUM_READERS 2
+#define NUM_UPDATES 20000
+#define NUM_CONTENDED_WRITERS 8
+#define NUM_CONTENDED_KEYS 64
+#define NUM_CONTENDED_UPDATES 20000
+
+struct int_array_t {
+  char dummy[2]; /* field so that we have a non-zero offset to the node */
+  int value;
+  AVLTreeConcurrentNode node;
+};
+
+struct int_array_t test_array[NUM_TEST_VALUES];
+
+/* Which entries are in the tree */
+bool test_in_tree[NUM_TEST_VALUES];
+
+AVLTreeConcurrent test_tree;
+
+/* Set when the writers are done */
+bool test_stop;
+
+/* Fresh nodes of the contended test, never reused. Writer "w" takes its
+ * nodes from "test_pool[w]" */
+struct int_array_t test_pool[NUM_CONTENDED_WRITERS][NUM_CONTENDED_UPDATES];
+
+/* Successful inserts minus successful removes of every key */
+int test_key_count[NUM_CONTENDED_KEYS];
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+#define TEST_NODE_TO_VAL(x) \
+  ((struct int_array_t *)((uintptr_t)(x) - offsetof(struct int_array_t, node)))
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+static AVLTreeConcurrent *create_tree(void)
+{
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = i;
+    test_in_tree[i] = false;
+  }
+  ASSERT(avl_tree_concurrent_new(&test_tree,
+                                 offsetof(struct int_array_t, node),
+                                 int_compare, value2key, NULL) == &test_tree);
+  return (&test_tree);
+}
+
+/* Check the order, the parents, the heights and the balance. Returns the
+ * height */
+static int validate_subtree(AVLTreeConcurrentNode *node,
+                            AVLTreeConcurrentNode *parent, int *last,
+                            int *count)
+{
+  int left, right;
+
+  if (node == NULL) {
+    return (0);
+  }
+  ASSERT(node->parent == parent);
+  left = validate_subtree(node->children[AVL_TREE_NODE_LEFT], node, last,
+                          count);
+  ASSERT(TEST_NODE_TO_VAL(node)->value > *last);
+  *last = TEST_NODE_TO_VAL(node)->value;
+  ASSERT(test_in_tree[*last]);
+  (*count)++;
+  right = validate_subtree(node->children[AVL_TREE_NODE_RIGHT], node, last,
+                           count);
+  ASSERT(left - right <= 1 && right - left <= 1);
+  ASSERT(node->height == (left > right ? left : right) + 1);
+  return (node->height);
+}
+
+/* The tree holds the entries of "test_in_tree" */
+static void validate_tree(AVLTreeConcurrent *tree)
+{
+  int i, count = 0, last = -1, num_in_tree = 0;
+
+  validate_subtree(tree->holder.children[AVL_TREE_NODE_RIGHT], &tree->holder,
+                   &last, &count);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT(avl_tree_concurrent_lookup(tree, &i) ==
+           (test_in_tree[i] ? &test_array[i].node : NULL));
+    num_in_tree += test_in_tree[i];
+  }
+  ASSERT(count == num_in_tree);
+  ASSERT(avl_tree_concurrent_num_entries(tree) == num_in_tree);
+}
+
+/* Insert or remove entry "i" */
+static void toggle(AVLTreeConcurrent *tree, int i)
+{
+  if (test_in_tree[i]) {
+    ASSERT(avl_tree_concurrent_remove(tree, &i) == &test_array[i].node);
+  } else {
+    ASSERT(avl_tree_concurrent_insert(tree, &test_array[i].node) ==
+           &test_array[i].node);
+  }
+  test_in_tree[i] = !test_in_tree[i];
+}
+
+void test_avl_tree_concurrent_insert_remove(void)
+{
+  AVLTreeConcurrent *tree = create_tree();
+  int i, key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  srandom(NUM_TEST_VALUES);
+  for (i = 0; i < 4 * NUM_TEST_VALUES; i++) {
+    toggle(tree, random() % NUM_TEST_VALUES);
+    if (i % 100 == 0) {
+      validate_tree(tree);
+    }
+  }
+  validate_tree(tree);
+
+  /* Duplicates and missing keys change nothing */
+  for (key = 0; !test_in_tree[key]; key++) {
+  }
+  ASSERT(avl_tree_concurrent_insert(tree, &test_array[key].node) == NULL);
+  for (key = 0; test_in_tree[key]; key++) {
+  }
+  ASSERT(avl_tree_concurrent_remove(tree, &key) == NULL);
+  key = NUM_TEST_VALUES;
+  ASSERT(avl_tree_concurrent_lookup(tree, &key) == NULL);
+
+  /* Sorted inserts, then removes from both ends */
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    if (test_in_tree[i]) {
+      toggle(tree, i);
+    }
+  }
+  validate_tree(tree);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    toggle(tree, i);
+  }
+  validate_tree(tree);
+  for (i = 0; i < NUM_TEST_VALUES / 2; i++) {
+    toggle(tree, i);
+    toggle(tree, NUM_TEST_VALUES - 1 - i);
+  }
+  validate_tree(tree);
+  ASSERT(tree->holder.children[AVL_TREE_NODE_RIGHT] == NULL);
+}
+
+/* Writer "w" toggles the entries whose index is w + 1 modulo 4 */
+static void *writer(void *arg)
+{
+  int w = (int)(uintptr_t)arg, i;
+  uint32_t seed = w;
+
+  for (i = 0; i < NUM_UPDATES; i++) {
+    seed = seed * 1103515245 + 12345;
+    toggle(&test_tree, 4 * ((seed >> 16) % (NUM_TEST_VALUES / 4)) + w + 1);
+  }
+  return (NULL);
+}
+
+/* The entries whose index is a multiple of 4 are always in the tree */
+static void *reader(void *arg)
+{
+  AVLTreeConcurrentNode *node;
+  uint32_t i = 0;
+  int key;
+
+  while (!__atomic_load_n(&test_stop, __ATOMIC_RELAXED)) {
+    key = 4 * ((i * 7919) % (NUM_TEST_VALUES / 4));
+    node = avl_tree_concurrent_lookup(&test_tree, &key);
+    ASSERT(node == &test_array[key].node);
+    key = NUM_TEST_VALUES + i % 10;
+    ASSERT(avl_tree_concurrent_lookup(&test_tree, &key) == NULL);
+    i++;
+  }
+  return (NULL);
+}
+
+void test_avl_tree_concurrent_threads(void)
+{
+  pthread_t writer_threads[NUM_WRITERS], reader_threads[NUM_READERS];
+  uintptr_t i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  create_tree();
+  for (i = 0; i < NUM_TEST_VALUES; i += 4) {
+    toggle(&test_tree, i);
+  }
+
+  test_stop = false;
+  for (i = 0; i < NUM_READERS; i++) {
+    ASSERT(pthread_create(&reader_threads[i], NULL, reader, NULL) == 0);
+  }
+  for (i = 0; i < NUM_WRITERS; i++) {
+    ASSERT(pthread_create(&writer_threads[i], NULL, writer, (void *)i) == 0);
+  }
+  for (i = 0; i < NUM_WRITERS; i++) {
+    pthread_join(writer_threads[i], NULL);
+  }
+  __atomic_store_n(&test_stop, true, __ATOMIC_RELAXED);
+  for (i = 0; i < NUM_READERS; i++) {
+    pthread_join(reader_threads[i], NULL);
+  }
+
+  /* Balanced again once all the updates returned */
+  validate_tree(&test_tree);
+}
+
+/* Writer "w" inserts and removes random keys that the other writers
+ * also use, with a new node for every insert */
+static void *contended_writer(void *arg)
+{
+  int w = (int)(uintptr_t)arg, i, key, num_used = 0;
+  uint32_t seed = w;
+  AVLTreeConcurrentNode *node;
+  struct int_array_t *value;
+
+  for (i = 0; i < NUM_CONTENDED_UPDATES; i++) {
+    seed = seed * 1103515245 + 12345;
+    key = (seed >> 16) % NUM_CONTENDED_KEYS;
+    if ((seed >> 8) & 1) {
+      value = &test_pool[w][num_used];
+      value->value = key;
+      node = avl_tree_concurrent_insert(&test_tree, &value->node);
+      ASSERT(node == NULL || node == &value->node);
+      if (node != NULL) {
+        num_used++;
+        __atomic_add_fetch(&test_key_count[key], 1, __ATOMIC_RELAXED);
+      }
+    } else {
+      node = avl_tree_concurrent_remove(&test_tree, &key);
+      if (node != NULL) {
+        ASSERT(TEST_NODE_TO_VAL(node)->value == key);
+        __atomic_sub_fetch(&test_key_count[key], 1, __ATOMIC_RELAXED);
+      }
+    }
+  }
+  return (NULL);
+}
+
+void test_avl_tree_concurrent_contended(void)
+{
+  pthread_t writer_threads[NUM_CONTENDED_WRITERS];
+  AVLTreeConcurrentNode *node;
+  int key, count = 0, last = -1, num_in_tree = 0;
+  uintptr_t i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  create_tree();
+  memset(test_pool, 0, sizeof(test_pool));
+  memset(test_key_count, 0, sizeof(test_key_count));
+  for (i = 0; i < NUM_CONTENDED_WRITERS; i++) {
+    ASSERT(pthread_create(&writer_threads[i], NULL, contended_writer,
+                          (void *)i) == 0);
+  }
+  for (i = 0; i < NUM_CONTENDED_WRITERS; i++) {
+    pthread_join(writer_threads[i], NULL);
+  }
+
+  /* Every key is in the tree once if it was inserted once more than it
+   * was removed, and the tree is ordered and balanced */
+  for (key = 0; key < NUM_CONTENDED_KEYS; key++) {
+    ASSERT(test_key_count[key] == 0 || test_key_count[key] == 1);
+    test_in_tree[key] = (test_key_count[key] == 1);
+    node = avl_tree_concurrent_lookup(&test_tree, &key);
+    ASSERT((node != NULL) == test_in_tree[key]);
+    ASSERT(node == NULL || TEST_NODE_TO_VAL(node)->value == key);
+    num_in_tree += test_in_tree[key];
+  }
+  validate_subtree(test_tree.holder.children[AVL_TREE_NODE_RIGHT],
+                   &test_tree.holder, &last, &count);
+  ASSERT(count == num_in_tree);
+  ASSERT(avl_tree_concurrent_num_entries(&test_tree) == num_in_tree);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_concurrent_insert_remove,
+  test_avl_tree_concurrent_threads,
+  test_avl_tree_concurrent_contended,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
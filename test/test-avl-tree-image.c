@@ -0,0 +1,248 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the file image of the AVL tree
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "avl-tree-image.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 1000
+
+struct int_array_t {
+  char dummy[2]; /* field so that we have a non-zero offset to the node */
+  int value;
+  AVLTreeNode node;
+};
+
+/* The arena */
+struct int_array_t test_array[NUM_TEST_VALUES] __attribute__ ((aligned (64)));
+
+char test_path[] = "/tmp/test-avl-tree-image-XXXXXX";
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+static AVLTree *new_tree(AVLTree *tree_struct)
+{
+  return (avl_tree_new(tree_struct, offsetof(struct int_array_t, node),
+                       int_compare, value2key, NULL, NULL, NULL));
+}
+
+/* Tree of the first "num_values" entries, with the values 0, 2, 4... */
+static AVLTree *create_tree(AVLTree *tree_struct, int num_values)
+{
+  AVLTree *tree;
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = new_tree(tree_struct);
+  for (i = 0; i < num_values; i++) {
+    test_array[i].value = 2 * i;
+    ASSERT(avl_tree_insert(tree, &test_array[i].node) == &test_array[i].node);
+  }
+  return (tree);
+}
+
+/* The opened tree has the same entries, in the nodes of the mapping */
+static void check_image(AVLTree *tree, AVLTreeImage *image, int num_values)
+{
+  struct int_array_t *arena = image->arena;
+  AVLTreeNode *node;
+  int i, key;
+
+  ASSERT(image->arena_size == sizeof(test_array));
+  ASSERT(avl_tree_num_entries(tree) == num_values);
+  for (i = 0, node = avl_tree_min(tree); i < num_values;
+       i++, node = avl_tree_node_next(node)) {
+    ASSERT(node == &arena[i].node);
+    ASSERT(avl_tree_node_parent(node) == NULL ||
+           avl_tree_node_child(avl_tree_node_parent(node),
+                               AVL_TREE_NODE_LEFT) == node ||
+           avl_tree_node_child(avl_tree_node_parent(node),
+                               AVL_TREE_NODE_RIGHT) == node);
+    key = 2 * i;
+    ASSERT(avl_tree_lookup(tree, &key) == node);
+  }
+  ASSERT(node == NULL);
+}
+
+/* Overwrite "size" bytes of the file at "offset" */
+static void patch_file(off_t offset, const void *data, size_t size)
+{
+  int fd = open(test_path, O_WRONLY);
+
+  ASSERT(fd >= 0);
+  ASSERT(pwrite(fd, data, size, offset) == size);
+  close(fd);
+}
+
+void test_avl_tree_image_save_open(void)
+{
+  AVLTree *tree, tree_struct, image_tree;
+  AVLTreeImage image;
+  int num_values, i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  for (num_values = 0; num_values <= NUM_TEST_VALUES;
+       num_values += (num_values < 10 ? 1 : 199)) {
+    tree = create_tree(&tree_struct, num_values);
+    ASSERT(avl_tree_image_save(tree, test_array, sizeof(test_array),
+                               test_path));
+
+    /* The original arena is still there, so the image moves */
+    ASSERT(avl_tree_image_open(&image, new_tree(&image_tree), test_path,
+                               num_values % 2) == &image_tree);
+    check_image(&image_tree, &image, num_values);
+
+    /* The opened tree can be modified */
+    for (i = 0; i < num_values; i += 3) {
+      ASSERT(avl_tree_remove(&image_tree, &((struct int_array_t *)
+                                            image.arena)[i].value) == 1);
+    }
+    ASSERT(avl_tree_num_entries(&image_tree) ==
+           num_values - (num_values + 2) / 3);
+    avl_tree_image_close(&image);
+
+    /* But the file is not */
+    ASSERT(avl_tree_image_open(&image, new_tree(&image_tree), test_path,
+                               true) == &image_tree);
+    check_image(&image_tree, &image, num_values);
+    avl_tree_image_close(&image);
+  }
+}
+
+void test_avl_tree_image_errors(void)
+{
+  AVLTree *tree, tree_struct, image_tree;
+  AVLTreeImage image;
+  AVLTreeNode outside;
+  uint32_t version = AVL_TREE_IMAGE_VERSION + 1;
+  int value = 12345;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* The root MUST be in the arena. The largest node is never the root */
+  tree = create_tree(&tree_struct, 10);
+  ASSERT(!avl_tree_image_save(tree, &test_array[9],
+                              sizeof(test_array[9]), test_path));
+  ASSERT(errno == EINVAL);
+  ASSERT(avl_tree_image_save(tree, test_array, sizeof(test_array),
+                             test_path));
+
+  /* The tree MUST be empty */
+  memset(&outside, 0, sizeof(outside));
+  new_tree(&image_tree);
+  ASSERT(avl_tree_insert(&image_tree, &outside) == &outside);
+  ASSERT(avl_tree_image_open(&image, &image_tree, test_path, false) == NULL);
+  ASSERT(errno == EINVAL);
+
+  /* Different node offset */
+  avl_tree_new(&image_tree, 0, int_compare, value2key, NULL, NULL, NULL);
+  ASSERT(avl_tree_image_open(&image, &image_tree, test_path, false) == NULL);
+
+  /* A modified arena is only seen with the checksum */
+  patch_file(AVL_TREE_IMAGE_HEADER_SIZE + offsetof(struct int_array_t, value),
+             &value, sizeof(value));
+  ASSERT(avl_tree_image_open(&image, new_tree(&image_tree), test_path,
+                             true) == NULL);
+  ASSERT(avl_tree_num_entries(&image_tree) == 0);
+  ASSERT(avl_tree_image_open(&image, &image_tree, test_path,
+                             false) == &image_tree);
+  avl_tree_image_close(&image);
+
+  /* Unknown version */
+  patch_file(offsetof(AVLTreeImageHeader, version), &version,
+             sizeof(version));
+  ASSERT(avl_tree_image_open(&image, new_tree(&image_tree), test_path,
+                             false) == NULL);
+  ASSERT(errno == EINVAL);
+
+  /* Truncated */
+  ASSERT(avl_tree_image_save(tree, test_array, sizeof(test_array),
+                             test_path));
+  ASSERT(truncate(test_path, AVL_TREE_IMAGE_HEADER_SIZE + 100) == 0);
+  ASSERT(avl_tree_image_open(&image, new_tree(&image_tree), test_path,
+                             false) == NULL);
+  ASSERT(errno == EINVAL);
+
+  ASSERT(avl_tree_image_open(&image, new_tree(&image_tree),
+                             "/nonexistent/avl-tree-image", false) == NULL);
+  ASSERT(errno == ENOENT);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_image_save_open,
+  test_avl_tree_image_errors,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  int fd = mkstemp(test_path);
+
+  if (fd < 0) {
+    print_error("\nCannot create '%s'\n", test_path);
+    return 1;
+  }
+  close(fd);
+  run_tests(tests);
+  unlink(test_path);
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,388 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the persistent AVL tree
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <sched.h>
+
+#include "avl-tree-persistent.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 500
+#define NUM_POOL_NODES 20000
+#define NUM_READERS 2
+#define NUM_UPDATES 20000
+
+struct int_array_t {
+  int value;
+};
+
+struct int_array_t test_array[NUM_TEST_VALUES];
+
+/* Which entries are in the latest version */
+bool test_in_tree[NUM_TEST_VALUES];
+
+/* Pool of nodes, with a free list linked through the left child */
+struct test_pool_t {
+  AVLTreePersistentNode nodes[NUM_POOL_NODES];
+  AVLTreePersistentNode *free_list;
+  uint32_t num_used;
+  uint32_t max_used;              /* The pool is empty beyond this */
+};
+
+struct test_pool_t test_pool;
+
+AVLTreePersistentReader test_readers[NUM_READERS];
+
+AVLTreePersistent test_tree;
+
+/* Set when the readers are done */
+bool test_stop;
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+static AVLTreePersistentNode *pool_alloc(void *pool)
+{
+  struct test_pool_t *test_pool = pool;
+  AVLTreePersistentNode *node = test_pool->free_list;
+
+  if (node == NULL || test_pool->num_used >= test_pool->max_used) {
+    return (NULL);
+  }
+  test_pool->free_list = node->children[0];
+  test_pool->num_used++;
+  return (node);
+}
+
+static void pool_free(void *pool, AVLTreePersistentNode *node)
+{
+  struct test_pool_t *test_pool = pool;
+
+  node->children[0] = test_pool->free_list;
+  test_pool->free_list = node;
+  test_pool->num_used--;
+}
+
+static AVLTreePersistent *create_tree(void)
+{
+  int i;
+
+  memset(&test_pool, 0, sizeof(test_pool));
+  for (i = 0; i < NUM_POOL_NODES; i++) {
+    pool_free(&test_pool, &test_pool.nodes[i]);
+  }
+  test_pool.num_used = 0;
+  test_pool.max_used = NUM_POOL_NODES;
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = i;
+    test_in_tree[i] = false;
+  }
+  ASSERT(avl_tree_persistent_new(&test_tree, int_compare, value2key, NULL,
+                                 pool_alloc, pool_free, &test_pool,
+                                 test_readers, NUM_READERS) == &test_tree);
+  return (&test_tree);
+}
+
+/* Check the order, the heights, the sizes and the balance. Returns the
+ * height */
+static int validate_subtree(const AVLTreePersistentNode *node, int *last)
+{
+  int left, right;
+
+  if (node == NULL) {
+    return (0);
+  }
+  left = validate_subtree(node->children[0], last);
+  ASSERT(((struct int_array_t *)node->value)->value > *last);
+  *last = ((struct int_array_t *)node->value)->value;
+  right = validate_subtree(node->children[1], last);
+  ASSERT(left - right <= 1 && right - left <= 1);
+  ASSERT(node->height == (left > right ? left : right) + 1);
+  ASSERT(node->size == (node->children[0] ? node->children[0]->size : 0) +
+         (node->children[1] ? node->children[1]->size : 0) + 1);
+  return (node->height);
+}
+
+/* The version holds the entries of "in_tree" */
+static void check_snapshot(AVLTreePersistentSnapshot *snapshot,
+                           const bool *in_tree)
+{
+  AVLTreePersistentCursor cursor;
+  struct int_array_t *value;
+  int i, count = 0, last = -1;
+
+  validate_subtree(snapshot->root, &last);
+  value = avl_tree_persistent_cursor_first(&cursor, snapshot, NULL);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT(avl_tree_persistent_lookup(snapshot, &i) ==
+           (in_tree[i] ? &test_array[i] : NULL));
+    if (in_tree[i]) {
+      ASSERT(value == &test_array[i]);
+      value = avl_tree_persistent_cursor_next(&cursor);
+      count++;
+    }
+  }
+  ASSERT(value == NULL);
+  ASSERT(avl_tree_persistent_num_entries(snapshot) == count);
+}
+
+/* Insert or remove entry "i" */
+static void toggle(AVLTreePersistent *tree, int i)
+{
+  AVLTreeValue removed = NULL;
+
+  if (test_in_tree[i]) {
+    ASSERT(avl_tree_persistent_remove(tree, &i, &removed) ==
+           AVL_TREE_PERSISTENT_OK);
+    ASSERT(removed == &test_array[i]);
+  } else {
+    ASSERT(avl_tree_persistent_insert(tree, &test_array[i]) ==
+           AVL_TREE_PERSISTENT_OK);
+  }
+  test_in_tree[i] = !test_in_tree[i];
+}
+
+void test_avl_tree_persistent_insert_remove(void)
+{
+  AVLTreePersistent *tree = create_tree();
+  AVLTreePersistentSnapshot snapshot;
+  AVLTreePersistentCursor cursor;
+  int i, key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  srandom(NUM_TEST_VALUES);
+  for (i = 0; i < 4 * NUM_TEST_VALUES; i++) {
+    toggle(tree, random() % NUM_TEST_VALUES);
+    if (i % 50 == 0) {
+      avl_tree_persistent_pin(&snapshot, tree, 0);
+      check_snapshot(&snapshot, test_in_tree);
+      avl_tree_persistent_unpin(&snapshot);
+    }
+  }
+
+  /* Duplicates and missing keys change nothing */
+  for (key = 0; !test_in_tree[key]; key++) {
+  }
+  ASSERT(avl_tree_persistent_insert(tree, &test_array[key]) ==
+         AVL_TREE_PERSISTENT_EXISTS);
+  for (key = 0; test_in_tree[key]; key++) {
+  }
+  ASSERT(avl_tree_persistent_remove(tree, &key, NULL) ==
+         AVL_TREE_PERSISTENT_NOT_FOUND);
+
+  /* Walk from a key */
+  avl_tree_persistent_pin(&snapshot, tree, 1);
+  for (key = 0; key < NUM_TEST_VALUES; key++) {
+    for (i = key; i < NUM_TEST_VALUES && !test_in_tree[i]; i++) {
+    }
+    ASSERT(avl_tree_persistent_cursor_first(&cursor, &snapshot, &key) ==
+           (i < NUM_TEST_VALUES ? &test_array[i] : NULL));
+  }
+  check_snapshot(&snapshot, test_in_tree);
+  avl_tree_persistent_unpin(&snapshot);
+
+  /* Nothing pinned: only the nodes of the latest version are used */
+  avl_tree_persistent_reclaim(tree);
+  avl_tree_persistent_pin(&snapshot, tree, 0);
+  ASSERT(test_pool.num_used == avl_tree_persistent_num_entries(&snapshot));
+  avl_tree_persistent_unpin(&snapshot);
+  avl_tree_persistent_free(tree);
+  ASSERT(test_pool.num_used == 0);
+}
+
+void test_avl_tree_persistent_pinned_version(void)
+{
+  AVLTreePersistent *tree = create_tree();
+  AVLTreePersistentSnapshot old_snapshot, snapshot;
+  bool old_in_tree[NUM_TEST_VALUES];
+  uint32_t num_used;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    toggle(tree, i);
+  }
+  memcpy(old_in_tree, test_in_tree, sizeof(old_in_tree));
+  avl_tree_persistent_pin(&old_snapshot, tree, 0);
+
+  /* The pinned version does not change, and its nodes are kept */
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    toggle(tree, (i * 7) % NUM_TEST_VALUES);
+  }
+  check_snapshot(&old_snapshot, old_in_tree);
+  avl_tree_persistent_pin(&snapshot, tree, 1);
+  check_snapshot(&snapshot, test_in_tree);
+  ASSERT(test_pool.num_used > avl_tree_persistent_num_entries(&snapshot) +
+         avl_tree_persistent_num_entries(&old_snapshot) / 2);
+
+  /* Until it is unpinned */
+  avl_tree_persistent_unpin(&old_snapshot);
+  avl_tree_persistent_reclaim(tree);
+  ASSERT(test_pool.num_used == avl_tree_persistent_num_entries(&snapshot));
+  check_snapshot(&snapshot, test_in_tree);
+
+  /* Out of nodes: the update fails and changes nothing */
+  num_used = test_pool.num_used;
+  test_pool.max_used = num_used + 3;
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    if (test_in_tree[i]) {
+      ASSERT(avl_tree_persistent_remove(tree, &i, NULL) ==
+             AVL_TREE_PERSISTENT_NO_MEMORY);
+    } else {
+      ASSERT(avl_tree_persistent_insert(tree, &test_array[i]) ==
+             AVL_TREE_PERSISTENT_NO_MEMORY);
+    }
+    ASSERT(test_pool.num_used == num_used);
+  }
+  avl_tree_persistent_unpin(&snapshot);
+  avl_tree_persistent_pin(&snapshot, tree, 1);
+  check_snapshot(&snapshot, test_in_tree);
+  avl_tree_persistent_unpin(&snapshot);
+
+  test_pool.max_used = NUM_POOL_NODES;
+  avl_tree_persistent_free(tree);
+  ASSERT(test_pool.num_used == 0);
+}
+
+/* Toggle the entries until the readers are done. A reader that keeps a
+ * version pinned for long can empty the pool, then wait for it */
+static void *writer(void *arg)
+{
+  AVLTreePersistentResult result;
+  uint32_t i = 0;
+  int key;
+
+  while (!__atomic_load_n(&test_stop, __ATOMIC_RELAXED)) {
+    key = (i * 7919) % NUM_TEST_VALUES;
+    if (test_in_tree[key]) {
+      result = avl_tree_persistent_remove(&test_tree, &key, NULL);
+    } else {
+      result = avl_tree_persistent_insert(&test_tree, &test_array[key]);
+    }
+    if (result == AVL_TREE_PERSISTENT_NO_MEMORY) {
+      sched_yield();
+      continue;
+    }
+    ASSERT(result == AVL_TREE_PERSISTENT_OK);
+    test_in_tree[key] = !test_in_tree[key];
+    i++;
+  }
+  return (NULL);
+}
+
+/* Every version is a valid tree, whatever the writer does */
+static void *reader(void *arg)
+{
+  uint32_t reader_index = (uint32_t)(uintptr_t)arg;
+  AVLTreePersistentSnapshot snapshot;
+  AVLTreePersistentCursor cursor;
+  struct int_array_t *value;
+  int i, count, last;
+
+  for (i = 0; i < NUM_UPDATES / 100; i++) {
+    avl_tree_persistent_pin(&snapshot, &test_tree, reader_index);
+    count = 0;
+    last = -1;
+    for (value = avl_tree_persistent_cursor_first(&cursor, &snapshot, NULL);
+         value != NULL; value = avl_tree_persistent_cursor_next(&cursor)) {
+      ASSERT(value->value > last);
+      ASSERT(avl_tree_persistent_lookup(&snapshot, &value->value) == value);
+      last = value->value;
+      count++;
+    }
+    ASSERT(count == avl_tree_persistent_num_entries(&snapshot));
+    avl_tree_persistent_unpin(&snapshot);
+  }
+  return (NULL);
+}
+
+void test_avl_tree_persistent_concurrent(void)
+{
+  pthread_t writer_thread, reader_threads[NUM_READERS];
+  uintptr_t i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  create_tree();
+  test_stop = false;
+  ASSERT(pthread_create(&writer_thread, NULL, writer, NULL) == 0);
+  for (i = 0; i < NUM_READERS; i++) {
+    ASSERT(pthread_create(&reader_threads[i], NULL, reader, (void *)i) == 0);
+  }
+  for (i = 0; i < NUM_READERS; i++) {
+    pthread_join(reader_threads[i], NULL);
+  }
+  __atomic_store_n(&test_stop, true, __ATOMIC_RELAXED);
+  pthread_join(writer_thread, NULL);
+
+  avl_tree_persistent_free(&test_tree);
+  ASSERT(test_pool.num_used == 0);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_persistent_insert_remove,
+  test_avl_tree_persistent_pinned_version,
+  test_avl_tree_persistent_concurrent,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
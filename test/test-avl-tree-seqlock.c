@@ -0,0 +1,258 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the AVL tree with lock-free readers
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "avl-tree-seqlock.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 1000
+#define NUM_READERS 3
+#define NUM_READS 20000
+
+struct int_array_t {
+  char dummy[2]; /* field so that we have a non-zero offset to the node */
+  int value;
+  AVLTreeNode node;
+};
+
+struct int_array_t test_array[NUM_TEST_VALUES];
+
+AVLTreeSeqlock test_seqlock;
+
+/* Set when the readers are done */
+bool test_stop;
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+#define TEST_NODE_TO_VAL(x) \
+  ((struct int_array_t *)((uintptr_t)(x) - offsetof(struct int_array_t, node)))
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+/* Tree with the values 0, 2, 4... */
+static AVLTreeSeqlock *create_tree(void)
+{
+  AVLTree *tree;
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  ASSERT(avl_tree_seqlock_new(&test_seqlock,
+                              offsetof(struct int_array_t, node),
+                              int_compare, value2key,
+                              NULL, NULL, NULL) == &test_seqlock);
+  tree = avl_tree_seqlock_write_lock(&test_seqlock);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = 2 * i;
+    ASSERT(avl_tree_insert(tree, &test_array[i].node) == &test_array[i].node);
+  }
+  avl_tree_seqlock_write_unlock(&test_seqlock);
+  return (&test_seqlock);
+}
+
+void test_avl_tree_seqlock_search(void)
+{
+  AVLTreeSeqlock *seqlock;
+  AVLTreeNode *node, *expected;
+  AVLTree *tree;
+  uint32_t sequence;
+  int key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  seqlock = create_tree();
+  tree = &seqlock->tree;
+  sequence = avl_tree_seqlock_read_begin(seqlock);
+  ASSERT(avl_tree_seqlock_num_entries(seqlock) == NUM_TEST_VALUES);
+  for (key = -1; key <= 2 * NUM_TEST_VALUES; key++) {
+    ASSERT(avl_tree_seqlock_lookup(seqlock, &key) ==
+           avl_tree_lookup(tree, &key));
+    ASSERT(avl_tree_seqlock_min_equal_or_greater(seqlock, &key) ==
+           avl_tree_min_equal_or_greater(tree, &key));
+    ASSERT(avl_tree_seqlock_max_equal_or_less(seqlock, &key) ==
+           avl_tree_max_equal_or_less(tree, &key));
+  }
+
+  /* Scans in both directions */
+  ASSERT(avl_tree_seqlock_min(seqlock) == avl_tree_min(tree));
+  ASSERT(avl_tree_seqlock_max(seqlock) == avl_tree_max(tree));
+  for (node = avl_tree_seqlock_min(seqlock), expected = avl_tree_min(tree);
+       expected != NULL; expected = avl_tree_node_next(expected)) {
+    ASSERT(node == expected);
+    node = avl_tree_seqlock_next(seqlock, node);
+  }
+  ASSERT(node == NULL);
+  for (node = avl_tree_seqlock_max(seqlock), expected = avl_tree_max(tree);
+       expected != NULL; expected = avl_tree_node_prev(expected)) {
+    ASSERT(node == expected);
+    node = avl_tree_seqlock_prev(seqlock, node);
+  }
+  ASSERT(node == NULL);
+  ASSERT(!avl_tree_seqlock_read_retry(seqlock, sequence));
+
+  /* A write in the middle of a read section */
+  sequence = avl_tree_seqlock_read_begin(seqlock);
+  avl_tree_seqlock_write_lock(seqlock);
+  avl_tree_seqlock_write_unlock(seqlock);
+  ASSERT(avl_tree_seqlock_read_retry(seqlock, sequence));
+  avl_tree_seqlock_destroy(seqlock);
+}
+
+/* Remove and insert again the odd entries until the readers are done */
+static void *writer(void *arg)
+{
+  AVLTree *tree;
+  int i = 1;
+
+  while (!__atomic_load_n(&test_stop, __ATOMIC_RELAXED)) {
+    tree = avl_tree_seqlock_write_lock(&test_seqlock);
+    avl_tree_remove_node(tree, &test_array[i].node);
+    avl_tree_insert(tree, &test_array[(i + 2) % NUM_TEST_VALUES].node);
+    avl_tree_seqlock_write_unlock(&test_seqlock);
+    i = (i + 2) % NUM_TEST_VALUES;
+  }
+  return (NULL);
+}
+
+/* The entries with an even index are always in the tree. Of those with
+ * an odd index only one is, so the next entry is one of two, and so is
+ * the previous one */
+static void *reader(void *arg)
+{
+  struct int_array_t *found, *after;
+  AVLTreeNode *node, *next, *prev, *min;
+  uint32_t sequence;
+  int i, key, value, after_value;
+
+  for (i = 0; i < NUM_READS; i++) {
+    key = 4 * ((i * 7919) % (NUM_TEST_VALUES / 2));
+    do {
+      sequence = avl_tree_seqlock_read_begin(&test_seqlock);
+      node = avl_tree_seqlock_lookup(&test_seqlock, &key);
+      found = (node == NULL ? NULL : TEST_NODE_TO_VAL(node));
+      value = (found == NULL ? -1 : found->value);
+      key++;
+      node = avl_tree_seqlock_min_equal_or_greater(&test_seqlock, &key);
+      key--;
+      after = (node == NULL ? NULL : TEST_NODE_TO_VAL(node));
+      after_value = (after == NULL ? -1 : after->value);
+      next = prev = NULL;
+      if (found != NULL) {
+        next = avl_tree_seqlock_next(&test_seqlock, &found->node);
+        prev = avl_tree_seqlock_prev(&test_seqlock, &found->node);
+      }
+      min = avl_tree_seqlock_min(&test_seqlock);
+    } while (avl_tree_seqlock_read_retry(&test_seqlock, sequence));
+
+    ASSERT(found == &test_array[key / 2] && value == key);
+    if (key < 2 * (NUM_TEST_VALUES - 2)) {
+      ASSERT((after == &test_array[key / 2 + 1] && after_value == key + 2) ||
+             (after == &test_array[key / 2 + 2] && after_value == key + 4));
+    }
+    ASSERT(next == (after == NULL ? NULL : &after->node));
+    if (key > 0) {
+      ASSERT(prev == &test_array[key / 2 - 1].node ||
+             prev == &test_array[key / 2 - 2].node);
+    } else {
+      ASSERT(prev == NULL);
+    }
+    ASSERT(min == &test_array[0].node);
+  }
+  return (NULL);
+}
+
+void test_avl_tree_seqlock_concurrent(void)
+{
+  pthread_t writer_thread, reader_threads[NUM_READERS];
+  AVLTree *tree;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  create_tree();
+
+  /* Start with the odd entries out of the tree, except one */
+  tree = avl_tree_seqlock_write_lock(&test_seqlock);
+  for (i = 3; i < NUM_TEST_VALUES; i += 2) {
+    avl_tree_remove_node(tree, &test_array[i].node);
+  }
+  avl_tree_seqlock_write_unlock(&test_seqlock);
+
+  test_stop = false;
+  ASSERT(pthread_create(&writer_thread, NULL, writer, NULL) == 0);
+  for (i = 0; i < NUM_READERS; i++) {
+    ASSERT(pthread_create(&reader_threads[i], NULL, reader, NULL) == 0);
+  }
+  for (i = 0; i < NUM_READERS; i++) {
+    pthread_join(reader_threads[i], NULL);
+  }
+  __atomic_store_n(&test_stop, true, __ATOMIC_RELAXED);
+  pthread_join(writer_thread, NULL);
+
+  ASSERT(avl_tree_num_entries(&test_seqlock.tree) == NUM_TEST_VALUES / 2 + 1);
+  avl_tree_seqlock_destroy(&test_seqlock);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_seqlock_search,
+  test_avl_tree_seqlock_concurrent,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
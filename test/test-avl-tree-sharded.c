@@ -0,0 +1,380 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the ordered map split by key ranges
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "avl-tree-sharded.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 1000
+#define NUM_SHARDS 4
+#define NUM_WRITERS 2
+#define NUM_UPDATES 20000
+
+struct int_array_t {
+  char dummy[2]; /* field so that we have a non-zero offset to the node */
+  int value;
+  AVLTreeNode node;
+};
+
+struct int_array_t test_array[NUM_TEST_VALUES];
+
+/* Which entries are in the map */
+bool test_in_map[NUM_TEST_VALUES];
+
+AVLTreeShard test_shards[NUM_SHARDS];
+
+AVLTreeSharded test_sharded;
+
+/* Set when the writers are done */
+bool test_stop;
+
+/* State of walk_node() */
+struct test_walk_t {
+  int last;
+  int count;
+  int max_count;                  /* Abort after that many nodes */
+  bool is_out_of_order;
+};
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+#define TEST_NODE_TO_VAL(x) \
+  ((struct int_array_t *)((uintptr_t)(x) - offsetof(struct int_array_t, node)))
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+/* Shards for [0, 250), [250, 500), [500, 750) and [750, ...) */
+static AVLTreeSharded *create_map(void)
+{
+  int boundaries[NUM_SHARDS - 1] = { 250, 500, 750 };
+  AVLTreeKey keys[NUM_SHARDS - 1];
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = i;
+    test_in_map[i] = false;
+  }
+  for (i = 0; i < NUM_SHARDS - 1; i++) {
+    keys[i] = &boundaries[i];
+  }
+  ASSERT(avl_tree_sharded_new(&test_sharded, test_shards, NUM_SHARDS, keys,
+                              sizeof(int), offsetof(struct int_array_t, node),
+                              int_compare, value2key, NULL) == &test_sharded);
+  return (&test_sharded);
+}
+
+/* Boundary of shard "i", copied out of the array of the shard */
+static int shard_low(AVLTreeSharded *sharded, uint32_t i)
+{
+  int low;
+
+  memcpy(&low, sharded->shards[i].low, sizeof(low));
+  return (low);
+}
+
+static bool walk_node(AVLTreeNode *node, void *context)
+{
+  struct test_walk_t *walk = context;
+  int value = TEST_NODE_TO_VAL(node)->value;
+
+  if (value <= walk->last) {
+    walk->is_out_of_order = true;
+  }
+  walk->last = value;
+  walk->count++;
+  return (walk->count == walk->max_count);
+}
+
+/* Walk [low, high] and compare with "test_in_map" */
+static void check_range(AVLTreeSharded *sharded, int low, int high,
+                        uint32_t flags)
+{
+  struct test_walk_t walk = { -1, 0, -1, false };
+  int i, count = 0;
+
+  avl_tree_sharded_range_walk(sharded, &low, &high, flags, walk_node, &walk);
+  for (i = low; i <= high && i < NUM_TEST_VALUES; i++) {
+    if ((i == low && !(flags & AVL_TREE_RANGE_INCLUDE_LOW)) ||
+        (i == high && !(flags & AVL_TREE_RANGE_INCLUDE_HIGH))) {
+      continue;
+    }
+    count += test_in_map[i];
+  }
+  ASSERT(!walk.is_out_of_order);
+  ASSERT(walk.count == count);
+}
+
+/* Every shard holds the keys of its range, and all of them are found */
+static void check_map(AVLTreeSharded *sharded)
+{
+  struct test_walk_t walk = { -1, 0, -1, false };
+  int i, low, count = 0;
+  AVLTreeNode *node;
+
+  for (i = 0; i < NUM_SHARDS; i++) {
+    low = (i == 0 ? -1 : shard_low(sharded, i));
+    node = avl_tree_min(&sharded->shards[i].tree);
+    ASSERT(node == NULL || TEST_NODE_TO_VAL(node)->value >= low);
+    node = avl_tree_max(&sharded->shards[i].tree);
+    ASSERT(node == NULL || i + 1 == NUM_SHARDS ||
+           TEST_NODE_TO_VAL(node)->value < shard_low(sharded, i + 1));
+  }
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT(avl_tree_sharded_lookup(sharded, &i) ==
+           (test_in_map[i] ? &test_array[i].node : NULL));
+    count += test_in_map[i];
+  }
+  ASSERT(avl_tree_sharded_num_entries(sharded) == count);
+  avl_tree_sharded_range_walk(sharded, NULL, NULL, 0, walk_node, &walk);
+  ASSERT(!walk.is_out_of_order);
+  ASSERT(walk.count == count);
+}
+
+/* Insert or remove entry "i" */
+static void toggle(AVLTreeSharded *sharded, int i)
+{
+  if (test_in_map[i]) {
+    ASSERT(avl_tree_sharded_remove(sharded, &i) == &test_array[i].node);
+  } else {
+    ASSERT(avl_tree_sharded_insert(sharded, &test_array[i].node) ==
+           &test_array[i].node);
+  }
+  test_in_map[i] = !test_in_map[i];
+}
+
+void test_avl_tree_sharded_insert_remove(void)
+{
+  AVLTreeSharded *sharded = create_map();
+  struct test_walk_t walk = { -1, 0, 10, false };
+  int i, key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  srandom(NUM_TEST_VALUES);
+  for (i = 0; i < 2 * NUM_TEST_VALUES; i++) {
+    toggle(sharded, random() % NUM_TEST_VALUES);
+  }
+  check_map(sharded);
+
+  /* Duplicates and missing keys change nothing */
+  for (key = 0; !test_in_map[key]; key++) {
+  }
+  ASSERT(avl_tree_sharded_insert(sharded, &test_array[key].node) == NULL);
+  for (key = 0; test_in_map[key]; key++) {
+  }
+  ASSERT(avl_tree_sharded_remove(sharded, &key) == NULL);
+
+  /* Ranges within a shard, across shards and ending on a boundary */
+  check_range(sharded, 10, 20, AVL_TREE_RANGE_INCLUDE_LOW);
+  check_range(sharded, 200, 800, AVL_TREE_RANGE_INCLUDE_LOW |
+              AVL_TREE_RANGE_INCLUDE_HIGH);
+  check_range(sharded, 250, 500, 0);
+  check_range(sharded, 249, 750, AVL_TREE_RANGE_INCLUDE_HIGH);
+  check_range(sharded, 600, 2 * NUM_TEST_VALUES, AVL_TREE_RANGE_INCLUDE_LOW);
+
+  /* An aborted walk does not go on in the next shard */
+  key = 240;
+  avl_tree_sharded_range_walk(sharded, &key, NULL, 0, walk_node, &walk);
+  ASSERT(walk.count == 10 && !walk.is_out_of_order);
+  avl_tree_sharded_destroy(sharded);
+}
+
+void test_avl_tree_sharded_move(void)
+{
+  AVLTreeSharded *sharded = create_map();
+  uint32_t num_entries;
+  int i, key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    toggle(sharded, i);
+  }
+
+  /* Up, down, and more than the shard has */
+  avl_tree_sharded_move(sharded, 0, 20);
+  ASSERT(shard_low(sharded, 1) == 210);
+  check_map(sharded);
+  avl_tree_sharded_move(sharded, 1, -30);
+  ASSERT(shard_low(sharded, 2) == 560);
+  check_map(sharded);
+  num_entries = avl_tree_num_entries(&sharded->shards[3].tree);
+  avl_tree_sharded_move(sharded, 2, -NUM_TEST_VALUES);
+  ASSERT(avl_tree_num_entries(&sharded->shards[3].tree) == 1);
+  ASSERT(avl_tree_num_entries(&sharded->shards[2].tree) ==
+         (500 - 560) / 2 + 125 + num_entries - 1);
+  check_map(sharded);
+  check_range(sharded, 100, 900, AVL_TREE_RANGE_INCLUDE_LOW);
+
+  /* Nothing moves out of an empty shard, in either direction */
+  for (i = 0; i < 210; i += 2) {
+    toggle(sharded, i);
+  }
+  num_entries = avl_tree_num_entries(&sharded->shards[1].tree);
+  avl_tree_sharded_move(sharded, 0, 5);
+  ASSERT(avl_tree_num_entries(&sharded->shards[0].tree) == 0);
+  ASSERT(avl_tree_num_entries(&sharded->shards[1].tree) == num_entries);
+  ASSERT(shard_low(sharded, 1) == 210);
+  toggle(sharded,
+         TEST_NODE_TO_VAL(avl_tree_min(&sharded->shards[3].tree))->value);
+  key = shard_low(sharded, 3);
+  num_entries = avl_tree_num_entries(&sharded->shards[2].tree);
+  avl_tree_sharded_move(sharded, 2, -5);
+  ASSERT(avl_tree_num_entries(&sharded->shards[3].tree) == 0);
+  ASSERT(avl_tree_num_entries(&sharded->shards[2].tree) == num_entries);
+  ASSERT(shard_low(sharded, 3) == key);
+  check_map(sharded);
+  for (i = 0; i < 210; i += 2) {
+    toggle(sharded, i);
+  }
+
+  /* The operations all go to the first shard: it gives nodes away */
+  avl_tree_sharded_rebalance(sharded);
+  num_entries = avl_tree_num_entries(&sharded->shards[0].tree);
+  for (i = 0; i < 1000; i++) {
+    avl_tree_sharded_lookup(sharded, &test_array[(i * 2) % 200].value);
+  }
+  avl_tree_sharded_rebalance(sharded);
+  ASSERT(avl_tree_num_entries(&sharded->shards[0].tree) < num_entries);
+  check_map(sharded);
+  avl_tree_sharded_destroy(sharded);
+}
+
+/* Writer "w" toggles the odd entries of half of the keys, while the
+ * boundaries move */
+static void *writer(void *arg)
+{
+  int w = (int)(uintptr_t)arg, i;
+  uint32_t seed = w;
+
+  for (i = 0; i < NUM_UPDATES; i++) {
+    seed = seed * 1103515245 + 12345;
+    toggle(&test_sharded, w * (NUM_TEST_VALUES / NUM_WRITERS) +
+           2 * ((seed >> 16) % (NUM_TEST_VALUES / NUM_WRITERS / 2)) + 1);
+    if (i % 1000 == 0) {
+      avl_tree_sharded_move(&test_sharded, (seed >> 8) % (NUM_SHARDS - 1),
+                            (int32_t)((seed >> 4) % 101) - 50);
+    }
+  }
+  return (NULL);
+}
+
+/* The even entries are always there, and the walks stay in order */
+static void *reader(void *arg)
+{
+  struct test_walk_t walk;
+  uint32_t i = 0;
+  int key;
+
+  while (!__atomic_load_n(&test_stop, __ATOMIC_RELAXED)) {
+    key = 2 * ((i * 7919) % (NUM_TEST_VALUES / 2));
+    ASSERT(avl_tree_sharded_lookup(&test_sharded, &key) ==
+           &test_array[key].node);
+    if (i % 100 == 0) {
+      memset(&walk, 0, sizeof(walk));
+      walk.last = -1;
+      walk.max_count = -1;
+      avl_tree_sharded_range_walk(&test_sharded, NULL, NULL, 0, walk_node,
+                                  &walk);
+      ASSERT(!walk.is_out_of_order);
+      ASSERT(walk.count >= NUM_TEST_VALUES / 2);
+      avl_tree_sharded_rebalance(&test_sharded);
+    }
+    i++;
+  }
+  return (NULL);
+}
+
+void test_avl_tree_sharded_threads(void)
+{
+  pthread_t writer_threads[NUM_WRITERS], reader_thread;
+  uintptr_t i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  create_map();
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    toggle(&test_sharded, i);
+  }
+
+  test_stop = false;
+  ASSERT(pthread_create(&reader_thread, NULL, reader, NULL) == 0);
+  for (i = 0; i < NUM_WRITERS; i++) {
+    ASSERT(pthread_create(&writer_threads[i], NULL, writer, (void *)i) == 0);
+  }
+  for (i = 0; i < NUM_WRITERS; i++) {
+    pthread_join(writer_threads[i], NULL);
+  }
+  __atomic_store_n(&test_stop, true, __ATOMIC_RELAXED);
+  pthread_join(reader_thread, NULL);
+
+  check_map(&test_sharded);
+  avl_tree_sharded_destroy(&test_sharded);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_sharded_insert_remove,
+  test_avl_tree_sharded_move,
+  test_avl_tree_sharded_threads,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,297 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the AVL tree shared by several processes
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "avl-tree-shared.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 2000
+#define NUM_PROCESSES 4
+
+struct int_array_t {
+  char dummy[2]; /* field so that we have a non-zero offset to the node */
+  int value;
+  AVLTreeNode node;
+};
+
+/* The shared memory segment */
+struct test_segment_t {
+  AVLTreeShared shared;
+  struct int_array_t values[NUM_TEST_VALUES];
+};
+
+/* Number of failed assertions, returned by the child processes */
+int num_fail;
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+    num_fail++;                                                         \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+static struct test_segment_t *create_segment(void)
+{
+  struct test_segment_t *segment;
+
+  segment = mmap(NULL, sizeof(*segment), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  ASSERT(segment != MAP_FAILED);
+  ASSERT(avl_tree_shared_init(&segment->shared,
+                              offsetof(struct int_array_t, node)) == 0);
+  return (segment);
+}
+
+static void attach(AVLTreeSharedView *view, struct test_segment_t *segment)
+{
+  ASSERT(avl_tree_shared_attach(view, &segment->shared, int_compare,
+                                value2key, NULL) == view);
+}
+
+/* Fork a process that runs "func" and return its exit status */
+static int run_process(void (*func)(struct test_segment_t *, int),
+                       struct test_segment_t *segment, int index)
+{
+  pid_t pid = fork();
+  int status;
+
+  if (pid == 0) {
+    num_fail = 0;
+    func(segment, index);
+    _exit(num_fail);
+  }
+  ASSERT(pid > 0);
+  ASSERT(waitpid(pid, &status, 0) == pid);
+  return (status);
+}
+
+/* Insert the values "index", "index + NUM_PROCESSES"... one lock each */
+static void insert_values(struct test_segment_t *segment, int index)
+{
+  AVLTreeSharedView view;
+  int i;
+
+  attach(&view, segment);
+  for (i = index; i < NUM_TEST_VALUES; i += NUM_PROCESSES) {
+    segment->values[i].value = i;
+    ASSERT(avl_tree_shared_lock(&view) == 0);
+    ASSERT(avl_tree_insert(&view.tree, &segment->values[i].node) ==
+           &segment->values[i].node);
+    ASSERT(avl_tree_lookup(&view.tree, &i) == &segment->values[i].node);
+    avl_tree_shared_unlock(&view);
+  }
+}
+
+void test_avl_tree_shared_processes(void)
+{
+  struct test_segment_t *segment = create_segment();
+  AVLTreeSharedView view;
+  pid_t pids[NUM_PROCESSES];
+  AVLTreeNode *node;
+  int i, status;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  for (i = 0; i < NUM_PROCESSES; i++) {
+    pids[i] = fork();
+    if (pids[i] == 0) {
+      num_fail = 0;
+      insert_values(segment, i);
+      _exit(num_fail);
+    }
+    ASSERT(pids[i] > 0);
+  }
+  for (i = 0; i < NUM_PROCESSES; i++) {
+    ASSERT(waitpid(pids[i], &status, 0) == pids[i]);
+    ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  /* Every process sees all the values */
+  attach(&view, segment);
+  ASSERT(avl_tree_shared_lock(&view) == 0);
+  ASSERT(avl_tree_num_entries(&view.tree) == NUM_TEST_VALUES);
+  for (i = 0, node = avl_tree_min(&view.tree); i < NUM_TEST_VALUES;
+       i++, node = avl_tree_node_next(node)) {
+    ASSERT(node == &segment->values[i].node);
+  }
+  ASSERT(node == NULL);
+  ASSERT(avl_tree_remove(&view.tree, &segment->values[7].value) == 1);
+  avl_tree_shared_unlock(&view);
+
+  i = 7;
+  ASSERT(avl_tree_shared_lock(&view) == 0);
+  ASSERT(avl_tree_num_entries(&view.tree) == NUM_TEST_VALUES - 1);
+  ASSERT(avl_tree_lookup(&view.tree, &i) == NULL);
+  avl_tree_shared_unlock(&view);
+
+  avl_tree_shared_destroy(&segment->shared);
+  ASSERT(avl_tree_shared_attach(&view, &segment->shared, int_compare,
+                                value2key, NULL) == NULL);
+  munmap(segment, sizeof(*segment));
+}
+
+/* Die while holding the mutex */
+static void die_locked(struct test_segment_t *segment, int index)
+{
+  AVLTreeSharedView view;
+
+  attach(&view, segment);
+  ASSERT(avl_tree_shared_lock(&view) == 0);
+  _exit(num_fail);
+}
+
+void test_avl_tree_shared_owner_died(void)
+{
+  struct test_segment_t *segment = create_segment();
+  AVLTreeSharedView view;
+  int i, status;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  attach(&view, segment);
+  ASSERT(avl_tree_shared_lock(&view) == 0);
+  for (i = 0; i < 10; i++) {
+    segment->values[i].value = i;
+    avl_tree_insert(&view.tree, &segment->values[i].node);
+  }
+  avl_tree_shared_unlock(&view);
+
+  status = run_process(die_locked, segment, 0);
+  ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  /* The lock is not wedged */
+  ASSERT(avl_tree_shared_lock(&view) == EOWNERDEAD);
+  ASSERT(avl_tree_num_entries(&view.tree) == 10);
+  avl_tree_shared_reset(&view);
+  ASSERT(avl_tree_num_entries(&view.tree) == 0);
+  ASSERT(avl_tree_min(&view.tree) == NULL);
+  ASSERT(avl_tree_insert(&view.tree, &segment->values[3].node) ==
+         &segment->values[3].node);
+  avl_tree_shared_unlock(&view);
+
+  ASSERT(avl_tree_shared_lock(&view) == 0);
+  ASSERT(avl_tree_num_entries(&view.tree) == 1);
+  avl_tree_shared_unlock(&view);
+
+  avl_tree_shared_destroy(&segment->shared);
+  munmap(segment, sizeof(*segment));
+}
+
+#ifdef AVL_TREE_RELATIVE_NODE
+void test_avl_tree_shared_relative_node(void)
+{
+  char path[] = "/tmp/test-avl-tree-shared-XXXXXX";
+  struct test_segment_t *segments[2];
+  AVLTreeSharedView views[2];
+  int fd, i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* The same segment at two addresses */
+  fd = mkstemp(path);
+  ASSERT(fd >= 0);
+  unlink(path);
+  ASSERT(ftruncate(fd, sizeof(*segments[0])) == 0);
+  for (i = 0; i < 2; i++) {
+    segments[i] = mmap(NULL, sizeof(*segments[i]), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+    ASSERT(segments[i] != MAP_FAILED);
+  }
+  close(fd);
+  ASSERT(segments[0] != segments[1]);
+
+  ASSERT(avl_tree_shared_init(&segments[0]->shared,
+                              offsetof(struct int_array_t, node)) == 0);
+  attach(&views[0], segments[0]);
+  attach(&views[1], segments[1]);
+
+  ASSERT(avl_tree_shared_lock(&views[1]) == 0);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    segments[1]->values[i].value = i;
+    avl_tree_insert(&views[1].tree, &segments[1]->values[i].node);
+  }
+  avl_tree_shared_unlock(&views[1]);
+
+  ASSERT(avl_tree_shared_lock(&views[0]) == 0);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT(avl_tree_lookup(&views[0].tree, &i) ==
+           &segments[0]->values[i].node);
+  }
+  avl_tree_shared_unlock(&views[0]);
+
+  avl_tree_shared_destroy(&segments[0]->shared);
+  munmap(segments[0], sizeof(*segments[0]));
+  munmap(segments[1], sizeof(*segments[1]));
+}
+#endif
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_shared_processes,
+  test_avl_tree_shared_owner_died,
+#ifdef AVL_TREE_RELATIVE_NODE
+  test_avl_tree_shared_relative_node,
+#endif
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
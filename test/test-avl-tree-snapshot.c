@@ -0,0 +1,206 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the read-only snapshot of the AVL tree
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "avl-tree-snapshot.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 300
+
+struct int_array_t {
+  char dummy[2]; /* field so that we have a non-zero offset to the node */
+  int value;
+  AVLTreeNode node;
+};
+
+struct int_array_t test_array[NUM_TEST_VALUES];
+
+AVLTreeSnapshotEntry test_buffer[NUM_TEST_VALUES + 1]
+  __attribute__ ((aligned (64)));
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *value2key(AVLTreeValue value, void *context)
+{
+  return (&((struct int_array_t *)value)->value);
+}
+
+/* Tree of the first "num_values" entries, with the values 0, 2, 4... */
+static AVLTree *create_tree(AVLTree *tree_struct, int num_values)
+{
+  AVLTree *tree;
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_new(tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      NULL,
+                      NULL);
+  ASSERT(tree != NULL);
+  for (i = 0; i < num_values; i++) {
+    test_array[i].value = 2 * i;
+    ASSERT(avl_tree_insert(tree, &test_array[i].node) == &test_array[i].node);
+  }
+  return (tree);
+}
+
+/* Every search of the snapshot gives the same node as the tree */
+static void check_snapshot(AVLTree *tree, AVLTreeSnapshot *snapshot)
+{
+  int key;
+
+  ASSERT(!avl_tree_snapshot_is_stale(snapshot));
+  ASSERT(snapshot->num_entries == avl_tree_num_entries(tree));
+  for (key = -2; key <= 2 * NUM_TEST_VALUES + 1; key++) {
+    ASSERT(avl_tree_snapshot_lookup(snapshot, &key) ==
+           avl_tree_lookup(tree, &key));
+    ASSERT(avl_tree_snapshot_min_equal_or_greater(snapshot, &key) ==
+           avl_tree_min_equal_or_greater(tree, &key));
+    ASSERT(avl_tree_snapshot_predecessor(snapshot, &key) ==
+           avl_tree_predeccessor(tree, &key));
+  }
+}
+
+void test_avl_tree_snapshot_search(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeSnapshot snapshot;
+  int num_values;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* All the shapes of the implicit tree up to a few levels, then large */
+  for (num_values = 0; num_values <= NUM_TEST_VALUES;
+       num_values += (num_values < 40 ? 1 : 37)) {
+    tree = create_tree(&tree_struct, num_values);
+    ASSERT(avl_tree_freeze(&snapshot, tree, test_buffer,
+                           num_values + 1) == &snapshot);
+    check_snapshot(tree, &snapshot);
+  }
+}
+
+void test_avl_tree_snapshot_refresh(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeSnapshot snapshot;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct, NUM_TEST_VALUES / 2);
+
+  /* Too small */
+  ASSERT(avl_tree_freeze(&snapshot, tree, test_buffer,
+                         NUM_TEST_VALUES / 2) == NULL);
+
+  ASSERT(avl_tree_freeze(&snapshot, tree, test_buffer,
+                         NUM_TEST_VALUES / 2 + 2) == &snapshot);
+  ASSERT(avl_tree_snapshot_refresh(&snapshot) == &snapshot);
+  check_snapshot(tree, &snapshot);
+
+  /* Remove */
+  avl_tree_remove_node(tree, &test_array[7].node);
+  ASSERT(avl_tree_snapshot_is_stale(&snapshot));
+  ASSERT(avl_tree_snapshot_refresh(&snapshot) == &snapshot);
+  check_snapshot(tree, &snapshot);
+
+  /* Insert, back to what fits exactly */
+  avl_tree_insert(tree, &test_array[7].node);
+  test_array[NUM_TEST_VALUES / 2].value = -5;
+  avl_tree_insert(tree, &test_array[NUM_TEST_VALUES / 2].node);
+  ASSERT(avl_tree_snapshot_refresh(&snapshot) == &snapshot);
+  check_snapshot(tree, &snapshot);
+
+  /* No longer fits */
+  test_array[NUM_TEST_VALUES / 2 + 1].value = 1;
+  avl_tree_insert(tree, &test_array[NUM_TEST_VALUES / 2 + 1].node);
+  ASSERT(avl_tree_snapshot_refresh(&snapshot) == NULL);
+  ASSERT(avl_tree_freeze(&snapshot, tree, test_buffer,
+                         NUM_TEST_VALUES + 1) == &snapshot);
+  check_snapshot(tree, &snapshot);
+
+  /* Split and join change the version of all the trees */
+  for (i = 0; i < 2; i++) {
+    AVLTree ge_struct;
+    AVLTreeSnapshot ge_snapshot;
+    int key = 100;
+
+    avl_tree_new(&ge_struct, offsetof(struct int_array_t, node),
+                 int_compare, value2key, NULL, NULL, NULL);
+    avl_tree_freeze(&ge_snapshot, &ge_struct, test_buffer, 1);
+    avl_tree_split(tree, &key, tree, &ge_struct);
+    ASSERT(avl_tree_snapshot_is_stale(&snapshot));
+    ASSERT(avl_tree_snapshot_is_stale(&ge_snapshot));
+    ASSERT(avl_tree_snapshot_refresh(&snapshot) == &snapshot);
+    check_snapshot(tree, &snapshot);
+    avl_tree_join(tree, NULL, &ge_struct);
+    ASSERT(avl_tree_snapshot_is_stale(&snapshot));
+    ASSERT(avl_tree_snapshot_refresh(&snapshot) == &snapshot);
+    check_snapshot(tree, &snapshot);
+  }
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_snapshot_search,
+  test_avl_tree_snapshot_refresh,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
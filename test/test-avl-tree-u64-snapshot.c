@@ -0,0 +1,199 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the k-ary snapshot of the AVL tree with 64-bit keys
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "avl-tree-u64-snapshot.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 800
+
+struct u64_array_t {
+  char dummy[4]; /* field so that we have a non-zero offset to the node */
+  AVLTreeU64Node node;
+};
+
+struct u64_array_t test_array[NUM_TEST_VALUES];
+
+AVLTreeU64SnapshotBlock
+  test_blocks[AVL_TREE_U64_SNAPSHOT_BLOCKS(NUM_TEST_VALUES)];
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+/* Key of test_array[i]. Spread out, on both sides of the top bit */
+static uint64_t test_key(int i)
+{
+  return (((uint64_t)i << 54) + 10 * (uint64_t)i + 5);
+}
+
+static AVLTree *create_tree(AVLTree *tree_struct, int num_values)
+{
+  AVLTree *tree;
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_u64_new(tree_struct,
+                          offsetof(struct u64_array_t, node),
+                          NULL,
+                          NULL);
+  ASSERT(tree != NULL);
+  for (i = 0; i < num_values; i++) {
+    test_array[i].node.key = test_key(i);
+    ASSERT(avl_tree_u64_insert(tree, &test_array[i].node) ==
+           &test_array[i].node);
+  }
+  return (tree);
+}
+
+/* A search of the snapshot gives the same node as the tree */
+static void check_key(AVLTree *tree, AVLTreeU64Snapshot *snapshot,
+                      uint64_t key)
+{
+  ASSERT(avl_tree_u64_snapshot_lookup(snapshot, key) ==
+         avl_tree_u64_lookup(tree, key));
+  ASSERT(avl_tree_u64_snapshot_min_equal_or_greater(snapshot, key) ==
+         avl_tree_u64_min_equal_or_greater(tree, key));
+  ASSERT(avl_tree_u64_snapshot_max_equal_or_less(snapshot, key) ==
+         avl_tree_u64_max_equal_or_less(tree, key));
+}
+
+static void check_snapshot(AVLTree *tree, AVLTreeU64Snapshot *snapshot,
+                           int num_values)
+{
+  int i;
+
+  ASSERT(!avl_tree_u64_snapshot_is_stale(snapshot));
+  check_key(tree, snapshot, 0);
+  check_key(tree, snapshot, UINT64_MAX);
+  check_key(tree, snapshot, UINT64_MAX - 1);
+  for (i = 0; i <= num_values; i++) {
+    check_key(tree, snapshot, test_key(i) - 1);
+    check_key(tree, snapshot, test_key(i));
+    check_key(tree, snapshot, test_key(i) + 1);
+  }
+}
+
+void test_avl_tree_u64_snapshot_search(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeU64Snapshot snapshot;
+  int num_values;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* One, two and three levels of blocks, then large */
+  for (num_values = 0; num_values <= NUM_TEST_VALUES;
+       num_values += (num_values < 100 ? 1 : 97)) {
+    tree = create_tree(&tree_struct, num_values);
+    ASSERT(avl_tree_u64_freeze(&snapshot, tree, test_blocks,
+                               AVL_TREE_U64_SNAPSHOT_BLOCKS(num_values)) ==
+           &snapshot);
+    check_snapshot(tree, &snapshot, num_values);
+  }
+}
+
+void test_avl_tree_u64_snapshot_extreme_keys(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeU64Snapshot snapshot;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* The largest key is the same as the unused entries */
+  tree = create_tree(&tree_struct, 20);
+  avl_tree_u64_remove_node(tree, &test_array[3].node);
+  test_array[3].node.key = UINT64_MAX;
+  avl_tree_u64_insert(tree, &test_array[3].node);
+  avl_tree_u64_remove_node(tree, &test_array[4].node);
+  test_array[4].node.key = 0;
+  avl_tree_u64_insert(tree, &test_array[4].node);
+  ASSERT(avl_tree_u64_freeze(&snapshot, tree, test_blocks,
+                             NUM_TEST_VALUES) == &snapshot);
+  ASSERT(avl_tree_u64_snapshot_lookup(&snapshot, UINT64_MAX) ==
+         &test_array[3].node);
+  ASSERT(avl_tree_u64_snapshot_lookup(&snapshot, 0) == &test_array[4].node);
+  check_snapshot(tree, &snapshot, 20);
+}
+
+void test_avl_tree_u64_snapshot_refresh(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeU64Snapshot snapshot;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct, 16);
+  ASSERT(avl_tree_u64_freeze(&snapshot, tree, test_blocks, 1) == NULL);
+  ASSERT(avl_tree_u64_freeze(&snapshot, tree, test_blocks, 2) == &snapshot);
+  ASSERT(avl_tree_u64_snapshot_refresh(&snapshot) == &snapshot);
+
+  avl_tree_u64_remove_node(tree, &test_array[5].node);
+  ASSERT(avl_tree_u64_snapshot_is_stale(&snapshot));
+  ASSERT(avl_tree_u64_snapshot_refresh(&snapshot) == &snapshot);
+  check_snapshot(tree, &snapshot, 16);
+
+  /* 17 entries need 3 blocks */
+  avl_tree_u64_insert(tree, &test_array[5].node);
+  test_array[16].node.key = test_key(16);
+  avl_tree_u64_insert(tree, &test_array[16].node);
+  ASSERT(avl_tree_u64_snapshot_refresh(&snapshot) == NULL);
+  ASSERT(avl_tree_u64_freeze(&snapshot, tree, test_blocks, 3) == &snapshot);
+  check_snapshot(tree, &snapshot, 17);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_u64_snapshot_search,
+  test_avl_tree_u64_snapshot_extreme_keys,
+  test_avl_tree_u64_snapshot_refresh,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,299 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the AVL tree with the 64-bit key inside the node
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "avl-tree-u64.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 1000
+
+struct u64_array_t {
+  char dummy[6]; /* field so that we have a non-zero offset to the node */
+  AVLTreeU64Node node;
+};
+
+struct u64_array_t test_array[NUM_TEST_VALUES];
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/*
+ * Gets us the beginning of the structure given the node pointer
+ */
+#define TEST_NODE_TO_VAL(x) \
+  (x ? ((struct u64_array_t *)((uintptr_t)x - offsetof(struct u64_array_t, node))) : NULL)
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+/* Key of test_array[i]. Spread out and large enough to need 64 bits */
+static uint64_t test_key(int i)
+{
+  return (((uint64_t)i << 33) + 5);
+}
+
+/* Validates a subtree, returning its height */
+static uint64_t last_key;
+static bool is_first;
+
+static int validate_subtree(AVLTreeNode *node)
+{
+  AVLTreeNode *left_node, *right_node;
+  int left_height, right_height;
+  uint64_t key;
+
+  if (node == NULL) {
+    return 0;
+  }
+
+  left_node = avl_tree_node_child(node, AVL_TREE_NODE_LEFT);
+  right_node = avl_tree_node_child(node, AVL_TREE_NODE_RIGHT);
+  if (left_node != NULL) {
+    ASSERT(avl_tree_node_parent(left_node) == node);
+  }
+  if (right_node != NULL) {
+    ASSERT(avl_tree_node_parent(right_node) == node);
+  }
+
+  left_height = validate_subtree(left_node);
+  key = ((AVLTreeU64Node *)node)->key;
+  ASSERT(is_first || key > last_key);
+  is_first = false;
+  last_key = key;
+  right_height = validate_subtree(right_node);
+
+  ASSERT(avl_tree_subtree_height(left_node) == left_height);
+  ASSERT(avl_tree_subtree_height(right_node) == right_height);
+  ASSERT(left_height - right_height < 2 &&
+         right_height - left_height < 2);
+
+  return ((left_height > right_height ? left_height : right_height) + 1);
+}
+
+static void validate_tree(AVLTree *tree)
+{
+  is_first = true;
+  validate_subtree(avl_tree_root_node(tree));
+}
+
+static AVLTree *create_tree(AVLTree *tree_struct)
+{
+  AVLTree *tree;
+  int i, j;
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_u64_new(tree_struct,
+                          offsetof(struct u64_array_t, node),
+                          NULL,
+                          NULL);
+  ASSERT(tree != NULL);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    j = (i * 7) % NUM_TEST_VALUES;
+    test_array[j].node.key = test_key(j);
+    ASSERT(avl_tree_u64_insert(tree, &test_array[j].node) ==
+           &test_array[j].node);
+  }
+  return tree;
+}
+
+void test_avl_tree_u64_insert_lookup(void)
+{
+  AVLTree *tree, tree_struct;
+  uint64_t key;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES);
+
+  /* Duplicate is refused */
+  ASSERT(avl_tree_u64_insert(tree, &test_array[3].node) == NULL);
+
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT(TEST_NODE_TO_VAL(avl_tree_u64_lookup(tree, test_key(i))) ==
+           &test_array[i]);
+    /* Generic lookup works on the same tree */
+    key = test_key(i);
+    ASSERT(avl_tree_lookup(tree, &key) == &test_array[i].node.node);
+  }
+  ASSERT(avl_tree_u64_lookup(tree, 0) == NULL);
+  ASSERT(avl_tree_u64_lookup(tree, test_key(2) + 1) == NULL);
+  ASSERT(avl_tree_u64_lookup(tree, UINT64_MAX) == NULL);
+}
+
+void test_avl_tree_u64_lookup_batch(void)
+{
+  AVLTree *tree, tree_struct;
+  uint64_t keys[2 * NUM_TEST_VALUES];
+  AVLTreeU64Node *results[2 * NUM_TEST_VALUES];
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* Every key present, each followed by one that is not */
+  tree = create_tree(&tree_struct);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    keys[2 * i] = test_key((i * 7) % NUM_TEST_VALUES);
+    keys[2 * i + 1] = keys[2 * i] + 1;
+  }
+  avl_tree_u64_lookup_batch(tree, keys, 2 * NUM_TEST_VALUES, results);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT(results[2 * i] == &test_array[(i * 7) % NUM_TEST_VALUES].node);
+    ASSERT(results[2 * i + 1] == NULL);
+  }
+}
+
+void test_avl_tree_u64_neighbours(void)
+{
+  AVLTree *tree, tree_struct;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+
+  ASSERT(avl_tree_u64_successor(tree, test_key(10)) == &test_array[11].node);
+  ASSERT(avl_tree_u64_successor(tree, test_key(10) - 1) ==
+         &test_array[10].node);
+  ASSERT(avl_tree_u64_successor(tree, test_key(NUM_TEST_VALUES - 1)) == NULL);
+
+  ASSERT(avl_tree_u64_min_equal_or_greater(tree, test_key(10)) ==
+         &test_array[10].node);
+  ASSERT(avl_tree_u64_min_equal_or_greater(tree, test_key(10) + 1) ==
+         &test_array[11].node);
+  ASSERT(avl_tree_u64_min_equal_or_greater(tree, UINT64_MAX) == NULL);
+
+  ASSERT(avl_tree_u64_predeccessor(tree, test_key(10)) ==
+         &test_array[9].node);
+  ASSERT(avl_tree_u64_predeccessor(tree, test_key(0)) == NULL);
+
+  ASSERT(avl_tree_u64_max_equal_or_less(tree, test_key(10)) ==
+         &test_array[10].node);
+  ASSERT(avl_tree_u64_max_equal_or_less(tree, test_key(10) - 1) ==
+         &test_array[9].node);
+  ASSERT(avl_tree_u64_max_equal_or_less(tree, 0) == NULL);
+}
+
+void test_avl_tree_u64_remove(void)
+{
+  AVLTree *tree, tree_struct;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+
+  /* Remove half by key and half by node */
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    ASSERT(avl_tree_u64_remove(tree, test_key(i)) == 1);
+    ASSERT(avl_tree_u64_remove(tree, test_key(i)) == 0);
+  }
+  validate_tree(tree);
+  for (i = 1; i < NUM_TEST_VALUES; i += 2) {
+    avl_tree_u64_remove_node(tree, &test_array[i].node);
+    ASSERT(avl_tree_u64_lookup(tree, test_key(i)) == NULL);
+  }
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == 0);
+  ASSERT(avl_tree_root_node(tree) == NULL);
+}
+
+static bool test_avl_tree_u64_walk_func(AVLTreeU64Node *node, void *context)
+{
+  int *index = context;
+  ASSERT(node == &test_array[*index].node);
+  (*index)++;
+  return (false);
+}
+
+void test_avl_tree_u64_walk(void)
+{
+  AVLTree *tree, tree_struct;
+  int index = 0;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+  avl_tree_u64_walk(tree, false, test_avl_tree_u64_walk_func, &index);
+  ASSERT(index == NUM_TEST_VALUES);
+}
+
+void test_avl_tree_u64_split(void)
+{
+  AVLTree *tree, tree_struct, lt, ge;
+  uint64_t key;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* The halves keep working once the tree they came from is gone */
+  tree = create_tree(&tree_struct);
+  key = test_key(NUM_TEST_VALUES / 2);
+  avl_tree_split(tree, &key, &lt, &ge);
+  memset(&tree_struct, 0xff, sizeof(tree_struct));
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    key = test_key(i);
+    ASSERT(avl_tree_lookup(i < NUM_TEST_VALUES / 2 ? &lt : &ge, &key) ==
+           &test_array[i].node.node);
+  }
+  validate_tree(&lt);
+  validate_tree(&ge);
+}
+
+static UnitTestFunction tests[] = {
+  test_avl_tree_u64_insert_lookup,
+  test_avl_tree_u64_lookup_batch,
+  test_avl_tree_u64_neighbours,
+  test_avl_tree_u64_remove,
+  test_avl_tree_u64_walk,
+  test_avl_tree_u64_split,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}
@@ -46,6 +46,7 @@ the src/ directory
 #include <stdarg.h>
 
 #include "avl-tree.h"
+#include "avl-tree-define.h"
 #include "framework.h"
 
 #define COLOR_NORMAL   "\x1B[0m"
@@ -69,6 +70,9 @@ struct int_array_t {
 
 struct int_array_t test_array[NUM_TEST_VALUES];
 
+/* Number of calls to the free function */
+unsigned int num_freed;
+
 /*
  * Assert macro to print error instead of crashing
  */
@@ -131,6 +135,7 @@ static void print_tree(AVLTreeNode *node, int depth)
 static void internal_free(AVLTreeNode *node,
                             void *context __attribute__((unused)))
 {
+  num_freed++;
   return;
 }
 
@@ -179,6 +184,7 @@ int find_subtree_height(AVLTreeNode *node)
 /* Validates a subtree, returning its height */
 
 int counter;
+bool is_equal_key_allowed; /* For multimap trees */
 
 int validate_subtree(AVLTree *tree, AVLTreeNode *node)
 {
@@ -211,11 +217,19 @@ int validate_subtree(AVLTree *tree, AVLTreeNode *node)
 
 	key = (int *) avl_tree_node_key(tree, node);
 
-	ASSERT(*key > counter);
+	ASSERT(*key > counter || (is_equal_key_allowed && *key == counter));
 	counter = *key;
 
 	right_height = validate_subtree(tree, right_node);
 
+#ifdef AVL_TREE_ORDER_STATISTIC
+	/* Check the size of the subtree */
+
+	ASSERT(avl_tree_subtree_size(node) ==
+	       avl_tree_subtree_size(left_node) +
+	       avl_tree_subtree_size(right_node) + 1);
+#endif
+
 	/* Check that the returned height value matches the
 	 * result of avl_tree_subtree_height(). */
 
@@ -250,6 +264,9 @@ void validate_tree(AVLTree *tree)
 
 	counter = -1;
 	validate_subtree(tree, root_node);
+#ifdef AVL_TREE_ORDER_STATISTIC
+	ASSERT(avl_tree_subtree_size(root_node) == avl_tree_num_entries(tree));
+#endif
 }
 
 AVLTree *create_tree(AVLTree *tree_struct)
@@ -295,6 +312,79 @@ void test_avl_tree_new(void)
   ASSERT(tree != NULL);
   ASSERT(avl_tree_root_node(tree) == NULL);
   ASSERT(avl_tree_num_entries(tree) == 0);  
+#if defined(AVL_TREE_COMPACT_NODE) && !defined(AVL_TREE_ORDER_STATISTIC)
+  ASSERT(sizeof(AVLTreeNode) == 3 * sizeof(void *));
+#endif
+#if defined(AVL_TREE_ORDER_STATISTIC) && UINTPTR_MAX == UINT64_MAX
+  ASSERT(sizeof(AVLTreeNode) == 32);
+#endif
+}
+
+void test_avl_tree_insert_or_get(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeSlot slot;
+  int i, j, key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+
+  /* Even entries with insert_or_get */
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    test_array[i].value = i / 2;
+    ASSERT(avl_tree_insert_or_get(tree, &test_array[i].node) ==
+           &test_array[i].node);
+  }
+
+  /* Odd entries have the same keys: they get the even ones back */
+  for (i = 1; i < NUM_TEST_VALUES; i += 2) {
+    test_array[i].value = i / 2;
+    ASSERT(avl_tree_insert_or_get(tree, &test_array[i].node) ==
+           &test_array[i - 1].node);
+  }
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES / 2);
+
+  /* Two-phase insert of new keys in a scattered order */
+  for (i = 0; i < NUM_TEST_VALUES / 2; i++) {
+    key = NUM_TEST_VALUES / 2 + (i * 7) % (NUM_TEST_VALUES / 2);
+    ASSERT(avl_tree_find_slot(tree, &key, &slot) == NULL);
+    j = 2 * (key - NUM_TEST_VALUES / 2) + 1;
+    test_array[j].value = key;
+    avl_tree_insert_at_slot(tree, &slot, &test_array[j].node);
+  }
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES);
+
+  /* A hit returns the node and nothing is inserted */
+  key = 10;
+  ASSERT(avl_tree_find_slot(tree, &key, &slot) == &test_array[20].node);
+  for (key = 0; key < NUM_TEST_VALUES; key++) {
+    ASSERT(TEST_NODE_TO_VAL(avl_tree_lookup(tree, &key))->value == key);
+  }
+
+  /* Slot in an empty tree */
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+  key = test_array[0].value;
+  ASSERT(avl_tree_find_slot(tree, &key, &slot) == NULL);
+  ASSERT(slot.parent == NULL);
+  avl_tree_insert_at_slot(tree, &slot, &test_array[0].node);
+  ASSERT(avl_tree_root_node(tree) == &test_array[0].node);
+  validate_tree(tree);
 }
 
 void test_avl_tree_insert_lookup(void)
@@ -418,7 +508,11 @@ void test_avl_tree_free(void)
   /* Create a big tree and free it */
   
   tree = create_tree(&tree_struct);
+  num_freed = 0;
   avl_tree_free(tree);
+  ASSERT(num_freed == NUM_TEST_VALUES);
+  ASSERT(avl_tree_root_node(tree) == NULL);
+  ASSERT(avl_tree_num_entries(tree) == 0);
 }
 
 
@@ -453,6 +547,47 @@ void test_avl_tree_lookup(void)
   
 }
 
+void test_avl_tree_lookup_batch(void)
+{
+  AVLTree *tree, tree_struct;
+  int keys[NUM_TEST_VALUES + 2];
+  AVLTreeKey key_ptrs[NUM_TEST_VALUES + 2];
+  AVLTreeNode *results[NUM_TEST_VALUES + 2];
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* Empty tree */
+  avl_tree_new(&tree_struct, offsetof(struct int_array_t, node),
+               int_compare, value2key, NULL, NULL, NULL);
+  keys[0] = 1;
+  key_ptrs[0] = &keys[0];
+  results[0] = &test_array[0].node;
+  avl_tree_lookup_batch(&tree_struct, key_ptrs, 1, results);
+  ASSERT(results[0] == NULL);
+
+  /* Keys from -1 to NUM_TEST_VALUES in a scattered order, so that the
+   * descents finish at different times */
+  tree = create_tree(&tree_struct);
+  for (i = 0; i < NUM_TEST_VALUES + 2; i++) {
+    keys[i] = (i * 7) % (NUM_TEST_VALUES + 2) - 1;
+    key_ptrs[i] = &keys[i];
+  }
+  avl_tree_lookup_batch(tree, key_ptrs, NUM_TEST_VALUES + 2, results);
+  for (i = 0; i < NUM_TEST_VALUES + 2; i++) {
+    ASSERT(results[i] == avl_tree_lookup(tree, &keys[i]));
+    ASSERT((keys[i] >= 0 && keys[i] < NUM_TEST_VALUES) ==
+           (results[i] != NULL));
+  }
+
+  /* Fewer keys than descents in flight */
+  avl_tree_lookup_batch(tree, key_ptrs, 3, results);
+  for (i = 0; i < 3; i++) {
+    ASSERT(results[i] == avl_tree_lookup(tree, &keys[i]));
+  }
+  avl_tree_lookup_batch(tree, key_ptrs, 0, NULL);
+}
+
 void test_avl_tree_remove(void)
 {
   AVLTree *tree;
@@ -498,7 +633,6 @@ void test_avl_tree_remove(void)
   
 }
 
-#if 0
 void test_avl_tree_to_array(void)
 {
   AVLTree *tree, tree_struct;
@@ -506,7 +640,7 @@ void test_avl_tree_to_array(void)
   int sorted[]  = { 4, 8, 15, 16, 23, 30, 42, 50, 89, 99 };
   unsigned int num_entries = sizeof(entries) / sizeof(int);
   unsigned int i;
-  struct int_array_t **array;
+  void **array;
   struct int_array_t  *values = malloc(num_entries * sizeof(*values));
 
   printf(":  '%s'", __FUNCTION__);
@@ -528,31 +662,22 @@ void test_avl_tree_to_array(void)
   ASSERT(avl_tree_num_entries(tree) == num_entries);
 
   /* Allocate the array because the APIs no logner allocate any memory*/
-  array = malloc(sizeof(void *) * tree->num_nodes);
+  array = malloc(sizeof(void *) * avl_tree_num_entries(tree));
 
-  
-  /* Convert to an array and check the contents */
+  /* Convert to an array and check the contents. The array contains the
+   * keys, i.e. what "value2key" returns */
 
-  array = (int **) avl_tree_to_array(tree, (void **)array);
+  ASSERT(avl_tree_to_array(tree, array) == array);
 
   for (i=0; i<num_entries; ++i) {
-    ASSERT(array[i]->value == sorted[i]);
+    ASSERT(*(int *)array[i] == sorted[i]);
   }
 
+  ASSERT(avl_tree_to_array(tree, NULL) == NULL);
+
   free(array);
   free(values);
-
-  /* NOT Test out of memory scenario because we do NOT allocate memory*/
-
-  /* alloc_test_set_limit(0);
-
-	array = (int **) avl_tree_to_array(tree);
-	ASSERT(array == NULL);
-	validate_tree(tree); */
-
-	/* avl_tree_free(tree); */
 }
-#endif
 
 void test_avl_tree_successor_predecessor_min_greater_or_equal_max_equal_or_less(void)
 {
@@ -812,24 +937,870 @@ void test_avl_tree_walk(void)
    */
   memset(array, 0, sizeof(entries));
   avl_tree_walk(tree, false, test_avl_tree_abort_walk_func, array);
+  ASSERT(!memcmp(array, ascend, 3 * sizeof(int)));
   for (i = 3; i < num_entries; i++) {
-    ASSERT(array[i] != 0);
+    ASSERT(array[i] == 0);
   }
   free(array);
 }
 
+/*
+ * Random mix of inserts and removes. Retracing stops early, so this makes
+ * sure that no ancestor is left with a stale height
+ */
+void test_avl_tree_random_insert_remove(void)
+{
+  AVLTree *tree, tree_struct;
+  bool is_inserted[NUM_TEST_VALUES];
+  unsigned int expected_entries = 0;
+  int i, j;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(test_array, 0, sizeof(test_array));
+  memset(is_inserted, 0, sizeof(is_inserted));
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+  srandom(NUM_TEST_VALUES);
+  for (i = 0; i < NUM_TEST_VALUES * 20; i++) {
+    j = random() % NUM_TEST_VALUES;
+    if (is_inserted[j]) {
+      avl_tree_remove_node(tree, &test_array[j].node);
+      expected_entries--;
+    } else {
+      test_array[j].value = j;
+      ASSERT(avl_tree_insert(tree, &test_array[j].node) != NULL);
+      expected_entries++;
+    }
+    is_inserted[j] = !is_inserted[j];
+    if ((i % 97) == 0) {
+      validate_tree(tree);
+    }
+  }
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == expected_entries);
+}
+
+/******************************** test cursor ********************************/
+void test_avl_tree_cursor(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeCursor cursor;
+  AVLTreeNode *node;
+  int i, key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+
+  /* Ascending, descending and next/prev */
+  i = 0;
+  for (node = avl_tree_cursor_first(&cursor, tree, false);
+       node != NULL;
+       node = avl_tree_cursor_next(&cursor)) {
+    ASSERT(TEST_NODE_TO_VAL(node)->value == i);
+    ASSERT(avl_tree_node_prev(node) ==
+           (i == 0 ? NULL : &test_array[i - 1].node));
+    i++;
+  }
+  ASSERT(i == NUM_TEST_VALUES);
+  ASSERT(avl_tree_cursor_next(&cursor) == NULL);
+
+  for (node = avl_tree_cursor_first(&cursor, tree, true);
+       node != NULL;
+       node = avl_tree_cursor_next(&cursor)) {
+    i--;
+    ASSERT(TEST_NODE_TO_VAL(node)->value == i);
+    ASSERT(avl_tree_node_next(node) ==
+           (i == NUM_TEST_VALUES - 1 ? NULL : &test_array[i + 1].node));
+  }
+  ASSERT(i == 0);
+
+  /* Seek then remove every third node while moving */
+  key = 100;
+  node = avl_tree_cursor_seek(&cursor, tree, &key, false);
+  ASSERT(node == &test_array[100].node);
+  i = 100;
+  while (node != NULL) {
+    if ((i % 3) == 0) {
+      node = avl_tree_cursor_remove(&cursor);
+    } else {
+      node = avl_tree_cursor_next(&cursor);
+    }
+    i++;
+    ASSERT(node == (i < NUM_TEST_VALUES ? &test_array[i].node : NULL));
+  }
+  validate_tree(tree);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    ASSERT((avl_tree_lookup(tree, &i) == NULL) == (i >= 100 && (i % 3) == 0));
+  }
+
+  /* Remove everything from the back */
+  node = avl_tree_cursor_first(&cursor, tree, true);
+  while (node != NULL) {
+    node = avl_tree_cursor_remove(&cursor);
+  }
+  ASSERT(avl_tree_num_entries(tree) == 0);
+  ASSERT(avl_tree_root_node(tree) == NULL);
+}
+
+/****************************** test range walk ******************************/
+struct test_range_walk_context {
+  int values[NUM_TEST_VALUES];
+  int num_values;
+  int max_values;
+};
+
+bool test_avl_tree_range_walk_func(AVLTreeNode *node, void *context)
+{
+  struct test_range_walk_context *range = context;
+  range->values[range->num_values++] = TEST_NODE_TO_VAL(node)->value;
+  return (range->num_values == range->max_values);
+}
+
+/* Run one range walk and check that we got exactly "first" to "last" */
+static void test_avl_tree_range_walk_check(AVLTree *tree,
+                                           int *low, int *high,
+                                           uint32_t flags,
+                                           bool is_descending,
+                                           int first, int last)
+{
+  struct test_range_walk_context range;
+  int i, step = is_descending ? -1 : 1;
+  int expected = (last - first) * step + 1;
+
+  memset(&range, 0, sizeof(range));
+  range.max_values = NUM_TEST_VALUES;
+  avl_tree_range_walk(tree, low, high, flags, is_descending,
+                      test_avl_tree_range_walk_func, &range);
+  ASSERT(range.num_values == (expected > 0 ? expected : 0));
+  for (i = 0; i < range.num_values; i++) {
+    ASSERT(range.values[i] == first + i * step);
+  }
+}
+
+void test_avl_tree_range_walk(void)
+{
+  AVLTree *tree, tree_struct;
+  struct test_range_walk_context range;
+  int low, high;
+  uint32_t both = AVL_TREE_RANGE_INCLUDE_LOW | AVL_TREE_RANGE_INCLUDE_HIGH;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+
+  low = 10;
+  high = 20;
+  test_avl_tree_range_walk_check(tree, &low, &high, both, false, 10, 20);
+  test_avl_tree_range_walk_check(tree, &low, &high, 0, false, 11, 19);
+  test_avl_tree_range_walk_check(tree, &low, &high,
+                                 AVL_TREE_RANGE_INCLUDE_LOW, false, 10, 19);
+  test_avl_tree_range_walk_check(tree, &low, &high, both, true, 20, 10);
+  test_avl_tree_range_walk_check(tree, &low, &high, 0, true, 19, 11);
+  test_avl_tree_range_walk_check(tree, &low, &high,
+                                 AVL_TREE_RANGE_INCLUDE_HIGH, true, 20, 11);
+
+  /* Open ends */
+  test_avl_tree_range_walk_check(tree, NULL, &high, both, false, 0, 20);
+  test_avl_tree_range_walk_check(tree, &low, NULL, both, true,
+                                 NUM_TEST_VALUES - 1, 10);
+  test_avl_tree_range_walk_check(tree, NULL, NULL, 0, false,
+                                 0, NUM_TEST_VALUES - 1);
+
+  /* Empty and out of the tree */
+  low = 20;
+  high = 10;
+  test_avl_tree_range_walk_check(tree, &low, &high, both, false, 1, 0);
+  low = 5;
+  high = 5;
+  test_avl_tree_range_walk_check(tree, &low, &high, 0, false, 1, 0);
+  test_avl_tree_range_walk_check(tree, &low, &high, both, true, 5, 5);
+  low = NUM_TEST_VALUES + 10;
+  high = NUM_TEST_VALUES + 20;
+  test_avl_tree_range_walk_check(tree, &low, &high, both, false, 1, 0);
+
+  /* Abort */
+  memset(&range, 0, sizeof(range));
+  range.max_values = 3;
+  low = 10;
+  avl_tree_range_walk(tree, &low, NULL, 0, false,
+                      test_avl_tree_range_walk_func, &range);
+  ASSERT(range.num_values == 3);
+  ASSERT(range.values[2] == 13);
+}
+
+/*************************** test build from sorted ***************************/
+void test_avl_tree_build_from_sorted(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeNode *nodes[NUM_TEST_VALUES];
+  uint32_t num_nodes;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(test_array, 0, sizeof(test_array));
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = i * 3;
+    nodes[i] = &test_array[i].node;
+  }
+
+  /* Try every size up to a few hundreds then the whole array */
+  for (num_nodes = 0; num_nodes <= NUM_TEST_VALUES;
+       num_nodes += (num_nodes < 300 ? 1 : NUM_TEST_VALUES - 300)) {
+    tree = avl_tree_new(&tree_struct,
+                        offsetof(struct int_array_t, node),
+                        int_compare,
+                        value2key,
+                        NULL,
+                        internal_free,
+                        NULL);
+    ASSERT(avl_tree_build_from_sorted(tree, nodes, num_nodes, true) == tree);
+    ASSERT(avl_tree_num_entries(tree) == num_nodes);
+    validate_tree(tree);
+  }
+
+  /* The tree is usable after the build */
+  for (i = 0; i < NUM_TEST_VALUES * 3; i++) {
+    ASSERT((avl_tree_lookup(tree, &i) != NULL) == ((i % 3) == 0));
+  }
+  for (i = 0; i < NUM_TEST_VALUES * 3; i += 6) {
+    ASSERT(avl_tree_remove(tree, &i) == 1);
+  }
+  validate_tree(tree);
+
+  /* Refuse a tree that is not empty */
+  ASSERT(avl_tree_build_from_sorted(tree, nodes, 1, false) == NULL);
+
+  /* Refuse unsorted nodes and leave the tree empty */
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+  nodes[10] = &test_array[9].node;
+  ASSERT(avl_tree_build_from_sorted(tree, nodes, NUM_TEST_VALUES, true) ==
+         NULL);
+  ASSERT(avl_tree_root_node(tree) == NULL);
+  ASSERT(avl_tree_num_entries(tree) == 0);
+}
+
+void test_avl_tree_join_split(void)
+{
+  AVLTree *tree, tree_struct, lt_struct, ge_struct;
+  AVLTreeNode *pivot;
+  int key;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  /* Split at every 7th key, including before the first and after the
+   * last, then join back, alternately with and without a pivot */
+  for (key = -1; key <= NUM_TEST_VALUES + 6; key += 7) {
+    tree = create_tree(&tree_struct);
+    avl_tree_split(tree, &key, &lt_struct, &ge_struct);
+    ASSERT(avl_tree_root_node(tree) == NULL);
+    ASSERT(avl_tree_num_entries(tree) == 0);
+
+    validate_tree(&lt_struct);
+    validate_tree(&ge_struct);
+    if (key <= 0) {
+      ASSERT(avl_tree_num_entries(&lt_struct) == 0);
+      ASSERT(avl_tree_num_entries(&ge_struct) == NUM_TEST_VALUES);
+    } else if (key >= NUM_TEST_VALUES) {
+      ASSERT(avl_tree_num_entries(&lt_struct) == NUM_TEST_VALUES);
+      ASSERT(avl_tree_num_entries(&ge_struct) == 0);
+    } else {
+      ASSERT(avl_tree_num_entries(&lt_struct) == key);
+      ASSERT(avl_tree_num_entries(&ge_struct) == NUM_TEST_VALUES - key);
+      ASSERT(avl_tree_max(&lt_struct) == &test_array[key - 1].node);
+      ASSERT(avl_tree_min(&ge_struct) == &test_array[key].node);
+    }
+
+    pivot = NULL;
+    if ((key % 2) == 0 && avl_tree_root_node(&ge_struct) != NULL) {
+      pivot = avl_tree_min(&ge_struct);
+      avl_tree_remove_node(&ge_struct, pivot);
+    }
+    ASSERT(avl_tree_join(&lt_struct, pivot, &ge_struct) == &lt_struct);
+    ASSERT(avl_tree_root_node(&ge_struct) == NULL);
+    ASSERT(avl_tree_num_entries(&ge_struct) == 0);
+    ASSERT(avl_tree_num_entries(&lt_struct) == NUM_TEST_VALUES);
+    validate_tree(&lt_struct);
+    ASSERT(avl_tree_lookup(&lt_struct, &key) ==
+           (key >= 0 && key < NUM_TEST_VALUES ?
+            &test_array[key].node : NULL));
+  }
+
+  /* The result can go back into the tree that is split */
+  tree = create_tree(&tree_struct);
+  key = 100;
+  avl_tree_split(tree, &key, tree, &ge_struct);
+  validate_tree(tree);
+  validate_tree(&ge_struct);
+  ASSERT(avl_tree_num_entries(tree) == 100);
+  ASSERT(avl_tree_num_entries(&ge_struct) == NUM_TEST_VALUES - 100);
+
+  /* Carve out [100, 200) and join the rest back */
+  key = 200;
+  avl_tree_split(&ge_struct, &key, &lt_struct, &ge_struct);
+  ASSERT(avl_tree_num_entries(&lt_struct) == 100);
+  ASSERT(avl_tree_min(&lt_struct) == &test_array[100].node);
+  ASSERT(avl_tree_max(&lt_struct) == &test_array[199].node);
+  avl_tree_join(tree, NULL, &ge_struct);
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES - 100);
+  key = 150;
+  ASSERT(avl_tree_lookup(tree, &key) == NULL);
+  key = 250;
+  ASSERT(avl_tree_lookup(tree, &key) == &test_array[250].node);
+
+  /* Join of empty trees with a pivot */
+  avl_tree_new(&lt_struct, offsetof(struct int_array_t, node), int_compare,
+               value2key, NULL, internal_free, NULL);
+  avl_tree_new(&ge_struct, offsetof(struct int_array_t, node), int_compare,
+               value2key, NULL, internal_free, NULL);
+  avl_tree_join(&lt_struct, &test_array[150].node, &ge_struct);
+  validate_tree(&lt_struct);
+  ASSERT(avl_tree_num_entries(&lt_struct) == 1);
+  ASSERT(avl_tree_root_node(&lt_struct) == &test_array[150].node);
+}
+
+/* Entries of the augmented tree. "sum" is the sum of "weight" over the
+ * subtree of the entry */
+#define NUM_SUM_ENTRIES 500
+
+struct sum_entry_t {
+  int value;
+  int weight;
+  long sum;
+  AVLTreeNode node;
+};
+
+struct sum_entry_t sum_array[NUM_SUM_ENTRIES];
+
+#define SUM_NODE_TO_ENTRY(x) \
+  ((struct sum_entry_t *)((uintptr_t)x - offsetof(struct sum_entry_t, node)))
+
+static void *sum_value2key(void *value, void *context)
+{
+  return (&((struct sum_entry_t *)value)->value);
+}
+
+static long sum_of(AVLTreeNode *node)
+{
+  return (node == NULL ? 0 : SUM_NODE_TO_ENTRY(node)->sum);
+}
+
+static void sum_augment(AVLTreeNode *node, void *context)
+{
+  (*(int *)context)++;
+  SUM_NODE_TO_ENTRY(node)->sum =
+    SUM_NODE_TO_ENTRY(node)->weight +
+    sum_of(avl_tree_node_child(node, AVL_TREE_NODE_LEFT)) +
+    sum_of(avl_tree_node_child(node, AVL_TREE_NODE_RIGHT));
+}
+
+/* Check the sum of every node of a subtree and return the real sum */
+static long validate_sums(AVLTreeNode *node)
+{
+  long sum;
+
+  if (node == NULL) {
+    return 0;
+  }
+  sum = (SUM_NODE_TO_ENTRY(node)->weight +
+         validate_sums(avl_tree_node_child(node, AVL_TREE_NODE_LEFT)) +
+         validate_sums(avl_tree_node_child(node, AVL_TREE_NODE_RIGHT)));
+  ASSERT(SUM_NODE_TO_ENTRY(node)->sum == sum);
+  return sum;
+}
+
+static bool sum_cover_func(AVLTreeNode *node, bool is_subtree, void *context)
+{
+  *(long *)context += (is_subtree ? SUM_NODE_TO_ENTRY(node)->sum :
+                       SUM_NODE_TO_ENTRY(node)->weight);
+  return false;
+}
+
+static bool sum_walk_func(AVLTreeNode *node, void *context)
+{
+  *(long *)context += SUM_NODE_TO_ENTRY(node)->weight;
+  return false;
+}
+
+void test_avl_tree_augment(void)
+{
+  AVLTree tree, ge_tree;
+  AVLTreeNode *nodes[NUM_SUM_ENTRIES];
+  int i, j, low, high, num_calls = 0;
+  uint32_t flags;
+  long cover_sum, walk_sum;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(sum_array, 0, sizeof(sum_array));
+  avl_tree_new(&tree, offsetof(struct sum_entry_t, node), int_compare,
+               sum_value2key, NULL, NULL, NULL);
+  avl_tree_set_augment(&tree, sum_augment, &num_calls);
+  for (i = 0; i < NUM_SUM_ENTRIES; i++) {
+    j = (i * 7) % NUM_SUM_ENTRIES;
+    sum_array[j].value = j;
+    sum_array[j].weight = (j * 37) % 101;
+    ASSERT(avl_tree_insert(&tree, &sum_array[j].node) != NULL);
+    validate_sums(avl_tree_root_node(&tree));
+  }
+  ASSERT(num_calls > 0);
+  for (i = 0; i < NUM_SUM_ENTRIES; i += 3) {
+    avl_tree_remove_node(&tree, &sum_array[i].node);
+    validate_sums(avl_tree_root_node(&tree));
+  }
+
+  /* The sum of any range from the cover is the sum of the walk */
+  for (low = -1; low <= NUM_SUM_ENTRIES; low += 13) {
+    for (high = low - 2; high <= NUM_SUM_ENTRIES + 1; high += 11) {
+      for (flags = 0; flags < 4; flags++) {
+        cover_sum = 0;
+        walk_sum = 0;
+        avl_tree_range_cover(&tree, &low, &high, flags, sum_cover_func,
+                             &cover_sum);
+        avl_tree_range_walk(&tree, &low, &high, flags, false, sum_walk_func,
+                            &walk_sum);
+        ASSERT(cover_sum == walk_sum);
+      }
+    }
+  }
+  cover_sum = 0;
+  avl_tree_range_cover(&tree, NULL, NULL, 0, sum_cover_func, &cover_sum);
+  ASSERT(cover_sum == sum_of(avl_tree_root_node(&tree)));
+
+  /* Changing a weight in place */
+  sum_array[10].weight += 1000;
+  avl_tree_update_augment(&tree, &sum_array[10].node);
+  validate_sums(avl_tree_root_node(&tree));
+
+  /* Split and join */
+  low = 200;
+  avl_tree_split(&tree, &low, &tree, &ge_tree);
+  validate_sums(avl_tree_root_node(&tree));
+  validate_sums(avl_tree_root_node(&ge_tree));
+  avl_tree_join(&tree, NULL, &ge_tree);
+  validate_sums(avl_tree_root_node(&tree));
+
+  /* Build from sorted */
+  avl_tree_new(&tree, offsetof(struct sum_entry_t, node), int_compare,
+               sum_value2key, NULL, NULL, NULL);
+  avl_tree_set_augment(&tree, sum_augment, &num_calls);
+  for (i = 0; i < NUM_SUM_ENTRIES; i++) {
+    nodes[i] = &sum_array[i].node;
+  }
+  avl_tree_build_from_sorted(&tree, nodes, NUM_SUM_ENTRIES, false);
+  validate_sums(avl_tree_root_node(&tree));
+}
+
+#ifdef AVL_TREE_ORDER_STATISTIC
+void test_avl_tree_order_statistic(void)
+{
+  AVLTree *tree, tree_struct, ge_struct;
+  int i, low, high;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+
+  /* Remove the odd values so that the rank of value "2*i" is "i" */
+  for (i = 1; i < NUM_TEST_VALUES; i += 2) {
+    ASSERT(avl_tree_remove(tree, &i) == 1);
+  }
+  validate_tree(tree);
+
+  for (i = -1; i <= NUM_TEST_VALUES; i++) {
+    ASSERT(avl_tree_rank(tree, &i) ==
+           (i < 0 ? 0 :
+            i >= NUM_TEST_VALUES ? NUM_TEST_VALUES / 2 : (i + 1) / 2));
+  }
+  for (i = 0; i < NUM_TEST_VALUES / 2; i++) {
+    ASSERT(avl_tree_select(tree, i) == &test_array[2 * i].node);
+  }
+  ASSERT(avl_tree_select(tree, NUM_TEST_VALUES / 2) == NULL);
+
+  /* [10, 20] holds 10, 12, ..., 20 */
+  low = 10;
+  high = 20;
+  ASSERT(avl_tree_count_range(tree, &low, &high,
+                              AVL_TREE_RANGE_INCLUDE_LOW |
+                              AVL_TREE_RANGE_INCLUDE_HIGH) == 6);
+  ASSERT(avl_tree_count_range(tree, &low, &high,
+                              AVL_TREE_RANGE_INCLUDE_LOW) == 5);
+  ASSERT(avl_tree_count_range(tree, &low, &high, 0) == 4);
+  low = 11;
+  high = 19;
+  ASSERT(avl_tree_count_range(tree, &low, &high,
+                              AVL_TREE_RANGE_INCLUDE_LOW |
+                              AVL_TREE_RANGE_INCLUDE_HIGH) == 4);
+  ASSERT(avl_tree_count_range(tree, &high, &low,
+                              AVL_TREE_RANGE_INCLUDE_LOW) == 0);
+  ASSERT(avl_tree_count_range(tree, NULL, &low, 0) == 6);
+  ASSERT(avl_tree_count_range(tree, &low, NULL, 0) ==
+         NUM_TEST_VALUES / 2 - 6);
+  ASSERT(avl_tree_count_range(tree, NULL, NULL, 0) == NUM_TEST_VALUES / 2);
+
+  /* Sizes survive split and join */
+  low = 300;
+  avl_tree_split(tree, &low, tree, &ge_struct);
+  validate_tree(tree);
+  validate_tree(&ge_struct);
+  ASSERT(avl_tree_select(tree, 149) == &test_array[298].node);
+  ASSERT(avl_tree_select(tree, 150) == NULL);
+}
+#endif
+
+/* Nodes with the same key in a multimap tree, in order of insertion */
+static int check_equal_range(AVLTree *tree, int key)
+{
+  AVLTreeNode *first, *last, *node;
+  int count = 0;
+
+  if (!avl_tree_equal_range(tree, &key, &first, &last)) {
+    ASSERT(first == NULL && last == NULL);
+    return 0;
+  }
+  ASSERT(first == avl_tree_min_equal_or_greater(tree, &key));
+  ASSERT(last == avl_tree_max_equal_or_less(tree, &key));
+  ASSERT(avl_tree_node_prev(first) == NULL ||
+         TEST_NODE_TO_VAL(avl_tree_node_prev(first))->value < key);
+  ASSERT(avl_tree_node_next(last) == NULL ||
+         TEST_NODE_TO_VAL(avl_tree_node_next(last))->value > key);
+  for (node = first; ; node = avl_tree_node_next(node)) {
+    ASSERT(TEST_NODE_TO_VAL(node)->value == key);
+    ASSERT(node == first ||
+           TEST_NODE_TO_VAL(node) > TEST_NODE_TO_VAL(avl_tree_node_prev(node)));
+    count++;
+    if (node == last) {
+      break;
+    }
+  }
+  return count;
+}
+
+static bool count_walk_func(AVLTreeNode *node, void *context)
+{
+  (*(int *)context)++;
+  return false;
+}
+
+void test_avl_tree_multimap(void)
+{
+  AVLTree *tree, tree_struct;
+  AVLTreeNode *nodes[NUM_TEST_VALUES];
+  int i, key, high, count;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+  avl_tree_set_multimap(tree, true);
+
+  /* 100 keys, 10 nodes each. The nodes with the same key are inserted
+   * in increasing order of their index in test_array */
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = (i * 7) % 100;
+    ASSERT(avl_tree_insert(tree, &test_array[i].node) ==
+           &test_array[i].node);
+  }
+  is_equal_key_allowed = true;
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES);
+
+  for (key = -1; key <= 100; key++) {
+    ASSERT(check_equal_range(tree, key) == (key < 0 || key >= 100 ? 0 : 10));
+  }
+
+  /* The ends of a range include all the equal keys */
+  key = 5;
+  high = 7;
+  count = 0;
+  avl_tree_range_walk(tree, &key, &high,
+                      AVL_TREE_RANGE_INCLUDE_LOW | AVL_TREE_RANGE_INCLUDE_HIGH,
+                      false, count_walk_func, &count);
+  ASSERT(count == 30);
+  count = 0;
+  avl_tree_range_walk(tree, &key, &high, AVL_TREE_RANGE_INCLUDE_HIGH,
+                      true, count_walk_func, &count);
+  ASSERT(count == 20);
+
+  /* Remove by key removes one node at a time */
+  key = 42;
+  for (i = 0; i < 10; i++) {
+    ASSERT(avl_tree_remove(tree, &key) == 1);
+    ASSERT(check_equal_range(tree, key) == 9 - i);
+  }
+  ASSERT(avl_tree_remove(tree, &key) == 0);
+  validate_tree(tree);
+
+  /* Build from sorted accepts equal keys */
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+  avl_tree_set_multimap(tree, true);
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].value = i / 4;
+    nodes[i] = &test_array[i].node;
+  }
+  ASSERT(avl_tree_build_from_sorted(tree, nodes, NUM_TEST_VALUES, true) ==
+         tree);
+  validate_tree(tree);
+  ASSERT(check_equal_range(tree, 17) == 4);
+  is_equal_key_allowed = false;
+}
+
+/* Number of calls to counting_compare() */
+unsigned int num_compares;
+
+int counting_compare(void *key1, void *key2)
+{
+  num_compares++;
+  return (*(int *)key1 - *(int *)key2);
+}
+
+void test_avl_tree_insert_hint(void)
+{
+  AVLTree *tree, tree_struct;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      counting_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+
+  /* Append the even values: one comparison each */
+  num_compares = 0;
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    test_array[i].value = i;
+    ASSERT(avl_tree_insert_hint(tree, NULL, &test_array[i].node) ==
+           &test_array[i].node);
+  }
+  ASSERT(num_compares == NUM_TEST_VALUES / 2 - 1);
+  validate_tree(tree);
+
+  /* Odd values with the node before or after as hint: two comparisons,
+   * except one for the last value that has no next node */
+  num_compares = 0;
+  for (i = 1; i < NUM_TEST_VALUES; i += 2) {
+    test_array[i].value = i;
+    ASSERT(avl_tree_insert_hint(tree,
+                                (i % 4) == 1 || i == NUM_TEST_VALUES - 1 ?
+                                &test_array[i - 1].node :
+                                &test_array[i + 1].node,
+                                &test_array[i].node) == &test_array[i].node);
+  }
+  ASSERT(num_compares == NUM_TEST_VALUES - 1);
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES);
+
+  /* Duplicate is refused, with or without a hint */
+  ASSERT(avl_tree_insert_hint(tree, &test_array[5].node,
+                              &test_array[5].node) == NULL);
+  ASSERT(avl_tree_insert_hint(tree, &test_array[7].node,
+                              &test_array[5].node) == NULL);
+  ASSERT(avl_tree_insert_hint(tree, NULL, &test_array[5].node) == NULL);
+
+  /* A wrong hint or a key that is not the largest still works */
+  avl_tree_remove_node(tree, &test_array[500].node);
+  avl_tree_remove_node(tree, &test_array[100].node);
+  ASSERT(avl_tree_insert_hint(tree, &test_array[3].node,
+                              &test_array[500].node) == &test_array[500].node);
+  ASSERT(avl_tree_insert_hint(tree, NULL, &test_array[100].node) ==
+         &test_array[100].node);
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES);
+}
+
+/************************ test specialized functions *************************/
+
+static inline int test_int_key_compare(const int *key1, const int *key2)
+{
+  return (*key1 - *key2);
+}
+
+AVL_TREE_DEFINE(test_int_tree, struct int_array_t, node, value,
+                test_int_key_compare)
+
+void test_avl_tree_define(void)
+{
+  AVLTree *tree, tree_struct;
+  int i, key;
+  struct int_array_t *value;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = avl_tree_new(&tree_struct,
+                      offsetof(struct int_array_t, node),
+                      int_compare,
+                      value2key,
+                      NULL,
+                      internal_free,
+                      NULL);
+
+  /* Insert in a scattered order using the specialized insert */
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    key = (i * 7) % NUM_TEST_VALUES;
+    test_array[key].value = key * 2;
+    ASSERT(test_int_tree_insert(tree, &test_array[key].node) != NULL);
+  }
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES);
+
+  /* Duplicate is refused */
+  ASSERT(test_int_tree_insert(tree, &test_array[0].node) == NULL);
+
+  /* Specialized and generic lookups MUST agree */
+  for (key = -1; key <= NUM_TEST_VALUES * 2; key++) {
+    ASSERT(test_int_tree_lookup(tree, &key) == avl_tree_lookup(tree, &key));
+    ASSERT(test_int_tree_successor(tree, &key) ==
+           avl_tree_successor(tree, &key));
+    ASSERT(test_int_tree_predeccessor(tree, &key) ==
+           avl_tree_predeccessor(tree, &key));
+    ASSERT(test_int_tree_min_equal_or_greater(tree, &key) ==
+           avl_tree_min_equal_or_greater(tree, &key));
+    ASSERT(test_int_tree_max_equal_or_less(tree, &key) ==
+           avl_tree_max_equal_or_less(tree, &key));
+  }
+  key = 10;
+  value = test_int_tree_node_to_value(test_int_tree_lookup(tree, &key));
+  ASSERT(value == &test_array[5]);
+
+  /* A multimap tree accepts the duplicate after the existing node */
+  avl_tree_set_multimap(tree, true);
+  test_array[NUM_TEST_VALUES - 1].value = 10;
+  avl_tree_remove_node(tree, &test_array[NUM_TEST_VALUES - 1].node);
+  ASSERT(test_int_tree_insert(tree, &test_array[NUM_TEST_VALUES - 1].node) ==
+         &test_array[NUM_TEST_VALUES - 1].node);
+  key = 10;
+  ASSERT(test_int_tree_min_equal_or_greater(tree, &key) ==
+         &test_array[5].node);
+  ASSERT(test_int_tree_max_equal_or_less(tree, &key) ==
+         &test_array[NUM_TEST_VALUES - 1].node);
+  avl_tree_remove_node(tree, &test_array[NUM_TEST_VALUES - 1].node);
+  avl_tree_set_multimap(tree, false);
+  test_array[NUM_TEST_VALUES - 1].value = (NUM_TEST_VALUES - 1) * 2;
+  ASSERT(test_int_tree_insert(tree, &test_array[NUM_TEST_VALUES - 1].node) ==
+         &test_array[NUM_TEST_VALUES - 1].node);
+
+  /* Remove every other key with the specialized remove */
+  for (key = 0; key < NUM_TEST_VALUES * 2; key += 4) {
+    ASSERT(test_int_tree_remove(tree, &key) == 1);
+    ASSERT(test_int_tree_remove(tree, &key) == 0);
+  }
+  validate_tree(tree);
+  ASSERT(avl_tree_num_entries(tree) == NUM_TEST_VALUES / 2);
+}
+
+#ifdef AVL_TREE_RELATIVE_NODE
+#define NUM_REGION_VALUES 100
+
+/* A tree and its nodes in one block of memory */
+struct test_region_t {
+  AVLTree tree;
+  struct int_array_t values[NUM_REGION_VALUES];
+};
+
+struct test_region_t test_regions[2];
+
+void test_avl_tree_relative_node(void)
+{
+  struct test_region_t *copy = &test_regions[1];
+  AVLTree *tree;
+  int i;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = avl_tree_new(&test_regions[0].tree,
+                      offsetof(struct int_array_t, node),
+                      int_compare, value2key, NULL, NULL, NULL);
+  for (i = 0; i < NUM_REGION_VALUES; i++) {
+    test_regions[0].values[i].value = i;
+    ASSERT(avl_tree_insert(tree, &test_regions[0].values[i].node) ==
+           &test_regions[0].values[i].node);
+  }
+
+  /* Move the block: the copy is a valid tree of its own nodes */
+  memcpy(copy, &test_regions[0], sizeof(*copy));
+  memset(&test_regions[0], 0xff, sizeof(test_regions[0]));
+  validate_tree(&copy->tree);
+  ASSERT(avl_tree_num_entries(&copy->tree) == NUM_REGION_VALUES);
+  for (i = 0; i < NUM_REGION_VALUES; i++) {
+    ASSERT(avl_tree_lookup(&copy->tree, &i) == &copy->values[i].node);
+  }
+
+  /* And can be modified */
+  for (i = 0; i < NUM_REGION_VALUES; i += 2) {
+    ASSERT(avl_tree_remove(&copy->tree, &i) == 1);
+  }
+  validate_tree(&copy->tree);
+  for (i = 0; i < NUM_REGION_VALUES; i += 2) {
+    ASSERT(avl_tree_insert(&copy->tree, &copy->values[i].node) ==
+           &copy->values[i].node);
+  }
+  validate_tree(&copy->tree);
+  ASSERT(avl_tree_num_entries(&copy->tree) == NUM_REGION_VALUES);
+}
+#endif
+
 static UnitTestFunction tests[] = {
 	test_avl_tree_new,
 	test_avl_tree_free,
 	test_avl_tree_child,
 	test_avl_tree_insert_lookup,
+	test_avl_tree_insert_or_get,
+	test_avl_tree_insert_hint,
 	test_avl_tree_lookup,
+	test_avl_tree_lookup_batch,
 	test_avl_tree_remove,
-	/*test_avl_tree_to_array,*/
+	test_avl_tree_to_array,
 	/*test_out_of_memory,*/
         test_avl_tree_successor_predecessor_min_greater_or_equal_max_equal_or_less,
         test_avl_tree_min_max,
         test_avl_tree_walk,
+        test_avl_tree_define,
+        test_avl_tree_random_insert_remove,
+        test_avl_tree_cursor,
+        test_avl_tree_range_walk,
+        test_avl_tree_build_from_sorted,
+        test_avl_tree_join_split,
+        test_avl_tree_augment,
+        test_avl_tree_multimap,
+#ifdef AVL_TREE_ORDER_STATISTIC
+        test_avl_tree_order_statistic,
+#endif
+#ifdef AVL_TREE_RELATIVE_NODE
+        test_avl_tree_relative_node,
+#endif
 	NULL
 };
 
@@ -123,16 +123,16 @@ test_populate_and_verify_heap(binary_heap_t *heap,
     struct int_array_st *node;
     index = random() % num_entries;
     x = indeces[index];
-    node = (struct int_array_st *)test_array[x].node.parent;
+    node = (struct int_array_st *)binary_heap_link_get(&test_array[x].node.parent);
     err = binary_heap_insert(heap, &test_array[x].node);
     if (err != BINARY_HEAP_ERR_OK) { 
       print_error("\n%s %d: Cannot insert %dth item '%d' in %s heap %p %p %p parent = %d:%d",
                   test_case,  __LINE__,
                   x, test_array[x].value,
                   heap->heap_type == BINARY_HEAP_MIN ? "min": "max",
-                  test_array[x].node.parent,
-                  test_array[x].node.left,
-                  test_array[x].node.right,
+                  binary_heap_link_get(&test_array[x].node.parent),
+                  binary_heap_link_get(&test_array[x].node.left),
+                  binary_heap_link_get(&test_array[x].node.right),
                   node ? node->value : -1,
                   err);
       local_fail++;
@@ -180,15 +180,15 @@ test_binary_heap_verify_sort(binary_heap_t *heap,
       goto out;
     }
     /* check that pointers are NULL AFTER poping the min  */
-    if (min->node.parent != NULL ||
-        min->node.left != NULL ||
-        min->node.right != NULL) {
+    if (binary_heap_link_get(&min->node.parent) != NULL ||
+        binary_heap_link_get(&min->node.left) != NULL ||
+        binary_heap_link_get(&min->node.right) != NULL) {
       print_error("\n%s %d %dth item value '%d' has non-NULL pointer %s %s %s",
                   test_case, __LINE__,  
                   i, min->value,
-                  min->node.parent != NULL ? "parent" : "",
-                  min->node.left != NULL ? "left" : "",
-                  min->node.right != NULL ? "right" : "");
+                  binary_heap_link_get(&min->node.parent) != NULL ? "parent" : "",
+                  binary_heap_link_get(&min->node.left) != NULL ? "left" : "",
+                  binary_heap_link_get(&min->node.right) != NULL ? "right" : "");
       local_fail ++;
       goto out;
     }
@@ -378,22 +378,22 @@ void test_binary_heap_delete(binary_heap_type_t heap_type,
                   i, index, x, test_array[x].value,
                   heap.heap_type == BINARY_HEAP_MIN ? "min": "max",
                   heap.num_entries,
-                  test_array[x].node.left, test_array[x].node.right,
-                  test_array[x].node.parent,
+                  binary_heap_link_get(&test_array[x].node.left), binary_heap_link_get(&test_array[x].node.right),
+                  binary_heap_link_get(&test_array[x].node.parent),
                   err);
       local_fail++;
       goto out;
     }
     /* Verify that all pointers are NULL after deleteion */
-    if (test_array[x].node.parent != NULL ||
-        test_array[x].node.left != NULL ||
-        test_array[x].node.right != NULL) {
+    if (binary_heap_link_get(&test_array[x].node.parent) != NULL ||
+        binary_heap_link_get(&test_array[x].node.left) != NULL ||
+        binary_heap_link_get(&test_array[x].node.right) != NULL) {
       print_error("\n%s %d: %dth item value '%d' has non-NULL %s %s %s",
                   __FUNCTION__,  __LINE__,
                   i, test_array[x].value,
-                  test_array[x].node.parent != NULL ? "parent" : "",
-                  test_array[x].node.left != NULL ? "left" : "",
-                  test_array[x].node.right != NULL ? "right" : "");
+                  binary_heap_link_get(&test_array[x].node.parent) != NULL ? "parent" : "",
+                  binary_heap_link_get(&test_array[x].node.left) != NULL ? "left" : "",
+                  binary_heap_link_get(&test_array[x].node.right) != NULL ? "right" : "");
       local_fail ++;
       goto out;
     }
@@ -529,15 +529,15 @@ void test_binary_heap_insert_delete(binary_heap_type_t heap_type,
       goto out;
     }
     /* Verify that all pointers are NULL after deleteion */
-    if (test_array[x].node.parent != NULL ||
-        test_array[x].node.left != NULL ||
-        test_array[x].node.right != NULL) {
+    if (binary_heap_link_get(&test_array[x].node.parent) != NULL ||
+        binary_heap_link_get(&test_array[x].node.left) != NULL ||
+        binary_heap_link_get(&test_array[x].node.right) != NULL) {
       print_error("\n%s %d: %dth item index %d value '%d' has non-NULL %s %s %s",
                   __FUNCTION__,  __LINE__,
                   i, x, test_array[x].value,
-                  test_array[x].node.parent != NULL ? "parent" : "",
-                  test_array[x].node.left != NULL ? "left" : "",
-                      test_array[x].node.right != NULL ? "right" : "");
+                  binary_heap_link_get(&test_array[x].node.parent) != NULL ? "parent" : "",
+                  binary_heap_link_get(&test_array[x].node.left) != NULL ? "left" : "",
+                      binary_heap_link_get(&test_array[x].node.right) != NULL ? "right" : "");
       local_fail ++;
       goto out;
     }
@@ -570,9 +570,9 @@ void test_binary_heap_insert_delete(binary_heap_type_t heap_type,
     }
     /* Verify that at least ONE pointer is non-NULL after insertion because
      * we know that the  heap already has nodes*/
-    if (test_array[x].node.parent == NULL &&
-        test_array[x].node.left == NULL &&
-        test_array[x].node.right == NULL) {
+    if (binary_heap_link_get(&test_array[x].node.parent) == NULL &&
+        binary_heap_link_get(&test_array[x].node.left) == NULL &&
+        binary_heap_link_get(&test_array[x].node.right) == NULL) {
       print_error("\n%s %d: %dth item index %d value '%d' has ALL POINTERS NULL",
                   __FUNCTION__, __LINE__,
                   i, x, test_array[x].value);
@@ -899,6 +899,81 @@ out:
   }
 }
 
+#ifdef BINARY_HEAP_RELATIVE_NODE
+#define NUM_REGION_VALUES 13
+
+/* A heap and its nodes in one block of memory */
+struct test_region_st {
+  binary_heap_t heap;
+  struct int_array_st values[NUM_REGION_VALUES];
+};
+
+void test_binary_heap_relative_node(binary_heap_type_t heap_type)
+{
+  int entries[] =        {78, 24, 39, 3, 18, 99, 7, 15, 49, 31, 103, 65, 110};
+  int sorted_ascend[]  = {3, 7, 15, 18, 24, 31, 39, 49, 65, 78, 99, 103, 110};
+  int sorted_descend[] = {110, 103, 99, 78, 65, 49, 39, 31, 24, 18, 15, 7, 3};
+  struct test_region_st *regions = calloc(2, sizeof(*regions));
+  struct test_region_st *copy = &regions[1];
+  binary_heap_err_t err;
+  uint32_t local_fail = 0;
+  struct int_array_st *node;
+  unsigned int i;
+
+  err = binary_heap_init(&regions[0].heap, heap_type, int_compare);
+  for (i = 0; err == BINARY_HEAP_ERR_OK && i < NUM_REGION_VALUES; i++) {
+    regions[0].values[i].value = entries[i];
+    err = binary_heap_insert(&regions[0].heap, &regions[0].values[i].node);
+  }
+  if (err != BINARY_HEAP_ERR_OK) {
+    print_error("\n%s %d: Cannot build %s heap :%d",
+                __FUNCTION__, __LINE__,
+                heap_type == BINARY_HEAP_MIN ? "min": "max", err);
+    local_fail++;
+    goto out;
+  }
+
+  /* Move the block and pop everything from the copy */
+  memcpy(copy, &regions[0], sizeof(*copy));
+  memset(&regions[0], 0xff, sizeof(regions[0]));
+  for (i = 0; i < NUM_REGION_VALUES; i++) {
+    node = (struct int_array_st *)binary_heap_pop(&copy->heap);
+    if (node < copy->values || node >= copy->values + NUM_REGION_VALUES ||
+        node->value != (heap_type == BINARY_HEAP_MIN ?
+                        sorted_ascend[i] : sorted_descend[i])) {
+      print_error("\n%s %d: Wrong %dth item popped from the moved %s heap",
+                  __FUNCTION__, __LINE__, i,
+                  heap_type == BINARY_HEAP_MIN ? "min": "max");
+      local_fail++;
+      goto out;
+    }
+  }
+  if (binary_heap_pop(&copy->heap) != NULL) {
+    print_error("\n%s %d: Moved %s heap is not empty",
+                __FUNCTION__, __LINE__,
+                heap_type == BINARY_HEAP_MIN ? "min": "max");
+    local_fail++;
+  }
+
+out:
+  num_fail += local_fail;
+  free(regions);
+
+  if (local_fail) {
+    print_error("\n****Test '%s' in %s heap FAILED !!",
+                __FUNCTION__,
+                heap_type == BINARY_HEAP_MIN ? "min": "max");
+  } else {
+    fprintf(stdout, COLOR_GREEN);
+    fprintf(stdout, "\nTest '%s' in %s heap succeeded with %d items",
+            __FUNCTION__,
+            heap_type == BINARY_HEAP_MIN ? "min": "max",
+            NUM_REGION_VALUES);
+    fprintf(stdout, COLOR_RESET);
+  }
+}
+#endif
+
 
 /************ M A I N   F U N C N T I O N **********************/
 int main(int argc, char *argv[])
@@ -927,6 +1002,12 @@ int main(int argc, char *argv[])
   test_binary_heap_top(BINARY_HEAP_MIN);
   test_binary_heap_top(BINARY_HEAP_MAX);
 
+#ifdef BINARY_HEAP_RELATIVE_NODE
+  printf("\n\nTesting a moved binary heap");
+  test_binary_heap_relative_node(BINARY_HEAP_MIN);
+  test_binary_heap_relative_node(BINARY_HEAP_MAX);
+#endif
+
   if (num_fail) {
     print_error("\n\n  ***F A I L U R E S : %d !!***\n", num_fail);
   } else {
@@ -0,0 +1,281 @@
+/*
+
+Copyright (c) 2019 Ahmed Bashandy
+
+Permission to use, copy, modify, and/or distribute this software
+for any purpose with or without fee is hereby granted, provided
+that the above copyright notice and this permission notice and the
+disclamer below appear in all copies.
+
+THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(s) DISCLAIMS ALL
+WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+AUTHOR(s) BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT,
+NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+Tests of the interval tree
+
+ */
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "interval-tree.h"
+#include "framework.h"
+
+#define COLOR_RED   "\x1B[31m"
+#define COLOR_RESET "\x1B[0m"
+
+#define NUM_TEST_VALUES 400
+#define MAX_POINT 1000
+
+struct interval_t {
+  char dummy[4]; /* field so that we have a non-zero offset to the node */
+  int low;
+  int high;
+  bool is_in_tree;
+  IntervalTreeNode node;
+};
+
+struct interval_t test_array[NUM_TEST_VALUES];
+
+/*
+ * Assert macro to print error instead of crashing
+ */
+#define ASSERT(condition) \
+  if (!(condition)) {                           \
+    char *string = #condition;                                            \
+    print_error("\n%s %d condition '%s' failed\n", __FUNCTION__, __LINE__, string); \
+  }                                                                     \
+
+/*
+ * Gets us the beginning of the structure given the node pointer
+ */
+#define TEST_NODE_TO_VAL(x) \
+  (x ? ((struct interval_t *)((uintptr_t)x - offsetof(struct interval_t, node))) : NULL)
+
+/* Print error in read color */
+__attribute__ ((format (printf, 1, 2)))
+static void print_error(char *string, ...)
+{
+  va_list args;
+  va_start(args, string);
+  fprintf(stderr, COLOR_RED);
+  vfprintf(stderr, string, args);
+  fprintf(stderr, COLOR_RESET);
+  va_end(args);
+}
+
+static int int_compare(AVLTreeKey key1, AVLTreeKey key2)
+{
+  return (*(int *)key1 - *(int *)key2);
+}
+
+static void *low_key(AVLTreeValue value, void *context)
+{
+  return (&((struct interval_t *)value)->low);
+}
+
+static void *high_key(AVLTreeValue value, void *context)
+{
+  return (&((struct interval_t *)value)->high);
+}
+
+/* Small pseudo-random generator so that the test is repeatable */
+static unsigned int test_seed;
+
+static int test_random(int max)
+{
+  test_seed = test_seed * 1103515245 + 12345;
+  return ((test_seed >> 16) % max);
+}
+
+/* Check "max_high" of every node of a subtree and return the real one */
+static int validate_subtree(AVLTreeNode *node)
+{
+  IntervalTreeNode *interval_node = (IntervalTreeNode *)node;
+  int max_high, child_max;
+  int side;
+
+  if (node == NULL) {
+    return (-1);
+  }
+  max_high = TEST_NODE_TO_VAL(interval_node)->high;
+  for (side = 0; side < 2; side++) {
+    child_max = validate_subtree(avl_tree_node_child(node, side));
+    if (child_max > max_high) {
+      max_high = child_max;
+    }
+  }
+  ASSERT(*(int *)interval_node->max_high == max_high);
+  return (max_high);
+}
+
+static IntervalTree *create_tree(IntervalTree *tree_struct)
+{
+  IntervalTree *tree;
+  int i;
+
+  memset(test_array, 0, sizeof(test_array));
+  tree = interval_tree_new(tree_struct,
+                           offsetof(struct interval_t, node),
+                           int_compare,
+                           low_key,
+                           high_key,
+                           NULL,
+                           NULL,
+                           NULL);
+  ASSERT(tree != NULL);
+
+  /* Mostly short intervals, and a few long ones. Some share "low" */
+  test_seed = 1;
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    test_array[i].low = test_random(MAX_POINT);
+    test_array[i].high = test_array[i].low +
+      ((i % 10) == 0 ? test_random(MAX_POINT / 2) : test_random(10));
+    test_array[i].is_in_tree = true;
+    interval_tree_insert(tree, &test_array[i].node);
+  }
+  return (tree);
+}
+
+/* Compare the overlap enumeration with a linear scan of the array */
+static void check_overlaps(IntervalTree *tree, int low, int high)
+{
+  IntervalTreeNode *node;
+  struct interval_t *interval;
+  int i, count = 0, expected = 0, last_low = -1;
+
+  for (node = interval_tree_overlap_first(tree, &low, &high);
+       node != NULL;
+       node = interval_tree_overlap_next(tree, node, &low, &high)) {
+    interval = TEST_NODE_TO_VAL(node);
+    ASSERT(interval->is_in_tree);
+    ASSERT(interval->low <= high && interval->high >= low);
+    ASSERT(interval->low >= last_low);
+    last_low = interval->low;
+    count++;
+  }
+  for (i = 0; i < NUM_TEST_VALUES; i++) {
+    if (test_array[i].is_in_tree &&
+        test_array[i].low <= high && test_array[i].high >= low) {
+      expected++;
+    }
+  }
+  ASSERT(count == expected);
+}
+
+void test_interval_tree_insert(void)
+{
+  IntervalTree *tree, tree_struct;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+  ASSERT(avl_tree_num_entries(&tree->tree) == NUM_TEST_VALUES);
+  validate_subtree(avl_tree_root_node(&tree->tree));
+
+  /* An identical interval is accepted */
+  test_array[1].low = test_array[0].low;
+  test_array[1].high = test_array[0].high;
+  interval_tree_remove(tree, &test_array[1].node);
+  interval_tree_insert(tree, &test_array[1].node);
+  ASSERT(avl_tree_num_entries(&tree->tree) == NUM_TEST_VALUES);
+  validate_subtree(avl_tree_root_node(&tree->tree));
+}
+
+void test_interval_tree_overlap(void)
+{
+  IntervalTree *tree, tree_struct;
+  int low, width;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+  for (low = -5; low < MAX_POINT + MAX_POINT / 2; low += 7) {
+    for (width = 0; width < 40; width += 13) {
+      check_overlaps(tree, low, low + width);
+    }
+  }
+  check_overlaps(tree, 0, 2 * MAX_POINT);
+}
+
+void test_interval_tree_stab(void)
+{
+  IntervalTree *tree, tree_struct;
+  IntervalTreeNode *node;
+  int point, i, count, expected;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+  for (point = -1; point <= MAX_POINT + MAX_POINT / 2; point += 3) {
+    count = 0;
+    for (node = interval_tree_stab(tree, &point);
+         node != NULL;
+         node = interval_tree_overlap_next(tree, node, &point, &point)) {
+      ASSERT(TEST_NODE_TO_VAL(node)->low <= point &&
+             TEST_NODE_TO_VAL(node)->high >= point);
+      count++;
+    }
+    expected = 0;
+    for (i = 0; i < NUM_TEST_VALUES; i++) {
+      if (test_array[i].low <= point && test_array[i].high >= point) {
+        expected++;
+      }
+    }
+    ASSERT(count == expected);
+  }
+}
+
+void test_interval_tree_remove(void)
+{
+  IntervalTree *tree, tree_struct;
+  IntervalTreeNode *node, *next;
+  int i, low, high;
+
+  printf(":  '%s'", __FUNCTION__);
+
+  tree = create_tree(&tree_struct);
+  for (i = 0; i < NUM_TEST_VALUES; i += 2) {
+    interval_tree_remove(tree, &test_array[i].node);
+    test_array[i].is_in_tree = false;
+  }
+  validate_subtree(avl_tree_root_node(&tree->tree));
+  for (low = 0; low < MAX_POINT; low += 11) {
+    check_overlaps(tree, low, low + 5);
+  }
+
+  /* Remove while enumerating */
+  low = 100;
+  high = 300;
+  for (node = interval_tree_overlap_first(tree, &low, &high);
+       node != NULL;
+       node = next) {
+    next = interval_tree_overlap_next(tree, node, &low, &high);
+    interval_tree_remove(tree, node);
+    TEST_NODE_TO_VAL(node)->is_in_tree = false;
+  }
+  validate_subtree(avl_tree_root_node(&tree->tree));
+  ASSERT(interval_tree_overlap_first(tree, &low, &high) == NULL);
+  check_overlaps(tree, 0, MAX_POINT);
+}
+
+static UnitTestFunction tests[] = {
+  test_interval_tree_insert,
+  test_interval_tree_overlap,
+  test_interval_tree_stab,
+  test_interval_tree_remove,
+  NULL
+};
+
+int main(int argc, char *argv[])
+{
+  run_tests(tests);
+  printf("\n");
+  return 0;
+}